@@ -25,8 +25,10 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -53,6 +55,7 @@
 #include "ias-shell-client-protocol.h"
 #include "../../shared/timespec-util.h"
 #include "../../shared/zalloc.h"
+#include "../../shared/helpers.h"
 
 #define NAL_REF_IDC_NONE        0
 #define NAL_REF_IDC_LOW         1
@@ -76,7 +79,9 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
-#define MAX_FRAMES              5
+/* One output buffer per transport queue slot, plus one being sent by
+ * each transport and the one being encoded. */
+#define MAX_FRAMES              (RD_QUEUE_MAX_DEPTH + RD_MAX_TRANSPORTS + 1)
 #define BUFFER_STATUS_FREE      0
 #define BUFFER_STATUS_IN_USE    1
 
@@ -101,6 +106,67 @@ typedef enum {
 #define US_IN_SEC              1000000
 #define DEFAULT_FPS            60
 
+struct encode_job {
+	int valid;
+	int prime_fd;
+	int stride;
+	int frame_number;
+	int32_t va_buffer_handle;
+	enum rd_encoder_format format;
+	uint32_t timestamp;
+	uint32_t shm_surf_id;
+	uint32_t buf_id;
+	uint32_t image_id;
+};
+
+/* An encoded frame, mapped once and shared by all transports. The last
+ * transport to drop its reference unmaps it and hands the VA output
+ * buffer back to the encoder. */
+struct rd_bitstream {
+	int refcount;
+	drm_intel_bo *drm_bo;
+	VABufferID output_buf;
+	int32_t stream_size;
+	uint32_t timestamp;
+	int frame_number;
+};
+
+/* Bounded ring of frames waiting between two pipeline stages. The slots
+ * themselves live in the owner, since each stage carries a different job
+ * type; this only tracks indices, policy and statistics. All fields are
+ * protected by the mutex of the consuming stage. */
+struct frame_queue {
+	int depth;
+	int head;
+	int count;
+	enum rd_queue_policy policy;
+	pthread_cond_t space_cond;
+	struct rd_queue_stats stats;
+};
+
+/* A transport plugin instance with its own thread and queue, so that a
+ * slow receiver only drops its own frames. */
+struct rd_transport {
+	struct rd_encoder *encoder;
+	char *plugin;
+
+	void *handle;
+	void *private_data;
+	int (*send_fptr)(void *transport_private_data,
+			drm_intel_bo *drm_bo,
+			int32_t stream_size,
+			uint32_t timestamp);
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int destroying;
+
+	struct rd_bitstream *ring[RD_QUEUE_MAX_DEPTH];
+	struct frame_queue queue;
+	uint64_t send_errors;
+};
+
 struct rd_encoder {
 	int drm_fd;
 	int width, height;
@@ -123,7 +189,6 @@ struct rd_encoder {
 	int first_frame;
 
 	int error;
-	int destroying_transport;
 	int destroying_encoder;
 
 	/* Encoder thread */
@@ -131,32 +196,16 @@ struct rd_encoder {
 	pthread_mutex_t encoder_mutex;
 	pthread_cond_t encoder_cond;
 
-	struct {
-		int valid;
-		int prime_fd;
-		int stride;
-		int frame_number;
-		int32_t va_buffer_handle;
-		enum rd_encoder_format format;
-		uint32_t timestamp;
-		uint32_t shm_surf_id;
-		uint32_t buf_id;
-		uint32_t image_id;
-	} current_encode, next_encode;
-
-	/* Transportation thread */
-	pthread_t transport_thread;
-	pthread_mutex_t transport_mutex;
-	pthread_cond_t transport_cond;
+	struct encode_job current_encode;
+	struct encode_job encode_ring[RD_QUEUE_MAX_DEPTH];
+	struct frame_queue encode_queue;
 
-	struct {
-		int valid;
-		int frame_number;
-		int32_t handle;
-		int32_t stream_size;
-		uint32_t timestamp;
-		VABufferID output_buf;
-	} current_transport, next_transport;
+	/* Transport plugins, each with its own thread */
+	struct rd_transport transports[RD_MAX_TRANSPORTS];
+	int num_transports;
+
+	/* Protects bitstream reference counts and output buffer status. */
+	pthread_mutex_t bitstream_mutex;
 
 	VADisplay va_dpy;
 
@@ -194,14 +243,6 @@ struct rd_encoder {
 		int bufferStatus;
 	} out_buf[MAX_FRAMES];
 
-	/* Transport plugin */
-	void *transport_handle;
-	void *transport_private_data;
-	int (*transport_send_fptr)(void *transport_private_data,
-			drm_intel_bo *drm_bo,
-			int32_t stream_size,
-			uint32_t timestamp);
-
 	drm_intel_bufmgr *drm_bufmgr;
 };
 
@@ -211,6 +252,109 @@ encoder_thread_function(void * const data);
 static void *
 transport_thread_function(void * const data);
 
+static void
+print_queue_stats(struct rd_encoder * const encoder);
+
+static void
+frame_queue_init(struct frame_queue * const queue, const int depth,
+		const enum rd_queue_policy policy)
+{
+	queue->depth = depth;
+	queue->head = 0;
+	queue->count = 0;
+	queue->policy = policy;
+	memset(&queue->stats, 0, sizeof(queue->stats));
+	queue->stats.depth = depth;
+}
+
+static int
+frame_queue_full(const struct frame_queue * const queue)
+{
+	return queue->count >= queue->depth;
+}
+
+/* Returns the slot index to fill in. The queue must not be full. */
+static int
+frame_queue_push(struct frame_queue * const queue)
+{
+	int slot = (queue->head + queue->count) % RD_QUEUE_MAX_DEPTH;
+
+	queue->count++;
+	queue->stats.queued++;
+	queue->stats.occupancy = queue->count;
+	if (queue->stats.occupancy > queue->stats.max_occupancy) {
+		queue->stats.max_occupancy = queue->stats.occupancy;
+	}
+
+	return slot;
+}
+
+/* Returns the slot index of the oldest entry. The queue must not be empty. */
+static int
+frame_queue_pop(struct frame_queue * const queue)
+{
+	int slot = queue->head;
+
+	queue->head = (queue->head + 1) % RD_QUEUE_MAX_DEPTH;
+	queue->count--;
+	queue->stats.occupancy = queue->count;
+	pthread_cond_signal(&queue->space_cond);
+
+	return slot;
+}
+
+/* Wait for a free slot according to the queue policy. Returns 0 if a slot
+ * is free, or 1 if the oldest entry has to be dropped by the caller. Must
+ * be called with the consuming stage's mutex held. */
+static int
+frame_queue_wait_space(struct frame_queue * const queue,
+		pthread_mutex_t * const mutex, const int * const destroying)
+{
+	if (!frame_queue_full(queue)) {
+		return 0;
+	}
+
+	if (queue->policy == RD_QUEUE_BLOCK) {
+		queue->stats.blocked++;
+		while (frame_queue_full(queue) && !*destroying) {
+			pthread_cond_wait(&queue->space_cond, mutex);
+		}
+		if (!frame_queue_full(queue)) {
+			return 0;
+		}
+	}
+
+	queue->stats.dropped++;
+	return 1;
+}
+
+static void
+release_encode_job(struct rd_encoder * const encoder,
+		struct encode_job * const job)
+{
+	if (job->va_buffer_handle) {
+		/* Shared memory surface. */
+		ias_hmi_release_buffer_handle(encoder->hmi,
+			job->shm_surf_id,
+			job->buf_id,
+			job->image_id,
+			encoder->surfid, 0);
+	} else {
+		close(job->prime_fd);
+		job->prime_fd = -1;
+		if (encoder->surfid) {
+			/* Wayland buffer surface. */
+			ias_hmi_release_buffer_handle(encoder->hmi, 0, 0, 0,
+					encoder->surfid, 0);
+		} else {
+			/* Full framebuffer. */
+			ias_hmi_release_buffer_handle(encoder->hmi, 0, 0, 0, 0,
+					encoder->output_number);
+		}
+	}
+	job->valid = 0;
+}
+
 /* bitstream code used for writing the packed headers */
 
 #define BITSTREAM_ALLOCATE_STEPPING	 4096
@@ -1277,6 +1421,9 @@ encoder_get_output_buffer(struct rd_encoder * const encoder)
 		return VA_INVALID_ID;
 	}
 
+	/* Transport threads hand buffers back concurrently. */
+	pthread_mutex_lock(&encoder->bitstream_mutex);
+
 	/* Use first free buffer ID... */
 	for (i = 0; i < MAX_FRAMES; i++) {
 		if (encoder->out_buf[i].bufferStatus == BUFFER_STATUS_FREE) {
@@ -1284,6 +1431,7 @@ encoder_get_output_buffer(struct rd_encoder * const encoder)
 		}
 	}
 	if (i == MAX_FRAMES) {
+		pthread_mutex_unlock(&encoder->bitstream_mutex);
 		printf("WARNING - no output buffer available.\n");
 		return VA_INVALID_ID;
 	}
@@ -1291,6 +1439,7 @@ encoder_get_output_buffer(struct rd_encoder * const encoder)
 	/* Use existing buffer if possible... */
 	if (encoder->out_buf[i].bufferID != VA_INVALID_ID) {
 		encoder->out_buf[i].bufferStatus = BUFFER_STATUS_IN_USE;
+		pthread_mutex_unlock(&encoder->bitstream_mutex);
 		return encoder->out_buf[i].bufferID;
 	}
 
@@ -1304,6 +1453,7 @@ encoder_get_output_buffer(struct rd_encoder * const encoder)
 		encoder->out_buf[i].bufferID = VA_INVALID_ID;
 		encoder->out_buf[i].bufferStatus = BUFFER_STATUS_FREE;
 	}
+	pthread_mutex_unlock(&encoder->bitstream_mutex);
 	return encoder->out_buf[i].bufferID;
 }
 
@@ -1318,17 +1468,19 @@ rd_encoder_release_buffer(struct rd_encoder *encoder, int buf_id)
 		return status;
 	}
 
+	pthread_mutex_lock(&encoder->bitstream_mutex);
 	for (i=0; i < MAX_FRAMES; i++) {
 		if ((VABufferID)buf_id == encoder->out_buf[i].bufferID) {
 			status = vaReleaseBufferHandle(encoder->va_dpy, buf_id);
 			if (status != VA_STATUS_SUCCESS) {
 				fprintf(stderr, "Failed to release handle for buffer %d.\n", buf_id);
-				return status;
+				break;
 			}
 			encoder->out_buf[i].bufferStatus = BUFFER_STATUS_FREE;
 			break;
 		}
 	}
+	pthread_mutex_unlock(&encoder->bitstream_mutex);
 	if (i == MAX_FRAMES) {
 		fprintf(stderr, "WARNING - can't release: no match for buffer ID.\n");
 	}
@@ -1336,6 +1488,63 @@ rd_encoder_release_buffer(struct rd_encoder *encoder, int buf_id)
 	return status;
 }
 
+static void
+bitstream_ref(struct rd_encoder * const encoder,
+		struct rd_bitstream * const bitstream)
+{
+	pthread_mutex_lock(&encoder->bitstream_mutex);
+	bitstream->refcount++;
+	pthread_mutex_unlock(&encoder->bitstream_mutex);
+}
+
+static void
+bitstream_unref(struct rd_encoder * const encoder,
+		struct rd_bitstream * const bitstream)
+{
+	int refcount;
+
+	pthread_mutex_lock(&encoder->bitstream_mutex);
+	refcount = --bitstream->refcount;
+	pthread_mutex_unlock(&encoder->bitstream_mutex);
+
+	if (refcount > 0) {
+		return;
+	}
+
+	drm_intel_bo_unmap(bitstream->drm_bo);
+	drm_intel_bo_unreference(bitstream->drm_bo);
+	rd_encoder_release_buffer(encoder, bitstream->output_buf);
+	free(bitstream);
+}
+
+static void
+transport_queue_bitstream(struct rd_transport * const transport,
+		struct rd_bitstream * const bitstream)
+{
+	struct rd_encoder *encoder = transport->encoder;
+	struct rd_bitstream *dropped = NULL;
+	int slot;
+
+	bitstream_ref(encoder, bitstream);
+
+	pthread_mutex_lock(&transport->mutex);
+	if (frame_queue_wait_space(&transport->queue, &transport->mutex,
+				&transport->destroying)) {
+		slot = frame_queue_pop(&transport->queue);
+		dropped = transport->ring[slot];
+		transport->ring[slot] = NULL;
+	}
+	transport->ring[frame_queue_push(&transport->queue)] = bitstream;
+	pthread_cond_signal(&transport->cond);
+	pthread_mutex_unlock(&transport->mutex);
+
+	if (dropped) {
+		fprintf(stderr, "WARNING: transport %s dropping frame %d.\n",
+			transport->plugin, dropped->frame_number);
+		bitstream_unref(encoder, dropped);
+	}
+}
+
 enum output_write_status {
 	OUTPUT_WRITE_SUCCESS,
 	OUTPUT_WRITE_OVERFLOW,
@@ -1349,8 +1558,10 @@ encoder_write_output(struct rd_encoder * const encoder,
 	VACodedBufferSegment *segment;
 	VAStatus status;
 	VABufferInfo buf_info;
+	struct rd_bitstream *bitstream;
 	unsigned int stream_size = 0;
 	int frame_number;
+	int i;
 #ifdef PROFILE_REMOTE_DISPLAY
 	struct timespec start_spec, end_spec;
 	int64_t duration;
@@ -1441,20 +1652,33 @@ encoder_write_output(struct rd_encoder * const encoder,
 		return OUTPUT_WRITE_FATAL;
 	}
 
-	pthread_mutex_lock(&encoder->transport_mutex);
-	if (encoder->next_transport.valid == 1) {
-		fprintf(stderr, "WARNING: transport dropping frame %d.\n",
-			encoder->next_transport.frame_number);
-			rd_encoder_release_buffer(encoder, encoder->next_transport.output_buf);
+	/* Map the bitstream once and share it between all transports. */
+	bitstream = zalloc(sizeof(*bitstream));
+	if (bitstream == NULL) {
+		rd_encoder_release_buffer(encoder, output_buf);
+		return OUTPUT_WRITE_FATAL;
+	}
+
+	bitstream->drm_bo = drm_intel_bo_gem_create_from_name(encoder->drm_bufmgr,
+			"temp1", buf_info.handle);
+	if (bitstream->drm_bo == NULL) {
+		fprintf(stderr, "Failed to create drm buffer.\n");
+		rd_encoder_release_buffer(encoder, output_buf);
+		free(bitstream);
+		return OUTPUT_WRITE_FATAL;
+	}
+	drm_intel_bo_map(bitstream->drm_bo, 1);
+
+	bitstream->refcount = 1;
+	bitstream->output_buf = output_buf;
+	bitstream->stream_size = stream_size;
+	bitstream->timestamp = encoder->current_encode.timestamp;
+	bitstream->frame_number = frame_number;
+
+	for (i = 0; i < encoder->num_transports; i++) {
+		transport_queue_bitstream(&encoder->transports[i], bitstream);
 	}
-	encoder->next_transport.handle = buf_info.handle;
-	encoder->next_transport.stream_size = stream_size;
-	encoder->next_transport.timestamp = encoder->current_encode.timestamp;
-	encoder->next_transport.output_buf = output_buf;
-	encoder->next_transport.frame_number = encoder->current_encode.frame_number;
-	encoder->next_transport.valid = 1;
-	pthread_cond_signal(&encoder->transport_cond);
-	pthread_mutex_unlock(&encoder->transport_mutex);
+	bitstream_unref(encoder, bitstream);
 
 #ifdef PROFILE_REMOTE_DISPLAY
 	if (encoder->profile_level > 1) {
@@ -1687,6 +1911,11 @@ setup_encoder_thread(struct rd_encoder * const encoder)
 		fprintf(stderr, "Encoder condition init failure: %d\n", err);
 		return err;
 	}
+	err = pthread_cond_init(&encoder->encode_queue.space_cond, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Encode queue condition init failure: %d\n", err);
+		return err;
+	}
 	err = pthread_create(&encoder->encoder_thread, NULL, encoder_thread_function, encoder);
 	if (err != 0) {
 		fprintf(stderr, "Encoder thread creation failure: %d\n", err);
@@ -1697,26 +1926,27 @@ setup_encoder_thread(struct rd_encoder * const encoder)
 }
 
 static int
-setup_transport_thread(struct rd_encoder * const encoder)
+setup_transport_thread(struct rd_transport * const transport)
 {
 	int err;
 
-	if (encoder == NULL) {
-		fprintf(stderr, "setup_transport_thread : No encoder.\n");
-		return -1;
-	}
-
-	err = pthread_mutex_init(&encoder->transport_mutex, NULL);
+	err = pthread_mutex_init(&transport->mutex, NULL);
 	if (err != 0) {
 		fprintf(stderr, "Transport mutex init failure: %d\n", err);
 		return err;
 	}
-	err = pthread_cond_init(&encoder->transport_cond, NULL);
+	err = pthread_cond_init(&transport->cond, NULL);
 	if (err != 0) {
 		fprintf(stderr, "Transport condition init failure: %d\n", err);
 		return err;
 	}
-	err = pthread_create(&encoder->transport_thread, NULL, transport_thread_function, encoder);
+	err = pthread_cond_init(&transport->queue.space_cond, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Transport queue condition init failure: %d\n", err);
+		return err;
+	}
+	err = pthread_create(&transport->thread, NULL,
+			transport_thread_function, transport);
 	if (err != 0) {
 		fprintf(stderr, "Transport thread creation failure: %d\n", err);
 		return err;
@@ -1725,6 +1955,27 @@ setup_transport_thread(struct rd_encoder * const encoder)
 	return 0;
 }
 
+static int
+setup_transport_threads(struct rd_encoder * const encoder)
+{
+	int i;
+	int err;
+
+	if (encoder == NULL) {
+		fprintf(stderr, "setup_transport_threads : No encoder.\n");
+		return -1;
+	}
+
+	for (i = 0; i < encoder->num_transports; i++) {
+		err = setup_transport_thread(&encoder->transports[i]);
+		if (err != 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
 static void
 destroy_encoder_thread(struct rd_encoder * const encoder)
 {
@@ -1736,87 +1987,207 @@ destroy_encoder_thread(struct rd_encoder * const encoder)
 		pthread_mutex_lock(&encoder->encoder_mutex);
 		encoder->destroying_encoder = 1;
 		pthread_cond_signal(&encoder->encoder_cond);
+		pthread_cond_broadcast(&encoder->encode_queue.space_cond);
 		pthread_mutex_unlock(&encoder->encoder_mutex);
 
 		if (encoder->verbose > 1) {
 			printf("Waiting for encoder thread to finish...\n");
 		}
 		pthread_join(encoder->encoder_thread, NULL);
+
+		/* Hand back any frames that were never encoded. */
+		while (encoder->encode_queue.count) {
+			release_encode_job(encoder, &encoder->encode_ring[
+					frame_queue_pop(&encoder->encode_queue)]);
+		}
+
 		pthread_mutex_destroy(&encoder->encoder_mutex);
 		pthread_cond_destroy(&encoder->encoder_cond);
+		pthread_cond_destroy(&encoder->encode_queue.space_cond);
 	}
 }
 
 static void
-destroy_transport_thread(struct rd_encoder * const encoder)
+destroy_transport_thread(struct rd_transport * const transport)
 {
-	if (encoder->transport_thread) {
+	struct rd_encoder *encoder = transport->encoder;
+
+	if (transport->thread) {
 		/* Make sure the transport thread finishes... */
 		if (encoder->verbose > 1) {
-			printf("Waiting for transport thread mutex...\n");
+			printf("Waiting for transport %s thread mutex...\n",
+					transport->plugin);
 		}
-		pthread_mutex_lock(&encoder->transport_mutex);
-		encoder->destroying_transport = 1;
-		pthread_cond_signal(&encoder->transport_cond);
-		pthread_mutex_unlock(&encoder->transport_mutex);
+		pthread_mutex_lock(&transport->mutex);
+		transport->destroying = 1;
+		pthread_cond_signal(&transport->cond);
+		pthread_cond_broadcast(&transport->queue.space_cond);
+		pthread_mutex_unlock(&transport->mutex);
 
 		if (encoder->verbose > 1) {
-			printf("Waiting for transport thread to finish...\n");
+			printf("Waiting for transport %s thread to finish...\n",
+					transport->plugin);
+		}
+		pthread_join(transport->thread, NULL);
+
+		/* Frames that were never sent still hold a bitstream reference. */
+		while (transport->queue.count) {
+			int slot = frame_queue_pop(&transport->queue);
+
+			bitstream_unref(encoder, transport->ring[slot]);
+			transport->ring[slot] = NULL;
+		}
+
+		pthread_mutex_destroy(&transport->mutex);
+		pthread_cond_destroy(&transport->cond);
+		pthread_cond_destroy(&transport->queue.space_cond);
+	}
+}
+
+static void
+destroy_transport_threads(struct rd_encoder * const encoder)
+{
+	int i;
+
+	for (i = 0; i < encoder->num_transports; i++) {
+		destroy_transport_thread(&encoder->transports[i]);
+	}
+}
+
+/* Split a ':'-separated list of key=value pairs into a private argument
+ * vector, so that each transport can be given its own options. */
+static char **
+transport_options_to_argv(const char *plugin, const char *options, int *argc)
+{
+	char **argv;
+	char *copy, *token, *saveptr = NULL;
+	int count = 2;
+	const char *p;
+
+	for (p = options; *p; p++) {
+		if (*p == ':') {
+			count++;
+		}
+	}
+
+	argv = zalloc((count + 1) * sizeof(*argv));
+	copy = strdup(options);
+	if (argv == NULL || copy == NULL) {
+		free(argv);
+		free(copy);
+		return NULL;
+	}
+
+	*argc = 0;
+	argv[(*argc)++] = strdup(plugin);
+	for (token = strtok_r(copy, ":", &saveptr); token;
+			token = strtok_r(NULL, ":", &saveptr)) {
+		if (asprintf(&argv[*argc], "--%s", token) < 0) {
+			break;
 		}
-		pthread_join(encoder->transport_thread, NULL);
-		pthread_mutex_destroy(&encoder->transport_mutex);
-		pthread_cond_destroy(&encoder->transport_cond);
+		(*argc)++;
+	}
+	free(copy);
+
+	return argv;
+}
+
+static void
+free_transport_argv(char **argv)
+{
+	int i;
+
+	for (i = 0; argv[i]; i++) {
+		free(argv[i]);
 	}
+	free(argv);
 }
 
 static int
-load_transport_plugin(const char *plugin, struct rd_encoder *encoder,
+load_transport_plugin(struct rd_transport * const transport,
+		const struct rd_transport_config * const config,
 		int *argc, char **argv)
 {
+	struct rd_encoder *encoder = transport->encoder;
 	int (*plugin_init_fptr)(int *argc, char **argv,
 			void **plugin_private_data, int verbose);
+	char **option_argv = NULL;
+	char **plugin_argv;
+	int plugin_argc = *argc;
+	int ret;
 
-	if (plugin == NULL) {
+	if (config->plugin == NULL) {
 		fprintf(stderr, "load_transport_plugin : no plugin name provided\n");
 		return -1;
 	}
 
-	if (encoder == NULL) {
-		fprintf(stderr, "load_transport_plugin : No encoder.\n");
+	transport->plugin = strdup(config->plugin);
+	if (transport->plugin == NULL) {
 		return -1;
 	}
 
-	encoder->transport_handle = dlopen(plugin, RTLD_LAZY | RTLD_LOCAL);
-	if (encoder->transport_handle == NULL) {
+	transport->handle = dlopen(config->plugin, RTLD_LAZY | RTLD_LOCAL);
+	if (transport->handle == NULL) {
 			fprintf(stderr, "Failed to load transport plugin at %s.\n",
-				plugin);
+				config->plugin);
 		return -1;
 	}
 	if (encoder->verbose) {
 		printf("Loaded transport plugin at %s...\n",
-						plugin);
+						config->plugin);
 	}
 
-	plugin_init_fptr = dlsym(encoder->transport_handle, "init");
-	if (plugin_init_fptr) {
-		int ret = (*plugin_init_fptr)(argc, argv,
-			&(encoder->transport_private_data), encoder->verbose);
+	plugin_init_fptr = dlsym(transport->handle, "init");
+	if (plugin_init_fptr == NULL) {
+		fprintf(stderr, "No init function found in %s transport plugin.\n",
+				config->plugin);
+		return -1;
+	}
 
-		if (ret) {
-			fprintf(stderr, "Init function in %s transport plugin "
-				"failed with %d.\n", plugin, ret);
+	/* Transports with their own options don't see the shared ones. */
+	if (config->options) {
+		option_argv = transport_options_to_argv(config->plugin,
+				config->options, &plugin_argc);
+		if (option_argv == NULL) {
 			return -1;
 		}
-	} else {
-		fprintf(stderr, "No init function found in %s transport plugin.\n",
-				plugin);
+		argv = option_argv;
+	}
+
+	/* Option parsing reorders and truncates the vector it is given, so
+	 * every plugin gets its own copy rather than what the previous one
+	 * left behind. */
+	plugin_argv = zalloc((plugin_argc + 1) * sizeof(*plugin_argv));
+	if (plugin_argv == NULL) {
+		if (option_argv) {
+			free_transport_argv(option_argv);
+		}
 		return -1;
 	}
-	encoder->transport_send_fptr = dlsym(encoder->transport_handle,
-			"send_frame");
-	if (encoder->transport_send_fptr == NULL) {
+	memcpy(plugin_argv, argv, plugin_argc * sizeof(*plugin_argv));
+
+	ret = (*plugin_init_fptr)(&plugin_argc, plugin_argv,
+		&(transport->private_data), encoder->verbose);
+
+	if (option_argv) {
+		if (plugin_argc > 1) {
+			fprintf(stderr, "WARNING: unused options for %s transport "
+				"plugin: %s\n", config->plugin, config->options);
+		}
+		free_transport_argv(option_argv);
+	}
+	free(plugin_argv);
+
+	if (ret) {
+		fprintf(stderr, "Init function in %s transport plugin "
+			"failed with %d.\n", config->plugin, ret);
+		return -1;
+	}
+
+	transport->send_fptr = dlsym(transport->handle, "send_frame");
+	if (transport->send_fptr == NULL) {
 		fprintf(stderr, "No send function found in %s transport plugin.\n",
-				plugin);
+				config->plugin);
 		return -1;
 	}
 
@@ -1824,32 +2195,44 @@ load_transport_plugin(const char *plugin, struct rd_encoder *encoder,
 }
 
 static int
-destroy_transport_plugin(struct rd_encoder *encoder)
+destroy_transport_plugins(struct rd_encoder *encoder)
 {
-	if (encoder->verbose) {
-		printf("Destroy transport plugin...\n");
-	}
+	int i;
 
-	if (encoder->transport_handle) {
-		void (*transport_destroy_fptr)(void **transport_private_data);
+	for (i = 0; i < encoder->num_transports; i++) {
+		struct rd_transport *transport = &encoder->transports[i];
 
-		transport_destroy_fptr = dlsym(encoder->transport_handle, "destroy");
-		if (transport_destroy_fptr) {
-			(*transport_destroy_fptr)(&(encoder->transport_private_data));
-		} else {
-			fprintf(stderr, "No destroy function found in transport plugin.\n");
+		if (encoder->verbose) {
+			printf("Destroy transport plugin %s...\n",
+					transport->plugin);
 		}
 
-		if (encoder->verbose) {
-			printf("Closing DLL...\n");
+		if (transport->handle) {
+			void (*transport_destroy_fptr)(void **transport_private_data);
+
+			transport_destroy_fptr = dlsym(transport->handle, "destroy");
+			if (transport_destroy_fptr) {
+				(*transport_destroy_fptr)(&(transport->private_data));
+			} else {
+				fprintf(stderr, "No destroy function found in transport plugin.\n");
+			}
+
+			if (encoder->verbose) {
+				printf("Closing DLL...\n");
+			}
+			dlclose(transport->handle);
+			transport->handle = NULL;
 		}
-		dlclose(encoder->transport_handle);
+		free(transport->plugin);
+		transport->plugin = NULL;
 	}
 	return 0;
 }
 
 struct rd_encoder *
-rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv)
+rd_encoder_create(const int verbose,
+		const struct rd_transport_config *transports,
+		int num_transports, int *argc, char **argv)
 {
 	struct rd_encoder *encoder;
 	VAStatus status;
@@ -1864,6 +2247,13 @@ rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv)
 
 	encoder->drm_fd = -1;
 	encoder->verbose = verbose;
+	pthread_mutex_init(&encoder->bitstream_mutex, NULL);
+
+	if ((num_transports < 1) || (num_transports > RD_MAX_TRANSPORTS)) {
+		fprintf(stderr, "Invalid number of transports %d, must be 1 to %d.\n",
+				num_transports, RD_MAX_TRANSPORTS);
+		goto err_encoder;
+	}
 
 	encoder->drm_fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
 	if(encoder->drm_fd < 0) {
@@ -1877,9 +2267,18 @@ rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv)
 		goto err_encoder;
 	}
 
-	err = load_transport_plugin(plugin, encoder, argc, argv);
-	if (err != 0) {
-		goto err_encoder;
+	for (i = 0; i < num_transports; i++) {
+		struct rd_transport *transport = &encoder->transports[i];
+
+		transport->encoder = encoder;
+		frame_queue_init(&transport->queue, RD_QUEUE_DEFAULT_DEPTH,
+				RD_QUEUE_DROP_OLDEST);
+		encoder->num_transports++;
+
+		err = load_transport_plugin(transport, &transports[i], argc, argv);
+		if (err != 0) {
+			goto err_encoder;
+		}
 	}
 
 	/* Buffers will be created on request... */
@@ -1888,6 +2287,9 @@ rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv)
 		encoder->out_buf[i].bufferStatus = BUFFER_STATUS_FREE;
 	}
 
+	frame_queue_init(&encoder->encode_queue, RD_QUEUE_DEFAULT_DEPTH,
+			RD_QUEUE_DROP_OLDEST);
+
 	encoder->vpp.output = VA_INVALID_ID;
 
 	encoder->va_dpy = vaGetDisplayDRM(encoder->drm_fd);
@@ -1905,9 +2307,19 @@ rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv)
 	return encoder;
 
 err_encoder:
-	if (encoder) {
-		rd_encoder_destroy(encoder);
+	/* No worker threads exist yet, so unwind only what was set up here. */
+	destroy_transport_plugins(encoder);
+	if (encoder->va_dpy) {
+		vaTerminate(encoder->va_dpy);
+	}
+	if (encoder->drm_bufmgr) {
+		drm_intel_bufmgr_destroy(encoder->drm_bufmgr);
 	}
+	if (encoder->drm_fd >= 0) {
+		close(encoder->drm_fd);
+	}
+	pthread_mutex_destroy(&encoder->bitstream_mutex);
+	free(encoder);
 	return NULL;
 }
 
@@ -1953,7 +2365,7 @@ rd_encoder_init(struct rd_encoder * const encoder,
 		goto err_vpp;
 	}
 
-	err = setup_transport_thread(encoder);
+	err = setup_transport_threads(encoder);
 	if (err != 0) {
 		goto err_vpp;
 	}
@@ -1980,14 +2392,17 @@ rd_encoder_destroy(struct rd_encoder *encoder)
 	int status;
 
 	destroy_encoder_thread(encoder);
-	destroy_transport_thread(encoder);
+	destroy_transport_threads(encoder);
 	if (encoder->verbose) {
 		printf("Worker threads destroyed...\n");
 	}
+	if (encoder->verbose || encoder->profile_level) {
+		print_queue_stats(encoder);
+	}
 
-	destroy_transport_plugin(encoder);
+	destroy_transport_plugins(encoder);
 	if (encoder->verbose) {
-		printf("Transport plugin destroyed...\n");
+		printf("Transport plugins destroyed...\n");
 	}
 
 	encoder_destroy_encode_session(encoder);
@@ -2010,6 +2425,7 @@ rd_encoder_destroy(struct rd_encoder *encoder)
 	}
 
 	close(encoder->drm_fd);
+	pthread_mutex_destroy(&encoder->bitstream_mutex);
 
 	free(encoder);
 	if (encoder->verbose) {
@@ -2297,7 +2713,7 @@ encoder_thread_function(void * const data)
 	while (!encoder->destroying_encoder) {
 		pthread_mutex_lock(&encoder->encoder_mutex);
 
-		if (!encoder->next_encode.valid) {
+		if (encoder->encode_queue.count == 0) {
 			if (encoder->verbose > 1) {
 				printf("Waiting on encoder condition...\n");
 			}
@@ -2309,7 +2725,7 @@ encoder_thread_function(void * const data)
 
 		/* If the thread is woken by destroy_encoder_thread()
 		 * then there might not be valid input. */
-		if (!encoder->next_encode.valid) {
+		if (encoder->encode_queue.count == 0) {
 			if (encoder->verbose > 1) {
 				printf("No encode in queue.\n");
 			}
@@ -2318,17 +2734,11 @@ encoder_thread_function(void * const data)
 		}
 
 		if (!encoder->destroying_encoder) {
-			encoder->current_encode.prime_fd = encoder->next_encode.prime_fd;
-			encoder->current_encode.stride = encoder->next_encode.stride;
-			encoder->current_encode.va_buffer_handle = encoder->next_encode.va_buffer_handle;
-			encoder->current_encode.format = encoder->next_encode.format;
-			encoder->current_encode.timestamp = encoder->next_encode.timestamp;
-			encoder->current_encode.frame_number = encoder->next_encode.frame_number;
-			encoder->current_encode.shm_surf_id = encoder->next_encode.shm_surf_id;
-			encoder->current_encode.buf_id = encoder->next_encode.buf_id;
-			encoder->current_encode.image_id = encoder->next_encode.image_id;
-			encoder->current_encode.valid =  encoder->next_encode.valid;
-			encoder->next_encode.valid = 0;
+			struct encode_job *job = &encoder->encode_ring[
+					frame_queue_pop(&encoder->encode_queue)];
+
+			encoder->current_encode = *job;
+			job->valid = 0;
 			pthread_mutex_unlock(&encoder->encoder_mutex);
 
 			if (encoder->verbose > 2) {
@@ -2355,82 +2765,68 @@ encoder_thread_function(void * const data)
 static void *
 transport_thread_function(void * const data)
 {
-	struct rd_encoder *encoder = data;
+	struct rd_transport *transport = data;
+	struct rd_encoder *encoder = transport->encoder;
+	struct rd_bitstream *bitstream;
+	int slot;
+	int ret;
 
 #ifdef PROFILE_REMOTE_DISPLAY
 	struct timespec end_spec;
 	int64_t finish;
 #endif
 
-	while (!encoder->destroying_transport) {
-		pthread_mutex_lock(&encoder->transport_mutex);
+	while (!transport->destroying) {
+		pthread_mutex_lock(&transport->mutex);
 
-		if (!encoder->next_transport.valid) {
-			pthread_cond_wait(&encoder->transport_cond, &encoder->transport_mutex);
+		if (transport->queue.count == 0) {
+			pthread_cond_wait(&transport->cond, &transport->mutex);
 		}
 
-		/* If the thread is woken by destroy_encoder_thread()
+		/* If the thread is woken by destroy_transport_thread()
 		 * then there might not be valid input. */
-		if (!encoder->next_transport.valid) {
+		if (transport->queue.count == 0) {
 			if (encoder->verbose > 1) {
 				printf("No transport in queue.\n");
 			}
-			pthread_mutex_unlock(&encoder->transport_mutex);
+			pthread_mutex_unlock(&transport->mutex);
 			continue;
 		}
 
-		if (!encoder->destroying_transport) {
-			drm_intel_bo *drm_bo = NULL;
-
-			encoder->current_transport.handle = encoder->next_transport.handle;
-			encoder->current_transport.stream_size = encoder->next_transport.stream_size;
-			encoder->current_transport.timestamp = encoder->next_transport.timestamp;
-			encoder->current_transport.valid = encoder->next_transport.valid;
-			encoder->current_transport.output_buf = encoder->next_transport.output_buf;
-			encoder->current_transport.frame_number = encoder->next_transport.frame_number;
-			encoder->next_transport.valid = 0;
-
-			pthread_mutex_unlock(&encoder->transport_mutex);
-
-			drm_bo = drm_intel_bo_gem_create_from_name(
-									encoder->drm_bufmgr,
-									"temp1",
-									encoder->current_transport.handle);
-
-			if (drm_bo == NULL) {
-				fprintf(stderr, "Failed to create drm buffer.\n");
-				rd_encoder_release_buffer(encoder, encoder->current_transport.output_buf);
-				return NULL;
-			}
-
-			drm_intel_bo_map(drm_bo, 1);
-
-			(*encoder->transport_send_fptr)(
-				encoder->transport_private_data,
-				drm_bo,
-				encoder->current_transport.stream_size,
-				encoder->current_transport.timestamp);
-
-			drm_intel_bo_unmap(drm_bo);
-			drm_intel_bo_unreference(drm_bo);
-		} else {
-			pthread_mutex_unlock(&encoder->transport_mutex);
+		if (transport->destroying) {
+			pthread_mutex_unlock(&transport->mutex);
 			if (encoder->verbose) {
 				printf("transport_thread_function skipping since encoder is being destroyed...\n");
 			}
+			continue;
 		}
 
-		rd_encoder_release_buffer(encoder, encoder->current_transport.output_buf);
+		slot = frame_queue_pop(&transport->queue);
+		bitstream = transport->ring[slot];
+		transport->ring[slot] = NULL;
+		pthread_mutex_unlock(&transport->mutex);
+
+		ret = (*transport->send_fptr)(
+			transport->private_data,
+			bitstream->drm_bo,
+			bitstream->stream_size,
+			bitstream->timestamp);
+		if (ret < 0) {
+			transport->send_errors++;
+		}
 
 #ifdef PROFILE_REMOTE_DISPLAY
 		if (encoder->profile_level) {
 			clock_gettime(CLOCK_MONOTONIC_RAW, &end_spec);
 			finish = timespec_to_nsec(&end_spec);
-			printf("RD-ENCODER:\tFrame[%d] transport_thread_function - "
+			printf("RD-ENCODER:\tFrame[%d] transport_thread_function(%s) - "
 						"finish: %ld ns\n",
-						encoder->current_transport.frame_number, finish);
+						bitstream->frame_number,
+						transport->plugin, finish);
 		}
 #endif
+
+		bitstream_unref(encoder, bitstream);
 	}
 
 	return NULL;
@@ -2444,6 +2840,8 @@ rd_encoder_frame(struct rd_encoder * const encoder,
 		int32_t frame_number, uint32_t shm_surf_id,
 		uint32_t buf_id, uint32_t image_id)
 {
+	struct encode_job *job;
+
 	/* TODO: Added additional strides, need to use them */
 	if (encoder->verbose > 1) {
 		printf("Frame %d received...\n", frame_number);
@@ -2473,61 +2871,189 @@ rd_encoder_frame(struct rd_encoder * const encoder,
 
 	pthread_mutex_lock(&encoder->encoder_mutex);
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if next_encode.valid is true. However, if the system
-	 * is under heavy load, it can happen that the encoder does not get
-	 * scheduled between frames being submitted. In this case, we
-	 * drop the older frame. Dropping the current frame as well is too
-	 * aggressive. */
-	if (encoder->next_encode.valid) {
+	/* If the system is under heavy load, it can happen that the encoder
+	 * does not get scheduled between frames being submitted and the queue
+	 * fills up. Depending on the queue policy we either wait for the
+	 * encoder to take a frame or drop the oldest queued frame. Dropping
+	 * the current frame is too aggressive. */
+	if (frame_queue_wait_space(&encoder->encode_queue,
+				&encoder->encoder_mutex,
+				&encoder->destroying_encoder)) {
 		/* Drop queued frame... */
+		job = &encoder->encode_ring[frame_queue_pop(&encoder->encode_queue)];
 		printf("WARNING: Dropping frame %d, since a newer frame is available to encode.\n",
-				encoder->next_encode.frame_number);
-		encoder->next_encode.valid = 0;
-		if (encoder->next_encode.va_buffer_handle) {
-			/* Shared memory surface. */
-			ias_hmi_release_buffer_handle(encoder->hmi,
-				encoder->next_encode.shm_surf_id,
-				encoder->next_encode.buf_id,
-				encoder->next_encode.image_id,
-				encoder->surfid, 0);
-		} else {
-			close(encoder->next_encode.prime_fd);
-			encoder->next_encode.prime_fd = -1;
-			if (encoder->surfid) {
-				/* Wayland buffer surface. */
-				ias_hmi_release_buffer_handle(encoder->hmi, 0, 0, 0,
-						encoder->surfid, 0);
-			} else {
-				/* Full framebuffer. */
-				ias_hmi_release_buffer_handle(encoder->hmi, 0, 0, 0, 0,
-						encoder->output_number);
-			}
-		}
+				job->frame_number);
+		release_encode_job(encoder, job);
 	}
 
 	/* Add current frame to queue... */
 	if (encoder->verbose > 2) {
-		printf("Updating queued buffer...\n");
+		printf("Queueing buffer (%d of %d slots in use)...\n",
+				encoder->encode_queue.count + 1,
+				encoder->encode_queue.depth);
 	}
-	encoder->next_encode.prime_fd = prime_fd;
+	job = &encoder->encode_ring[frame_queue_push(&encoder->encode_queue)];
+	job->prime_fd = prime_fd;
 	/* TODO - Once we have a version of mesa that supports
 	 * gbm_bo_get_stride_for_plane(), we should send an array of
 	 * strides and offsets. */
-	encoder->next_encode.stride = stride0;
-	encoder->next_encode.va_buffer_handle = va_buffer_handle;
-	encoder->next_encode.format = format;
-	encoder->next_encode.timestamp = timestamp;
-	encoder->next_encode.frame_number = frame_number;
-	encoder->next_encode.shm_surf_id = shm_surf_id;
-	encoder->next_encode.buf_id = buf_id;
-	encoder->next_encode.image_id = image_id;
-	encoder->next_encode.valid = 1;
+	job->stride = stride0;
+	job->va_buffer_handle = va_buffer_handle;
+	job->format = format;
+	job->timestamp = timestamp;
+	job->frame_number = frame_number;
+	job->shm_surf_id = shm_surf_id;
+	job->buf_id = buf_id;
+	job->image_id = image_id;
+	job->valid = 1;
 	pthread_cond_signal(&encoder->encoder_cond);
 	pthread_mutex_unlock(&encoder->encoder_mutex);
 	return 0;
 }
 
+int
+rd_encoder_set_queue_params(struct rd_encoder *encoder,
+		enum rd_queue_stage stage, int depth,
+		enum rd_queue_policy policy)
+{
+	int i;
+
+	if (encoder == NULL) {
+		fprintf(stderr, "rd_encoder_set_queue_params : No encoder.\n");
+		return -1;
+	}
+
+	/* The worker threads are only created by rd_encoder_init(). */
+	if (encoder->encoder_thread || encoder->transports[0].thread) {
+		fprintf(stderr, "rd_encoder_set_queue_params : "
+				"queues must be configured before init.\n");
+		return -1;
+	}
+
+	if ((depth < 1) || (depth > RD_QUEUE_MAX_DEPTH)) {
+		fprintf(stderr, "Invalid queue depth %d, must be 1 to %d.\n",
+				depth, RD_QUEUE_MAX_DEPTH);
+		return -1;
+	}
+
+	switch (stage) {
+	case RD_QUEUE_ENCODE:
+		frame_queue_init(&encoder->encode_queue, depth, policy);
+		break;
+	case RD_QUEUE_TRANSPORT:
+		/* A blocked transport would stall the encoder and with it
+		 * every other receiver. */
+		if ((policy == RD_QUEUE_BLOCK) && (encoder->num_transports > 1)) {
+			fprintf(stderr, "WARNING: blocking transport queues are "
+				"not supported with multiple transports, "
+				"dropping oldest instead.\n");
+			policy = RD_QUEUE_DROP_OLDEST;
+		}
+		for (i = 0; i < encoder->num_transports; i++) {
+			frame_queue_init(&encoder->transports[i].queue,
+					depth, policy);
+		}
+		break;
+	default:
+		fprintf(stderr, "Invalid queue stage %d.\n", stage);
+		return -1;
+	}
+
+	if (encoder->verbose) {
+		printf("Using %s queue of depth %d, %s when full.\n",
+			stage == RD_QUEUE_ENCODE ? "encode" : "transport", depth,
+			policy == RD_QUEUE_BLOCK ? "blocking" : "dropping oldest");
+	}
+
+	return 0;
+}
+
+int
+rd_encoder_get_queue_stats(struct rd_encoder *encoder,
+		enum rd_queue_stage stage, struct rd_queue_stats *stats)
+{
+	int i;
+
+	if (encoder == NULL || stats == NULL) {
+		return -1;
+	}
+
+	switch (stage) {
+	case RD_QUEUE_ENCODE:
+		pthread_mutex_lock(&encoder->encoder_mutex);
+		*stats = encoder->encode_queue.stats;
+		pthread_mutex_unlock(&encoder->encoder_mutex);
+		break;
+	case RD_QUEUE_TRANSPORT:
+		/* Totals across all transports; per-transport figures are
+		 * available from rd_encoder_get_transport_stats(). */
+		memset(stats, 0, sizeof(*stats));
+		for (i = 0; i < encoder->num_transports; i++) {
+			struct rd_queue_stats transport_stats;
+
+			rd_encoder_get_transport_stats(encoder, i,
+					&transport_stats);
+			stats->depth = transport_stats.depth;
+			stats->occupancy = MAX(stats->occupancy,
+					transport_stats.occupancy);
+			stats->max_occupancy = MAX(stats->max_occupancy,
+					transport_stats.max_occupancy);
+			stats->queued += transport_stats.queued;
+			stats->dropped += transport_stats.dropped;
+			stats->blocked += transport_stats.blocked;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+rd_encoder_get_transport_stats(struct rd_encoder *encoder, int transport,
+		struct rd_queue_stats *stats)
+{
+	struct rd_transport *t;
+
+	if (encoder == NULL || stats == NULL ||
+			transport < 0 || transport >= encoder->num_transports) {
+		return -1;
+	}
+
+	t = &encoder->transports[transport];
+	pthread_mutex_lock(&t->mutex);
+	*stats = t->queue.stats;
+	pthread_mutex_unlock(&t->mutex);
+
+	return 0;
+}
+
+static void
+print_queue_stats(struct rd_encoder * const encoder)
+{
+	const struct rd_queue_stats *stats = &encoder->encode_queue.stats;
+	int i;
+
+	printf("RD-ENCODER:\tencode queue - depth: %u, max occupancy: %u, "
+		"queued: %" PRIu64 ", dropped: %" PRIu64 ", "
+		"blocked: %" PRIu64 "\n",
+		stats->depth, stats->max_occupancy,
+		stats->queued, stats->dropped, stats->blocked);
+
+	for (i = 0; i < encoder->num_transports; i++) {
+		const struct rd_transport *transport = &encoder->transports[i];
+
+		stats = &transport->queue.stats;
+		printf("RD-ENCODER:\ttransport %d (%s) queue - depth: %u, "
+			"max occupancy: %u, queued: %" PRIu64 ", "
+			"dropped: %" PRIu64 ", blocked: %" PRIu64 ", "
+			"send errors: %" PRIu64 "\n",
+			i, transport->plugin, stats->depth, stats->max_occupancy,
+			stats->queued, stats->dropped, stats->blocked,
+			transport->send_errors);
+	}
+}
 
 void
 rd_encoder_enable_profiling(struct rd_encoder *encoder, int profile_level)
@@ -41,8 +41,45 @@ enum rd_encoder_format {
 	RD_FORMAT_NV12,
 };
 
+/* Maximum number of frames that can be held between pipeline stages. */
+#define RD_QUEUE_MAX_DEPTH	8
+#define RD_QUEUE_DEFAULT_DEPTH	2
+
+/* What to do when a frame arrives at a full queue. */
+enum rd_queue_policy {
+	RD_QUEUE_DROP_OLDEST,
+	RD_QUEUE_BLOCK,
+};
+
+/* Queues between the pipeline stages. */
+enum rd_queue_stage {
+	RD_QUEUE_ENCODE,	/* capture -> colour conversion/encode */
+	RD_QUEUE_TRANSPORT,	/* encode -> transport */
+	RD_QUEUE_NUM_STAGES
+};
+
+struct rd_queue_stats {
+	uint32_t depth;
+	uint32_t occupancy;
+	uint32_t max_occupancy;
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t blocked;
+};
+
+/* Maximum number of transports a single encoded stream is sent to. */
+#define RD_MAX_TRANSPORTS	4
+
+struct rd_transport_config {
+	const char *plugin;	/* full path of the transport plugin */
+	char *options;		/* ':'-separated key=value pairs, or NULL to
+				 * use the shared command line options */
+};
+
 struct rd_encoder *
-rd_encoder_create(const int verbose, char *plugin, int *argc, char **argv);
+rd_encoder_create(const int verbose,
+		const struct rd_transport_config *transports,
+		int num_transports, int *argc, char **argv);
 int
 rd_encoder_init(struct rd_encoder * const encoder,
 				const int width, const int height,
@@ -63,6 +100,17 @@ rd_encoder_frame(struct rd_encoder * const encoder, int32_t va_buffer_handle,
 void
 rd_encoder_enable_profiling(struct rd_encoder *encoder, int profile_level);
 int
+rd_encoder_set_queue_params(struct rd_encoder *encoder,
+					enum rd_queue_stage stage, int depth,
+					enum rd_queue_policy policy);
+int
+rd_encoder_get_queue_stats(struct rd_encoder *encoder,
+					enum rd_queue_stage stage,
+					struct rd_queue_stats *stats);
+int
+rd_encoder_get_transport_stats(struct rd_encoder *encoder, int transport,
+					struct rd_queue_stats *stats);
+int
 vsync_received(struct rd_encoder *encoder);
 void
 vsync_notify(struct rd_encoder *encoder);
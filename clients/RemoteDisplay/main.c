@@ -365,6 +365,21 @@ handle_capture_error(void *data,
 	}
 }
 
+static void
+handle_capture_stats(void *data,
+		struct ias_hmi *hmi,
+		uint32_t surfid,
+		uint32_t output_number,
+		uint32_t captured,
+		uint32_t skipped_rate,
+		uint32_t skipped_busy,
+		uint32_t deferred)
+{
+	printf("Capture - sent: %u, skipped for rate: %u, "
+		"skipped while busy: %u, sent late: %u\n",
+		captured, skipped_rate, skipped_busy, deferred);
+}
+
 static const struct ias_hmi_listener hmi_listener = {
 	handle_surface_info,
 	handle_surface_destroyed,
@@ -372,6 +387,7 @@ static const struct ias_hmi_listener hmi_listener = {
 	handle_raw_buffer_handle,
 	handle_raw_buffer_fd,
 	handle_capture_error,
+	handle_capture_stats,
 };
 
 static void
@@ -383,7 +399,9 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 
   printf("%s : %s.\n", __func__, interface);
 	if (strcmp(interface, "ias_hmi") == 0) {
-		app_state->hmi = wl_registry_bind(registry, id, &ias_hmi_interface, 1);
+		app_state->hmi_version = MIN(version, 2);
+		app_state->hmi = wl_registry_bind(registry, id, &ias_hmi_interface,
+				app_state->hmi_version);
 		ias_hmi_add_listener(app_state->hmi, &hmi_listener, app_state);
 	} else if (strcmp(interface, "ias_relay_input") == 0) {
 		printf("Bind ias_relay_input.\n");
@@ -407,6 +425,13 @@ static const struct wl_registry_listener registry_listener = {
 static void
 stop_recording(struct app_state *app_state)
 {
+	if ((app_state->verbose || app_state->profile) &&
+			(app_state->hmi_version >= 2)) {
+		ias_hmi_get_capture_stats(app_state->hmi, app_state->surfid,
+				app_state->output_number);
+		wl_display_roundtrip(app_state->display);
+	}
+
 	ias_hmi_stop_capture(app_state->hmi, app_state->surfid,
 			app_state->output_number);
 }
@@ -422,6 +447,18 @@ start_recording(struct app_state *app_state)
 	ias_hmi_start_capture(app_state->hmi, app_state->surfid,
 		app_state->output_number, app_state->profile, app_state->verbose);
 
+	/* Don't let weston send more frames than the encode queue can hold,
+	 * plus the one being encoded. */
+	if (app_state->hmi_version >= 2) {
+		ias_hmi_set_capture_rate(app_state->hmi, app_state->surfid,
+			app_state->output_number, app_state->capture_fps,
+			app_state->capture_burst,
+			app_state->encode_queue_depth + 1,
+			app_state->capture_latest ?
+				IAS_HMI_CAPTURE_POLICY_LATEST :
+				IAS_HMI_CAPTURE_POLICY_DROP);
+	}
+
 	app_state->recording = 1;
 }
 
@@ -508,43 +545,100 @@ static void
 plugin_print_help(void)
 {
 	void (*plugin_help_fptr)(void);
-	void *plugin_handle = NULL;
+	void *plugin_handle;
+	int i;
 
-	if (app_state.transport_plugin) {
-		plugin_handle = dlopen(app_state.plugin_fullname, RTLD_LAZY | RTLD_LOCAL);
-	}
-	if (!plugin_handle) {
+	if (app_state.num_transports == 0) {
 		fprintf(stderr, "Failed to load transport plugin.\n");
 		return;
 	}
 
-	plugin_help_fptr = dlsym(plugin_handle, "help");
-	if (plugin_help_fptr) {
-		(*plugin_help_fptr)();
-	} else {
-		fprintf(stderr, "Failed to locate help in transport plugin: %s\n", dlerror());
-	}
+	for (i = 0; i < app_state.num_transports; i++) {
+		plugin_handle = dlopen(app_state.plugin_fullname[i],
+				RTLD_LAZY | RTLD_LOCAL);
+		if (!plugin_handle) {
+			fprintf(stderr, "Failed to load transport plugin %s.\n",
+					app_state.plugin_fullname[i]);
+			continue;
+		}
+
+		plugin_help_fptr = dlsym(plugin_handle, "help");
+		if (plugin_help_fptr) {
+			(*plugin_help_fptr)();
+		} else {
+			fprintf(stderr, "Failed to locate help in transport plugin: %s\n", dlerror());
+		}
 
-	dlclose(plugin_handle);
+		dlclose(plugin_handle);
+	}
 }
 
 
-static void
-plugin_fullname_helper(void)
+static char *
+plugin_fullname_helper(const char *plugin, size_t len)
 {
 	char *prefix = "/usr/lib/weston/transport_plugin_";
 	char *suffix = ".so";
-	size_t fullnamelen = strlen(prefix)
-				+ strlen(app_state.transport_plugin)
-				+ strlen(suffix) + 1;
+	size_t fullnamelen = strlen(prefix) + len + strlen(suffix) + 1;
+	char *fullname;
 
-	app_state.plugin_fullname = malloc(fullnamelen);
-	if (app_state.plugin_fullname == NULL) {
+	fullname = malloc(fullnamelen);
+	if (fullname == NULL) {
 		fprintf(stderr, "plugin_fullname_helper : name allocation failure.\n");
 	} else {
-		snprintf(app_state.plugin_fullname, fullnamelen, "%s%s%s",
-				prefix, app_state.transport_plugin, suffix);
+		snprintf(fullname, fullnamelen, "%s%.*s%s",
+				prefix, (int) len, plugin, suffix);
 	}
+
+	return fullname;
+}
+
+
+/* Split --plugin=name[:key=value...][,name[:key=value...]...] into one
+ * transport per comma-separated entry. Options given after a plugin name
+ * are passed to that plugin only. */
+static int
+parse_transport_list(void)
+{
+	const char *entry = app_state.transport_plugin;
+	const char *end, *options;
+	struct rd_transport_config *transport;
+
+	while (*entry) {
+		end = strchr(entry, ',');
+		if (end == NULL) {
+			end = entry + strlen(entry);
+		}
+		if (end == entry) {
+			entry = *end ? end + 1 : end;
+			continue;
+		}
+
+		if (app_state.num_transports == RD_MAX_TRANSPORTS) {
+			fprintf(stderr, "Too many transport plugins, "
+					"at most %d are supported.\n",
+					RD_MAX_TRANSPORTS);
+			return -1;
+		}
+
+		options = memchr(entry, ':', end - entry);
+		transport = &app_state.transports[app_state.num_transports];
+		app_state.plugin_fullname[app_state.num_transports] =
+			plugin_fullname_helper(entry,
+					(options ? options : end) - entry);
+		if (app_state.plugin_fullname[app_state.num_transports] == NULL) {
+			return -1;
+		}
+		transport->plugin =
+			app_state.plugin_fullname[app_state.num_transports];
+		transport->options = options ?
+			strndup(options + 1, end - options - 1) : NULL;
+		app_state.num_transports++;
+
+		entry = *end ? end + 1 : end;
+	}
+
+	return app_state.num_transports ? 0 : -1;
 }
 
 
@@ -562,7 +656,11 @@ usage(int error_code)
 		" video stream.\n\n");
 	printf("Options:\n");
 	printf("\t--plugin=<transport_plugin>\tTransport plugin to use."
-		" Examples are avb, file, tcp and stub.\n");
+		" Examples are avb, file, rtp, tcp and stub.\n"
+		"\t\t\t\t\tUp to %d plugins can be given as a comma-separated"
+		" list, each\n\t\t\t\t\twith its own options, e.g.\n"
+		"\t\t\t\t\t--plugin=tcp:ipaddr=10.0.0.2:port=5000,"
+		"rtp:ipaddr=10.0.0.3\n", RD_MAX_TRANSPORTS);
 	printf("\t--state=0\t\t\tstop frame capture, e.g. if another client did"
 		" not close cleanly\n"
 		"\t--state=1\t\t\tstart frame capture (this is the default)\n");
@@ -579,6 +677,20 @@ usage(int error_code)
 		"\t--w=<width>\t\t\twidth of region of surface to be captured\n"
 		"\t--h=<height>\t\t\theight of region of surface "
 		"to be captured\n");
+	printf("\t--queue=<depth>\t\t\tnumber of captured frames that can "
+		"wait for the encoder, 1 to %d (default %d)\n"
+		"\t--tqueue=<depth>\t\tnumber of encoded frames that can "
+		"wait for the transport, 1 to %d (default %d)\n"
+		"\t--queue-block\t\t\twait for a free slot when a queue is "
+		"full instead of dropping the oldest frame\n",
+		RD_QUEUE_MAX_DEPTH, RD_QUEUE_DEFAULT_DEPTH,
+		RD_QUEUE_MAX_DEPTH, RD_QUEUE_DEFAULT_DEPTH);
+	printf("\t--capture-fps=<rate>\t\tmaximum capture frame rate, or 0 to "
+		"limit the rate per composite event (default 0)\n"
+		"\t--capture-burst=<frames>\tframes that can be captured back to "
+		"back (default 2)\n"
+		"\t--capture-latest\t\tsend the latest frame skipped by the rate "
+		"limit once it allows, instead of dropping it\n");
 	printf("\t--help\t\t\t\tshow this help text and exit\n\n");
 	printf("Note that all options other than state default to zero.\n"
 		"A width or height of zero is taken to mean that the entire "
@@ -630,7 +742,8 @@ init(struct app_state *app_state, int *argc, char **argv)
 	}
 
 	app_state->rd_encoder =
-		rd_encoder_create(app_state->verbose, app_state->plugin_fullname, argc, argv);
+		rd_encoder_create(app_state->verbose, app_state->transports,
+				app_state->num_transports, argc, argv);
 
 	if (app_state->rd_encoder == NULL) {
 		fprintf(stderr, "Failed to create Remote Display encoder\n");
@@ -641,6 +754,19 @@ init(struct app_state *app_state, int *argc, char **argv)
 		rd_encoder_enable_profiling(app_state->rd_encoder, app_state->profile);
 	}
 
+	if (rd_encoder_set_queue_params(app_state->rd_encoder, RD_QUEUE_ENCODE,
+			app_state->encode_queue_depth,
+			app_state->queue_block ?
+				RD_QUEUE_BLOCK : RD_QUEUE_DROP_OLDEST) != 0) {
+		return -1;
+	}
+	if (rd_encoder_set_queue_params(app_state->rd_encoder, RD_QUEUE_TRANSPORT,
+			app_state->transport_queue_depth,
+			app_state->queue_block ?
+				RD_QUEUE_BLOCK : RD_QUEUE_DROP_OLDEST) != 0) {
+		return -1;
+	}
+
 	app_state->encoder_state = ENC_STATE_NONE;
 
 	if (init_encoder(app_state) != 0) {
@@ -657,6 +783,7 @@ destroy(struct app_state *app_state)
 {
 	struct surf_list *s, *tmp;
 	struct output *output, *temp_output;
+	int i;
 
 	if (app_state->verbose) {
 		printf("Flushing...\n");
@@ -675,8 +802,9 @@ destroy(struct app_state *app_state)
 		rd_encoder_destroy(app_state->rd_encoder);
 	}
 
-	if (app_state->plugin_fullname) {
-		free(app_state->plugin_fullname);
+	for (i = 0; i < app_state->num_transports; i++) {
+		free(app_state->plugin_fullname[i]);
+		free(app_state->transports[i].options);
 	}
 
 	if (app_state->verbose) {
@@ -733,6 +861,12 @@ main(int argc, char **argv)
 		{ WESTON_OPTION_INTEGER, "w", 0, &app_state.w},
 		{ WESTON_OPTION_INTEGER, "h", 0, &app_state.h},
 		{ WESTON_OPTION_INTEGER, "tu", 0, &app_state.encoder_tu},
+		{ WESTON_OPTION_INTEGER, "queue", 0, &app_state.encode_queue_depth},
+		{ WESTON_OPTION_INTEGER, "tqueue", 0, &app_state.transport_queue_depth},
+		{ WESTON_OPTION_BOOLEAN, "queue-block", 0, &app_state.queue_block},
+		{ WESTON_OPTION_INTEGER, "capture-fps", 0, &app_state.capture_fps},
+		{ WESTON_OPTION_INTEGER, "capture-burst", 0, &app_state.capture_burst},
+		{ WESTON_OPTION_BOOLEAN, "capture-latest", 0, &app_state.capture_latest},
 		{ WESTON_OPTION_BOOLEAN, "help", 0, &help },
 	};
 
@@ -742,7 +876,7 @@ main(int argc, char **argv)
 		if (app_state.transport_plugin == NULL) {
 			fprintf(stderr, "No transport plugin name given.\n");
 		} else {
-			plugin_fullname_helper();
+			parse_transport_list();
 		}
 		usage(0);
 	}
@@ -758,8 +892,9 @@ main(int argc, char **argv)
 			fprintf(stderr, "No transport plugin name given.\n");
 			usage(-EINVAL);
 		}
-	} else {
-		plugin_fullname_helper();
+	} else if (parse_transport_list() != 0) {
+		fprintf(stderr, "Invalid transport plugin list given.\n");
+		usage(-EINVAL);
 	}
 
 	if (app_state.encoder_tu == 0) {
@@ -767,6 +902,13 @@ main(int argc, char **argv)
 		app_state.encoder_tu = 7;
 	}
 
+	if (app_state.encode_queue_depth == 0) {
+		app_state.encode_queue_depth = RD_QUEUE_DEFAULT_DEPTH;
+	}
+	if (app_state.transport_queue_depth == 0) {
+		app_state.transport_queue_depth = RD_QUEUE_DEFAULT_DEPTH;
+	}
+
 	err = init(&app_state, &argc, argv);
 	if ((err == 0) && state) {
 		/* Catch SIGINT / Ctrl+C to stop recording. */
@@ -51,6 +51,13 @@ struct app_state {
 	int w;
 	int h;
 	int encoder_tu;
+	int encode_queue_depth;
+	int transport_queue_depth;
+	int queue_block;
+	int capture_fps;
+	int capture_burst;
+	int capture_latest;
+	uint32_t hmi_version;
 	int output_number;
 	int output_origin_x;
 	int output_origin_y;
@@ -58,7 +65,9 @@ struct app_state {
 	int output_height;
 	enum encoder_state encoder_state;
 	char *transport_plugin;
-	char *plugin_fullname;
+	char *plugin_fullname[RD_MAX_TRANSPORTS];
+	struct rd_transport_config transports[RD_MAX_TRANSPORTS];
+	int num_transports;
 	struct rd_encoder *rd_encoder;
 	struct input_receiver_private_data *ir_priv;
 
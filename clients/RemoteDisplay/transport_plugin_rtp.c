@@ -0,0 +1,537 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * This file contains an RTP over UDP transport plugin for the remote display
+ * wayland client. Each H.264 frame is split into NAL units and packetised as
+ * described in RFC 6184: NAL units that fit in one packet are sent as single
+ * NAL unit packets, larger ones are split into FU-A fragmentation units.
+ * The RTP headers are built separately, so the payload is sent straight out
+ * of the mapped encoder buffer with no copies. Packets are sent in batches
+ * with sendmmsg() and the batches are spread across the frame interval so
+ * that a large IDR frame does not overrun switch or receiver buffers.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <wayland-util.h>
+#include <libdrm/intel_bufmgr.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../shared/config-parser.h"
+#include "../shared/helpers.h"
+#include "../shared/timespec-util.h"
+
+#include "transport_plugin.h"
+
+#define RTP_CLOCK		90000
+#define RTP_VERSION		0x80
+#define RTP_MARKER		0x80
+#define RTP_PAYLOAD_TYPE	96
+#define RTP_HEADER_SIZE		12
+#define FU_INDICATOR_SIZE	1
+#define FU_HEADER_SIZE		1
+#define FU_A_TYPE		28
+#define FU_START		0x80
+#define FU_END			0x40
+#define NRI_MASK		0x60
+#define NAL_TYPE_MASK		0x1F
+#define NAL_F_NRI_MASK		0xE0
+
+#define DEFAULT_MTU		1400
+#define MIN_MTU			64
+#define MAX_MTU			9000
+#define DEFAULT_FPS		60
+#define DEFAULT_PACE		80
+#define DEFAULT_BATCH		8
+#define MAX_BATCH		64
+
+/* Intervals outside this range are treated as a stall or a clock jump and
+ * the configured frame rate is used instead. */
+#define MIN_FRAME_INTERVAL_NS	1000000LL
+#define MAX_FRAME_INTERVAL_NS	100000000LL
+
+
+/* One RTP packet: header (plus FU indicator and header) and a pointer to
+ * the payload in the mapped buffer. */
+struct rtp_packet {
+	uint8_t header[RTP_HEADER_SIZE + FU_INDICATOR_SIZE + FU_HEADER_SIZE];
+	struct iovec iov[2];
+};
+
+struct private_data {
+	int verbose;
+	int socket;
+	struct sockaddr_in sockAddr;
+	char *ipaddr;
+	unsigned short port;
+
+	int mtu;
+	int fps;
+	int pace;
+	int batch;
+
+	uint16_t sequence_number;
+	uint32_t ssrc;
+	uint32_t last_timestamp;
+	int have_last_timestamp;
+
+	/* Packet and message arrays, grown to fit the largest frame seen. */
+	struct rtp_packet *packets;
+	struct mmsghdr *msgs;
+	int max_packets;
+
+	struct {
+		uint64_t frames;
+		uint64_t packets;
+		uint64_t fragments;
+		uint64_t bytes;
+		uint64_t send_errors;
+	} stats;
+};
+
+
+WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbose)
+{
+	printf("Using RTP remote display transport plugin...\n");
+	struct private_data *private_data = calloc(1, sizeof(*private_data));
+	struct timespec now;
+	*plugin_private_data = (void *)private_data;
+	if (private_data) {
+		private_data->verbose = verbose;
+		private_data->socket = -1;
+	} else {
+		return(-ENOMEM);
+	}
+
+	int port = 0;
+	const struct weston_option options[] = {
+		{ WESTON_OPTION_STRING,  "ipaddr", 0, &private_data->ipaddr},
+		{ WESTON_OPTION_INTEGER, "port", 0, &port},
+		{ WESTON_OPTION_INTEGER, "mtu", 0, &private_data->mtu},
+		{ WESTON_OPTION_INTEGER, "fps", 0, &private_data->fps},
+		{ WESTON_OPTION_INTEGER, "pace", 0, &private_data->pace},
+		{ WESTON_OPTION_INTEGER, "batch", 0, &private_data->batch},
+	};
+	parse_options(options, ARRAY_LENGTH(options), argc, argv);
+	private_data->port = port;
+
+	if (private_data->mtu == 0) {
+		private_data->mtu = DEFAULT_MTU;
+	}
+	if (private_data->fps <= 0) {
+		private_data->fps = DEFAULT_FPS;
+	}
+	if (private_data->pace == 0) {
+		private_data->pace = DEFAULT_PACE;
+	}
+	if (private_data->batch == 0) {
+		private_data->batch = DEFAULT_BATCH;
+	}
+
+	if ((private_data->ipaddr == NULL) || (private_data->ipaddr[0] == 0)
+			|| (port <= 0)) {
+		fprintf(stderr, "Invalid network configuration.\n");
+		goto err;
+	}
+	if ((private_data->mtu < MIN_MTU) || (private_data->mtu > MAX_MTU)) {
+		fprintf(stderr, "Invalid MTU %d, must be %d to %d.\n",
+				private_data->mtu, MIN_MTU, MAX_MTU);
+		goto err;
+	}
+	if ((private_data->pace < 0) || (private_data->pace > 100)) {
+		fprintf(stderr, "Invalid pacing %d%%, must be 0 to 100.\n",
+				private_data->pace);
+		goto err;
+	}
+	if ((private_data->batch < 1) || (private_data->batch > MAX_BATCH)) {
+		fprintf(stderr, "Invalid batch size %d, must be 1 to %d.\n",
+				private_data->batch, MAX_BATCH);
+		goto err;
+	}
+
+	private_data->socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (private_data->socket < 0) {
+		fprintf(stderr, "Socket creation failed.\n");
+		goto err;
+	}
+
+	private_data->sockAddr.sin_addr.s_addr = inet_addr(private_data->ipaddr);
+	private_data->sockAddr.sin_family = AF_INET;
+	private_data->sockAddr.sin_port = htons(private_data->port);
+	if (connect(private_data->socket,
+			(struct sockaddr *) &private_data->sockAddr,
+			sizeof(private_data->sockAddr)) < 0) {
+		fprintf(stderr, "Error setting receiver address.\n");
+		goto err;
+	}
+
+	/* RFC 3550 wants a random SSRC and initial sequence number. */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	srandom(now.tv_nsec ^ getpid());
+	private_data->ssrc = random();
+	private_data->sequence_number = random();
+
+	printf("Sending RTP to %s:%d, MTU %d.\n", private_data->ipaddr, port,
+			private_data->mtu);
+
+	return 0;
+
+err:
+	if (private_data->socket >= 0) {
+		close(private_data->socket);
+	}
+	free(private_data);
+	*plugin_private_data = NULL;
+	return -1;
+}
+
+
+WL_EXPORT void help(void)
+{
+	printf("\tThe rtp plugin uses the following parameters:\n");
+	printf("\t--ipaddr=<ip_address>\t\tIP address of receiver.\n");
+	printf("\t--port=<port_number>\t\tUDP port to use on receiver.\n");
+	printf("\t--mtu=<bytes>\t\t\tMaximum RTP packet size (default %d).\n",
+		DEFAULT_MTU);
+	printf("\t--fps=<rate>\t\t\tFrame rate assumed for pacing until the"
+		" frame\n\t\t\t\t\ttimestamps give one (default %d).\n",
+		DEFAULT_FPS);
+	printf("\t--pace=<percent>\t\tPart of the frame interval over which a"
+		" frame's\n\t\t\t\t\tpackets are spread, 0 to send at once"
+		" (default %d).\n", DEFAULT_PACE);
+	printf("\t--batch=<packets>\t\tPackets per sendmmsg() call"
+		" (default %d).\n", DEFAULT_BATCH);
+	printf("\n\tThe receiver should be started using:\n");
+	printf("\t\"gst-launch-1.0 udpsrc port=<port_number> caps=\\\"application/x-rtp,"
+		"media=video,clock-rate=90000,encoding-name=H264\\\" ! rtph264depay !"
+		" h264parse ! mfxdecode live-mode=true ! mfxsinkelement\"\n");
+}
+
+
+/* Find the next Annex B start code at or after offset. Returns the offset
+ * of the first byte after the start code, or size if there is none. */
+static int32_t
+next_nal(const uint8_t *data, int32_t size, int32_t offset)
+{
+	int32_t i;
+
+	for (i = offset; i + 2 < size; i++) {
+		if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) {
+			return i + 3;
+		}
+	}
+
+	return size;
+}
+
+/* Length of a NAL unit starting at offset, excluding any trailing zero
+ * bytes that belong to the next start code. */
+static int32_t
+nal_length(const uint8_t *data, int32_t size, int32_t offset, int32_t next)
+{
+	int32_t end = (next < size) ? next - 3 : size;
+
+	while (end > offset && next < size && data[end - 1] == 0x00) {
+		end--;
+	}
+
+	return end - offset;
+}
+
+static int
+ensure_packets(struct private_data *private_data, int count)
+{
+	struct rtp_packet *packets;
+	struct mmsghdr *msgs;
+	int n = private_data->max_packets ? private_data->max_packets : 64;
+
+	if (count <= private_data->max_packets) {
+		return 0;
+	}
+
+	while (n < count) {
+		n *= 2;
+	}
+
+	packets = realloc(private_data->packets, n * sizeof(*packets));
+	if (packets == NULL) {
+		return -ENOMEM;
+	}
+	private_data->packets = packets;
+
+	msgs = realloc(private_data->msgs, n * sizeof(*msgs));
+	if (msgs == NULL) {
+		return -ENOMEM;
+	}
+	private_data->msgs = msgs;
+	private_data->max_packets = n;
+
+	return 0;
+}
+
+static void
+fill_rtp_header(struct private_data *private_data, uint8_t *header,
+		uint32_t timestamp)
+{
+	uint16_t seq = htons(private_data->sequence_number++);
+	uint32_t ts = htonl(timestamp);
+	uint32_t ssrc = htonl(private_data->ssrc);
+
+	header[0] = RTP_VERSION;
+	header[1] = RTP_PAYLOAD_TYPE;
+	memcpy(&header[2], &seq, sizeof(seq));
+	memcpy(&header[4], &ts, sizeof(ts));
+	memcpy(&header[8], &ssrc, sizeof(ssrc));
+}
+
+/* Build the packet list for a frame. Returns the number of packets, or a
+ * negative error code. */
+static int
+packetise(struct private_data *private_data, uint8_t *data,
+		int32_t stream_size, uint32_t timestamp)
+{
+	const int32_t max_payload = private_data->mtu - RTP_HEADER_SIZE;
+	const int32_t max_fragment = max_payload - FU_INDICATOR_SIZE - FU_HEADER_SIZE;
+	int32_t offset = next_nal(data, stream_size, 0);
+	int count = 0;
+
+	while (offset < stream_size) {
+		int32_t next = next_nal(data, stream_size, offset);
+		int32_t len = nal_length(data, stream_size, offset, next);
+		struct rtp_packet *packet;
+
+		if (len <= 0) {
+			offset = next;
+			continue;
+		}
+
+		if (len <= max_payload) {
+			/* Single NAL unit packet. */
+			if (ensure_packets(private_data, count + 1) < 0) {
+				return -ENOMEM;
+			}
+			packet = &private_data->packets[count++];
+			fill_rtp_header(private_data, packet->header, timestamp);
+			packet->iov[0].iov_len = RTP_HEADER_SIZE;
+			packet->iov[1].iov_base = data + offset;
+			packet->iov[1].iov_len = len;
+		} else {
+			/* FU-A. The NAL header is carried in the FU indicator
+			 * and FU header, so it is not part of the payload. */
+			uint8_t nal_header = data[offset];
+			int32_t pos = offset + 1;
+			int32_t end = offset + len;
+			int needed = (len - 1 + max_fragment - 1) / max_fragment;
+
+			if (ensure_packets(private_data, count + needed) < 0) {
+				return -ENOMEM;
+			}
+
+			while (pos < end) {
+				int32_t frag = MIN(max_fragment, end - pos);
+
+				packet = &private_data->packets[count++];
+				fill_rtp_header(private_data, packet->header, timestamp);
+				packet->header[RTP_HEADER_SIZE] =
+					(nal_header & NAL_F_NRI_MASK) | FU_A_TYPE;
+				packet->header[RTP_HEADER_SIZE + 1] =
+					(nal_header & NAL_TYPE_MASK) |
+					(pos == offset + 1 ? FU_START : 0) |
+					(pos + frag == end ? FU_END : 0);
+				packet->iov[0].iov_len = RTP_HEADER_SIZE +
+					FU_INDICATOR_SIZE + FU_HEADER_SIZE;
+				packet->iov[1].iov_base = data + pos;
+				packet->iov[1].iov_len = frag;
+				pos += frag;
+				private_data->stats.fragments++;
+			}
+		}
+
+		offset = next;
+	}
+
+	/* The marker bit flags the last packet of the access unit. */
+	if (count) {
+		private_data->packets[count - 1].header[1] |= RTP_MARKER;
+	}
+
+	return count;
+}
+
+/* Work out how long this frame's packets may be spread over, from the
+ * RTP timestamps of consecutive frames. */
+static int64_t
+pacing_window(struct private_data *private_data, uint32_t timestamp)
+{
+	int64_t interval = NSEC_PER_SEC / private_data->fps;
+
+	if (private_data->have_last_timestamp) {
+		/* Unsigned subtraction copes with the 32-bit wrap. */
+		uint32_t delta = timestamp - private_data->last_timestamp;
+		int64_t measured = (int64_t)delta * NSEC_PER_SEC / RTP_CLOCK;
+
+		if (measured >= MIN_FRAME_INTERVAL_NS &&
+				measured <= MAX_FRAME_INTERVAL_NS) {
+			interval = measured;
+		}
+	}
+	private_data->last_timestamp = timestamp;
+	private_data->have_last_timestamp = 1;
+
+	return interval * private_data->pace / 100;
+}
+
+static int
+send_batch(struct private_data *private_data, struct mmsghdr *msgs, int count)
+{
+	int sent = 0;
+
+	while (sent < count) {
+		int rval = sendmmsg(private_data->socket, msgs + sent,
+				count - sent, 0);
+
+		if (rval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* ECONNREFUSED just means nobody is listening (yet),
+			 * which is normal for a datagram stream. Keep going. */
+			private_data->stats.send_errors++;
+			if (errno == ECONNREFUSED) {
+				return 0;
+			}
+			return -errno;
+		}
+		sent += rval;
+	}
+
+	return 0;
+}
+
+WL_EXPORT int send_frame(void *plugin_private_data, drm_intel_bo *drm_bo,
+		int32_t stream_size, uint32_t timestamp)
+{
+	uint8_t *bufdata = (uint8_t *)(drm_bo->virtual);
+	struct private_data *private_data = (struct private_data *)plugin_private_data;
+	struct timespec start, when;
+	int64_t window;
+	int num_packets, num_batches;
+	int i, err;
+
+	if (private_data == NULL) {
+		fprintf(stderr, "Private data is null!\n");
+		return -1;
+	}
+
+	num_packets = packetise(private_data, bufdata, stream_size, timestamp);
+	if (num_packets < 0) {
+		fprintf(stderr, "Failed to packetise frame.\n");
+		return num_packets;
+	}
+
+	if (private_data->verbose) {
+		printf("Sending frame of %d bytes in %d RTP packets...\n",
+				stream_size, num_packets);
+	}
+
+	/* The packet array may have moved while growing, so the header
+	 * pointers are only filled in once it is complete. */
+	for (i = 0; i < num_packets; i++) {
+		private_data->packets[i].iov[0].iov_base = private_data->packets[i].header;
+		memset(&private_data->msgs[i], 0, sizeof(private_data->msgs[i]));
+		private_data->msgs[i].msg_hdr.msg_iov = private_data->packets[i].iov;
+		private_data->msgs[i].msg_hdr.msg_iovlen = 2;
+		private_data->stats.bytes += private_data->packets[i].iov[0].iov_len +
+			private_data->packets[i].iov[1].iov_len;
+	}
+
+	window = pacing_window(private_data, timestamp);
+	num_batches = (num_packets + private_data->batch - 1) / private_data->batch;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < num_batches; i++) {
+		int first = i * private_data->batch;
+		int count = MIN(private_data->batch, num_packets - first);
+
+		/* Batch i goes out i/num_batches of the way into the window. */
+		if (i && window) {
+			timespec_add_nsec(&when, &start, window * i / num_batches);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+						&when, NULL) == EINTR)
+				;
+		}
+
+		err = send_batch(private_data, private_data->msgs + first, count);
+		if (err < 0) {
+			fprintf(stderr, "Send failed: %s\n", strerror(-err));
+			return err;
+		}
+	}
+
+	private_data->stats.frames++;
+	private_data->stats.packets += num_packets;
+
+	return 0;
+}
+
+WL_EXPORT void destroy(void **plugin_private_data)
+{
+	struct private_data *private_data = (struct private_data *)*plugin_private_data;
+
+	if (private_data == NULL) {
+		return;
+	}
+
+	if (private_data->verbose) {
+		printf("RTP frames: %" PRIu64 ", packets: %" PRIu64 ", "
+			"FU-A fragments: %" PRIu64 ", bytes: %" PRIu64 ", "
+			"send errors: %" PRIu64 "\n",
+			private_data->stats.frames, private_data->stats.packets,
+			private_data->stats.fragments, private_data->stats.bytes,
+			private_data->stats.send_errors);
+		fprintf(stdout, "Closing network connection...\n");
+	}
+	close(private_data->socket);
+
+	free(private_data->packets);
+	free(private_data->msgs);
+
+	if (private_data->verbose) {
+		fprintf(stdout, "Freeing plugin private data...\n");
+	}
+	free(private_data);
+	*plugin_private_data = NULL;
+}
@@ -22,16 +22,35 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+
+/*
+ * This file contains a TCP transport plugin for the remote display wayland
+ * client. By default each frame is written out with blocking sends. With
+ * --nonblock=1 the socket is made non-blocking and frames that cannot be
+ * sent straight away are queued for a writer thread, which is woken by
+ * epoll when the socket becomes writable. If the receiver falls so far
+ * behind that the queue overflows, the unsent frames are discarded and
+ * nothing more is queued until the next IDR frame, so that the receiver
+ * always sees a decodable H.264 stream.
+ */
 #include <stdio.h>
 #include <wayland-util.h>
 #include <libdrm/intel_bufmgr.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include "../shared/config-parser.h"
@@ -39,21 +58,397 @@
 
 #include "transport_plugin.h"
 
+#define DEFAULT_SEND_QUEUE	4
+#define MAX_SEND_QUEUE		16
+
+#define NAL_TYPE_MASK		0x1F
+#define NAL_NON_IDR		1
+#define NAL_IDR			5
+#define NAL_SPS			7
+
 
 struct tcpSocket {
 	int sockDesc;
 	struct sockaddr_in sockAddr;
 };
 
+/* A frame, or the unsent tail of one, waiting for the writer thread. The
+ * data buffer is kept between uses and only grown when needed. */
+struct send_entry {
+	uint8_t *data;
+	size_t capacity;
+	size_t size;
+	size_t offset;
+	int started;
+};
 
 struct private_data {
 	int verbose;
 	struct tcpSocket socket;
 	char *ipaddr;
 	unsigned short port;
+
+	/* Non-blocking mode */
+	int nonblock;
+	int queue_depth;
+	int epoll_fd;
+	int wake_fd;
+	int stopping;
+	int error;
+	int wait_for_idr;
+	pthread_t writer_thread;
+	pthread_mutex_t mutex;
+
+	struct send_entry queue[MAX_SEND_QUEUE];
+	int head;
+	int count;
+
+	struct {
+		uint64_t frames;
+		uint64_t bytes;
+		uint64_t direct;
+		uint64_t partial;
+		uint64_t overflows;
+		uint64_t dropped;
+	} stats;
 };
 
 
+/* IDR frames from the encoder are preceded by SPS and PPS, so finding
+ * either an SPS or an IDR slice before the first non-IDR slice is enough
+ * to know that the receiver can start decoding from this frame. */
+static int
+frame_is_idr(const uint8_t *data, int32_t size)
+{
+	int32_t i;
+
+	for (i = 0; i + 3 < size; i++) {
+		if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) {
+			uint8_t nal_type = data[i + 3] & NAL_TYPE_MASK;
+
+			if (nal_type == NAL_IDR || nal_type == NAL_SPS) {
+				return 1;
+			}
+			if (nal_type == NAL_NON_IDR) {
+				return 0;
+			}
+			i += 3;
+		}
+	}
+
+	return 0;
+}
+
+static int
+send_all(int fd, const uint8_t *data, size_t size)
+{
+	while (size) {
+		ssize_t rval = send(fd, data, size, MSG_NOSIGNAL);
+
+		if (rval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		data += rval;
+		size -= rval;
+	}
+
+	return 0;
+}
+
+static struct send_entry *
+queue_entry(struct private_data *private_data, int index)
+{
+	return &private_data->queue[(private_data->head + index) % MAX_SEND_QUEUE];
+}
+
+static void
+queue_pop(struct private_data *private_data)
+{
+	private_data->head = (private_data->head + 1) % MAX_SEND_QUEUE;
+	private_data->count--;
+}
+
+/* Drop every queued frame that has not started going out on the wire. A
+ * partially sent frame has to be completed or the stream is corrupted. */
+static void
+queue_drop_unsent(struct private_data *private_data)
+{
+	int keep = (private_data->count && queue_entry(private_data, 0)->started) ? 1 : 0;
+
+	private_data->stats.dropped += private_data->count - keep;
+	private_data->count = keep;
+}
+
+/* Write as much of the queue as the socket will take. Must be called with
+ * the mutex held. Returns 0 if the queue was emptied, -EAGAIN if the socket
+ * is full, or another negative errno on failure. */
+static int
+flush_queue(struct private_data *private_data)
+{
+	struct iovec iov[MAX_SEND_QUEUE];
+	struct msghdr msg;
+	ssize_t rval;
+	int i;
+
+	while (private_data->count) {
+		for (i = 0; i < private_data->count; i++) {
+			struct send_entry *entry = queue_entry(private_data, i);
+
+			iov[i].iov_base = entry->data + entry->offset;
+			iov[i].iov_len = entry->size - entry->offset;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = private_data->count;
+
+		rval = sendmsg(private_data->socket.sockDesc, &msg,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return -EAGAIN;
+			}
+			return -errno;
+		}
+
+		private_data->stats.bytes += rval;
+		while (rval > 0) {
+			struct send_entry *entry = queue_entry(private_data, 0);
+			size_t left = entry->size - entry->offset;
+
+			entry->started = 1;
+			if ((size_t)rval < left) {
+				entry->offset += rval;
+				private_data->stats.partial++;
+				break;
+			}
+			rval -= left;
+			queue_pop(private_data);
+			private_data->stats.frames++;
+		}
+	}
+
+	return 0;
+}
+
+static void
+arm_writable(struct private_data *private_data, int arm)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = arm ? EPOLLOUT : 0;
+	ev.data.fd = private_data->socket.sockDesc;
+	epoll_ctl(private_data->epoll_fd, EPOLL_CTL_MOD,
+			private_data->socket.sockDesc, &ev);
+}
+
+/* The pending error of a socket epoll reported EPOLLHUP or EPOLLERR on */
+static int
+socket_error(struct private_data *private_data)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(private_data->socket.sockDesc, SOL_SOCKET, SO_ERROR,
+				&err, &len) < 0 || err == 0) {
+		return -EPIPE;
+	}
+
+	return -err;
+}
+
+static void *
+writer_thread_function(void *data)
+{
+	struct private_data *private_data = data;
+	struct epoll_event events[2];
+	uint64_t value;
+	int hangup;
+	int ret;
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(private_data->epoll_fd, events,
+				ARRAY_LENGTH(events), -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "TCP writer epoll_wait failed: %s\n",
+					strerror(errno));
+			break;
+		}
+
+		hangup = 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == private_data->wake_fd) {
+				if (read(private_data->wake_fd, &value, sizeof(value)) < 0
+						&& errno != EAGAIN) {
+					fprintf(stderr, "TCP writer wake read failed.\n");
+				}
+			} else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+				hangup = 1;
+			}
+		}
+
+		pthread_mutex_lock(&private_data->mutex);
+		if (private_data->stopping) {
+			pthread_mutex_unlock(&private_data->mutex);
+			break;
+		}
+
+		/* epoll keeps reporting these whatever the socket is armed
+		 * for, so the socket has to go or the thread would spin. */
+		if (hangup) {
+			private_data->error = socket_error(private_data);
+			fprintf(stderr, "Receiver connection lost: %s\n",
+					strerror(-private_data->error));
+			private_data->stats.dropped += private_data->count;
+			private_data->count = 0;
+			epoll_ctl(private_data->epoll_fd, EPOLL_CTL_DEL,
+					private_data->socket.sockDesc, NULL);
+			pthread_mutex_unlock(&private_data->mutex);
+			break;
+		}
+
+		ret = flush_queue(private_data);
+		if (ret == -EAGAIN) {
+			arm_writable(private_data, 1);
+		} else {
+			arm_writable(private_data, 0);
+			if (ret < 0) {
+				fprintf(stderr, "Send failed: %s\n", strerror(-ret));
+				private_data->error = ret;
+				private_data->stats.dropped += private_data->count;
+				private_data->count = 0;
+			}
+		}
+		pthread_mutex_unlock(&private_data->mutex);
+	}
+
+	return NULL;
+}
+
+static int
+setup_writer(struct private_data *private_data)
+{
+	struct epoll_event ev;
+	int flags;
+	int one = 1;
+	int err;
+
+	flags = fcntl(private_data->socket.sockDesc, F_GETFL);
+	if (flags < 0 || fcntl(private_data->socket.sockDesc, F_SETFL,
+				flags | O_NONBLOCK) < 0) {
+		fprintf(stderr, "Failed to make socket non-blocking.\n");
+		return -1;
+	}
+	/* Frames are written in one go, so don't hold back the tail. */
+	setsockopt(private_data->socket.sockDesc, IPPROTO_TCP, TCP_NODELAY,
+			&one, sizeof(one));
+
+	private_data->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (private_data->wake_fd < 0) {
+		fprintf(stderr, "Failed to create writer eventfd.\n");
+		return -1;
+	}
+
+	private_data->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (private_data->epoll_fd < 0) {
+		fprintf(stderr, "Failed to create writer epoll instance.\n");
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = private_data->wake_fd;
+	if (epoll_ctl(private_data->epoll_fd, EPOLL_CTL_ADD,
+				private_data->wake_fd, &ev) < 0) {
+		fprintf(stderr, "Failed to add eventfd to epoll.\n");
+		return -1;
+	}
+
+	/* The socket is only polled for EPOLLOUT while the queue is backed up. */
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = private_data->socket.sockDesc;
+	if (epoll_ctl(private_data->epoll_fd, EPOLL_CTL_ADD,
+				private_data->socket.sockDesc, &ev) < 0) {
+		fprintf(stderr, "Failed to add socket to epoll.\n");
+		return -1;
+	}
+
+	err = pthread_mutex_init(&private_data->mutex, NULL);
+	if (err != 0) {
+		fprintf(stderr, "TCP writer mutex init failure: %d\n", err);
+		return -1;
+	}
+
+	err = pthread_create(&private_data->writer_thread, NULL,
+			writer_thread_function, private_data);
+	if (err != 0) {
+		fprintf(stderr, "TCP writer thread creation failure: %d\n", err);
+		pthread_mutex_destroy(&private_data->mutex);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+destroy_writer(struct private_data *private_data)
+{
+	uint64_t value = 1;
+	int i;
+
+	if (private_data->writer_thread) {
+		pthread_mutex_lock(&private_data->mutex);
+		private_data->stopping = 1;
+		pthread_mutex_unlock(&private_data->mutex);
+
+		if (write(private_data->wake_fd, &value, sizeof(value)) < 0) {
+			fprintf(stderr, "Failed to wake TCP writer thread.\n");
+		}
+		pthread_join(private_data->writer_thread, NULL);
+		pthread_mutex_destroy(&private_data->mutex);
+		private_data->writer_thread = 0;
+	}
+
+	if (private_data->epoll_fd >= 0) {
+		close(private_data->epoll_fd);
+		private_data->epoll_fd = -1;
+	}
+	if (private_data->wake_fd >= 0) {
+		close(private_data->wake_fd);
+		private_data->wake_fd = -1;
+	}
+
+	for (i = 0; i < MAX_SEND_QUEUE; i++) {
+		free(private_data->queue[i].data);
+		private_data->queue[i].data = NULL;
+	}
+}
+
+static void
+free_private_data(void **plugin_private_data)
+{
+	struct private_data *private_data = (struct private_data *)*plugin_private_data;
+
+	destroy_writer(private_data);
+	if (private_data->socket.sockDesc >= 0) {
+		close(private_data->socket.sockDesc);
+	}
+	free(private_data);
+	*plugin_private_data = NULL;
+}
+
+
 WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbose)
 {
 	printf("Using TCP remote display transport plugin...\n");
@@ -61,6 +456,9 @@ WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbo
 	*plugin_private_data = (void *)private_data;
 	if (private_data) {
 		private_data->verbose = verbose;
+		private_data->socket.sockDesc = -1;
+		private_data->epoll_fd = -1;
+		private_data->wake_fd = -1;
 	} else {
 		return(-ENOMEM);
 	}
@@ -69,6 +467,8 @@ WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbo
 	const struct weston_option options[] = {
 		{ WESTON_OPTION_STRING,  "ipaddr", 0, &private_data->ipaddr},
 		{ WESTON_OPTION_INTEGER, "port", 0, &port},
+		{ WESTON_OPTION_INTEGER, "nonblock", 0, &private_data->nonblock},
+		{ WESTON_OPTION_INTEGER, "sendq", 0, &private_data->queue_depth},
 	};
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
 	private_data->port = port;
@@ -77,16 +477,24 @@ WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbo
 		printf("Sending to %s:%d.\n", private_data->ipaddr, port);
 	} else {
 		fprintf(stderr, "Invalid network configuration.\n");
-		free(private_data);
-		*plugin_private_data = NULL;
+		free_private_data(plugin_private_data);
+		return -1;
+	}
+
+	if (private_data->queue_depth == 0) {
+		private_data->queue_depth = DEFAULT_SEND_QUEUE;
+	} else if ((private_data->queue_depth < 1) ||
+			(private_data->queue_depth > MAX_SEND_QUEUE)) {
+		fprintf(stderr, "Invalid send queue depth %d, must be 1 to %d.\n",
+				private_data->queue_depth, MAX_SEND_QUEUE);
+		free_private_data(plugin_private_data);
 		return -1;
 	}
 
-	private_data->socket.sockDesc = socket(AF_INET, SOCK_STREAM, 0);
+	private_data->socket.sockDesc = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (private_data->socket.sockDesc < 0) {
 		fprintf(stderr, "Socket creation failed.\n");
-		free(private_data);
-		*plugin_private_data = NULL;
+		free_private_data(plugin_private_data);
 		return -1;
 	}
 
@@ -97,11 +505,21 @@ WL_EXPORT int init(int *argc, char **argv, void **plugin_private_data, int verbo
 			(struct sockaddr *) &private_data->socket.sockAddr,
 			sizeof(private_data->socket.sockAddr)) < 0) {
 		fprintf(stderr, "Error connecting to receiver.\n");
-		free(private_data);
-		*plugin_private_data = NULL;
+		free_private_data(plugin_private_data);
 		return -1;
 	}
 
+	if (private_data->nonblock) {
+		if (setup_writer(private_data) < 0) {
+			free_private_data(plugin_private_data);
+			return -1;
+		}
+		if (private_data->verbose) {
+			printf("Using non-blocking sends with a queue of %d frames.\n",
+					private_data->queue_depth);
+		}
+	}
+
 	return 0;
 }
 
@@ -111,16 +529,115 @@ WL_EXPORT void help(void)
 	printf("\tThe tcp plugin uses the following parameters:\n");
 	printf("\t--ipaddr=<ip_address>\t\tIP address of receiver.\n");
 	printf("\t--port=<port_number>\t\tPort to use on receiver.\n");
+	printf("\t--nonblock=1\t\t\tQueue frames for a writer thread instead of"
+		" blocking\n\t\t\t\t\tthe transport thread until they are sent.\n");
+	printf("\t--sendq=<frames>\t\tNumber of frames that can be queued in"
+		" non-blocking mode,\n\t\t\t\t\t1 to %d (default %d). On overflow,"
+		" frames are skipped\n\t\t\t\t\tuntil the next IDR frame.\n",
+		MAX_SEND_QUEUE, DEFAULT_SEND_QUEUE);
 	printf("\n\tThe receiver should be started using:\n");
 	printf("\t\"gst-launch-1.0 tcpserversrc  host=<ip_address> port=<port_number> ! h264parse ! mfxdecode live-mode=true ! mfxsinkelement\"\n");
 }
 
 
+static int
+queue_frame(struct private_data *private_data, const uint8_t *bufdata,
+		int32_t stream_size)
+{
+	struct send_entry *entry;
+	ssize_t sent = 0;
+	uint64_t value = 1;
+	int idr = frame_is_idr(bufdata, stream_size);
+
+	if (private_data->error) {
+		return private_data->error;
+	}
+
+	if (private_data->wait_for_idr) {
+		if (!idr) {
+			private_data->stats.dropped++;
+			return 0;
+		}
+		private_data->wait_for_idr = 0;
+	}
+
+	if (private_data->count >= private_data->queue_depth) {
+		/* Receiver can't keep up. Whatever follows the dropped frames
+		 * would reference them, so skip ahead to the next IDR. */
+		private_data->stats.overflows++;
+		queue_drop_unsent(private_data);
+		if (!idr) {
+			private_data->stats.dropped++;
+			private_data->wait_for_idr = 1;
+			if (private_data->verbose) {
+				printf("TCP send queue overflow, waiting for IDR frame.\n");
+			}
+			return 0;
+		}
+	}
+
+	/* Nothing ahead of us, so try to send straight from the mapped
+	 * buffer and only copy what the socket didn't take. */
+	if (private_data->count == 0) {
+		do {
+			sent = send(private_data->socket.sockDesc, bufdata,
+					stream_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+		} while (sent < 0 && errno == EINTR);
+
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				private_data->error = -errno;
+				return private_data->error;
+			}
+			sent = 0;
+		}
+		private_data->stats.bytes += sent;
+		if (sent == stream_size) {
+			private_data->stats.frames++;
+			private_data->stats.direct++;
+			return 0;
+		}
+		if (sent) {
+			private_data->stats.partial++;
+		}
+	}
+
+	entry = queue_entry(private_data, private_data->count);
+	if (entry->capacity < (size_t)(stream_size - sent)) {
+		uint8_t *data = realloc(entry->data, stream_size - sent);
+
+		if (data == NULL) {
+			fprintf(stderr, "Failed to grow TCP send buffer.\n");
+			/* If part of the frame is already out, the stream can
+			 * only recover at an IDR frame. */
+			if (sent) {
+				private_data->wait_for_idr = 1;
+			}
+			private_data->stats.dropped++;
+			return -ENOMEM;
+		}
+		entry->data = data;
+		entry->capacity = stream_size - sent;
+	}
+	memcpy(entry->data, bufdata + sent, stream_size - sent);
+	entry->size = stream_size - sent;
+	entry->offset = 0;
+	entry->started = (sent != 0);
+	private_data->count++;
+
+	if (write(private_data->wake_fd, &value, sizeof(value)) < 0) {
+		fprintf(stderr, "Failed to wake TCP writer thread.\n");
+	}
+
+	return 0;
+}
+
 WL_EXPORT int send_frame(void *plugin_private_data, drm_intel_bo *drm_bo,
 		int32_t stream_size, uint32_t timestamp)
 {
 	uint8_t *bufdata = (uint8_t *)(drm_bo->virtual);
 	struct private_data *private_data = (struct private_data *)plugin_private_data;
+	int rval;
 
 	if (private_data == NULL) {
 		fprintf(stderr, "Private data is null!\n");
@@ -131,13 +648,19 @@ WL_EXPORT int send_frame(void *plugin_private_data, drm_intel_bo *drm_bo,
 		printf("Sending frame over TCP...\n");
 	}
 
-	int rval = write(private_data->socket.sockDesc, bufdata, stream_size);
+	if (private_data->nonblock) {
+		pthread_mutex_lock(&private_data->mutex);
+		rval = queue_frame(private_data, bufdata, stream_size);
+		pthread_mutex_unlock(&private_data->mutex);
+	} else {
+		rval = send_all(private_data->socket.sockDesc, bufdata, stream_size);
+	}
 
-	if (rval <= 0) {
-		fprintf(stderr, "Send failed.\n");
+	if (rval < 0) {
+		fprintf(stderr, "Send failed: %s\n", strerror(-rval));
 	}
 
-	return 0;
+	return rval;
 }
 
 WL_EXPORT void destroy(void **plugin_private_data)
@@ -151,6 +674,15 @@ WL_EXPORT void destroy(void **plugin_private_data)
 	if (private_data->verbose) {
 		fprintf(stdout, "Closing network connection...\n");
 	}
+	destroy_writer(private_data);
+	if (private_data->nonblock && private_data->verbose) {
+		printf("TCP frames sent: %" PRIu64 " (%" PRIu64 " direct), "
+			"bytes: %" PRIu64 ", partial writes: %" PRIu64 ", "
+			"overflows: %" PRIu64 ", dropped: %" PRIu64 "\n",
+			private_data->stats.frames, private_data->stats.direct,
+			private_data->stats.bytes, private_data->stats.partial,
+			private_data->stats.overflows, private_data->stats.dropped);
+	}
 	close(private_data->socket.sockDesc);
 	private_data->socket.sockDesc = -1;
 	memset(&private_data->socket.sockAddr, 0, sizeof(private_data->socket.sockAddr));
@@ -49,6 +49,7 @@ struct wayland {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct ias_hmi *hmi;
+	uint32_t hmi_version;
 	struct ivi_application *ivi_application;
 	struct wl_list surface_list;
 	struct wl_callback *mode_callback;
@@ -252,7 +253,10 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 	struct wayland *w = data;
 
 	if (strcmp(interface, "ias_hmi") == 0) {
-		w->hmi = wl_registry_bind(registry, id, &ias_hmi_interface, 1);
+		/* Version 3 lets all changes be applied together */
+		w->hmi_version = MIN(version, 3);
+		w->hmi = wl_registry_bind(registry, id, &ias_hmi_interface,
+				w->hmi_version);
 		ias_hmi_add_listener(w->hmi, &listener, w);
 	} else if (strcmp(interface, "ivi_application") == 0) {
 		w->ivi_application = wl_registry_bind(registry, id,
@@ -479,6 +483,10 @@ main(int argc, char **argv)
 		wl_display_roundtrip(wayland.display);
 	}
 
+	if (wayland.hmi && wayland.hmi_version >= 3) {
+		ias_hmi_begin(wayland.hmi);
+	}
+
 	/* Handle moving output */
 	if (strlen(pos_str) > 0) {
 		int x, y;
@@ -512,6 +520,10 @@ main(int argc, char **argv)
 		ret = surface_shareable(&wayland, surfname, surfid, shareable);
 	}
 
+	if (wayland.hmi && wayland.hmi_version >= 3) {
+		ias_hmi_commit(wayland.hmi);
+	}
+
 	wl_display_roundtrip(wayland.display);
 
 	ret = 0;
@@ -32,6 +32,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include <wayland-client.h>
@@ -40,6 +42,7 @@
 #include "../shared/config-parser.h"
 
 #include "trace-reporter-client-protocol.h"
+#include "../libweston/trace-ring.h"
 
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
@@ -47,6 +50,11 @@ struct wayland {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct trace_reporter *reporter;
+	uint32_t version;
+	int binary;
+	int repaint_stats;
+	int surfaces_listed;
+	int done;
 };
 
 struct trace_event {
@@ -226,10 +234,16 @@ static void
 trace_reporter_trace_end(void *data,
 		struct trace_reporter *reporter)
 {
+	struct wayland *w = data;
 	struct trace_event *ev = first_event;
 	struct trace_event *child;
 	struct timeval *prevtime;
 
+	w->done = 1;
+	if (w->binary || w->repaint_stats) {
+		return;
+	}
+
 	if (!ev) {
 		printf("No timing information logged.\n");
 		return;
@@ -257,9 +271,84 @@ trace_reporter_trace_end(void *data,
 	}
 }
 
+static const char *stage_names[] = {
+	[TRACE_REPORTER_REPAINT_STAGE_BUILD_VIEW_LIST] = "build_view_list",
+	[TRACE_REPORTER_REPAINT_STAGE_ASSIGN_PLANES] = "assign_planes",
+	[TRACE_REPORTER_REPAINT_STAGE_ACCUMULATE_DAMAGE] = "accumulate_damage",
+	[TRACE_REPORTER_REPAINT_STAGE_RENDER] = "render",
+	[TRACE_REPORTER_REPAINT_STAGE_FLIP] = "flip",
+	[TRACE_REPORTER_REPAINT_STAGE_TOTAL] = "total",
+	[TRACE_REPORTER_REPAINT_STAGE_PRESENT_LATENCY] = "present_latency",
+	[TRACE_REPORTER_REPAINT_STAGE_UPLOAD] = "upload",
+	[TRACE_REPORTER_REPAINT_STAGE_UPLOAD_SIZE] = "upload_size (KiB)",
+};
+
+/*
+ * trace_reporter_output_stats()
+ *
+ * Print the repaint counters of an output, ahead of its histograms.
+ */
+static void
+trace_reporter_output_stats(void *data,
+		struct trace_reporter *reporter,
+		const char *output,
+		uint32_t frames,
+		uint32_t missed_vblank,
+		uint32_t over_budget)
+{
+	printf("\n%s: %u frames, %u missed vblank, %u over budget\n",
+			output, frames, missed_vblank, over_budget);
+	printf("  %-40.40s %8s %8s %8s %8s %8s %8s\n", "Stage (us)",
+			"count", "mean", "p50", "p90", "p99", "max");
+}
+
+/*
+ * trace_reporter_histogram()
+ *
+ * Print the summary of a histogram; the buckets aren't shown.
+ */
+static void
+trace_reporter_histogram(void *data,
+		struct trace_reporter *reporter,
+		const char *name,
+		uint32_t stage,
+		uint32_t count,
+		uint32_t min,
+		uint32_t max,
+		uint32_t mean,
+		uint32_t p50,
+		uint32_t p90,
+		uint32_t p99,
+		struct wl_array *buckets)
+{
+	struct wayland *w = data;
+	const char *label = "?";
+
+	if (stage < ARRAY_LENGTH(stage_names)) {
+		label = stage_names[stage];
+	}
+
+	/* Surfaces come after all outputs, and are listed by name */
+	if (stage == TRACE_REPORTER_REPAINT_STAGE_PRESENT_LATENCY) {
+		if (!w->surfaces_listed) {
+			printf("\nCommit to present\n");
+			printf("  %-40.40s %8s %8s %8s %8s %8s %8s\n",
+					"Surface (us)", "count", "mean",
+					"p50", "p90", "p99", "max");
+			w->surfaces_listed = 1;
+		}
+		label = name;
+	}
+
+	printf("  %-40.40s %8u %8u %8u %8u %8u %8u\n",
+			label, count, mean, p50, p90, p99, max);
+}
+
 static const struct trace_reporter_listener listener = {
 	trace_reporter_tracepoint,
 	trace_reporter_trace_end,
+	trace_reporter_output_stats,
+	trace_reporter_histogram,
 };
 
 /*
@@ -275,10 +364,11 @@ display_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 	struct wayland *w = data;
 
 	if (!strcmp(interface, "trace_reporter")) {
+		w->version = version < 4 ? version : 4;
 		w->reporter = wl_registry_bind(registry,
 				id,
 				&trace_reporter_interface,
-				1);
+				w->version);
 		trace_reporter_add_listener(w->reporter, &listener, w);
 	}
 }
@@ -287,6 +377,157 @@ static const struct wl_registry_listener registry_listener = {
 	display_handle_global,
 };
 
+static const char *
+json_phase(uint32_t kind)
+{
+	switch (kind) {
+	case TRACE_KIND_BEGIN:
+		return "B";
+	case TRACE_KIND_END:
+		return "E";
+	case TRACE_KIND_COUNTER:
+		return "C";
+	default:
+		return "i";
+	}
+}
+
+static void
+json_string(FILE *out, const char *s, size_t len)
+{
+	size_t i;
+
+	fputc('"', out);
+	for (i = 0; i < len; i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			fprintf(out, "\\%c", s[i]);
+		else if ((unsigned char)s[i] < 0x20)
+			fprintf(out, "\\u%04x", s[i]);
+		else
+			fputc(s[i], out);
+	}
+	fputc('"', out);
+}
+
+/*
+ * convert_dump()
+ *
+ * Converts a binary report (see binary_report in trace-reporter.xml) into
+ * the Chrome trace event format, which chrome://tracing and similar tools
+ * load.  The leading whitespace that nests startup tracepoints is dropped.
+ */
+static int
+convert_dump(const char *filename)
+{
+	struct trace_dump_header header;
+	struct trace_dump_thread *threads = NULL;
+	struct trace_dump_event ev;
+	char **strings = NULL;
+	uint32_t *lengths = NULL;
+	uint32_t i, tid;
+	const char *msg;
+	size_t len;
+	FILE *in;
+	int ret = -1;
+
+	in = fopen(filename, "rb");
+	if (!in) {
+		fprintf(stderr, "Failed to open %s: %m\n", filename);
+		return -1;
+	}
+
+	if (fread(&header, sizeof header, 1, in) != 1 ||
+	    memcmp(header.magic, TRACE_DUMP_MAGIC, sizeof header.magic) ||
+	    header.version != TRACE_DUMP_VERSION) {
+		fprintf(stderr, "%s is not a trace dump\n", filename);
+		goto out;
+	}
+
+	threads = calloc(header.n_threads + 1, sizeof *threads);
+	strings = calloc(header.n_strings + 1, sizeof *strings);
+	lengths = calloc(header.n_strings + 1, sizeof *lengths);
+	if (!threads || !strings || !lengths)
+		goto out;
+
+	if (fread(threads, sizeof *threads, header.n_threads, in) !=
+	    header.n_threads)
+		goto truncated;
+
+	for (i = 0; i < header.n_strings; i++) {
+		if (fread(&lengths[i], sizeof lengths[i], 1, in) != 1)
+			goto truncated;
+		strings[i] = malloc(lengths[i] + 1);
+		if (!strings[i] ||
+		    fread(strings[i], 1, lengths[i], in) != lengths[i])
+			goto truncated;
+	}
+
+	printf("{\"traceEvents\":[\n");
+	for (i = 0; i < header.n_threads; i++) {
+		printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		       "\"tid\":%u,\"args\":{\"name\":", threads[i].tid);
+		json_string(stdout, threads[i].name,
+			    strnlen(threads[i].name, sizeof threads[i].name));
+		printf("}},\n");
+	}
+
+	for (i = 0; i < header.n_events; i++) {
+		if (fread(&ev, sizeof ev, 1, in) != 1)
+			goto truncated;
+		if (ev.thread >= header.n_threads ||
+		    ev.string >= header.n_strings)
+			goto truncated;
+
+		msg = strings[ev.string];
+		len = lengths[ev.string];
+		while (len && isspace(*msg)) {
+			msg++;
+			len--;
+		}
+		tid = threads[ev.thread].tid;
+
+		printf("{\"name\":");
+		json_string(stdout, msg, len);
+		printf(",\"ph\":\"%s\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u",
+		       json_phase(ev.kind),
+		       (unsigned long long)(ev.timestamp / 1000),
+		       (unsigned)(ev.timestamp % 1000), tid);
+		if (ev.kind == TRACE_KIND_COUNTER)
+			printf(",\"args\":{\"value\":%lld}",
+			       (long long)ev.value);
+		else if (ev.id)
+			printf(",\"args\":{\"id\":%u}", ev.id);
+		if (ev.kind == TRACE_KIND_INSTANT)
+			printf(",\"s\":\"t\"");
+		printf("},\n");
+	}
+
+	/* Dropped entries show up as a counter per thread */
+	for (i = 0; i < header.n_threads; i++) {
+		printf("{\"name\":\"dropped\",\"ph\":\"C\",\"ts\":0,"
+		       "\"pid\":1,\"tid\":%u,\"args\":{\"value\":%u}}%s\n",
+		       threads[i].tid, threads[i].dropped,
+		       i + 1 < header.n_threads ? "," : "");
+	}
+	printf("]}\n");
+
+	ret = 0;
+	goto out;
+
+truncated:
+	fprintf(stderr, "%s is truncated or corrupt\n", filename);
+out:
+	if (strings) {
+		for (i = 0; i < header.n_strings; i++)
+			free(strings[i]);
+	}
+	free(strings);
+	free(lengths);
+	free(threads);
+	fclose(in);
+	return ret;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -297,10 +538,17 @@ main(int argc, char **argv)
 	/* cmdline options */
 	int32_t dump_stdout = 0;
 	int32_t clear = 0;
+	char *binary = NULL;
+	char *convert = NULL;
+	int32_t repaint_stats = 0;
+	int fd;
 
 	const struct weston_option options[] = {
 		{ WESTON_OPTION_BOOLEAN, "stdout", 0, &dump_stdout },
 		{ WESTON_OPTION_BOOLEAN, "clear", 'c', &clear },
+		{ WESTON_OPTION_STRING, "binary", 'b', &binary },
+		{ WESTON_OPTION_STRING, "convert", 0, &convert },
+		{ WESTON_OPTION_BOOLEAN, "repaint-stats", 'r', &repaint_stats },
 	};
 
 	remaining_argc = parse_options(options, ARRAY_LENGTH(options), &argc, argv);
@@ -308,10 +556,18 @@ main(int argc, char **argv)
 	if (remaining_argc > 1 || argc > 3) {
 		printf("Usage:\n");
 		printf("  traceinfo [--dump-stdout] [--clear | -c]\n");
+		printf("  traceinfo --binary=FILE [--clear | -c]\n");
+		printf("  traceinfo --convert=FILE > trace.json\n");
+		printf("  traceinfo --repaint-stats [--clear | -c]\n");
 
 		return -1;
 	}
 
+	/* Converting a dump doesn't need a compositor */
+	if (convert) {
+		return convert_dump(convert);
+	}
+
 	wayland.display = wl_display_connect(NULL);
 	if (!wayland.display) {
 		fprintf(stderr, "Failed to open wayland display\n");
@@ -337,7 +593,38 @@ main(int argc, char **argv)
 		clearmode = TRACE_REPORTER_LOG_REPORT_PRESERVE;
 	}
 
-	if (dump_stdout) {
+	if (binary) {
+		if (wayland.version < 2) {
+			fprintf(stderr, "Compositor can't write binary reports\n");
+			wl_display_disconnect(wayland.display);
+			return -1;
+		}
+
+		fd = open(binary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to open %s: %m\n", binary);
+			wl_display_disconnect(wayland.display);
+			return -1;
+		}
+
+		/* trace_end follows once the compositor has written it all */
+		wayland.binary = 1;
+		trace_reporter_binary_report(wayland.reporter, fd, clearmode);
+		close(fd);
+		while (!wayland.done &&
+		       wl_display_dispatch(wayland.display) != -1)
+			;
+	} else if (repaint_stats) {
+		if (wayland.version < 3) {
+			fprintf(stderr, "Compositor can't report repaint statistics\n");
+			wl_display_disconnect(wayland.display);
+			return -1;
+		}
+
+		wayland.repaint_stats = 1;
+		printf("Repaint statistics\n");
+		trace_reporter_repaint_stats(wayland.reporter, clearmode);
+	} else if (dump_stdout) {
 		trace_reporter_stdout_report(wayland.reporter, clearmode);
 	} else {
 		trace_reporter_event_report(wayland.reporter, clearmode);
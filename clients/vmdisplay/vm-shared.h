@@ -86,6 +86,39 @@ struct vm_buffer_info {
 #define METADATA_STREAM_START 0xF00D
 #define METADATA_STREAM_END 0xCAFE
 
+/*
+ * Optional framing for stream channels. Each frame, markers included, is
+ * preceded by this prefix so that receivers don't have to scan for the
+ * markers. Receivers that only know about markers skip the prefix as noise.
+ */
+#define METADATA_FRAME_MAGIC 0x464D4456 /* "VDMF" */
+
+struct vm_frame_prefix {
+	uint32_t magic;
+	uint32_t len;
+};
+
+/*
+ * Delta metadata stream. A frame whose vm_header carries VM_DELTA_VERSION is
+ * followed by a struct vm_delta_header and then only the vm_buffer_info
+ * records that changed since the last frame sent for that output, each
+ * keyed by its surf_index. n_buffers in the vm_header is still the size of
+ * the whole table. base_counter is the counter of the previous frame for
+ * the output that carried records; a receiver that didn't apply that frame
+ * has to wait for the next keyframe, which carries every record.
+ * Receivers hand out the rebuilt table as a regular VM_TABLE_VERSION one.
+ */
+#define VM_TABLE_VERSION 3
+#define VM_DELTA_VERSION 4
+
+#define VM_DELTA_KEYFRAME       BIT(0)
+
+struct vm_delta_header {
+	int32_t flags;
+	int32_t base_counter;
+	int32_t n_records;
+};
+
 #define VM_MAX_OUTPUTS 12
 
 /*
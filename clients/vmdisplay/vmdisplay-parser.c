@@ -68,36 +68,35 @@ extern unsigned int pipe_id;
 
 #define ALIGN(x, y) ((x + y - 1) & ~(y - 1))
 
-int parse_event_metadata(int fd, int *counter)
+int parse_event_metadata(int fd, int *counter, int timeout_ms)
 {
 	int ret;
 	struct pollfd fds = { 0 };
 	hyper_dmabuf_id_t *new_hid;
 	char meta_data[sizeof(struct vm_header) +
+		       sizeof(struct vm_delta_header) +
 		       sizeof(struct vm_buffer_info) +
 		       sizeof(struct hyper_dmabuf_event_hdr)];
+	int info_offset;
 
 	fds.fd = fd;
 	fds.events = POLLIN;
 
 repoll:
 	do {
-		ret = poll(&fds, 1, -1);
+		ret = poll(&fds, 1, timeout_ms);
 
 		if (ret > 0) {
 			if (fds.revents & (POLLERR | POLLNVAL)) {
 				errno = EINVAL;
-				return 1;
+				return VMDISPLAY_METADATA_LOST;
 			}
 			break;
 		} else if (ret == 0) {
-			/* should not get here */
-			errno = ETIME;
-			return 1;
+			return -1;
 		}
 	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
 
-reread:
 	ret = read(fd, meta_data, sizeof(meta_data));
 
 	if (ret <= 0) {
@@ -105,24 +104,33 @@ reread:
 		goto repoll;
 	}
 
-	vbt = (struct vm_buffer_info *)&meta_data[sizeof(struct vm_header) +
-						  sizeof(struct
-							 hyper_dmabuf_event_hdr)];
+	/* getting vbt_header from meta_data from hyper_dmabuf driver */
+	memcpy(&vbt_header, &meta_data[sizeof(struct hyper_dmabuf_event_hdr)],
+	       sizeof(vbt_header));
+
+	/*
+	 * Buffers exported in delta mode carry an extra header. Only changed
+	 * buffers get exported then, which is fine here: no event simply
+	 * means the surface still shows the same buffer.
+	 */
+	info_offset = sizeof(struct hyper_dmabuf_event_hdr) +
+		      sizeof(struct vm_header);
+	if (vbt_header.version == VM_DELTA_VERSION)
+		info_offset += sizeof(struct vm_delta_header);
+
+	vbt = (struct vm_buffer_info *)&meta_data[info_offset];
 
 	/* go back and try to fetch the next event */
 	if (vbt->surf_index != surf_index) {
-		goto reread;
+		goto repoll;
 	}
 
-	/* getting vbt_header from meta_data from hyper_dmabuf driver */
-	memcpy(&vbt_header, &meta_data[sizeof(struct hyper_dmabuf_event_hdr)],
-	       sizeof(vbt_header));
-
 	/* update hyper_dmabuf_id with valid one generated for the buffer */
 	new_hid = (hyper_dmabuf_id_t *) & meta_data[sizeof(int)];
 	vbt->hyper_dmabuf_id = *new_hid;
 
-	if (vbt_header.version != VMDISPLAY_VBT_VERSION) {
+	if (vbt_header.version != VMDISPLAY_VBT_VERSION &&
+	    vbt_header.version != VM_DELTA_VERSION) {
 		printf
 		    ("Mismatched VBT versions! Expected %d, but received %d.\n",
 		     VMDISPLAY_VBT_VERSION, vbt_header.version);
@@ -170,26 +178,44 @@ reread:
 	return 0;
 }
 
-int parse_socket_metadata(vmdisplay_socket * socket, int *counter)
+int parse_socket_metadata(vmdisplay_socket * socket, int *counter,
+			  int timeout_ms)
 {
-	int len;
-	struct vmdisplay_msg msg;
+	static char table[METADATA_BUFFER_SIZE];
+	static uint32_t seq;
+	struct vmdisplay_shm *shm = socket->outputs[pipe_id].mem_addr;
+	char c;
+	uint32_t len;
+	int rc;
 
-	/* Wait for message about metadata update for given pipe/output */
-	do {
-		len = recv(socket->socket_fd, &msg, sizeof(msg), 0);
-	} while (len > 0 && (msg.type != VMDISPLAY_METADATA_UPDATE_MSG ||
-			     msg.display_num != pipe_id));
-
-	if (len <= 0) {
-		int err = errno;
-		printf("recv returned invalid status: %d, errno = %d", len,
-		       err);
+	/*
+	 * Wait for metadata update for given pipe/output. The server only
+	 * talks on the socket at startup, so it being readable means it's
+	 * gone.
+	 */
+	while (vmdisplay_shm_wait(shm, seq,
+				  timeout_ms < 0 ? 1000 : timeout_ms) < 0) {
+		rc = recv(socket->socket_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (rc == 0 || (rc < 0 && errno != EAGAIN &&
+				errno != EWOULDBLOCK && errno != EINTR)) {
+			printf("Lost connection to vmdisplay server, errno = %d\n",
+			       errno);
+			return VMDISPLAY_METADATA_LOST;
+		}
+
+		if (timeout_ms >= 0)
+			return -1;
+	}
+
+	/* Work on a copy, the server may be publishing the next one already */
+	seq = vmdisplay_shm_read(shm, table, &len);
+
+	if (len < sizeof(vbt_header)) {
+		printf("Short buffer table\n");
 		return 1;
 	}
 
-	memcpy(&vbt_header, socket->outputs[pipe_id].mem_addr,
-	       sizeof(vbt_header));
+	memcpy(&vbt_header, table, sizeof(vbt_header));
 
 	if (vbt_header.version != VMDISPLAY_VBT_VERSION) {
 		printf
@@ -198,7 +224,9 @@ int parse_socket_metadata(vmdisplay_socket * socket, int *counter)
 		return 1;
 	}
 
-	if (vbt_header.n_buffers <= 0) {
+	if (vbt_header.n_buffers <= 0 ||
+	    len < sizeof(struct vm_header) +
+	    vbt_header.n_buffers * sizeof(struct vm_buffer_info)) {
 		printf("Bad n_buffers value\n");
 		return 1;
 	}
@@ -206,9 +234,7 @@ int parse_socket_metadata(vmdisplay_socket * socket, int *counter)
 	disp_w = vbt_header.disp_w;
 	disp_h = vbt_header.disp_h;
 
-	vbt =
-	    (struct vm_buffer_info *)(socket->outputs[pipe_id].mem_addr +
-				      sizeof(struct vm_header));
+	vbt = (struct vm_buffer_info *)(table + sizeof(struct vm_header));
 
 	/*
 	 * Report bad index only if surf_id was not provided.
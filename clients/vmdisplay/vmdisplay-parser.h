@@ -56,7 +56,15 @@ extern int32_t surf_disp_h;
 extern int32_t disp_w;
 extern int32_t disp_h;
 
-int parse_event_metadata(int fd, int *counter);
-int parse_socket_metadata(vmdisplay_socket * socket, int *counter);
+/*
+ * Both wait up to timeout_ms (-1 for ever) for new metadata. They return
+ * 0 once it's parsed, 1 if it can't be used, -1 if nothing arrived in time
+ * and VMDISPLAY_METADATA_LOST if no more metadata can arrive.
+ */
+#define VMDISPLAY_METADATA_LOST 2
+
+int parse_event_metadata(int fd, int *counter, int timeout_ms);
+int parse_socket_metadata(vmdisplay_socket * socket, int *counter,
+			  int timeout_ms);
 
 #endif
@@ -57,9 +57,13 @@ int HyperDMABUFCommunicator::init(int domid,
 	direction = dir;
 
 	metadata = new char[sizeof(struct vm_header) +
+			    sizeof(struct vm_delta_header) +
 			    sizeof(struct vm_buffer_info) +
 			    sizeof(struct hyper_dmabuf_event_hdr)];
 
+	delta = new struct vm_delta_decoder;
+	vm_delta_decoder_init(delta);
+
 	hdr = NULL;
 	buf_info = NULL;
 	last_counter = -1;
@@ -80,6 +84,8 @@ void HyperDMABUFCommunicator::cleanup()
 
 	delete[]metadata;
 	metadata = NULL;
+	delete delta;
+	delta = NULL;
 }
 
 int HyperDMABUFCommunicator::recv_data(void *buffer, int max_len)
@@ -120,6 +126,8 @@ int HyperDMABUFCommunicator::recv_metadata(void **buffer)
 	struct vm_header last_hdr;
 	int num_buffers = 0;
 	struct hyper_dmabuf_event_hdr *event_hdr;
+	struct vm_delta_header *delta_hdr;
+	int output_num;
 
 	while (1) {
 		/*
@@ -143,6 +151,7 @@ int HyperDMABUFCommunicator::recv_metadata(void **buffer)
 
 		len = recv_data(metadata,
 				sizeof(struct vm_header) +
+				sizeof(struct vm_delta_header) +
 				sizeof(struct vm_buffer_info) +
 				sizeof(struct hyper_dmabuf_event_hdr));
 
@@ -155,6 +164,24 @@ int HyperDMABUFCommunicator::recv_metadata(void **buffer)
 		    (struct vm_header *)
 		    &metadata[sizeof(struct hyper_dmabuf_event_hdr)];
 
+		/*
+		 * In delta mode only changed buffers get exported, so a frame
+		 * can't be put together from the events alone.
+		 */
+		if (hdr->version == VM_DELTA_VERSION) {
+			delta_hdr = (struct vm_delta_header *)(hdr + 1);
+			buf_info = (struct vm_buffer_info *)(delta_hdr + 1);
+			buf_info->hyper_dmabuf_id = event_hdr->hid;
+
+			output_num = vm_delta_decode_record(delta, hdr,
+							    delta_hdr,
+							    buf_info, buffer);
+			hdr = NULL;
+			if (output_num >= 0)
+				return output_num;
+			continue;
+		}
+
 		buf_info =
 		    (struct vm_buffer_info *)
 		    &metadata[sizeof(struct hyper_dmabuf_event_hdr) +
@@ -35,6 +35,7 @@
 
 #include "vmdisplay-server.h"
 #include "vm-shared.h"
+#include "vm-delta.h"
 
 class HyperDMABUFCommunicator:public HyperCommunicatorInterface {
 public:
@@ -53,6 +54,7 @@ private:
 	struct vm_buffer_info *buf_info;
 	int offset[VM_MAX_OUTPUTS];
 	int last_counter;
+	struct vm_delta_decoder *delta;
 };
 
 #endif // _VMDISPLAY_SERVER_HYPERDMABUF_H_
@@ -90,12 +90,14 @@ int NetworkCommunicator::init(int domid, HyperCommunicatorDirection dir,
 	direction = dir;
 
 	if (dir == HyperCommunicatorInterface::Receiver) {
-		metadata_offset = 0;
-		metadata = new char[METADATA_BUFFER_SIZE];
-		if (metadata == NULL) {
+		stream = new struct vmdisplay_stream;
+		delta = new struct vm_delta_decoder;
+		if (stream == NULL || delta == NULL) {
 			printf("Cannot allocate memory\n");
 			return -1;
 		}
+		vmdisplay_stream_init(stream);
+		vm_delta_decoder_init(delta);
 
 		server = gethostbyname(addr);
 
@@ -175,9 +177,11 @@ void NetworkCommunicator::cleanup()
 		client_sock_fd = -1;
 	}
 
-	if (direction == HyperCommunicatorInterface::Receiver && metadata) {
-		delete[]metadata;
-		metadata = NULL;
+	if (direction == HyperCommunicatorInterface::Receiver && stream) {
+		delete stream;
+		stream = NULL;
+		delete delta;
+		delta = NULL;
 	} else if (direction == HyperCommunicatorInterface::Sender) {
 		pthread_join(listener_thread, NULL);
 	}
@@ -204,57 +208,27 @@ int NetworkCommunicator::recv_data(void *buffer, int max_len)
 
 int NetworkCommunicator::recv_metadata(void **surfaces_metadata)
 {
+	const char *frame;
+	char *space;
 	int len;
-	int start_offset = -1;
-	int end_offset = -1;
-	struct vm_header *header;
-	int output_num = -1;
+	int output_num;
 
 	while (1) {
-		len = recv_data(&metadata[metadata_offset],
-				METADATA_BUFFER_SIZE - metadata_offset);
-		if (len < 0)
-			return -1;
-
-		metadata_offset += len;
-
-		start_offset = -1;
-		end_offset = -1;
-
-		/* Look for frame metadata start/end markers */
-		for (int i = 0; i < metadata_offset; i++) {
-			int marker = *(int *)(&metadata[i]);
-
-			if (marker == METADATA_STREAM_START) {
-				start_offset = i + sizeof(int);
-				continue;
-			}
-
-			if (marker == METADATA_STREAM_END) {
-				end_offset = i;
-				if (start_offset != -1)
-					break;
-			}
+		/* A single recv() may have brought in several frames */
+		while ((len = vmdisplay_stream_next_frame(stream, &frame)) > 0) {
+			/* Full tables are copied as is, deltas applied on top of the last one */
+			output_num = vm_delta_decode_frame(delta, frame, len,
+							   surfaces_metadata);
+			if (output_num >= 0)
+				return output_num;
 		}
 
-		/* If whole frame metadata was received, parse for which output it is and return */
-		if (start_offset != -1 && end_offset != -1
-		    && end_offset > start_offset) {
-			header = (struct vm_header *)(&metadata[start_offset]);
-			if (header->output < VM_MAX_OUTPUTS) {
-				memcpy(surfaces_metadata[header->output],
-				       header, end_offset - start_offset);
-			}
-			output_num = header->output;
-
-			memmove(metadata, &metadata[end_offset + sizeof(int)],
-				METADATA_BUFFER_SIZE - (end_offset +
-							sizeof(int)));
-
-			metadata_offset -= (end_offset + sizeof(int));
+		len = vmdisplay_stream_get_space(stream, &space);
+		len = recv_data(space, len);
+		if (len < 0)
+			return -1;
 
-			return output_num;
-		}
+		vmdisplay_stream_commit(stream, len);
 	}
 }
 
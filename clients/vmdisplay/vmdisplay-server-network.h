@@ -33,6 +33,9 @@
 #define _VMDISPLAY_SERVER_NETWORK_H_
 
 #include "vmdisplay-server.h"
+#include "vm-shared.h"
+#include "vm-delta.h"
+#include "vmdisplay-stream.h"
 #include <pthread.h>
 
 class NetworkCommunicator:public HyperCommunicatorInterface {
@@ -51,8 +54,8 @@ private:
 	int client_sock_fd;
 	pthread_t listener_thread;
 	bool running;
-	char *metadata;
-	int metadata_offset;
+	struct vmdisplay_stream *stream;
+	struct vm_delta_decoder *delta;
 };
 
 #endif // _VMDISPLAY_SERVER_NETWORK_H_
@@ -49,6 +49,7 @@
 #include <poll.h>
 #include "vm-shared.h"
 #include "vmdisplay-shared.h"
+#include "vmdisplay-shm.h"
 #include "vmdisplay-server.h"
 #include "vmdisplay-server-hyperdmabuf.h"
 #include "vmdisplay-server-network.h"
@@ -69,13 +70,20 @@ struct output_data {
 	int shm_fd;
 
 	/* Address of mmaped metadata file */
-	void *shm_addr;
+	struct vmdisplay_shm *shm;
+
+	/*
+	 * Table the communicator puts together, only published to
+	 * the metadata file once it is complete
+	 */
+	char *table;
 };
 
 class VMDisplayServer {
 public:
 	VMDisplayServer():hyper_comm_metadata(NULL), hyper_comm_input(NULL),
 	    running(false), domid(-1), current_buf(NULL) {
+		memset(outputs, 0, sizeof(outputs));
 	} int init(int domid,
 		   CommunicationChannelType surf_comm_type,
 		   const char *surf_comm_args,
@@ -182,18 +190,21 @@ int VMDisplayServer::init_outputs()
 		}
 
 		unlink(path);
-		if (ftruncate(outputs[i].shm_fd, METADATA_BUFFER_SIZE) < 0)
+		if (ftruncate(outputs[i].shm_fd, sizeof(struct vmdisplay_shm)) < 0)
                         printf("truncating failed\n");
 
-		outputs[i].shm_addr =
-		    mmap(NULL, METADATA_BUFFER_SIZE,
+		outputs[i].shm = (struct vmdisplay_shm *)
+		    mmap(NULL, sizeof(struct vmdisplay_shm),
 			 PROT_READ | PROT_WRITE, MAP_SHARED,
 			 outputs[i].shm_fd, 0);
 
-		if (!outputs[i].shm_addr) {
+		if (outputs[i].shm == MAP_FAILED) {
+			outputs[i].shm = NULL;
 			printf("Cannot mmap metadata file\n");
 			return -1;
 		}
+
+		outputs[i].table = new char[METADATA_BUFFER_SIZE]();
 	}
 
 	return 0;
@@ -323,6 +334,18 @@ int VMDisplayServer::cleanup()
 		current_buf = NULL;
 	}
 
+	for (int i = 0; i < VM_MAX_OUTPUTS; i++) {
+		if (outputs[i].shm) {
+			munmap(outputs[i].shm, sizeof(struct vmdisplay_shm));
+			outputs[i].shm = NULL;
+		}
+
+		if (outputs[i].table) {
+			delete[]outputs[i].table;
+			outputs[i].table = NULL;
+		}
+	}
+
 	return 0;
 }
 
@@ -371,14 +394,27 @@ void VMDisplayServer::stop()
 	running = false;
 }
 
+/* Only the part of the table that is in use gets published */
+static uint32_t table_len(const char *table)
+{
+	const struct vm_header *hdr = (const struct vm_header *)table;
+	int max = (METADATA_BUFFER_SIZE - sizeof(struct vm_header)) /
+	    sizeof(struct vm_buffer_info);
+
+	if (hdr->n_buffers < 0 || hdr->n_buffers > max)
+		return METADATA_BUFFER_SIZE;
+
+	return sizeof(struct vm_header) +
+	    hdr->n_buffers * sizeof(struct vm_buffer_info);
+}
+
 int VMDisplayServer::process_metadata()
 {
-	int rc;
 	int output_num;
 	void *surfaces_metadata[VM_MAX_OUTPUTS];
 
 	for (int i = 0; i < VM_MAX_OUTPUTS; i++)
-		surfaces_metadata[i] = outputs[i].shm_addr;
+		surfaces_metadata[i] = outputs[i].table;
 
 	while (running) {
 		output_num =
@@ -391,23 +427,13 @@ int VMDisplayServer::process_metadata()
 			break;
 		}
 
-		pthread_mutex_lock(&mutex);
-
-		std::vector < int >::iterator it;
-		for (it = client_sockets.begin(); it != client_sockets.end();) {
-			rc = send_message((*it), VMDISPLAY_METADATA_UPDATE_MSG,
-					  output_num);
-			if (rc < 0) {
-				if (errno == EPIPE) {
-					printf("Client closed\n");
-					close(*it);
-					it = client_sockets.erase(it);
-					continue;
-				}
-			}
-			it++;
-		}
-		pthread_mutex_unlock(&mutex);
+		/*
+		 * Clients pick the new table up from the metadata file and
+		 * are woken through it too, however many of them there are.
+		 */
+		vmdisplay_shm_publish(outputs[output_num].shm,
+				      outputs[output_num].table,
+				      table_len(outputs[output_num].table));
 	}
 
 	return 0;
@@ -420,7 +446,7 @@ int VMDisplayServer::process_input()
 	struct vmdisplay_touch_event touch_event;
 	struct vmdisplay_key_event key_event;
 	struct vmdisplay_pointer_event pointer_event;
-	int rc, i;
+	int rc, i, polled;
 	/* TODO assuming now that max 255 client apps will be running */
 	struct pollfd fds[255];
 
@@ -434,24 +460,47 @@ int VMDisplayServer::process_input()
 		}
 		pthread_mutex_unlock(&mutex);
 
-		int ret = poll(fds, i, 100);
+		polled = i;
+		int ret = poll(fds, polled, 100);
 		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
 			running = false;
 			break;
 		} else if (ret > 0) {
 			i = 0;
 			pthread_mutex_lock(&mutex);
+			/* Sockets accepted since the poll are only appended */
 			for (it = client_sockets.begin();
-			     it != client_sockets.end();) {
-				if (fds[i++].revents != POLLIN) {
+			     it != client_sockets.end() && i < polled;) {
+				short revents = fds[i++].revents;
+
+				if (revents & POLLNVAL) {
+					it = client_sockets.erase(it);
+					continue;
+				}
+
+				/* Hung up clients keep polling ready, so they
+				 * have to go now or this loop would spin */
+				if ((revents & POLLERR) ||
+				    ((revents & POLLHUP) && !(revents & POLLIN))) {
+					printf("Client closed\n");
+					close(*it);
+					it = client_sockets.erase(it);
+					continue;
+				}
+
+				if (!(revents & POLLIN)) {
 					it++;
 					continue;
 				}
 				rc = recv((*it), &header, sizeof(header), 0);
 
 				if (rc <= 0) {
-					if (rc == 0 || errno == EPIPE) {
-						printf("Cleint closed\n");
+					if (rc == 0 ||
+					    (errno != EINTR && errno != EAGAIN)) {
+						printf("Client closed\n");
+						close(*it);
 						it = client_sockets.erase(it);
 						continue;
 					}
@@ -0,0 +1,118 @@
+/*
+ *-----------------------------------------------------------------------------
+ * Filename: vmdisplay-shm.c
+ *-----------------------------------------------------------------------------
+ * Copyright 2012-2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-----------------------------------------------------------------------------
+ * Description:
+ *   VMDisplay per-output metadata shared memory
+ *-----------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "vmdisplay-shm.h"
+
+/* Not FUTEX_PRIVATE_FLAG, the waiters are in other processes */
+static long futex(const uint32_t *addr, int op, uint32_t val,
+		  const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+void vmdisplay_shm_publish(struct vmdisplay_shm *shm,
+			   const void *table, uint32_t len)
+{
+	uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+	int slot = ((seq >> 1) + 1) % VMDISPLAY_SHM_SLOTS;
+
+	if (len > METADATA_BUFFER_SIZE)
+		len = METADATA_BUFFER_SIZE;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(shm->slot[slot], table, len);
+	shm->len[slot] = len;
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+	futex(&shm->seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+uint32_t vmdisplay_shm_read(const struct vmdisplay_shm *shm,
+			    void *table, uint32_t *len)
+{
+	uint32_t seq, now;
+	int slot;
+
+	do {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE) & ~1u;
+		slot = (seq >> 1) % VMDISPLAY_SHM_SLOTS;
+
+		*len = shm->len[slot];
+		if (*len > METADATA_BUFFER_SIZE)
+			*len = METADATA_BUFFER_SIZE;
+		memcpy(table, shm->slot[slot], *len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		now = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+
+		/* Writing of the next generation but one reuses our slot */
+	} while (now - seq > 2);
+
+	return seq;
+}
+
+uint32_t vmdisplay_shm_seq(const struct vmdisplay_shm *shm)
+{
+	return __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE) & ~1u;
+}
+
+int vmdisplay_shm_wait(const struct vmdisplay_shm *shm, uint32_t seq,
+		       int timeout_ms)
+{
+	struct timespec timeout = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (timeout_ms % 1000) * 1000000,
+	};
+	uint32_t now;
+
+	while (1) {
+		now = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if ((now >> 1) != (seq >> 1))
+			return 0;
+
+		/* Woken only once the new generation is complete */
+		if (futex(&shm->seq, FUTEX_WAIT, now,
+			  timeout_ms < 0 ? NULL : &timeout) < 0 &&
+		    errno == ETIMEDOUT)
+			return -1;
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ *-----------------------------------------------------------------------------
+ * Filename: vmdisplay-shm.h
+ *-----------------------------------------------------------------------------
+ * Copyright 2012-2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-----------------------------------------------------------------------------
+ * Description:
+ *   VMDisplay per-output metadata shared memory
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _VMDISPLAY_SHM_H_
+#define _VMDISPLAY_SHM_H_
+
+#include <stdint.h>
+#include "vm-shared.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define VMDISPLAY_SHM_SLOTS 2
+
+/*
+ * Layout of the metadata file the server shares with its clients for each
+ * output. There is a single writer, the server. Generation g of the table
+ * lives in slot g % 2. seq is 2 * g once it is complete, and odd while the
+ * next generation is being written to the other slot. A reader copies out
+ * the slot of the generation it saw and only has to retry if the writer
+ * went on to reuse that slot meanwhile. seq doubles as a futex word, woken
+ * once per update whatever the number of readers.
+ */
+struct vmdisplay_shm {
+	uint32_t seq;
+	uint32_t len[VMDISPLAY_SHM_SLOTS];
+	char slot[VMDISPLAY_SHM_SLOTS][METADATA_BUFFER_SIZE];
+};
+
+void vmdisplay_shm_publish(struct vmdisplay_shm *shm,
+			   const void *table, uint32_t len);
+
+/*
+ * Copies the latest complete table into table, which must hold
+ * METADATA_BUFFER_SIZE bytes. Returns the seq value it belongs to and
+ * sets len to its size, 0 if nothing was published yet.
+ */
+uint32_t vmdisplay_shm_read(const struct vmdisplay_shm *shm,
+			    void *table, uint32_t *len);
+
+/* The seq value of the latest complete table, without copying it out */
+uint32_t vmdisplay_shm_seq(const struct vmdisplay_shm *shm);
+
+/*
+ * Waits up to timeout_ms (-1 for ever) for a newer table than the one
+ * read with seq. Returns 0 if there is one, -1 otherwise.
+ */
+int vmdisplay_shm_wait(const struct vmdisplay_shm *shm, uint32_t seq,
+		       int timeout_ms);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif // _VMDISPLAY_SHM_H_
@@ -0,0 +1,223 @@
+/*
+ *-----------------------------------------------------------------------------
+ * Filename: vmdisplay-stream.c
+ *-----------------------------------------------------------------------------
+ * Copyright 2012-2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-----------------------------------------------------------------------------
+ * Description:
+ *   VMDisplay server: metadata stream parser
+ *-----------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include "vmdisplay-stream.h"
+
+#define RING_MASK (VMDISPLAY_STREAM_SIZE - 1)
+
+/* Can't match either marker, whatever the next bytes are */
+#define EMPTY_WINDOW 0xffffffff
+
+void vmdisplay_stream_init(struct vmdisplay_stream *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->window = EMPTY_WINDOW;
+}
+
+static uint32_t used(const struct vmdisplay_stream *stream)
+{
+	return stream->head - stream->tail;
+}
+
+static void copy_out(const struct vmdisplay_stream *stream, uint32_t pos,
+		     void *dst, uint32_t len)
+{
+	uint32_t off = pos & RING_MASK;
+	uint32_t first = VMDISPLAY_STREAM_SIZE - off;
+
+	if (first >= len) {
+		memcpy(dst, &stream->ring[off], len);
+	} else {
+		memcpy(dst, &stream->ring[off], first);
+		memcpy((char *)dst + first, stream->ring, len - first);
+	}
+}
+
+static uint32_t peek(const struct vmdisplay_stream *stream, uint32_t pos)
+{
+	uint32_t val;
+
+	copy_out(stream, pos, &val, sizeof(val));
+
+	return val;
+}
+
+static const char *frame_data(struct vmdisplay_stream *stream, uint32_t pos,
+			      uint32_t len)
+{
+	uint32_t off = pos & RING_MASK;
+
+	if (off + len <= VMDISPLAY_STREAM_SIZE)
+		return &stream->ring[off];
+
+	copy_out(stream, pos, stream->frame, len);
+
+	return stream->frame;
+}
+
+int vmdisplay_stream_get_space(struct vmdisplay_stream *stream, char **ptr)
+{
+	uint32_t off = stream->head & RING_MASK;
+	uint32_t space = VMDISPLAY_STREAM_SIZE - used(stream);
+
+	*ptr = &stream->ring[off];
+
+	if (space > VMDISPLAY_STREAM_SIZE - off)
+		space = VMDISPLAY_STREAM_SIZE - off;
+
+	return space;
+}
+
+void vmdisplay_stream_commit(struct vmdisplay_stream *stream, int len)
+{
+	if (len > 0)
+		stream->head += len;
+}
+
+/*
+ * At a frame boundary, check for a length prefix. Returns 1 and the frame
+ * if a whole prefixed frame is available, 0 if it isn't (yet) and -1 if
+ * there's no prefix here and the marker scan should carry on.
+ */
+static int next_prefixed(struct vmdisplay_stream *stream,
+			 uint32_t *pos, uint32_t *len)
+{
+	uint32_t avail = used(stream);
+	uint32_t frame_len;
+
+	if (avail < sizeof(uint32_t))
+		return 0;
+
+	if (peek(stream, stream->tail) != METADATA_FRAME_MAGIC)
+		return -1;
+
+	if (avail < sizeof(struct vm_frame_prefix))
+		return 0;
+
+	frame_len = peek(stream, stream->tail + sizeof(uint32_t));
+	if (frame_len > METADATA_BUFFER_SIZE)
+		return -1;
+
+	if (avail < sizeof(struct vm_frame_prefix) + frame_len)
+		return 0;
+
+	*pos = stream->tail + sizeof(struct vm_frame_prefix);
+	*len = frame_len;
+
+	stream->tail = *pos + frame_len;
+	stream->scan = stream->tail;
+	stream->window = EMPTY_WINDOW;
+	stream->framed++;
+
+	/* The markers are still there, for the benefit of older receivers */
+	if (*len >= sizeof(uint32_t) &&
+	    peek(stream, *pos) == METADATA_STREAM_START) {
+		*pos += sizeof(uint32_t);
+		*len -= sizeof(uint32_t);
+	}
+	if (*len >= sizeof(uint32_t) &&
+	    peek(stream, *pos + *len - sizeof(uint32_t)) == METADATA_STREAM_END)
+		*len -= sizeof(uint32_t);
+
+	return 1;
+}
+
+int vmdisplay_stream_next_frame(struct vmdisplay_stream *stream,
+				const char **data)
+{
+	uint32_t pos, len;
+	uint8_t byte;
+	int ret;
+
+	while (1) {
+		if (!stream->in_frame) {
+			ret = next_prefixed(stream, &pos, &len);
+			if (ret == 0)
+				return 0;
+			if (ret > 0) {
+				if (len == 0)
+					continue;
+				break;
+			}
+		}
+
+		if (stream->scan == stream->head)
+			return 0;
+
+		byte = stream->ring[stream->scan & RING_MASK];
+		stream->scan++;
+		stream->window = (stream->window >> 8) | ((uint32_t)byte << 24);
+
+		if (stream->window == METADATA_STREAM_START) {
+			/* A frame that never got its END marker */
+			if (stream->in_frame)
+				stream->dropped++;
+			stream->tail = stream->scan;
+			stream->window = EMPTY_WINDOW;
+			stream->in_frame = 1;
+			continue;
+		}
+
+		if (!stream->in_frame) {
+			/* Noise between frames */
+			stream->tail = stream->scan;
+			continue;
+		}
+
+		if (stream->window == METADATA_STREAM_END) {
+			pos = stream->tail;
+			len = stream->scan - stream->tail - sizeof(uint32_t);
+
+			stream->tail = stream->scan;
+			stream->window = EMPTY_WINDOW;
+			stream->in_frame = 0;
+
+			if (len == 0)
+				continue;
+			break;
+		}
+
+		/* No END in sight, this can't be a frame */
+		if (stream->scan - stream->tail > METADATA_BUFFER_SIZE) {
+			stream->dropped++;
+			stream->tail = stream->scan;
+			stream->window = EMPTY_WINDOW;
+			stream->in_frame = 0;
+		}
+	}
+
+	stream->frames++;
+	*data = frame_data(stream, pos, len);
+
+	return len;
+}
@@ -0,0 +1,89 @@
+/*
+ *-----------------------------------------------------------------------------
+ * Filename: vmdisplay-stream.h
+ *-----------------------------------------------------------------------------
+ * Copyright 2012-2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-----------------------------------------------------------------------------
+ * Description:
+ *   VMDisplay server: metadata stream parser
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _VMDISPLAY_STREAM_H_
+#define _VMDISPLAY_STREAM_H_
+
+#include <stdint.h>
+#include "vm-shared.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Power of two, comfortably larger than two frames */
+#define VMDISPLAY_STREAM_SIZE 32768
+
+/*
+ * Splits a metadata byte stream into frames. Both the length prefixed
+ * framing and the plain marker format are understood, frame by frame, so
+ * either kind of sender works. Every received byte is looked at once.
+ */
+struct vmdisplay_stream {
+	char ring[VMDISPLAY_STREAM_SIZE];
+	/* Free running offsets, masked on access */
+	uint32_t head;		/* next byte written */
+	uint32_t tail;		/* oldest byte still needed */
+	uint32_t scan;		/* next byte the marker scan looks at */
+	uint32_t window;	/* last four bytes scanned */
+	int in_frame;		/* START seen, tail is right after it */
+
+	/* Frames that wrap around the end of the ring get copied here */
+	char frame[METADATA_BUFFER_SIZE];
+
+	uint32_t frames;
+	uint32_t framed;	/* of which came with a length prefix */
+	uint32_t dropped;	/* partial frames thrown away */
+};
+
+void vmdisplay_stream_init(struct vmdisplay_stream *stream);
+
+/*
+ * Where and how much can be received next. Pass the number of bytes
+ * actually written to vmdisplay_stream_commit().
+ */
+int vmdisplay_stream_get_space(struct vmdisplay_stream *stream, char **ptr);
+void vmdisplay_stream_commit(struct vmdisplay_stream *stream, int len);
+
+/*
+ * Returns the length of the next complete frame and points data at its
+ * contents (the bytes between the markers), or returns 0 if more data is
+ * needed. data stays valid until the next call on the stream.
+ */
+int vmdisplay_stream_next_frame(struct vmdisplay_stream *stream,
+				const char **data);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif // _VMDISPLAY_STREAM_H_
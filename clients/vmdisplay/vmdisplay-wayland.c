@@ -38,6 +38,8 @@
 #include <math.h>
 #include <assert.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <linux/input.h>
 #include <drm/drm_fourcc.h>
@@ -93,6 +95,7 @@ struct display {
 	} egl;
 	struct window *window;
 	struct ias_hmi *hmi;
+	uint32_t compositor_version;
 };
 
 struct wl_drm *wl_drm;
@@ -121,6 +124,7 @@ struct window {
 	EGLSurface egl_surface;
 	struct wl_callback *callback;
 	int fullscreen, configured, opaque;
+	int needs_redraw;
 	int positioned;
 	int x, y;
 	char name[128];
@@ -193,6 +197,8 @@ int surf_index = 0;
 uint64_t surf_id = 0;
 int enable_fps_info = 0;
 int enable_fixed_size = 0;
+/* Redraw on new guest frames only, rather than on every frame callback */
+static int redraw_on_update = 0;
 extern vmdisplay_socket vmsocket;
 
 /* Function Prototypes */
@@ -580,6 +586,12 @@ static void redraw_egl(void *data, struct wl_callback *callback, uint32_t time)
 	if (!w->configured)
 		return;
 
+	if (redraw_on_update) {
+		if (!w->needs_redraw)
+			return;
+		w->needs_redraw = 0;
+	}
+
 	if ((surf_rotation == 0 || surf_rotation == 180) &&
 	    (w->window_size.width != surf_width ||
 	     w->window_size.height != surf_height)) {
@@ -616,7 +628,8 @@ static void redraw_egl(void *data, struct wl_callback *callback, uint32_t time)
 	w->callback = wl_surface_frame(w->surface);
 	wl_callback_add_listener(w->callback, &frame_listener, w);
 
-	ret = check_for_new_buffer();
+	/* In update mode the metadata has been taken in already */
+	ret = redraw_on_update ? 0 : check_for_new_buffer();
 
 	// Set the viewport
 	glViewport(0, 0, w->geometry.width, w->geometry.height);
@@ -700,12 +713,25 @@ static void redraw_wl(void *data, struct wl_callback *callback, uint32_t time)
 	if (!w->configured)
 		return;
 
+	if (redraw_on_update) {
+		if (!w->needs_redraw)
+			return;
+		w->needs_redraw = 0;
+
+		/* Nothing to show, leave the last frame up */
+		if (show_window == 0)
+			return;
+		ret = 0;
+	}
+
 	w->callback = wl_surface_frame(w->surface);
 	wl_callback_add_listener(w->callback, &frame_listener, w);
 
-	do {
-		ret = check_for_new_buffer();
-	} while (show_window == 0);
+	if (!redraw_on_update) {
+		do {
+			ret = check_for_new_buffer();
+		} while (show_window == 0);
+	}
 
 	if ((enable_fixed_size == 0) &&
 	    (w->window_size.width != surf_width ||
@@ -724,8 +750,15 @@ static void redraw_wl(void *data, struct wl_callback *callback, uint32_t time)
 
 	if (ret == 0) {
 		wl_surface_attach(w->surface, current_buffer, 0, 0);
-		wl_surface_damage(w->surface, 0, 0, w->window_size.width,
-				  w->window_size.height);
+		/* The whole guest buffer is new, in its own coordinates */
+		if (w->display->compositor_version >=
+		    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+			wl_surface_damage_buffer(w->surface, 0, 0,
+						 surf_width, surf_height);
+		else
+			wl_surface_damage(w->surface, 0, 0,
+					  w->window_size.width,
+					  w->window_size.height);
 	}
 	wl_surface_commit(w->surface);
 }
@@ -1062,9 +1095,10 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	struct display *d = data;
 
 	if (strcmp(interface, "wl_compositor") == 0) {
+		d->compositor_version = version < 4 ? version : 4;
 		d->compositor =
 		    wl_registry_bind(registry, name, &wl_compositor_interface,
-				     1);
+				     d->compositor_version);
 	} else if (strcmp(interface, "wl_shell") == 0) {
 		d->shell =
 		    wl_registry_bind(registry, name, &wl_shell_interface, 1);
@@ -1123,10 +1157,81 @@ static void usage(int error_code)
 		"  -H\tWindow height\n"
 		"  -W\tWindow width\n"
 		"  -d\tDisplay number\n"
-		"  -w\tUse wl_drm for rendering\n" "  -h\tThis help text\n\n");
+		"  -w\tUse wl_drm for rendering\n"
+		"  -u\tRedraw only when the shared surface has a new frame\n"
+		"  -h\tThis help text\n\n");
 	exit(error_code);
 }
 
+/*
+ * Main loop for update mode. Besides the Wayland connection it waits on
+ * the metadata, and draws (or asks for a frame callback to draw) only when
+ * the shared surface actually has a new frame, so a static guest costs
+ * the host nothing.
+ */
+static int run_update_driven(struct display *display)
+{
+	struct window *w = display->window;
+	struct pollfd fds[2];
+	int ret;
+
+	fds[0].fd = wl_display_get_fd(display->display);
+	fds[0].events = POLLIN;
+	fds[1].fd = vmdisplay_update_fd();
+	fds[1].events = POLLIN;
+
+	if (fds[1].fd < 0) {
+		printf("Cannot wait for metadata, redrawing continuously\n");
+		redraw_on_update = 0;
+		if (w->configured && w->callback == NULL)
+			redraw(w, NULL, 0);
+		return 0;
+	}
+
+	while (running) {
+		while (wl_display_prepare_read(display->display) != 0)
+			wl_display_dispatch_pending(display->display);
+
+		if (wl_display_flush(display->display) < 0 &&
+		    errno != EAGAIN) {
+			wl_display_cancel_read(display->display);
+			return -1;
+		}
+
+		ret = poll(fds, 2, -1);
+		if (ret < 0) {
+			wl_display_cancel_read(display->display);
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (wl_display_read_events(display->display) < 0)
+				return -1;
+		} else {
+			wl_display_cancel_read(display->display);
+		}
+
+		if (wl_display_dispatch_pending(display->display) < 0)
+			return -1;
+
+		if (fds[1].revents & POLLIN) {
+			ret = poll_for_new_frame();
+			if (ret < 0)
+				return -1;
+			if (ret) {
+				w->needs_redraw = 1;
+				/* Otherwise the pending frame callback draws it */
+				if (w->callback == NULL)
+					redraw(w, NULL, 0);
+			}
+		}
+	}
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	eglBindAPI(EGL_OPENGL_API);
@@ -1173,6 +1278,8 @@ int main(int argc, char **argv)
 			use_egl = 0;
 		} else if (strcmp("-e", argv[i]) == 0) {
 			use_event_poll = 1;
+		} else if (strcmp("-u", argv[i]) == 0) {
+			redraw_on_update = 1;
 		} else if (strcmp("-h", argv[i]) == 0)
 			usage(EXIT_SUCCESS);
 	}
@@ -1226,6 +1333,9 @@ int main(int argc, char **argv)
 	sigint.sa_flags = SA_RESETHAND;
 	sigaction(SIGINT, &sigint, NULL);
 
+	if (redraw_on_update)
+		ret = run_update_driven(&display);
+
 	while (running && ret != -1)
 		ret = wl_display_dispatch(display.display);
 
@@ -52,6 +52,8 @@
 #include <stropts.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 
 #define PAGE_SIZE 0x1000
 #define PAGE_SHIFT 12
@@ -80,6 +82,9 @@ static PFNEGLCREATEIMAGEKHRPROC create_image;
 static PFNEGLDESTROYIMAGEKHRPROC destroy_image;
 static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 
+/* Imported buffers kept around, enough for the guest's swap chain */
+#define BUFFER_CACHE_SIZE 8
+
 static struct buffer_list hyper_dmabuf_list;
 
 struct egl_manager g_eman_common;
@@ -101,10 +106,16 @@ unsigned int pipe_id = 0;
 
 int hyper_dmabuf_fd = -1;
 static int counter = 0;
+static hyper_dmabuf_id_t old_hyper_dmabuf_id = { 0, {0, 0, 0} };
+
+/* Signalled by update_thread whenever the server publishes metadata */
+static int update_fd = -1;
+static int update_thread_running;
+static pthread_t update_thread;
 
 vmdisplay_socket vmsocket;
 
-static void create_new_buffer_common(int dmabuf_fd);
+static int create_new_buffer_common(int dmabuf_fd);
 static int find_rec(struct buffer_list *l, uint32_t hyper_dmabuf_id);
 static void age_list(struct buffer_list *l);
 static void last_rec(struct buffer_list *l, int i);
@@ -148,19 +159,24 @@ int init_hyper_dmabuf(int dom)
 	return 0;
 }
 
-int check_for_new_buffer(void)
+static int update_buffer(int timeout_ms)
 {
-	static hyper_dmabuf_id_t old_hyper_dmabuf_id = { 0, {0, 0, 0} };
 	int ret = 0;
 
 	if (use_event_poll) {
-		ret = parse_event_metadata(hyper_dmabuf_fd, &counter);
+		ret = parse_event_metadata(hyper_dmabuf_fd, &counter,
+					   timeout_ms);
 	} else {
-		ret = parse_socket_metadata(&vmsocket, &counter);
+		ret = parse_socket_metadata(&vmsocket, &counter, timeout_ms);
 	}
 
+	if (ret < 0 || ret == VMDISPLAY_METADATA_LOST)
+		return ret;
+
 	if (ret) {
 		printf("Buffer table parse error\n");
+		show_window = 0;
+		old_hyper_dmabuf_id.id = 0;
 		clear_hyper_dmabuf_list();
 		return 1;
 	}
@@ -178,7 +194,105 @@ int check_for_new_buffer(void)
 	return 0;
 }
 
-void create_new_hyper_dmabuf_buffer(void)
+int check_for_new_buffer(void)
+{
+	return update_buffer(-1);
+}
+
+static void *update_thread_func(void *data)
+{
+	struct vmdisplay_shm *shm = data;
+	uint32_t seq = 0;
+	uint64_t one = 1;
+
+	while (__atomic_load_n(&update_thread_running, __ATOMIC_RELAXED)) {
+		/* Time out now and then to notice being stopped */
+		if (vmdisplay_shm_wait(shm, seq, 200) < 0)
+			continue;
+
+		seq = vmdisplay_shm_seq(shm);
+		if (write(update_fd, &one, sizeof(one)) < 0)
+			printf("Cannot signal metadata update\n");
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns an fd that polls readable when there may be new metadata for
+ * poll_for_new_frame() to pick up. The metadata file can only be waited
+ * for with a futex, so a thread turns those wakeups into an eventfd.
+ */
+int vmdisplay_update_fd(void)
+{
+	if (use_event_poll)
+		return hyper_dmabuf_fd;
+
+	if (update_fd >= 0)
+		return update_fd;
+
+	if (!vmsocket.outputs[pipe_id].mem_addr)
+		return -1;
+
+	update_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (update_fd < 0)
+		return -1;
+
+	update_thread_running = 1;
+	if (pthread_create(&update_thread, NULL, update_thread_func,
+			   vmsocket.outputs[pipe_id].mem_addr)) {
+		update_thread_running = 0;
+		close(update_fd);
+		update_fd = -1;
+	}
+
+	return update_fd;
+}
+
+/*
+ * Takes in all metadata that has arrived, without waiting for more.
+ * Returns 1 if what should be on screen has changed since the last call,
+ * that is a new frame of the shared surface or it going away, 0 if not,
+ * and -1 if the metadata can't be read anymore.
+ */
+int poll_for_new_frame(void)
+{
+	static int shown_counter = -1;
+	static uint32_t shown_id, shown_window;
+	static uint32_t shown_width, shown_height, shown_rotation;
+	uint64_t count;
+	int changed, ret;
+
+	if (!use_event_poll && update_fd >= 0)
+		while (read(update_fd, &count, sizeof(count)) > 0) ;
+
+	/* Tables that can't be used just blank the window until a good one */
+	do {
+		ret = update_buffer(0);
+	} while (ret == 0 || ret == 1);
+
+	if (ret == VMDISPLAY_METADATA_LOST)
+		return -1;
+
+	changed = show_window != shown_window;
+	if (show_window)
+		changed |= counter != shown_counter ||
+		    hyper_dmabuf_id.id != shown_id ||
+		    surf_width != shown_width ||
+		    surf_height != shown_height ||
+		    surf_rotation != shown_rotation;
+
+	shown_window = show_window;
+	shown_counter = counter;
+	shown_id = hyper_dmabuf_id.id;
+	shown_width = surf_width;
+	shown_height = surf_height;
+	shown_rotation = surf_rotation;
+
+	return changed;
+}
+
+int create_new_hyper_dmabuf_buffer(void)
 {
 	struct ioctl_hyper_dmabuf_export_fd msg;
 	msg.fd = -1;
@@ -190,13 +304,13 @@ void create_new_hyper_dmabuf_buffer(void)
 		       strerror(errno));
 		show_window = 0;
 		hyper_dmabuf_id.id = 0;
-		return;
+		return -1;
 	}
 
-	create_new_buffer_common(msg.fd);
+	return create_new_buffer_common(msg.fd);
 }
 
-static void create_new_buffer_common(int dmabuf_fd)
+static int create_new_buffer_common(int dmabuf_fd)
 {
 	GLuint textureId[2];
 	struct zwp_linux_buffer_params_v1 *params;
@@ -214,7 +328,7 @@ static void create_new_buffer_common(int dmabuf_fd)
 		break;
 	default:
 		printf("Non supported surface format 0x%x\n", surf_format);
-		return;
+		return -1;
 	}
 
 	if (use_egl) {
@@ -351,7 +465,7 @@ static void create_new_buffer_common(int dmabuf_fd)
 					    DRM_FORMAT_ARGB8888;
 				} else {
 					printf("DRI not supporint NV12\n");
-					return;
+					return -1;
 				}
 			}
 		} else {
@@ -439,6 +553,8 @@ static void create_new_buffer_common(int dmabuf_fd)
 		current_buffer = buf;
 	}
 	close(dmabuf_fd);
+
+	return 0;
 }
 
 void clear_hyper_dmabuf_list(void)
@@ -483,33 +599,80 @@ static void clear_rec(struct buffer_list *l, int i)
 	l->l[i].textureId[1] = 0;
 	l->l[i].width = 0;
 	l->l[i].height = 0;
+	l->l[i].format = 0;
+	l->l[i].sampler_format = 0;
 	l->l[i].buffer = 0;
 	l->l[i].hyper_dmabuf_id = 0;
 	l->l[i].gem_handle = 0;
 }
 
+static int oldest_rec(struct buffer_list *l)
+{
+	int i, r = 0;
+
+	for (i = 0; i < l->len; i++) {
+		if (l->l[i].hyper_dmabuf_id == 0)
+			return i;
+		if (l->l[i].age > l->l[r].age)
+			r = i;
+	}
+	return r;
+}
+
+/*
+ * Show the buffer with the given id, importing it only if it isn't among
+ * the ones imported before. The guest cycles through a handful of buffers,
+ * so normally all of them end up being reused.
+ */
 static void update_hyper_dmabuf_list(int id, int old_id)
 {
-	int r = find_rec(&hyper_dmabuf_list, id);
+	struct buffer_rec *rec;
+	int r;
+
+	if (!hyper_dmabuf_list.l) {
+		hyper_dmabuf_list.l = calloc(BUFFER_CACHE_SIZE,
+					     sizeof(*hyper_dmabuf_list.l));
+		if (!hyper_dmabuf_list.l) {
+			create_new_hyper_dmabuf_buffer();
+			return;
+		}
+		hyper_dmabuf_list.len = BUFFER_CACHE_SIZE;
+	}
+
+	r = find_rec(&hyper_dmabuf_list, id);
 
 	age_list(&hyper_dmabuf_list);
 
 	if (r >= 0) {
-		if (old_id == 0 ||
-		    hyper_dmabuf_list.l[r].width != surf_width ||
-		    hyper_dmabuf_list.l[r].height != surf_height) {
-			clear_rec(&hyper_dmabuf_list, r);
-			create_new_hyper_dmabuf_buffer();
-		} else {
+		rec = &hyper_dmabuf_list.l[r];
+		if (old_id != 0 &&
+		    rec->width == surf_width &&
+		    rec->height == surf_height &&
+		    rec->format == surf_format) {
 			last_rec(&hyper_dmabuf_list, r);
-			current_textureId[0] =
-			    hyper_dmabuf_list.l[r].textureId[0];
-			current_textureId[1] =
-			    hyper_dmabuf_list.l[r].textureId[1];
-			current_buffer = hyper_dmabuf_list.l[r].buffer;
+			current_textureId[0] = rec->textureId[0];
+			current_textureId[1] = rec->textureId[1];
+			current_texture_sampler_format = rec->sampler_format;
+			current_buffer = rec->buffer;
+			return;
 		}
 	} else {
-		create_new_hyper_dmabuf_buffer();
+		r = oldest_rec(&hyper_dmabuf_list);
+	}
+
+	clear_rec(&hyper_dmabuf_list, r);
+
+	if (create_new_hyper_dmabuf_buffer() == 0) {
+		rec = &hyper_dmabuf_list.l[r];
+		rec->hyper_dmabuf_id = id;
+		rec->textureId[0] = current_textureId[0];
+		rec->textureId[1] = current_textureId[1];
+		rec->sampler_format = current_texture_sampler_format;
+		rec->buffer = use_egl ? NULL : current_buffer;
+		rec->width = surf_width;
+		rec->height = surf_height;
+		rec->format = surf_format;
+		last_rec(&hyper_dmabuf_list, r);
 	}
 }
 
@@ -620,8 +783,8 @@ int vmdisplay_socket_init(vmdisplay_socket * vmsocket, int domid)
 	for (i = 0; i < msg.display_num; i++) {
 		vmsocket->outputs[i].mem_fd = recvfd(vmsocket->socket_fd);
 		vmsocket->outputs[i].mem_addr =
-		    mmap(NULL, METADATA_BUFFER_SIZE, PROT_READ, MAP_SHARED,
-			 vmsocket->outputs[i].mem_fd, 0);
+		    mmap(NULL, sizeof(struct vmdisplay_shm), PROT_READ,
+			 MAP_SHARED, vmsocket->outputs[i].mem_fd, 0);
 	}
 
 	return 0;
@@ -630,6 +793,14 @@ int vmdisplay_socket_init(vmdisplay_socket * vmsocket, int domid)
 void vmdisplay_socket_cleanup(vmdisplay_socket * socket)
 {
 	int i;
+
+	if (update_thread_running) {
+		__atomic_store_n(&update_thread_running, 0, __ATOMIC_RELAXED);
+		pthread_join(update_thread, NULL);
+		close(update_fd);
+		update_fd = -1;
+	}
+
 	if (socket) {
 		if (socket->socket_fd) {
 			close(socket->socket_fd);
@@ -639,7 +810,7 @@ void vmdisplay_socket_cleanup(vmdisplay_socket * socket)
 		for (i = 0; i < VM_MAX_OUTPUTS; i++) {
 			if (socket->outputs[i].mem_addr) {
 				munmap(socket->outputs[i].mem_addr,
-				       METADATA_BUFFER_SIZE);
+				       sizeof(struct vmdisplay_shm));
 				socket->outputs[i].mem_addr = NULL;
 			}
 
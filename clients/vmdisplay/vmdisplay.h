@@ -48,6 +48,7 @@ typedef int32_t s32;
 #endif
 #include "vm-shared.h"
 #include "vmdisplay-shared.h"
+#include "vmdisplay-shm.h"
 
 #define PAGE_SIZE 0x1000
 #define PAGE_SHIFT 12
@@ -60,6 +61,8 @@ typedef struct buffer_rec {
 	struct wl_buffer *buffer;
 	uint32_t width;
 	uint32_t height;
+	uint32_t format;
+	uint32_t sampler_format;
 	int age;
 	uint32_t gem_handle;
 } buffer_rec;
@@ -94,8 +97,10 @@ extern uint32_t show_window;
 int open_drm(void);
 int init_hyper_dmabuf(int dom);
 void clear_hyper_dmabuf_list(void);
-void create_new_hyper_dmabuf_buffer(void);
+int create_new_hyper_dmabuf_buffer(void);
 int check_for_new_buffer(void);
+int vmdisplay_update_fd(void);
+int poll_for_new_frame(void);
 void received_frames(void);
 int vmdisplay_socket_init(vmdisplay_socket * socket, int domid);
 void vmdisplay_socket_cleanup(vmdisplay_socket * socket);
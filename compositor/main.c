@@ -51,6 +51,7 @@
 #include "git-version.h"
 #include "version.h"
 #include "trace-reporter.h"
+#include "timeline.h"
 #include "weston.h"
 
 #include "compositor-ias.h"
@@ -844,6 +845,7 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int timeline_points;
 	int vt_switching;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
@@ -882,6 +884,10 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_int(s, "timeline-ring", &timeline_points, 0);
+	if (timeline_points > 0)
+		weston_timeline_open_ring(ec, timeline_points);
+
 	return 0;
 }
 
@@ -774,6 +774,36 @@ commit_layer_list(struct ivi_layout *layout)
 	}
 }
 
+/* Whether the layout layer already holds the visible views in order */
+static bool
+layout_layer_is_current(struct ivi_layout *layout)
+{
+	struct ivi_layout_screen *iviscrn;
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_view *ivi_view;
+	struct wl_list *head = &layout->layout_layer.view_list.link;
+	struct wl_list *link = head->prev;
+
+	/* The views are inserted at the head, so the list is in reverse */
+	wl_list_for_each(iviscrn, &layout->screen_list, link) {
+		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
+			if (ivilayer->prop.visibility == false)
+				continue;
+
+			wl_list_for_each(ivi_view, &ivilayer->order.view_list, order_link) {
+				if (ivi_view->ivisurf->prop.visibility == false)
+					continue;
+
+				if (link != &ivi_view->view->layer_link.link)
+					return false;
+				link = link->prev;
+			}
+		}
+	}
+
+	return link == head;
+}
+
 static void
 commit_screen_list(struct ivi_layout *layout)
 {
@@ -782,9 +812,6 @@ commit_screen_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *next     = NULL;
 	struct ivi_layout_view *ivi_view = NULL;
 
-	/* Clear view list of layout ivi_layer */
-	wl_list_init(&layout->layout_layer.view_list.link);
-
 	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		if (iviscrn->order.dirty) {
 			wl_list_for_each_safe(ivilayer, next,
@@ -810,7 +837,17 @@ commit_screen_list(struct ivi_layout *layout)
 
 			iviscrn->order.dirty = 0;
 		}
+	}
+
+	/* Leave the compositor's view list alone if nothing moved */
+	if (layout_layer_is_current(layout))
+		return;
 
+	/* Clear view list of layout ivi_layer */
+	wl_list_init(&layout->layout_layer.view_list.link);
+	weston_layer_dirty(&layout->layout_layer);
+
+	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
 			if (ivilayer->prop.visibility == false)
 				continue;
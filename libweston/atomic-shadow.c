@@ -0,0 +1,230 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atomic-shadow.h"
+
+struct atomic_shadow_prop {
+	uint32_t id;
+	uint64_t value;		/* what the kernel has, if known */
+	uint64_t pending;	/* what the current request sets, if queued */
+	bool known;
+	bool queued;
+};
+
+struct atomic_shadow_object {
+	uint32_t id;
+	int n_props;
+	struct atomic_shadow_prop props[ATOMIC_SHADOW_MAX_PROPS];
+};
+
+struct atomic_shadow {
+	const struct atomic_shadow_ops *ops;
+	void *data;
+
+	struct atomic_shadow_object *objects;
+	int n_objects;
+	int size;
+
+	/* Properties come grouped by object, so remember the last one */
+	int last;
+};
+
+struct atomic_shadow *
+atomic_shadow_create(const struct atomic_shadow_ops *ops, void *data)
+{
+	struct atomic_shadow *shadow;
+
+	shadow = calloc(1, sizeof *shadow);
+	if (!shadow)
+		return NULL;
+
+	shadow->ops = ops;
+	shadow->data = data;
+	shadow->last = -1;
+
+	return shadow;
+}
+
+void
+atomic_shadow_destroy(struct atomic_shadow *shadow)
+{
+	free(shadow->objects);
+	free(shadow);
+}
+
+static struct atomic_shadow_object *
+get_object(struct atomic_shadow *shadow, uint32_t object_id)
+{
+	struct atomic_shadow_object *objects;
+	int i;
+
+	if (shadow->last >= 0 && shadow->objects[shadow->last].id == object_id)
+		return &shadow->objects[shadow->last];
+
+	for (i = 0; i < shadow->n_objects; i++) {
+		if (shadow->objects[i].id == object_id) {
+			shadow->last = i;
+			return &shadow->objects[i];
+		}
+	}
+
+	if (shadow->n_objects == shadow->size) {
+		objects = realloc(shadow->objects,
+				  (shadow->size + 8) * sizeof *objects);
+		if (!objects)
+			return NULL;
+		shadow->objects = objects;
+		shadow->size += 8;
+	}
+
+	shadow->last = shadow->n_objects++;
+	shadow->objects[shadow->last].id = object_id;
+	shadow->objects[shadow->last].n_props = 0;
+
+	return &shadow->objects[shadow->last];
+}
+
+static struct atomic_shadow_prop *
+get_prop(struct atomic_shadow *shadow, uint32_t object_id, uint32_t property_id)
+{
+	struct atomic_shadow_object *object;
+	struct atomic_shadow_prop *prop;
+	int i;
+
+	object = get_object(shadow, object_id);
+	if (!object)
+		return NULL;
+
+	for (i = 0; i < object->n_props; i++) {
+		if (object->props[i].id == property_id)
+			return &object->props[i];
+	}
+
+	if (object->n_props == ATOMIC_SHADOW_MAX_PROPS)
+		return NULL;
+
+	prop = &object->props[object->n_props++];
+	prop->id = property_id;
+	prop->known = false;
+	prop->queued = false;
+
+	return prop;
+}
+
+static int
+add(struct atomic_shadow *shadow, void *req, uint32_t object_id,
+    uint32_t property_id, uint64_t value, bool always)
+{
+	struct atomic_shadow_prop *prop;
+	int ret;
+
+	/* Untracked, so always sent */
+	prop = get_prop(shadow, object_id, property_id);
+	if (!prop)
+		return shadow->ops->add_property(req, object_id,
+						 property_id, value);
+
+	if (!always) {
+		if (prop->queued && prop->pending == value)
+			return 0;
+		if (!prop->queued && prop->known && prop->value == value)
+			return 0;
+	}
+
+	ret = shadow->ops->add_property(req, object_id, property_id, value);
+	if (ret < 0)
+		return ret;
+
+	prop->pending = value;
+	prop->queued = true;
+
+	return ret;
+}
+
+int
+atomic_shadow_add(struct atomic_shadow *shadow, void *req,
+		  uint32_t object_id, uint32_t property_id, uint64_t value)
+{
+	return add(shadow, req, object_id, property_id, value, false);
+}
+
+int
+atomic_shadow_add_always(struct atomic_shadow *shadow, void *req,
+			 uint32_t object_id, uint32_t property_id,
+			 uint64_t value)
+{
+	return add(shadow, req, object_id, property_id, value, true);
+}
+
+int
+atomic_shadow_commit(struct atomic_shadow *shadow, void *req,
+		     uint32_t flags, void *user_data)
+{
+	struct atomic_shadow_object *object;
+	struct atomic_shadow_prop *prop;
+	int ret, i, j;
+
+	ret = shadow->ops->commit(shadow->data, req, flags, user_data);
+
+	for (i = 0; i < shadow->n_objects; i++) {
+		object = &shadow->objects[i];
+		for (j = 0; j < object->n_props; j++) {
+			prop = &object->props[j];
+			if (!prop->queued)
+				continue;
+
+			/* A failed commit leaves the kernel as it was */
+			if (ret == 0) {
+				prop->value = prop->pending;
+				prop->known = true;
+			}
+			prop->queued = false;
+		}
+	}
+
+	shadow->ops->reset(req);
+
+	return ret;
+}
+
+void
+atomic_shadow_invalidate(struct atomic_shadow *shadow)
+{
+	struct atomic_shadow_object *object;
+	int i, j;
+
+	for (i = 0; i < shadow->n_objects; i++) {
+		object = &shadow->objects[i];
+		for (j = 0; j < object->n_props; j++)
+			object->props[j].known = false;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_ATOMIC_SHADOW_H
+#define WESTON_ATOMIC_SHADOW_H
+
+#include <stdint.h>
+
+/*
+ * Shadow copy of the KMS property values last committed through an
+ * atomic request, so that the next request only carries what changed:
+ * the kernel keeps the values of properties a commit leaves out.
+ *
+ * The request itself is reused from commit to commit rather than
+ * allocated every frame. Properties added to it without going through
+ * the shadow are committed as usual, they just aren't tracked.
+ *
+ * The libdrm calls go through atomic_shadow_ops, so that they can be
+ * replaced in tests. This file doesn't depend on the rest of libweston.
+ */
+
+/* Matches drmModeAtomicAddProperty(), drmModeAtomicCommit() and
+ * drmModeAtomicSetCursor(req, 0) */
+struct atomic_shadow_ops {
+	int (*add_property)(void *req, uint32_t object_id,
+			    uint32_t property_id, uint64_t value);
+	int (*commit)(void *data, void *req, uint32_t flags, void *user_data);
+	void (*reset)(void *req);
+};
+
+#define ATOMIC_SHADOW_MAX_PROPS 24
+
+struct atomic_shadow;
+
+struct atomic_shadow *
+atomic_shadow_create(const struct atomic_shadow_ops *ops, void *data);
+
+void
+atomic_shadow_destroy(struct atomic_shadow *shadow);
+
+/* Adds a property to req, unless the kernel already has this value */
+int
+atomic_shadow_add(struct atomic_shadow *shadow, void *req,
+		  uint32_t object_id, uint32_t property_id, uint64_t value);
+
+/* Adds a property to req even if unchanged, e.g. an FB_ID to flip */
+int
+atomic_shadow_add_always(struct atomic_shadow *shadow, void *req,
+			 uint32_t object_id, uint32_t property_id,
+			 uint64_t value);
+
+/*
+ * Commits req, and takes its values as the kernel's if that succeeded.
+ * Either way req is emptied, ready for the next frame.
+ */
+int
+atomic_shadow_commit(struct atomic_shadow *shadow, void *req,
+		     uint32_t flags, void *user_data);
+
+/* For when the state may have changed behind our back, e.g. a VT switch */
+void
+atomic_shadow_invalidate(struct atomic_shadow *shadow);
+
+#endif /* WESTON_ATOMIC_SHADOW_H */
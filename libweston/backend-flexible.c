@@ -35,6 +35,7 @@
 #include "config.h"
 #include "ias-backend.h"
 #include "ias-common.h"
+#include "atomic-shadow.h"
 
 #define PLANE_0     0
 
@@ -67,6 +68,7 @@ struct ias_flexible_priv {
 	int in_handler;  /* currently handling a flip event */
 	int pending;     /* Which planes are pending a commit */
 	int commited;    /* Which planes have been commited, awaiting complete */
+	struct atomic_shadow *shadow; /* Plane properties the kernel has */
 };
 
 static void
@@ -104,6 +106,8 @@ static uint32_t is_surface_flippable_flexible(
 			struct weston_view *view,
 			struct weston_output *output,
 			uint32_t check_xy);
+static int
+test_sprites_flexible(struct ias_crtc *ias_crtc);
 
 extern void
 ias_get_object_properties(int fd,
@@ -132,6 +136,7 @@ struct ias_output_model output_model_flexible = {
 	.get_next_fb = get_next_fb_flexible,
 	.flip = flip_flexible,
 	.update_sprites = NULL,
+	.test_sprites = test_sprites_flexible,
 	.is_surface_flippable = is_surface_flippable_flexible,
 };
 
@@ -244,21 +249,72 @@ create_sprites_for_crtc(struct ias_crtc *ias_crtc)
 		/* possible_crtcs is a bit mask which is calculated by 1 << pipe */
 		sprite->ias_crtc = ias_crtc;
 
+		if (ias_crtc->num_outputs < ias_crtc->configuration->output_num) {
+			sprite->output_id = ias_crtc->num_outputs;
+			ias_crtc->num_outputs++;
+		} else if (backend->auto_sprites && backend->has_nuclear_pageflip &&
+				sprite->type == DRM_PLANE_TYPE_OVERLAY) {
+			/*
+			 * Overlay planes left over once every output has one are free
+			 * for ias_assign_planes() to put client buffers on.  Picking
+			 * them relies on atomic test commits.
+			 */
+			sprite->output_id = -1;
+		} else {
+			free(sprite);
+			continue;
+		}
+
 		wl_list_insert(&ias_crtc->sprite_list, &sprite->link);
 		ias_crtc->num_sprites++;
-
-		sprite->output_id = ias_crtc->num_outputs;
-		ias_crtc->num_outputs++;
-
-		if (ias_crtc->num_outputs == ias_crtc->configuration->output_num) {
-			break;
-		}
 	}
 
 	free(plane_res->planes);
 	free(plane_res);
 }
 
+static int
+shadow_add_property(void *req, uint32_t object_id, uint32_t property_id,
+		uint64_t value)
+{
+	return drmModeAtomicAddProperty(req, object_id, property_id, value);
+}
+
+static int
+shadow_commit(void *data, void *req, uint32_t flags, void *user_data)
+{
+	struct ias_flexible_priv *priv = data;
+
+	return drmModeAtomicCommit(priv->drm_fd, req, flags, user_data);
+}
+
+static void
+shadow_reset(void *req)
+{
+	drmModeAtomicSetCursor(req, 0);
+}
+
+static const struct atomic_shadow_ops shadow_ops = {
+	.add_property = shadow_add_property,
+	.commit = shadow_commit,
+	.reset = shadow_reset,
+};
+
+/*
+ * Adds a plane property to an atomic request. Going through the shadow,
+ * it is left out if the kernel already has that value.
+ */
+static void
+add_plane_property(struct atomic_shadow *shadow, drmModeAtomicReqPtr req,
+		uint32_t plane_id, uint32_t property_id, uint64_t value)
+{
+	if (shadow) {
+		atomic_shadow_add(shadow, req, plane_id, property_id, value);
+	} else {
+		drmModeAtomicAddProperty(req, plane_id, property_id, value);
+	}
+}
+
 static void
 init_flexible(struct ias_crtc *ias_crtc)
 {
@@ -280,6 +336,12 @@ init_flexible(struct ias_crtc *ias_crtc)
 	/* If atomic pageflip isn't supported, fall back to legacy code */
 	if (!backend->has_nuclear_pageflip) {
 		output_model_flexible.flip = flip_flexible_legacy;
+	} else {
+		/* Without it every commit just carries all the properties */
+		priv->shadow = atomic_shadow_create(&shadow_ops, priv);
+		if (!priv->shadow) {
+			IAS_ERROR("Failed to allocate atomic property shadow.");
+		}
 	}
 }
 
@@ -820,7 +882,19 @@ commit(struct ias_crtc *ias_crtc)
 	priv->rp_needed = 0;
 	priv->commited = priv->pending;
 	priv->pending = 0;
-	ret = drmModeAtomicCommit(priv->drm_fd, ias_crtc->prop_set, flags, ias_crtc);
+
+	/*
+	 * The property set is emptied and reused for the next frame rather
+	 * than freed and allocated again.
+	 */
+	if (priv->shadow) {
+		ret = atomic_shadow_commit(priv->shadow, ias_crtc->prop_set,
+				flags, ias_crtc);
+	} else {
+		ret = drmModeAtomicCommit(priv->drm_fd, ias_crtc->prop_set,
+				flags, ias_crtc);
+		drmModeAtomicSetCursor(ias_crtc->prop_set, 0);
+	}
 	if (ret) {
 		IAS_ERROR("Queueing atomic pageflip failed: %m (%d)", ret);
 		IAS_ERROR("This failure will prevent clients from updating.");
@@ -828,10 +902,6 @@ commit(struct ias_crtc *ias_crtc)
 
 	mode_id = 0;
 
-	/* Free and re-allocate the property set so it's always clean */
-	drmModeAtomicFree(ias_crtc->prop_set);
-	ias_crtc->prop_set = drmModeAtomicAlloc();
-
 	if (ias_crtc->backend->no_flip_event) {
 		clock_gettime(ias_crtc->backend->clock, &ts);
 		flip_handler_flexible(ias_crtc, ts.tv_sec, ts.tv_nsec/1000, 0, 0);
@@ -841,6 +911,30 @@ commit(struct ias_crtc *ias_crtc)
 }
 
 
+/*
+ * The free sprites were committed together with the output's scanout, so
+ * the buffers they were showing are no longer needed.
+ */
+static void
+free_sprites_flipped(struct ias_crtc *ias_crtc)
+{
+	struct ias_sprite *sprite;
+
+	wl_list_for_each(sprite, &ias_crtc->sprite_list, link) {
+		if (sprite->output_id >= 0 || !sprite->page_flip_pending) {
+			continue;
+		}
+
+		if (sprite->current) {
+			gbm_bo_destroy(sprite->current->bo);
+		}
+
+		sprite->current = sprite->next;
+		sprite->next = NULL;
+		sprite->page_flip_pending = 0;
+	}
+}
+
 /*
  * flip_handler_flexible
  *
@@ -899,6 +993,8 @@ flip_handler_flexible(struct ias_crtc *ias_crtc,
 			scanout[s].next = NULL;
 			priv->commited &= ~(1<<s);
 
+			free_sprites_flipped(ias_crtc);
+
 			wl_signal_emit(&ias_crtc->output[s]->printfps_signal, ias_crtc->output[s]);
 
 
@@ -928,6 +1024,81 @@ flip_handler_flexible(struct ias_crtc *ias_crtc,
 	priv->in_handler = 0;
 }
 
+/*
+ * Adds a free sprite's next state to an atomic request: the client buffer
+ * it was given, or turning it off.
+ */
+static void
+add_free_sprite_properties(struct atomic_shadow *shadow,
+		drmModeAtomicReqPtr req, struct ias_crtc *ias_crtc,
+		struct ias_sprite *sprite)
+{
+	if (!sprite->next) {
+		add_plane_property(shadow, req, sprite->plane_id,
+				sprite->prop.fb_id, 0);
+		add_plane_property(shadow, req, sprite->plane_id,
+				sprite->prop.crtc_id, 0);
+		return;
+	}
+
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.fb_id, sprite->next->fb_id);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.crtc_id, ias_crtc->crtc_id);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.crtc_x, sprite->plane.x);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.crtc_y, sprite->plane.y);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.crtc_w, sprite->dest_w);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.crtc_h, sprite->dest_h);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.src_x, sprite->src_x);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.src_y, sprite->src_y);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.src_w, sprite->src_w);
+	add_plane_property(shadow, req, sprite->plane_id,
+			sprite->prop.src_h, sprite->src_h);
+}
+
+/*
+ * test_sprites_flexible()
+ *
+ * Asks the kernel whether the free sprites can show what they were given
+ * for the next frame, without touching the display.
+ */
+static int
+test_sprites_flexible(struct ias_crtc *ias_crtc)
+{
+	struct ias_flexible_priv *priv =
+		(struct ias_flexible_priv *)ias_crtc->output_model_priv;
+	struct ias_sprite *sprite;
+	drmModeAtomicReqPtr req;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req) {
+		return -1;
+	}
+
+	wl_list_for_each(sprite, &ias_crtc->sprite_list, link) {
+		if (sprite->output_id >= 0 || (!sprite->next && !sprite->current)) {
+			continue;
+		}
+
+		/* Not through the shadow, the test has to see everything */
+		add_free_sprite_properties(NULL, req, ias_crtc, sprite);
+	}
+
+	ret = drmModeAtomicCommit(priv->drm_fd, req,
+			DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
 /*
  * flip
  *
@@ -944,6 +1115,7 @@ flip_flexible(int drm_fd, struct ias_crtc *ias_crtc, int output_id)
 	struct ias_sprite *ias_sprite;
 	int s = 0;
 	uint32_t w, h;
+	uint32_t plane_id;
 	struct ias_flexible_priv *priv =
 		(struct ias_flexible_priv *)ias_crtc->output_model_priv;
 	struct flexible_scanout *scanout = priv->scanout;
@@ -965,45 +1137,53 @@ flip_flexible(int drm_fd, struct ias_crtc *ias_crtc, int output_id)
 		s = output_id;
 
 		if (scanout[s].next) {
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.fb_id,
-					scanout[s].next->fb_id);
+			plane_id = ias_sprite->plane_id;
 
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.crtc_id,
+			/*
+			 * FB_ID always goes in, or the commit would have no
+			 * flip to send an event for. The rest only changes
+			 * when the mode or the output layout does.
+			 */
+			if (priv->shadow) {
+				atomic_shadow_add_always(priv->shadow,
+						ias_crtc->prop_set, plane_id,
+						ias_sprite->prop.fb_id,
+						scanout[s].next->fb_id);
+			} else {
+				drmModeAtomicAddProperty(ias_crtc->prop_set,
+						plane_id, ias_sprite->prop.fb_id,
+						scanout[s].next->fb_id);
+			}
+
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.crtc_id,
 					ias_crtc->crtc_id);
 
 			output = ias_crtc->output[s];
 			w = output->width << 16;
 			h = output->height << 16;
 
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.crtc_x, priv->plane_geometry[s].x);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.crtc_y, priv->plane_geometry[s].y);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.crtc_w, priv->plane_geometry[s].width);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.crtc_h, priv->plane_geometry[s].height);
-
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.src_x, 0);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.src_y, 0);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.src_w, w);
-			drmModeAtomicAddProperty(ias_crtc->prop_set,
-					ias_sprite->plane_id,
-					ias_sprite->prop.src_h, h);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.crtc_x,
+					priv->plane_geometry[s].x);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.crtc_y,
+					priv->plane_geometry[s].y);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.crtc_w,
+					priv->plane_geometry[s].width);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.crtc_h,
+					priv->plane_geometry[s].height);
+
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.src_x, 0);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.src_y, 0);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.src_w, w);
+			add_plane_property(priv->shadow, ias_crtc->prop_set,
+					plane_id, ias_sprite->prop.src_h, h);
 
 			if (backend->rbc_supported && backend->rbc_debug) {
 				weston_log("[RBC] Commiting scanout %d, compression enabled = %d\n",
@@ -1012,6 +1192,18 @@ flip_flexible(int drm_fd, struct ias_crtc *ias_crtc, int output_id)
 
 			priv->pending |= (1 << s);
 
+			/* Client buffers ias_assign_planes() put on free sprites */
+			wl_list_for_each(ias_sprite, &ias_crtc->sprite_list, link) {
+				if (ias_sprite->output_id >= 0 ||
+						(!ias_sprite->next && !ias_sprite->current)) {
+					continue;
+				}
+
+				add_free_sprite_properties(priv->shadow,
+						ias_crtc->prop_set, ias_crtc, ias_sprite);
+				ias_sprite->page_flip_pending = 1;
+			}
+
 			/*
 			 * TODO: set properties for sprite plane z-order when
 			 * they've been implemented in the driver.
@@ -1118,6 +1310,14 @@ set_mode_flexible(struct ias_crtc *ias_crtc)
 	drmModeCrtcPtr current_crtc_mode;
 	drmModeModeInfo *mode = &ias_crtc->current_mode->mode_info;
 
+	/*
+	 * Coming back from a VT switch, whoever had the display may have
+	 * left the planes in any state, so send all of their properties.
+	 */
+	if (priv->shadow) {
+		atomic_shadow_invalidate(priv->shadow);
+	}
+
 	/* Make sure there's a valid framebuffer ready to be set */
 	if (!scanout[PLANE_0].next) {
 		return 0;
@@ -46,6 +46,7 @@
 
 #include "compositor.h"
 #include "capture-proxy.h"
+#include "capture-staging.h"
 #include "ias-shell-server-protocol.h"
 #include "../shared/timespec-util.h"
 
@@ -53,19 +54,40 @@
  * outstanding frames. */
 #define MAX_FRAMES_IN_FLIGHT 3
 
+/* Allow two frames to be captured between composite events by default.
+ * Only allowing a single frame is too aggressive. */
+#define DEFAULT_MAX_BURST 2
+
+#define NS_IN_SEC 1000000000LL
+
 struct capture_proxy {
 	int drm_fd;
 	int profile_capture;
 	int verbose_capture;
 
 	int frame_count;
-	int num_vsyncs;
 	int num_frames_in_flight;
+	int max_frames_in_flight;
+
+	/* Frame-rate governor. With no target frame rate, up to max_burst
+	 * frames are allowed between vsyncs. Otherwise credit accrues at
+	 * target_fps and up to max_burst frames worth can be saved up. */
+	uint32_t target_fps;
+	uint32_t max_burst;
+	enum capture_proxy_policy policy;
+	uint32_t frames_since_vsync;
+	int64_t credit_ns;
+	int64_t credit_time_ns;
+	int deferred;
+	struct capture_proxy_stats stats;
 
 	int width;
 	int height;
 
 	VADisplay va_dpy;
+	/* The staging copy thread maps surfaces on va_dpy too, and libva
+	 * doesn't guarantee a display can be used from two threads at once. */
+	pthread_mutex_t va_lock;
 
 	/* Resource for client that asked us to start capturing, to which
 	 * we will send buffer handles. */
@@ -76,6 +98,26 @@ struct capture_proxy {
 	/* Store client in order to flush events when sending HMI messages
 	 * this improves performance. */
 	struct wl_client *client;
+
+	/* Staging surfaces that shm frames are copied into, created on the
+	 * first shm frame. */
+	struct capture_staging *staging;
+	struct wl_event_source *staging_source;
+};
+
+struct capture_proxy_staging_buffer {
+	VASurfaceID surface;
+	VAImage image;
+};
+
+/* An shm frame on its way through the staging pool. The buffer reference
+ * stops the client from reusing the buffer before it has been copied. */
+struct capture_proxy_job {
+	struct capture_proxy *cp;
+	struct weston_buffer_reference buffer_ref;
+	struct wl_listener buffer_destroy_listener;
+	uint32_t timestamp;
+	int frame_count;
 };
 
 
@@ -117,11 +159,14 @@ capture_proxy_create(const int drm_fd, struct wl_client *client)
 		return NULL;
 	}
 
-
+	pthread_mutex_init(&cp->va_lock, NULL);
 	wl_list_init(&cp->resource_listener.link);
 	cp->resource_listener.notify = handle_resource_destroyed;
 	cp->drm_fd = drm_fd;
 
+	capture_proxy_set_rate(cp, 0, DEFAULT_MAX_BURST, MAX_FRAMES_IN_FLIGHT,
+			CP_POLICY_DROP);
+
 	weston_log("[capture proxy]: Capture proxy created.\n");
 	return cp;
 }
@@ -135,9 +180,38 @@ capture_proxy_set_size(struct capture_proxy *cp, int width, int height)
 	}
 }
 
+static void
+capture_proxy_job_free(struct capture_proxy_job *job)
+{
+	wl_list_remove(&job->buffer_destroy_listener.link);
+	weston_buffer_reference(&job->buffer_ref, NULL);
+	free(job);
+}
+
+static void
+capture_proxy_staging_fini(struct capture_proxy *cp)
+{
+	void *user;
+
+	if (!cp->staging) {
+		return;
+	}
+
+	wl_event_source_remove(cp->staging_source);
+
+	capture_staging_wait_idle(cp->staging);
+	while (capture_staging_next_done(cp->staging, &user)) {
+		capture_proxy_job_free(user);
+	}
+
+	capture_staging_destroy(cp->staging);
+	cp->staging = NULL;
+}
+
 void
 capture_proxy_destroy(struct capture_proxy *cp)
 {
+	capture_proxy_staging_fini(cp);
 	wl_list_remove(&cp->resource_listener.link);
 	close(cp->drm_fd);
 
@@ -145,6 +219,7 @@ capture_proxy_destroy(struct capture_proxy *cp)
 		wl_resource_destroy(cp->resource);
 	}
 	vaTerminate(cp->va_dpy);
+	pthread_mutex_destroy(&cp->va_lock);
 	free(cp);
 	weston_log("[capture proxy]: Capture proxy destroyed.\n");
 }
@@ -166,120 +241,296 @@ capture_proxy_set_resource(struct capture_proxy * const cp,
 
 
 static int
-capture_proxy_shm_frame(struct capture_proxy * const cp,
-		struct wl_shm_buffer * const shm_buffer, int stride,
-		enum capture_proxy_format format, uint32_t timestamp)
+staging_create(void *data, struct capture_staging_buffer *buf)
 {
-	VASurfaceID src_surface;
+	struct capture_proxy *cp = data;
+	struct capture_proxy_staging_buffer *sb;
 	VAStatus status;
-	void *surface_p = NULL;
-	void *shm_buffer_data = NULL;
-	VAImage rgb_image;
-	VABufferInfo buf_info;
-	uint32_t shm_format;
 
-	wl_shm_buffer_begin_access(shm_buffer);
-	shm_buffer_data = wl_shm_buffer_get_data(shm_buffer);
-
-	if (shm_buffer_data == NULL) {
-		weston_log("[capture proxy]: Failed to get data pointer from shm_buffer.\n");
-		goto error_data_pointer;
-	}
-
-	shm_format = wl_shm_buffer_get_format(shm_buffer);
-	if (shm_format != WL_SHM_FORMAT_XRGB8888 && shm_format != WL_SHM_FORMAT_ARGB8888 &&
-		shm_format != WL_SHM_FORMAT_RGB565) {
-		weston_log("[capture proxy]: shm buffer not of RGB32 type.\n");
-		goto error_data_pointer;
+	sb = zalloc(sizeof(*sb));
+	if (!sb) {
+		return -1;
 	}
 
+	pthread_mutex_lock(&cp->va_lock);
 	status = vaCreateSurfaces(cp->va_dpy, VA_RT_FORMAT_RGB32,
-			wl_shm_buffer_get_width(shm_buffer),
-			wl_shm_buffer_get_height(shm_buffer),
-			&src_surface, 1, NULL, 0);
+			buf->width, buf->height, &sb->surface, 1, NULL, 0);
 	if (status != VA_STATUS_SUCCESS) {
+		pthread_mutex_unlock(&cp->va_lock);
 		weston_log("[capture proxy]: Failed to create shm source surface.\n");
-		goto error_data_pointer;
+		free(sb);
+		return -1;
 	}
 
-	status = vaDeriveImage(cp->va_dpy, src_surface, &rgb_image);
+	status = vaDeriveImage(cp->va_dpy, sb->surface, &sb->image);
 	if (status != VA_STATUS_SUCCESS) {
+		vaDestroySurfaces(cp->va_dpy, &sb->surface, 1);
+		pthread_mutex_unlock(&cp->va_lock);
 		weston_log("[capture proxy]: Failed to get shm source image.\n");
-		goto error_source_image;
+		free(sb);
+		return -1;
 	}
+	pthread_mutex_unlock(&cp->va_lock);
+
+	buf->id = sb->surface;
+	buf->priv = sb;
+
+	if (cp->verbose_capture) {
+		weston_log("[capture proxy]: New staging surface %u, %dx%d.\n",
+				sb->surface, buf->width, buf->height);
+	}
+
+	return 0;
+}
 
-	status = vaMapBuffer(cp->va_dpy, rgb_image.buf, &surface_p);
+static void
+staging_destroy(void *data, struct capture_staging_buffer *buf)
+{
+	struct capture_proxy *cp = data;
+	struct capture_proxy_staging_buffer *sb = buf->priv;
+
+	pthread_mutex_lock(&cp->va_lock);
+	vaDestroyImage(cp->va_dpy, sb->image.image_id);
+	vaDestroySurfaces(cp->va_dpy, &sb->surface, 1);
+	pthread_mutex_unlock(&cp->va_lock);
+	free(sb);
+}
+
+static void *
+staging_map(void *data, struct capture_staging_buffer *buf, int *pitch)
+{
+	struct capture_proxy *cp = data;
+	struct capture_proxy_staging_buffer *sb = buf->priv;
+	void *surface_p = NULL;
+	VAStatus status;
+
+	pthread_mutex_lock(&cp->va_lock);
+	status = vaMapBuffer(cp->va_dpy, sb->image.buf, &surface_p);
+	pthread_mutex_unlock(&cp->va_lock);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[capture proxy]: Failed to map shm source image.\n");
-		goto error_map_image;
+		return NULL;
 	}
 
-	/* Shared memory buffer and the VAImage may not have the same stride. */
-	if (rgb_image.pitches[0] == (uint32_t)wl_shm_buffer_get_stride(shm_buffer)) {
-		memcpy(surface_p, shm_buffer_data,
-			wl_shm_buffer_get_height(shm_buffer) * wl_shm_buffer_get_stride(shm_buffer));
-	} else {
-		int i;
-		const char *src = (char *)shm_buffer_data;
-		char *dst = (char *)surface_p;
-		int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
-		int32_t height = wl_shm_buffer_get_height(shm_buffer);
-		size_t count = (size_t)stride <
-			(size_t)(rgb_image.pitches[0]) ?
-			(size_t)stride :
-			(size_t)(rgb_image.pitches[0]);
-
-		for (i = 0; i < height; i++) {
-			memcpy(dst, src, count);
-			src += stride;
-			dst += rgb_image.pitches[0];
-		}
-	}
+	*pitch = sb->image.pitches[0];
+	return surface_p;
+}
+
+static void
+staging_unmap(void *data, struct capture_staging_buffer *buf)
+{
+	struct capture_proxy *cp = data;
+	struct capture_proxy_staging_buffer *sb = buf->priv;
+	VAStatus status;
 
-	status = vaUnmapBuffer(cp->va_dpy, rgb_image.buf);
+	pthread_mutex_lock(&cp->va_lock);
+	status = vaUnmapBuffer(cp->va_dpy, sb->image.buf);
+	pthread_mutex_unlock(&cp->va_lock);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("[capture proxy]: Failed to unmap image.\n");
 	}
+}
+
+static void
+staging_begin_read(void *data, void *source)
+{
+	wl_shm_buffer_begin_access(source);
+}
+
+static void
+staging_end_read(void *data, void *source)
+{
+	wl_shm_buffer_end_access(source);
+}
+
+static const struct capture_staging_ops staging_ops = {
+	staging_create,
+	staging_destroy,
+	staging_map,
+	staging_unmap,
+	staging_begin_read,
+	staging_end_read,
+};
+
+/* Hands the copied frames over to the client, in the order captured. */
+static int
+staging_done(int fd, uint32_t mask, void *data)
+{
+	struct capture_proxy *cp = data;
+	struct capture_staging_buffer *buf;
+	struct capture_proxy_staging_buffer *sb;
+	struct capture_proxy_job *job;
+	VABufferInfo buf_info;
+	VAStatus status;
+	uint32_t timestamp;
+	int frame_count;
+	void *user;
+
+	while ((buf = capture_staging_next_done(cp->staging, &user))) {
+		job = user;
+		sb = buf->priv;
+		timestamp = job->timestamp;
+		frame_count = job->frame_count;
+		capture_proxy_job_free(job);
+
+		if (cp->resource == NULL) {
+			capture_staging_release(cp->staging, buf->id);
+			cp->num_frames_in_flight--;
+			continue;
+		}
+
+		memset(&buf_info, 0, sizeof(buf_info));
+		buf_info.mem_type = VA_SURFACE_ATTRIB_MEM_TYPE_KERNEL_DRM;
+		pthread_mutex_lock(&cp->va_lock);
+		status = vaAcquireBufferHandle(cp->va_dpy, sb->image.buf,
+				&buf_info);
+		pthread_mutex_unlock(&cp->va_lock);
+		if (status != VA_STATUS_SUCCESS) {
+			weston_log("[capture proxy]: Failed to acquire buffer handle.\n");
+			capture_staging_release(cp->staging, buf->id);
+			cp->num_frames_in_flight--;
+			continue;
+		}
+
+		ias_hmi_send_raw_buffer_handle(cp->resource, buf_info.handle,
+			timestamp, frame_count, sb->image.pitches[0], 0, 0, 0,
+			cp->width, cp->height, sb->surface, sb->image.buf,
+			sb->image.image_id);
+	}
 
-	memset(&buf_info, 0, sizeof(buf_info));
-	buf_info.mem_type = VA_SURFACE_ATTRIB_MEM_TYPE_KERNEL_DRM;
-	status = vaAcquireBufferHandle(cp->va_dpy, rgb_image.buf, &buf_info);
-	wl_shm_buffer_end_access(shm_buffer);
+	return 0;
+}
+
+static int
+capture_proxy_staging_init(struct capture_proxy *cp)
+{
+	struct wl_event_loop *loop;
+
+	cp->staging = capture_staging_create(&staging_ops, cp,
+			CAPTURE_STAGING_MAX_BUFFERS);
+	if (!cp->staging) {
+		weston_log("[capture proxy]: Failed to create staging pool.\n");
+		return -1;
+	}
 
-	ias_hmi_send_raw_buffer_handle(cp->resource, buf_info.handle, timestamp,
-		cp->frame_count, rgb_image.pitches[0], 0, 0, 0,
-		cp->width, cp->height, src_surface, rgb_image.buf,
-		rgb_image.image_id);
+	loop = wl_display_get_event_loop(wl_client_get_display(cp->client));
+	cp->staging_source = wl_event_loop_add_fd(loop,
+			capture_staging_get_fd(cp->staging), WL_EVENT_READABLE,
+			staging_done, cp);
+	if (!cp->staging_source) {
+		capture_staging_destroy(cp->staging);
+		cp->staging = NULL;
+		return -1;
+	}
 
 	return 0;
+}
+
+/* The shm pool goes away with the last buffer using it, so a copy still
+ * reading from it has to finish first. */
+static void
+handle_job_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+	struct capture_proxy_job *job =
+		container_of(listener, struct capture_proxy_job,
+				buffer_destroy_listener);
+
+	wl_list_remove(&listener->link);
+	wl_list_init(&listener->link);
+	capture_staging_wait_idle(job->cp->staging);
+}
+
+void
+capture_proxy_damage(struct capture_proxy *cp, int32_t x, int32_t y,
+		int32_t width, int32_t height)
+{
+	struct capture_staging_rect rect;
 
-error_map_image:
-	vaDestroyImage(cp->va_dpy, rgb_image.image_id);
-error_source_image:
-	vaDestroySurfaces(cp->va_dpy, &src_surface, 1);
-error_data_pointer:
-	wl_shm_buffer_end_access(shm_buffer);
-	return -1;
+	/* Without a pool, every staging surface starts out fully damaged. */
+	if (!cp || !cp->staging) {
+		return;
+	}
+
+	rect.x1 = x;
+	rect.y1 = y;
+	rect.x2 = x + width;
+	rect.y2 = y + height;
+	capture_staging_damage(cp->staging, &rect);
+}
+
+/* Queues the frame to be copied into a staging surface off the compositor
+ * thread; staging_done() sends it on once that's done. Frames that can't
+ * be captured, but don't stop later ones from being, return a positive
+ * error and are skipped. */
+static int
+capture_proxy_shm_frame(struct capture_proxy * const cp,
+		struct weston_buffer * const buffer, uint32_t timestamp)
+{
+	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer->resource);
+	struct capture_staging_frame frame;
+	struct capture_proxy_job *job;
+	uint32_t shm_format;
+	int ret;
+
+	shm_format = wl_shm_buffer_get_format(shm_buffer);
+	if (shm_format != WL_SHM_FORMAT_XRGB8888 && shm_format != WL_SHM_FORMAT_ARGB8888 &&
+		shm_format != WL_SHM_FORMAT_RGB565) {
+		weston_log("[capture proxy]: shm buffer not of RGB32 type.\n");
+		return ENOTSUP;
+	}
+
+	if (!cp->staging && capture_proxy_staging_init(cp) < 0) {
+		return -1;
+	}
+
+	job = zalloc(sizeof(*job));
+	if (!job) {
+		return -1;
+	}
+
+	job->cp = cp;
+	job->timestamp = timestamp;
+	job->frame_count = cp->frame_count;
+	weston_buffer_reference(&job->buffer_ref, buffer);
+	job->buffer_destroy_listener.notify = handle_job_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &job->buffer_destroy_listener);
+
+	frame.pixels = wl_shm_buffer_get_data(shm_buffer);
+	frame.stride = wl_shm_buffer_get_stride(shm_buffer);
+	frame.width = wl_shm_buffer_get_width(shm_buffer);
+	frame.height = wl_shm_buffer_get_height(shm_buffer);
+	frame.cpp = shm_format == WL_SHM_FORMAT_RGB565 ? 2 : 4;
+	frame.source = shm_buffer;
+	frame.user = job;
+
+	if (frame.pixels == NULL) {
+		weston_log("[capture proxy]: Failed to get data pointer from shm_buffer.\n");
+		capture_proxy_job_free(job);
+		return ENOTSUP;
+	}
+
+	ret = capture_staging_submit(cp->staging, &frame);
+	if (ret != 0) {
+		capture_proxy_job_free(job);
+	}
+
+	return ret;
 }
 
 int
 capture_proxy_handle_frame(struct capture_proxy * const cp,
-		struct wl_shm_buffer * const shm_buffer, int prime_fd, int stride,
+		struct weston_buffer * const buffer, int prime_fd, int stride,
 		enum capture_proxy_format format, uint32_t timestamp)
 {
+	int ret;
+
 	if (cp->resource == NULL) {
 		weston_log("[capture proxy]: No client to receive frame.\n");
-		if (prime_fd >= 0) {
-			close(prime_fd);
-		}
 		return -1;
 	}
 
-	if (cp->num_frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+	if (cp->num_frames_in_flight >= cp->max_frames_in_flight) {
 		weston_log("[capture proxy]: Too many frames in flight.\n");
-		if (prime_fd >= 0) {
-			close(prime_fd);
-		}
 		return EBUSY;
 	}
 
@@ -287,14 +538,17 @@ capture_proxy_handle_frame(struct capture_proxy * const cp,
 		ias_hmi_send_raw_buffer_fd(cp->resource, prime_fd, timestamp,
 				cp->frame_count, stride,
 				0, 0, format, cp->width, cp->height);
-		close(prime_fd);
-	} else if (shm_buffer) {
-		capture_proxy_shm_frame(cp, shm_buffer, stride, format, timestamp);
+	} else if (buffer && wl_shm_buffer_get(buffer->resource)) {
+		ret = capture_proxy_shm_frame(cp, buffer, timestamp);
+		if (ret != 0) {
+			return ret;
+		}
 	} else {
 		weston_log("[capture proxy]: Unsupported buffer type.\n");
 	}
 	cp->frame_count++;
 	cp->num_frames_in_flight++;
+	cp->stats.captured++;
 
 	return 0;
 }
@@ -309,23 +563,20 @@ capture_proxy_release_buffer(struct capture_proxy *cp, uint32_t surfid,
 		if (surfid) {
 			VABufferID buf_id = bufid;
 			VASurfaceID surface_id = surfid;
-			VAImageID image_id = imageid;
 
+			pthread_mutex_lock(&cp->va_lock);
 			status = vaReleaseBufferHandle(cp->va_dpy, buf_id);
+			pthread_mutex_unlock(&cp->va_lock);
 			if (status != VA_STATUS_SUCCESS) {
 				weston_log("[capture proxy release]: Failed to release handle for buffer %u.\n",
 						bufid);
 			}
 
-			status = vaDestroyImage(cp->va_dpy, image_id);
-			if (status != VA_STATUS_SUCCESS) {
-				weston_log("[capture proxy]: Failed to destroy image.\n");
-			}
-
-			status = vaDestroySurfaces(cp->va_dpy, &surface_id, 1);
-			if (status != VA_STATUS_SUCCESS) {
-				weston_log("[capture proxy release]: Failed to destroy surface %u.\n",
-						surfid);
+			/* The surface goes back to the pool for a later frame. */
+			if (!cp->staging ||
+			    capture_staging_release(cp->staging, surface_id) < 0) {
+				weston_log("[capture proxy release]: Unknown surface %u, image %u.\n",
+						surfid, imageid);
 			}
 		}
 	} else {
@@ -378,29 +629,132 @@ capture_proxy_set_verbose(struct capture_proxy *cp, int verbose)
 	}
 }
 
-int
-vsync_received(struct capture_proxy *cp)
+void
+vsync_notify(struct capture_proxy *cp)
 {
 	if (cp) {
-		return cp->num_vsyncs;
-	} else {
-		return 0;
+		cp->frames_since_vsync = 0;
 	}
 }
 
 void
-vsync_notify(struct capture_proxy *cp)
+capture_proxy_set_rate(struct capture_proxy *cp, uint32_t target_fps,
+		uint32_t max_burst, uint32_t max_in_flight,
+		enum capture_proxy_policy policy)
 {
-	if (cp) {
-		cp->num_vsyncs++;
+	if (!cp) {
+		return;
+	}
+
+	cp->target_fps = target_fps;
+	cp->max_burst = max_burst ? max_burst : DEFAULT_MAX_BURST;
+	cp->max_frames_in_flight = max_in_flight ?
+		(int)max_in_flight : MAX_FRAMES_IN_FLIGHT;
+	cp->policy = policy;
+	cp->frames_since_vsync = 0;
+	cp->credit_time_ns = 0;
+	cp->deferred = 0;
+
+	if (cp->verbose_capture) {
+		weston_log("[capture proxy]: Rate %u fps, burst %u, "
+				"%d frames in flight, %s.\n",
+				cp->target_fps, cp->max_burst,
+				cp->max_frames_in_flight,
+				cp->policy == CP_POLICY_LATEST ?
+					"sending latest" : "dropping");
+	}
+}
+
+static int
+governor_has_budget(struct capture_proxy *cp)
+{
+	struct timespec now_spec;
+	int64_t now, interval, max_credit;
+
+	if (cp->target_fps == 0) {
+		return cp->frames_since_vsync < cp->max_burst;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now_spec);
+	now = timespec_to_nsec(&now_spec);
+	interval = NS_IN_SEC / cp->target_fps;
+	max_credit = interval * cp->max_burst;
+
+	if (cp->credit_time_ns == 0) {
+		cp->credit_ns = max_credit;
+	} else {
+		cp->credit_ns += now - cp->credit_time_ns;
+		if (cp->credit_ns > max_credit) {
+			cp->credit_ns = max_credit;
+		}
+	}
+	cp->credit_time_ns = now;
+
+	return cp->credit_ns >= interval;
+}
+
+static void
+governor_consume(struct capture_proxy *cp)
+{
+	if (cp->target_fps == 0) {
+		cp->frames_since_vsync++;
+	} else {
+		cp->credit_ns -= NS_IN_SEC / cp->target_fps;
+	}
+}
+
+enum capture_proxy_decision
+capture_proxy_govern_frame(struct capture_proxy *cp)
+{
+	if (!cp) {
+		return CP_SKIP_BUSY;
+	}
+
+	/* Frames that the client could only queue up and drop are better
+	 * not exported in the first place. */
+	if (cp->num_frames_in_flight >= cp->max_frames_in_flight) {
+		cp->stats.skipped_busy++;
+		cp->deferred = (cp->policy == CP_POLICY_LATEST);
+		return CP_SKIP_BUSY;
 	}
+
+	if (!governor_has_budget(cp)) {
+		cp->stats.skipped_rate++;
+		cp->deferred = (cp->policy == CP_POLICY_LATEST);
+		return CP_SKIP_RATE;
+	}
+
+	governor_consume(cp);
+	cp->deferred = 0;
+	return CP_CAPTURE;
+}
+
+int
+capture_proxy_take_deferred(struct capture_proxy *cp)
+{
+	if (!cp || !cp->deferred) {
+		return 0;
+	}
+
+	if (cp->num_frames_in_flight >= cp->max_frames_in_flight ||
+			!governor_has_budget(cp)) {
+		return 0;
+	}
+
+	governor_consume(cp);
+	cp->deferred = 0;
+	cp->stats.deferred++;
+	return 1;
 }
 
 void
-clear_vsyncs(struct capture_proxy *cp)
+capture_proxy_get_stats(struct capture_proxy *cp,
+		struct capture_proxy_stats *stats)
 {
 	if (cp) {
-		cp->num_vsyncs = 0;
+		*stats = cp->stats;
+	} else {
+		memset(stats, 0, sizeof(*stats));
 	}
 }
 
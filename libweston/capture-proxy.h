@@ -33,25 +33,49 @@
 
 
 struct capture_proxy;
-struct wl_shm_buffer;
+struct weston_buffer;
 
 enum capture_proxy_format {
 	CP_FORMAT_RGB,
 	CP_FORMAT_NV12,
 };
 
+/* What to do with frames that the rate governor skips. */
+enum capture_proxy_policy {
+	CP_POLICY_DROP,
+	CP_POLICY_LATEST,	/* send the latest skipped frame at the next vsync */
+};
+
+enum capture_proxy_decision {
+	CP_CAPTURE,
+	CP_SKIP_RATE,		/* over the frame rate budget */
+	CP_SKIP_BUSY,		/* client has too many frames in flight */
+};
+
+struct capture_proxy_stats {
+	uint32_t captured;
+	uint32_t skipped_rate;
+	uint32_t skipped_busy;
+	uint32_t deferred;
+};
+
 struct capture_proxy *
 capture_proxy_create(int drm_fd, struct wl_client *client);
 void
 capture_proxy_set_size(struct capture_proxy *cp, int width, int height);
 void
 capture_proxy_destroy(struct capture_proxy *cp);
+/* prime_fd is not consumed; the caller still owns it afterwards. shm
+ * buffers are copied asynchronously and kept referenced until then. */
 int
 capture_proxy_handle_frame(struct capture_proxy *cp,
-		struct wl_shm_buffer *shm_buffer,
+		struct weston_buffer *buffer,
 		int prime_fd, int stride,
 		enum capture_proxy_format format,
 		uint32_t timestamp);
+void
+capture_proxy_damage(struct capture_proxy *cp, int32_t x, int32_t y,
+		int32_t width, int32_t height);
 int
 capture_proxy_release_buffer(struct capture_proxy *cp, uint32_t surfid,
 								uint32_t bufid, uint32_t imageid);
@@ -63,12 +87,19 @@ void
 capture_proxy_set_verbose(struct capture_proxy *cp, int verbose);
 int
 capture_proxy_verbose_is_enabled(struct capture_proxy *cp);
-int
-vsync_received(struct capture_proxy *cp);
 void
 vsync_notify(struct capture_proxy *cp);
 void
-clear_vsyncs(struct capture_proxy *cp);
+capture_proxy_set_rate(struct capture_proxy *cp, uint32_t target_fps,
+		uint32_t max_burst, uint32_t max_in_flight,
+		enum capture_proxy_policy policy);
+enum capture_proxy_decision
+capture_proxy_govern_frame(struct capture_proxy *cp);
+int
+capture_proxy_take_deferred(struct capture_proxy *cp);
+void
+capture_proxy_get_stats(struct capture_proxy *cp,
+		struct capture_proxy_stats *stats);
 int
 capture_get_frame_count(struct capture_proxy *cp);
 void
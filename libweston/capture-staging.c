@@ -0,0 +1,527 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "capture-staging.h"
+
+struct capture_staging {
+	const struct capture_staging_ops *ops;
+	void *data;
+
+	int max_buffers;
+	int n_buffers;
+	struct capture_staging_buffer *buffers[CAPTURE_STAGING_MAX_BUFFERS];
+
+	/* Size of the frames currently captured */
+	int width, height;
+	uint32_t next_seq;
+
+	/* Buffers in the COPYING state; the copy thread works on the one
+	 * with the lowest seq first. Buffer states and the buffers array are
+	 * changed under lock, the stale damage is only ever touched by the
+	 * submitting thread. */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t idle_cond;
+	int running;
+	int pending;
+
+	/* Readable when a copied frame is ready to be collected */
+	int event_fd;
+
+	struct capture_staging_stats stats;
+};
+
+static int
+rect_is_empty(const struct capture_staging_rect *r)
+{
+	return r->x1 >= r->x2 || r->y1 >= r->y2;
+}
+
+static int
+rect_contains(const struct capture_staging_rect *outer,
+	      const struct capture_staging_rect *inner)
+{
+	return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+	       outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+static void
+damage_add(struct capture_staging_damage *damage,
+	   const struct capture_staging_rect *rect)
+{
+	struct capture_staging_rect *ext;
+	int i;
+
+	if (rect_is_empty(rect))
+		return;
+
+	for (i = 0; i < damage->n_rects; i++) {
+		if (rect_contains(&damage->rects[i], rect))
+			return;
+	}
+
+	if (damage->n_rects < CAPTURE_STAGING_MAX_RECTS) {
+		damage->rects[damage->n_rects++] = *rect;
+		return;
+	}
+
+	/* Too fragmented; fall back to the bounding box */
+	ext = &damage->rects[0];
+	for (i = 1; i < damage->n_rects; i++) {
+		struct capture_staging_rect *r = &damage->rects[i];
+
+		if (r->x1 < ext->x1)
+			ext->x1 = r->x1;
+		if (r->y1 < ext->y1)
+			ext->y1 = r->y1;
+		if (r->x2 > ext->x2)
+			ext->x2 = r->x2;
+		if (r->y2 > ext->y2)
+			ext->y2 = r->y2;
+	}
+	if (rect->x1 < ext->x1)
+		ext->x1 = rect->x1;
+	if (rect->y1 < ext->y1)
+		ext->y1 = rect->y1;
+	if (rect->x2 > ext->x2)
+		ext->x2 = rect->x2;
+	if (rect->y2 > ext->y2)
+		ext->y2 = rect->y2;
+	damage->n_rects = 1;
+}
+
+static void
+damage_clip(struct capture_staging_damage *dst,
+	    const struct capture_staging_damage *src, int width, int height)
+{
+	struct capture_staging_rect r;
+	int i;
+
+	dst->n_rects = 0;
+	for (i = 0; i < src->n_rects; i++) {
+		r = src->rects[i];
+		if (r.x1 < 0)
+			r.x1 = 0;
+		if (r.y1 < 0)
+			r.y1 = 0;
+		if (r.x2 > width)
+			r.x2 = width;
+		if (r.y2 > height)
+			r.y2 = height;
+		if (!rect_is_empty(&r))
+			dst->rects[dst->n_rects++] = r;
+	}
+}
+
+static uint64_t
+copy_damage(struct capture_staging *cs, struct capture_staging_buffer *buf)
+{
+	const struct capture_staging_rect *r;
+	const char *src;
+	char *dst, *map;
+	uint64_t bytes = 0;
+	size_t len;
+	int pitch, i, y;
+
+	if (buf->copy.n_rects == 0)
+		return 0;
+
+	map = cs->ops->map(cs->data, buf, &pitch);
+	if (!map)
+		return 0;
+
+	if (cs->ops->begin_read)
+		cs->ops->begin_read(cs->data, buf->source);
+
+	for (i = 0; i < buf->copy.n_rects; i++) {
+		r = &buf->copy.rects[i];
+		len = (size_t)(r->x2 - r->x1) * buf->cpp;
+		src = (const char *)buf->pixels + (size_t)r->y1 * buf->stride +
+		      (size_t)r->x1 * buf->cpp;
+		dst = map + (size_t)r->y1 * pitch + (size_t)r->x1 * buf->cpp;
+
+		for (y = r->y1; y < r->y2; y++) {
+			memcpy(dst, src, len);
+			src += buf->stride;
+			dst += pitch;
+		}
+		bytes += len * (r->y2 - r->y1);
+	}
+
+	if (cs->ops->end_read)
+		cs->ops->end_read(cs->data, buf->source);
+
+	cs->ops->unmap(cs->data, buf);
+
+	return bytes;
+}
+
+static struct capture_staging_buffer *
+oldest_in_state(struct capture_staging *cs,
+		enum capture_staging_buffer_state state)
+{
+	struct capture_staging_buffer *oldest = NULL;
+	int i;
+
+	for (i = 0; i < cs->n_buffers; i++) {
+		struct capture_staging_buffer *buf = cs->buffers[i];
+
+		if (buf->state != state)
+			continue;
+		/* seq wraps around, compare the difference */
+		if (!oldest || (int32_t)(buf->seq - oldest->seq) < 0)
+			oldest = buf;
+	}
+
+	return oldest;
+}
+
+static void *
+copy_thread_func(void *data)
+{
+	struct capture_staging *cs = data;
+	struct capture_staging_buffer *buf;
+	uint64_t bytes, one = 1;
+
+	pthread_mutex_lock(&cs->lock);
+	while (cs->running) {
+		buf = oldest_in_state(cs, CS_BUFFER_COPYING);
+		if (!buf) {
+			pthread_cond_wait(&cs->work_cond, &cs->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&cs->lock);
+		bytes = copy_damage(cs, buf);
+		pthread_mutex_lock(&cs->lock);
+
+		buf->state = CS_BUFFER_DONE;
+		cs->stats.bytes_copied += bytes;
+		cs->pending--;
+		pthread_cond_broadcast(&cs->idle_cond);
+
+		if (write(cs->event_fd, &one, sizeof(one)) < 0) {
+			/* The counter can't overflow in practice */
+		}
+	}
+	pthread_mutex_unlock(&cs->lock);
+
+	return NULL;
+}
+
+struct capture_staging *
+capture_staging_create(const struct capture_staging_ops *ops, void *data,
+		       int max_buffers)
+{
+	struct capture_staging *cs;
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs)
+		return NULL;
+
+	cs->ops = ops;
+	cs->data = data;
+	cs->max_buffers = max_buffers;
+	if (cs->max_buffers <= 0 ||
+	    cs->max_buffers > CAPTURE_STAGING_MAX_BUFFERS)
+		cs->max_buffers = CAPTURE_STAGING_MAX_BUFFERS;
+
+	cs->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cs->event_fd < 0)
+		goto err_free;
+
+	pthread_mutex_init(&cs->lock, NULL);
+	pthread_cond_init(&cs->work_cond, NULL);
+	pthread_cond_init(&cs->idle_cond, NULL);
+
+	cs->running = 1;
+	if (pthread_create(&cs->thread, NULL, copy_thread_func, cs) != 0)
+		goto err_thread;
+
+	return cs;
+
+err_thread:
+	pthread_cond_destroy(&cs->idle_cond);
+	pthread_cond_destroy(&cs->work_cond);
+	pthread_mutex_destroy(&cs->lock);
+	close(cs->event_fd);
+err_free:
+	free(cs);
+	return NULL;
+}
+
+/* Takes a buffer out of the pool, called with the lock held. It is
+ * destroyed with buffer_destroy() once the lock has been dropped. */
+static struct capture_staging_buffer *
+buffer_detach(struct capture_staging *cs, int index)
+{
+	struct capture_staging_buffer *buf = cs->buffers[index];
+
+	cs->n_buffers--;
+	cs->buffers[index] = cs->buffers[cs->n_buffers];
+	cs->buffers[cs->n_buffers] = NULL;
+
+	return buf;
+}
+
+static void
+buffer_destroy(struct capture_staging *cs, struct capture_staging_buffer *buf)
+{
+	cs->ops->destroy(cs->data, buf);
+	free(buf);
+}
+
+void
+capture_staging_destroy(struct capture_staging *cs)
+{
+	if (!cs)
+		return;
+
+	pthread_mutex_lock(&cs->lock);
+	cs->running = 0;
+	pthread_cond_signal(&cs->work_cond);
+	pthread_mutex_unlock(&cs->lock);
+	pthread_join(cs->thread, NULL);
+
+	while (cs->n_buffers > 0)
+		buffer_destroy(cs, buffer_detach(cs, cs->n_buffers - 1));
+
+	pthread_cond_destroy(&cs->idle_cond);
+	pthread_cond_destroy(&cs->work_cond);
+	pthread_mutex_destroy(&cs->lock);
+	close(cs->event_fd);
+	free(cs);
+}
+
+/*
+ * Marks an area of the captured surface, in buffer coordinates, as
+ * changed. Needs to be called for every change, including those of
+ * frames that are not captured, before the next frame is submitted.
+ */
+void
+capture_staging_damage(struct capture_staging *cs,
+		       const struct capture_staging_rect *rect)
+{
+	int i;
+
+	for (i = 0; i < cs->n_buffers; i++)
+		damage_add(&cs->buffers[i]->stale, rect);
+}
+
+static struct capture_staging_buffer *
+buffer_create(struct capture_staging *cs)
+{
+	struct capture_staging_buffer *buf;
+	struct capture_staging_rect all = { 0, 0, cs->width, cs->height };
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	buf->width = cs->width;
+	buf->height = cs->height;
+	if (cs->ops->create(cs->data, buf) < 0) {
+		free(buf);
+		return NULL;
+	}
+
+	/* Nothing in a new buffer is up to date */
+	damage_add(&buf->stale, &all);
+
+	pthread_mutex_lock(&cs->lock);
+	cs->buffers[cs->n_buffers++] = buf;
+	cs->stats.buffers_created++;
+	pthread_mutex_unlock(&cs->lock);
+
+	return buf;
+}
+
+/*
+ * Queues a frame to be copied into a free staging buffer. Only what
+ * changed since that buffer was last filled is copied. The frame's pixels
+ * must stay valid and unchanged until the copy is done, see
+ * capture_staging_wait_idle().
+ *
+ * Returns 0 on success, EBUSY if all buffers are in use and -1 on error.
+ */
+int
+capture_staging_submit(struct capture_staging *cs,
+		       const struct capture_staging_frame *frame)
+{
+	struct capture_staging_buffer *buf = NULL;
+	struct capture_staging_buffer *dropped[CAPTURE_STAGING_MAX_BUFFERS];
+	int n_dropped = 0;
+	int i;
+
+	pthread_mutex_lock(&cs->lock);
+	if (frame->width != cs->width || frame->height != cs->height) {
+		cs->width = frame->width;
+		cs->height = frame->height;
+
+		/* Buffers of the old size are dropped as they come free */
+		for (i = cs->n_buffers - 1; i >= 0; i--) {
+			if (cs->buffers[i]->state == CS_BUFFER_FREE)
+				dropped[n_dropped++] = buffer_detach(cs, i);
+			else
+				cs->buffers[i]->orphaned = 1;
+		}
+	}
+
+	for (i = 0; i < cs->n_buffers; i++) {
+		if (cs->buffers[i]->state == CS_BUFFER_FREE) {
+			buf = cs->buffers[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cs->lock);
+
+	for (i = 0; i < n_dropped; i++)
+		buffer_destroy(cs, dropped[i]);
+
+	if (!buf) {
+		if (cs->n_buffers >= cs->max_buffers)
+			return EBUSY;
+
+		buf = buffer_create(cs);
+		if (!buf)
+			return -1;
+	}
+
+	damage_clip(&buf->copy, &buf->stale, cs->width, cs->height);
+	buf->stale.n_rects = 0;
+
+	buf->pixels = frame->pixels;
+	buf->stride = frame->stride;
+	buf->cpp = frame->cpp;
+	buf->source = frame->source;
+	buf->user = frame->user;
+
+	pthread_mutex_lock(&cs->lock);
+	buf->seq = cs->next_seq++;
+	buf->state = CS_BUFFER_COPYING;
+	cs->pending++;
+	cs->stats.frames++;
+	pthread_cond_signal(&cs->work_cond);
+	pthread_mutex_unlock(&cs->lock);
+
+	return 0;
+}
+
+/* Polls readable when capture_staging_next_done() has a frame to return. */
+int
+capture_staging_get_fd(struct capture_staging *cs)
+{
+	return cs->event_fd;
+}
+
+/*
+ * Returns the next copied frame, in submission order, along with the user
+ * pointer it was submitted with, or NULL if none is ready. The buffer is
+ * then considered with the client until capture_staging_release().
+ */
+struct capture_staging_buffer *
+capture_staging_next_done(struct capture_staging *cs, void **user)
+{
+	struct capture_staging_buffer *buf, *copying;
+	uint64_t count;
+
+	while (read(cs->event_fd, &count, sizeof(count)) > 0)
+		;
+
+	pthread_mutex_lock(&cs->lock);
+	buf = oldest_in_state(cs, CS_BUFFER_DONE);
+	copying = oldest_in_state(cs, CS_BUFFER_COPYING);
+	/* Don't overtake a frame still being copied */
+	if (buf && copying && (int32_t)(copying->seq - buf->seq) < 0)
+		buf = NULL;
+	if (buf)
+		buf->state = CS_BUFFER_SENT;
+	pthread_mutex_unlock(&cs->lock);
+
+	if (buf && user)
+		*user = buf->user;
+
+	return buf;
+}
+
+/* Returns a buffer handed out by capture_staging_next_done() to the pool. */
+int
+capture_staging_release(struct capture_staging *cs, uint32_t id)
+{
+	struct capture_staging_buffer *orphan = NULL;
+	int i, ret = -1;
+
+	pthread_mutex_lock(&cs->lock);
+	for (i = 0; i < cs->n_buffers; i++) {
+		struct capture_staging_buffer *buf = cs->buffers[i];
+
+		if (buf->id != id || buf->state != CS_BUFFER_SENT)
+			continue;
+
+		if (buf->orphaned)
+			orphan = buffer_detach(cs, i);
+		else
+			buf->state = CS_BUFFER_FREE;
+
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&cs->lock);
+
+	if (orphan)
+		buffer_destroy(cs, orphan);
+
+	return ret;
+}
+
+/* Waits until all submitted frames have been copied. */
+void
+capture_staging_wait_idle(struct capture_staging *cs)
+{
+	pthread_mutex_lock(&cs->lock);
+	while (cs->pending > 0)
+		pthread_cond_wait(&cs->idle_cond, &cs->lock);
+	pthread_mutex_unlock(&cs->lock);
+}
+
+void
+capture_staging_get_stats(struct capture_staging *cs,
+			  struct capture_staging_stats *stats)
+{
+	pthread_mutex_lock(&cs->lock);
+	*stats = cs->stats;
+	pthread_mutex_unlock(&cs->lock);
+}
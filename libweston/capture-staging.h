@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CAPTURE_STAGING_H_
+#define _CAPTURE_STAGING_H_
+
+#include <stdint.h>
+
+/*
+ * Pool of staging buffers that captured shm frames are copied into before
+ * being handed to the capture client. Buffers are reused once the client
+ * releases them, and only the parts of a buffer that changed since it was
+ * last filled are copied again. The copies run on a thread of their own.
+ *
+ * The buffers themselves come from a capture_staging_ops implementation;
+ * capture-proxy.c uses VA surfaces.
+ */
+
+#define CAPTURE_STAGING_MAX_BUFFERS 8
+
+/* Beyond this many rectangles, damage is tracked as its bounding box */
+#define CAPTURE_STAGING_MAX_RECTS 16
+
+struct capture_staging;
+
+struct capture_staging_rect {
+	int32_t x1, y1, x2, y2;
+};
+
+struct capture_staging_damage {
+	int n_rects;
+	struct capture_staging_rect rects[CAPTURE_STAGING_MAX_RECTS];
+};
+
+enum capture_staging_buffer_state {
+	CS_BUFFER_FREE,
+	CS_BUFFER_COPYING,	/* queued for or being filled by the copy thread */
+	CS_BUFFER_DONE,		/* filled, not yet collected */
+	CS_BUFFER_SENT,		/* with the client until released */
+};
+
+struct capture_staging_buffer {
+	/* Filled in by ops->create; id identifies the buffer on release */
+	uint32_t id;
+	void *priv;
+
+	int width, height;
+	enum capture_staging_buffer_state state;
+
+	/* Areas that changed since the buffer was last filled */
+	struct capture_staging_damage stale;
+
+	/* Fill order, so that frames are collected in submission order */
+	uint32_t seq;
+	/* Created for an earlier frame size, destroy once released */
+	int orphaned;
+
+	/* The frame being copied into the buffer */
+	const void *pixels;
+	int stride, cpp;
+	void *source;
+	void *user;
+	struct capture_staging_damage copy;
+};
+
+/*
+ * create and destroy are called on the submitting thread, the others on
+ * the copy thread, possibly at the same time; anything they share needs
+ * locking of its own.
+ */
+struct capture_staging_ops {
+	/* Allocates the storage for buf->width x buf->height pixels. */
+	int (*create)(void *data, struct capture_staging_buffer *buf);
+	void (*destroy)(void *data, struct capture_staging_buffer *buf);
+
+	/* Called on the copy thread around writing into a buffer. */
+	void *(*map)(void *data, struct capture_staging_buffer *buf,
+		     int *pitch);
+	void (*unmap)(void *data, struct capture_staging_buffer *buf);
+
+	/* Called on the copy thread around reading a frame's pixels.
+	 * Optional. */
+	void (*begin_read)(void *data, void *source);
+	void (*end_read)(void *data, void *source);
+};
+
+struct capture_staging_frame {
+	const void *pixels;
+	int stride;
+	int width, height;
+	int cpp;		/* bytes per pixel */
+	void *source;		/* handed to begin_read/end_read */
+	void *user;		/* handed back by capture_staging_next_done */
+};
+
+struct capture_staging_stats {
+	uint32_t frames;
+	uint32_t buffers_created;
+	uint64_t bytes_copied;
+};
+
+struct capture_staging *
+capture_staging_create(const struct capture_staging_ops *ops, void *data,
+		       int max_buffers);
+void
+capture_staging_destroy(struct capture_staging *cs);
+void
+capture_staging_damage(struct capture_staging *cs,
+		       const struct capture_staging_rect *rect);
+int
+capture_staging_submit(struct capture_staging *cs,
+		       const struct capture_staging_frame *frame);
+int
+capture_staging_get_fd(struct capture_staging *cs);
+struct capture_staging_buffer *
+capture_staging_next_done(struct capture_staging *cs, void **user);
+int
+capture_staging_release(struct capture_staging *cs, uint32_t id);
+void
+capture_staging_wait_idle(struct capture_staging *cs);
+void
+capture_staging_get_stats(struct capture_staging *cs,
+			  struct capture_staging_stats *stats);
+
+#endif /* _CAPTURE_STAGING_H_ */
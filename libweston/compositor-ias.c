@@ -123,6 +123,7 @@ static int vm_exec = 0;
 static int vm_dbg = 0;
 static int vm_unexport_delay = HYPER_DMABUF_UNEXPORT_DELAY;
 static int vm_share_only = 1;
+static int vm_delta_keyframe = 0;
 static char vm_plugin_path[256];
 static char vm_plugin_args[256];
 
@@ -149,13 +150,19 @@ static int use_rbc = 0;
 static int rbc_debug = 0;
 static int damage_outputs_on_init = 1;
 static int use_cursor_as_uplane = 0;
-
-TRACING_DECLARATIONS;
+static int auto_sprites = 1;
 
 #define SYSFS_LOCATION "/sys/module/emgd"
 #define SYSFS_BUF_SIZE 100
 #define SYSFS_CRTCID_ADJUSTMENT 3
 
+/*
+ * Views from the top of an output that may go on free sprites, and the
+ * atomic test commits spent per frame finding where they fit.
+ */
+#define IAS_AUTO_SPRITE_MAX_VIEWS 16
+#define IAS_AUTO_SPRITE_MAX_TESTS 8
+
 
 /* Config element handler functions */
 void backend_begin(void *userdata, const char **attrs);
@@ -1079,11 +1086,55 @@ ias_crtc* ias_crtc_create(struct ias_backend *backend)
 	return ias_crtc;
 }
 
+/*
+ * Sets up the plane solver if the output model left sprites free for
+ * client buffers and can test what goes on them.
+ */
+static void
+ias_crtc_init_plane_solver(struct ias_crtc *ias_crtc)
+{
+	struct ias_sprite *sprite;
+	int n_sprites = 0;
+
+	if (!ias_crtc->output_model->test_sprites) {
+		return;
+	}
+
+	wl_list_for_each(sprite, &ias_crtc->sprite_list, link) {
+		if (sprite->output_id < 0) {
+			n_sprites++;
+		}
+	}
+
+	if (n_sprites == 0) {
+		return;
+	}
+
+	if (n_sprites > PLANE_SOLVER_MAX_SPRITES) {
+		n_sprites = PLANE_SOLVER_MAX_SPRITES;
+	}
+
+	ias_crtc->plane_solver = plane_solver_create(IAS_AUTO_SPRITE_MAX_VIEWS,
+			n_sprites, IAS_AUTO_SPRITE_MAX_TESTS);
+	if (!ias_crtc->plane_solver) {
+		IAS_ERROR("Failed to create plane solver: out of memory");
+		return;
+	}
+
+	weston_log("CRTC %d: %d sprites free for client buffers\n",
+			ias_crtc->crtc_id, n_sprites);
+}
+
 static void
 ias_crtc_destroy(struct ias_crtc *ias_crtc)
 {
 	drmModeCrtcPtr origcrtc = ias_crtc->original_crtc;
 
+	if (ias_crtc->plane_solver) {
+		plane_solver_destroy(ias_crtc->plane_solver);
+		ias_crtc->plane_solver = NULL;
+	}
+
 	if (ias_crtc->prop_set) {
 		drmModeAtomicFree(ias_crtc->prop_set);
 		ias_crtc->prop_set = NULL;
@@ -2007,6 +2058,266 @@ ias_attempt_cursor_for_view(struct ias_crtc *ias_crtc,
 }
 
 
+struct ias_sprite_candidate {
+	struct weston_view *view;
+	struct ias_fb *fb;
+	int import_failed;
+};
+
+/*
+ * The plane solver's view of the display: the free sprites of a CRTC,
+ * tested through the output model.
+ */
+struct ias_sprite_kms {
+	struct plane_solver_kms base;
+	struct ias_output *output;
+	struct ias_sprite *sprites[PLANE_SOLVER_MAX_SPRITES];
+	int n_sprites;
+	struct ias_sprite_candidate candidates[IAS_AUTO_SPRITE_MAX_VIEWS];
+};
+
+static void
+ias_sprite_release_next(struct ias_sprite *sprite)
+{
+	if (sprite->next) {
+		gbm_bo_destroy(sprite->next->bo);
+		sprite->next = NULL;
+	}
+}
+
+/*
+ * Finds the free sprites, bottom to top.  A sprite given a buffer for a
+ * frame that was never flipped gets it taken back.
+ */
+static void
+ias_sprite_kms_init(struct ias_sprite_kms *kms, struct ias_output *output)
+{
+	struct ias_sprite *sprite;
+
+	memset(kms, 0, sizeof *kms);
+	kms->output = output;
+
+	wl_list_for_each_reverse(sprite, &output->ias_crtc->sprite_list, link) {
+		if (sprite->output_id >= 0 ||
+				kms->n_sprites == PLANE_SOLVER_MAX_SPRITES) {
+			continue;
+		}
+
+		if (!sprite->page_flip_pending) {
+			ias_sprite_release_next(sprite);
+		}
+		kms->sprites[kms->n_sprites++] = sprite;
+	}
+}
+
+/*
+ * Which free sprites could show this view, at the output position in sv?
+ * Only dmabufs shown unscaled and unrotated, entirely within the output,
+ * qualify; the sprite must also support the format, and resolving
+ * compression if needed.
+ */
+static uint32_t
+ias_sprite_mask_for_view(struct ias_sprite_kms *kms, struct weston_view *ev,
+		const struct plane_solver_view *sv)
+{
+	struct ias_output *output = kms->output;
+	struct ias_backend *backend = output->ias_crtc->backend;
+	struct weston_surface *surface = ev->surface;
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	struct linux_dmabuf_buffer *dmabuf;
+	uint32_t format, mask = 0;
+	int resolve_needed = 0;
+	int i, f;
+
+	if (output->rotation || !is_surface_flippable_on_sprite(ev, &output->base)) {
+		return 0;
+	}
+
+	dmabuf = linux_dmabuf_buffer_get(surface->buffer_ref.buffer->resource);
+	if (!dmabuf) {
+		return 0;
+	}
+
+	if ((ev->transform.enabled &&
+			(ev->transform.matrix.type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE)) ||
+			vp->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+			vp->buffer.scale != 1 ||
+			vp->buffer.src_width != wl_fixed_from_int(-1) ||
+			vp->surface.width != -1 ||
+			ev->alpha != 1.0f) {
+		return 0;
+	}
+
+	if (sv->x1 < 0 || sv->y1 < 0 ||
+			sv->x2 > output->base.width || sv->y2 > output->base.height ||
+			sv->x2 - sv->x1 != dmabuf->attributes.width ||
+			sv->y2 - sv->y1 != dmabuf->attributes.height) {
+		return 0;
+	}
+
+	format = dmabuf->attributes.format;
+	for (i = 0; i < dmabuf->attributes.n_planes; i++) {
+		if (dmabuf->attributes.modifier[i] == I915_FORMAT_MOD_Y_TILED_CCS ||
+		    dmabuf->attributes.modifier[i] == I915_FORMAT_MOD_Yf_TILED_CCS) {
+			resolve_needed = 1;
+		}
+	}
+
+	for (i = 0; i < kms->n_sprites; i++) {
+		struct ias_sprite *sprite = kms->sprites[i];
+
+		if (resolve_needed && !(backend->rbc_enabled &&
+					sprite->supports_rbc &&
+					is_rbc_resolve_possible_on_sprite(0, format))) {
+			continue;
+		}
+
+		for (f = 0; f < (int)sprite->count_formats; f++) {
+			if (sprite->formats[f] == format) {
+				mask |= 1 << i;
+				break;
+			}
+		}
+	}
+
+	return mask;
+}
+
+/* Imports the view's buffer for scanout the first time it's needed */
+static struct ias_fb *
+ias_sprite_candidate_get_fb(struct ias_sprite_kms *kms,
+		struct ias_sprite_candidate *candidate)
+{
+	struct ias_backend *backend = kms->output->ias_crtc->backend;
+	struct weston_buffer *buffer = candidate->view->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct gbm_import_fd_data gbm_dmabuf;
+	struct gbm_bo *bo;
+
+	if (candidate->fb || candidate->import_failed) {
+		return candidate->fb;
+	}
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	gbm_dmabuf.fd = dmabuf->attributes.fd[0];
+	gbm_dmabuf.width = dmabuf->attributes.width;
+	gbm_dmabuf.height = dmabuf->attributes.height;
+	gbm_dmabuf.stride = dmabuf->attributes.stride[0];
+	gbm_dmabuf.format = dmabuf->attributes.format;
+
+	bo = gbm_bo_import(backend->gbm, GBM_BO_IMPORT_FD,
+			&gbm_dmabuf, GBM_BO_USE_SCANOUT);
+	if (bo) {
+		candidate->fb = ias_fb_get_from_bo(bo, buffer, kms->output,
+				IAS_FB_OVERLAY);
+		if (!candidate->fb) {
+			gbm_bo_destroy(bo);
+		}
+	}
+
+	if (!candidate->fb) {
+		IAS_DEBUG("Could not import buffer for a sprite");
+		candidate->import_failed = 1;
+	}
+
+	return candidate->fb;
+}
+
+/* Puts a buffer on a sprite, unscaled, at the view's position */
+static void
+ias_sprite_set_next(struct ias_sprite *sprite, struct ias_fb *fb,
+		const struct plane_solver_view *sv)
+{
+	sprite->next = fb;
+	sprite->plane.x = sv->x1;
+	sprite->plane.y = sv->y1;
+	sprite->dest_w = sv->x2 - sv->x1;
+	sprite->dest_h = sv->y2 - sv->y1;
+	sprite->src_x = 0;
+	sprite->src_y = 0;
+	sprite->src_w = sprite->dest_w << 16;
+	sprite->src_h = sprite->dest_h << 16;
+}
+
+static int
+ias_sprite_kms_test(struct plane_solver_kms *base,
+		const struct plane_solver_view *views,
+		const int *sprite, int n_views)
+{
+	struct ias_sprite_kms *kms = container_of(base, struct ias_sprite_kms, base);
+	struct ias_crtc *ias_crtc = kms->output->ias_crtc;
+	struct ias_fb *fb;
+	int i;
+
+	for (i = 0; i < kms->n_sprites; i++) {
+		kms->sprites[i]->next = NULL;
+	}
+
+	for (i = 0; i < n_views; i++) {
+		if (sprite[i] < 0) {
+			continue;
+		}
+
+		fb = ias_sprite_candidate_get_fb(kms, &kms->candidates[i]);
+		if (!fb) {
+			return -1;
+		}
+		ias_sprite_set_next(kms->sprites[sprite[i]], fb, &views[i]);
+	}
+
+	return ias_crtc->output_model->test_sprites(ias_crtc);
+}
+
+/*
+ * Moves the views the solver picks onto free sprites, and the rest of the
+ * candidates onto the primary plane.
+ */
+static void
+ias_assign_free_sprites(struct ias_sprite_kms *kms,
+		const struct plane_solver_view *views, int n_views,
+		struct weston_plane *primary_plane)
+{
+	struct ias_crtc *ias_crtc = kms->output->ias_crtc;
+	struct ias_sprite_candidate *candidate;
+	struct plane_solver_result result;
+	struct ias_sprite *sprite;
+	int assigned[IAS_AUTO_SPRITE_MAX_VIEWS];
+	int i;
+
+	kms->base.test = ias_sprite_kms_test;
+	plane_solver_solve(ias_crtc->plane_solver, &kms->base, views, n_views,
+			assigned, &result);
+
+	for (i = 0; i < kms->n_sprites; i++) {
+		kms->sprites[i]->next = NULL;
+	}
+
+	for (i = 0; i < n_views; i++) {
+		candidate = &kms->candidates[i];
+		if (!views[i].sprite_mask) {
+			continue;
+		}
+
+		if (assigned[i] < 0) {
+			if (candidate->fb) {
+				gbm_bo_destroy(candidate->fb->bo);
+			}
+			weston_view_move_to_plane(candidate->view, primary_plane);
+			continue;
+		}
+
+		sprite = kms->sprites[assigned[i]];
+		ias_sprite_set_next(sprite, candidate->fb, &views[i]);
+		weston_buffer_reference(&candidate->fb->buffer_ref,
+				candidate->view->surface->buffer_ref.buffer);
+		weston_view_move_to_plane(candidate->view, &sprite->plane);
+	}
+
+	IAS_DEBUG("%d views on sprites, %llu pixels not composited, %d tests",
+			result.n_scanout,
+			(unsigned long long)result.scanout_area, result.n_tests);
+}
+
 /*
  * ias_assign_planes()
  *
@@ -2024,6 +2335,13 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 	struct ias_crtc *ias_crtc = ias_output->ias_crtc;
 	struct ias_output_model *output_model = ias_crtc->output_model;
 	struct ias_backend *backend = ias_crtc->backend;
+	struct ias_sprite_kms sprite_kms;
+	struct plane_solver_view solver_views[IAS_AUTO_SPRITE_MAX_VIEWS];
+	struct plane_solver_view *sv;
+	pixman_box32_t *box;
+	int n_solver_views = 0;
+	int use_free_sprites;
+	int scanout;
 
 	/*
 	 * If this output model can neither flip client surfaces or use a hardware
@@ -2033,6 +2351,16 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 		return;
 	}
 
+	/*
+	 * Free sprites are shared by all outputs of the CRTC, so they're only
+	 * handed out when there's a single one.
+	 */
+	use_free_sprites = !ias_output->plugin && ias_crtc->plane_solver &&
+		ias_crtc->num_outputs == 1;
+	if (use_free_sprites) {
+		ias_sprite_kms_init(&sprite_kms, ias_output);
+	}
+
 	/*
 	 * Assuming this output model supports it, the cursor is available for use
 	 * for matching surfaces
@@ -2076,6 +2404,7 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 					&ev->transform.boundingbox);
 
 			next_plane = NULL;
+			scanout = 0;
 
 			/*
 			 * If this surface is clipped by any higher surfaces, it's not a
@@ -2094,6 +2423,40 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 			/* See if it can be flipped directly as a scanout */
 			if (next_plane == NULL && output_model->can_client_flip) {
 				next_plane = ias_attempt_scanout_for_view(output, ev, 1);
+				scanout = next_plane != NULL;
+			}
+
+			/*
+			 * Let the plane solver decide between the free sprites and the
+			 * main fb, once it has seen all views from the top down to here.
+			 * Views that can only be composited are passed on as well, as
+			 * the views below can't go on a sprite where they overlap them.
+			 * A view flipped onto the main fb is below every sprite just
+			 * like composited ones, so it's passed on as one.
+			 */
+			if ((next_plane == NULL || next_plane == primary_plane ||
+						scanout) &&
+					use_free_sprites &&
+					n_solver_views < IAS_AUTO_SPRITE_MAX_VIEWS) {
+				sv = &solver_views[n_solver_views];
+				sprite_kms.candidates[n_solver_views].view = ev;
+				n_solver_views++;
+
+				box = pixman_region32_extents(&ev->transform.boundingbox);
+				sv->x1 = box->x1 - output->x;
+				sv->y1 = box->y1 - output->y;
+				sv->x2 = box->x2 - output->x;
+				sv->y2 = box->y2 - output->y;
+				sv->sprite_mask = scanout ? 0 :
+					ias_sprite_mask_for_view(&sprite_kms, ev, sv);
+
+				if (sv->sprite_mask) {
+					ev->surface->keep_buffer = 1;
+					pixman_region32_union(&overlap, &overlap,
+							&ev->transform.boundingbox);
+					pixman_region32_fini(&surface_overlap);
+					continue;
+				}
 			}
 
 			/* All other options failed; we're going to blit it to the main fb */
@@ -2107,8 +2470,11 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 			 */
 			weston_view_move_to_plane(ev, next_plane);
 
-			/* Update region of main FB being redrawn */
-			if (next_plane == primary_plane) {
+			/*
+			 * Update region of main FB being redrawn or scanned out,
+			 * which the views below can't be put on top of
+			 */
+			if (next_plane == primary_plane || scanout) {
 				pixman_region32_union(&overlap, &overlap,
 						&ev->transform.boundingbox);
 			}
@@ -2131,6 +2497,11 @@ ias_assign_planes(struct weston_output *output, void *repaint_data)
 		}
 	}
 	pixman_region32_fini(&overlap);
+
+	if (n_solver_views) {
+		ias_assign_free_sprites(&sprite_kms, solver_views, n_solver_views,
+				primary_plane);
+	}
 }
 
 static void
@@ -2894,6 +3265,8 @@ create_single_crtc(struct ias_backend *backend,
 		return NULL;
 	}
 
+	ias_crtc_init_plane_solver(ias_crtc);
+
 	/* Make sure configuration matches model requirements */
 	/*if (ias_crtc->configuration->output_num !=
 			ias_crtc->output_model->outputs_per_crtc) {
@@ -3386,97 +3759,175 @@ capture_proxy_destroy_from_output(struct ias_output *output)
 }
 
 static void
-capture_proxy_destroy_from_surface(struct ias_backend *ias_backend, struct weston_surface *surface)
+capture_buffer_destroy(struct ias_capture_buffer *cached)
 {
-	struct ias_surface_capture *capture_item = NULL;
-	struct ias_surface_capture *tmp_list_item = NULL;
+	wl_list_remove(&cached->buffer_destroy_listener.link);
+	wl_list_remove(&cached->link);
+	close(cached->prime_fd);
+	gbm_bo_destroy(cached->bo);
+	free(cached);
+}
 
-	weston_log("[WESTON] Destroying frame capture for surface %p...\n", surface);
-	wl_list_for_each_safe(capture_item, tmp_list_item, &ias_backend->capture_proxy_list, link) {
-		if (capture_item->capture_surface == surface) {
-			if (!capture_item->cp) {
-				weston_log("ERROR: Trying to destroy capture proxy that doesn't exist for this surface.\n");
-			} else {
-				if (surface->output) {
-					surface->output->disable_planes--;
-				} else {
-					weston_log("Warning - capture_proxy_destroy_from_surface - No output associated with surface %p.\n",
-							surface);
-				}
-				capture_proxy_destroy(capture_item->cp);
-				capture_item->cp = NULL;
-			}
+static void
+capture_buffer_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct ias_capture_buffer *cached = container_of(listener,
+			struct ias_capture_buffer, buffer_destroy_listener);
 
-			weston_log("[WESTON] Removing callbacks...\n");
-			wl_list_remove(&capture_item->capture_commit_listener.link);
-			wl_list_remove(&capture_item->capture_vsync_listener.link);
-			wl_list_remove(&capture_item->link);
-			free(capture_item);
-		}
-	}
+	capture_buffer_destroy(cached);
 }
 
+/* Returns the imported bo and prime fd for a client buffer, importing and
+ * exporting it only the first time that the buffer is seen. */
+static struct ias_capture_buffer *
+capture_buffer_get(struct ias_surface_capture *capture,
+		   struct weston_buffer *buffer)
+{
+	struct ias_backend *c = capture->backend;
+	struct ias_capture_buffer *cached;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct gbm_bo *bo;
+	int fd, ret;
+	int count = 0;
+
+	wl_list_for_each(cached, &capture->buffer_cache, link) {
+		if (cached->buffer == buffer) {
+			wl_list_remove(&cached->link);
+			wl_list_insert(&capture->buffer_cache, &cached->link);
+			capture->cache_hits++;
+			return cached;
+		}
+		count++;
+	}
+	capture->cache_misses++;
 
-static struct ias_fb *
-ias_capture_fb_get_from_bo(struct gbm_bo *bo, struct weston_buffer *buffer,
-			   struct ias_backend *backend)
+	if ((dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
+		struct gbm_import_fd_data gbm_dmabuf = {
+			.fd = dmabuf->attributes.fd[0],
+			.width = dmabuf->attributes.width,
+			.height = dmabuf->attributes.height,
+			.stride = dmabuf->attributes.stride[0],
+			.format = dmabuf->attributes.format
+		};
 
-{
-	struct ias_fb *fb = gbm_bo_get_user_data(bo);
-	uint32_t width, height;
-	uint32_t format, strides[4] = {0}, handles[4] = {0}, offsets[4] = {0};
-	uint64_t modifiers[4] = {0};
-	int ret;
-	int flags = 0;
+		bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_FD,
+				   &gbm_dmabuf, GBM_BO_USE_SCANOUT);
+	} else {
+		bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
+				   buffer->resource, GBM_BO_USE_SCANOUT);
+	}
 
-	if (fb) {
-		if (fb->fb_id) {
-			drmModeRmFB(backend->drm.fd, fb->fb_id);
-		}
-		/* TODO: need to find better way instead of creating fb again */
-		free(fb);
+	if (!bo) {
+		weston_log("[capture proxy]: Failed to import bo for wl_resource at %p - giving up.\n",
+				buffer->resource);
+		return NULL;
 	}
 
-	fb = calloc(1, sizeof *fb);
-	if (!fb) {
-		IAS_ERROR("Failed to allocate fb: out of memory");
-		exit(1);
+	ret = drmPrimeHandleToFD(c->drm.fd, gbm_bo_get_handle(bo).u32,
+				 DRM_CLOEXEC, &fd);
+	if (ret) {
+		weston_log("[capture proxy]: Failed to create prime fd for front buffer.\n");
+		gbm_bo_destroy(bo);
+		return NULL;
 	}
 
-	fb->bo = bo;
-	width = gbm_bo_get_width(bo);
-	height = gbm_bo_get_height(bo);
-	format = gbm_bo_get_format(bo);
+	cached = calloc(1, sizeof *cached);
+	if (!cached) {
+		weston_log("[capture proxy]: Failed to allocate buffer cache entry.\n");
+		close(fd);
+		gbm_bo_destroy(bo);
+		return NULL;
+	}
 
-	/* Special handling of RGB formats, as they may have RBC enabled */
-	if (format == GBM_FORMAT_XRGB8888 || format == GBM_FORMAT_ARGB8888) {
-		strides[0] = gbm_bo_get_stride(bo);
-		handles[0] = gbm_bo_get_handle(bo).u32;
-		offsets[0] = 0;
-	} else if (format == GBM_FORMAT_NV12) {
-		if (buffer != NULL) {
-			gl_renderer->query_buffer(backend->compositor,
-				buffer->legacy_buffer, EGL_STRIDE, (EGLint *)strides);
-			gl_renderer->query_buffer(backend->compositor,
-				buffer->legacy_buffer, EGL_OFFSET, (EGLint *)offsets);
-		}
-		handles[0] = gbm_bo_get_handle(bo).u32;
-		handles[1] = gbm_bo_get_handle(bo).u32;
+	/* Drop the least recently used buffer if the client cycles through
+	 * more buffers than we keep. */
+	if (count >= IAS_CAPTURE_BUFFER_CACHE_SIZE) {
+		capture_buffer_destroy(container_of(capture->buffer_cache.prev,
+					struct ias_capture_buffer, link));
 	}
 
-	ret = drmModeAddFB2WithModifiers(backend->drm.fd, width, height,
-					format, handles, strides, offsets,
-					modifiers, &fb->fb_id, flags);
+	cached->buffer = buffer;
+	cached->bo = bo;
+	cached->prime_fd = fd;
+	cached->stride = gbm_bo_get_stride(bo);
+	cached->format = gbm_bo_get_format(bo);
+	cached->buffer_destroy_listener.notify = capture_buffer_destroy_notify;
+	wl_signal_add(&buffer->destroy_signal, &cached->buffer_destroy_listener);
+	wl_list_insert(&capture->buffer_cache, &cached->link);
 
-	if (ret) {
-		weston_log("Failed to create kms fb: %m.\n");
-		free(fb);
+	return cached;
+}
+
+static void
+capture_surface_destroy_notify(struct wl_listener *listener, void *data);
+
+/* The capture of a surface, if any, is found through the listener that it
+ * registers on the surface's destroy signal. */
+static struct ias_surface_capture *
+ias_surface_capture_get(struct weston_surface *surface)
+{
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&surface->destroy_signal,
+				 capture_surface_destroy_notify);
+	if (!listener) {
 		return NULL;
 	}
 
-	gbm_bo_set_user_data(bo, fb, ias_fb_destroy_callback);
+	return container_of(listener, struct ias_surface_capture,
+			    surface_destroy_listener);
+}
 
-	return fb;
+static void
+capture_proxy_destroy_from_surface(struct ias_backend *ias_backend, struct weston_surface *surface)
+{
+	struct ias_surface_capture *capture_item;
+	struct ias_capture_buffer *cached, *tmp;
+
+	weston_log("[WESTON] Destroying frame capture for surface %p...\n", surface);
+	capture_item = ias_surface_capture_get(surface);
+	if (!capture_item) {
+		return;
+	}
+
+	if (!capture_item->cp) {
+		weston_log("ERROR: Trying to destroy capture proxy that doesn't exist for this surface.\n");
+	} else {
+		if (surface->output) {
+			surface->output->disable_planes--;
+		} else {
+			weston_log("Warning - capture_proxy_destroy_from_surface - No output associated with surface %p.\n",
+					surface);
+		}
+		if (capture_proxy_verbose_is_enabled(capture_item->cp)) {
+			weston_log("[capture proxy]: Buffer cache hits: %u, misses: %u.\n",
+					capture_item->cache_hits,
+					capture_item->cache_misses);
+		}
+		capture_proxy_destroy(capture_item->cp);
+		capture_item->cp = NULL;
+	}
+
+	wl_list_for_each_safe(cached, tmp, &capture_item->buffer_cache, link) {
+		capture_buffer_destroy(cached);
+	}
+
+	weston_log("[WESTON] Removing callbacks...\n");
+	wl_list_remove(&capture_item->capture_commit_listener.link);
+	wl_list_remove(&capture_item->capture_vsync_listener.link);
+	wl_list_remove(&capture_item->surface_destroy_listener.link);
+	wl_list_remove(&capture_item->link);
+	free(capture_item);
+}
+
+static void
+capture_surface_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct ias_surface_capture *capture_item = container_of(listener,
+			struct ias_surface_capture, surface_destroy_listener);
+
+	capture_proxy_destroy_from_surface(capture_item->backend,
+			capture_item->capture_surface);
 }
 
 
@@ -3484,6 +3935,17 @@ ias_capture_fb_get_from_bo(struct gbm_bo *bo, struct weston_buffer *buffer,
  * needed. RFC6184 says that "A 90 kHz clock rate MUST be used." */
 #define PIPELINE_CLOCK 90000
 
+/* The timestamp forms part of the RTP header and thus must be
+ * updated per frame. It is a 32-bit value that wraps. */
+static uint32_t
+capture_timestamp(const struct timespec *spec)
+{
+	uint64_t frame_time; /* in microseconds */
+
+	frame_time = spec->tv_sec * US_IN_SEC + spec->tv_nsec / NS_IN_US;
+	return (PIPELINE_CLOCK * frame_time / US_IN_SEC) & 0xFFFFFFFF;
+}
+
 /* Callback that is called when a frame has been composited
  * and is ready to be displayed on the relevant output. */
 static void
@@ -3495,7 +3957,6 @@ capture_frame_notify(struct wl_listener *listener, void *data)
 	int fd, ret;
 	uint32_t handle;
 	int64_t start = 0;
-	uint64_t frame_time; /* in microseconds */
 	struct timespec start_spec;
 	uint32_t timestamp = 0;
 #ifdef PROFILE_REMOTE_DISPLAY
@@ -3503,11 +3964,8 @@ capture_frame_notify(struct wl_listener *listener, void *data)
 	int64_t duration, finish;
 #endif
 
-	/* The timestamp forms part of the RTP header and thus must be
-	 * updated per frame. It is a 32-bit value that wraps. */
 	clock_gettime(CLOCK_REALTIME, &start_spec);
-	frame_time = start_spec.tv_sec * US_IN_SEC + start_spec.tv_nsec / NS_IN_US;
-	timestamp = (PIPELINE_CLOCK * frame_time / US_IN_SEC) & 0xFFFFFFFF;
+	timestamp = capture_timestamp(&start_spec);
 
 	output = container_of(listener, struct ias_output,
 				capture_proxy_frame_listener);
@@ -3518,6 +3976,12 @@ capture_frame_notify(struct wl_listener *listener, void *data)
 		return;
 	}
 
+	/* Each frame of an output is itself a composite event. */
+	vsync_notify(output->cp);
+	if (capture_proxy_govern_frame(output->cp) != CP_CAPTURE) {
+		return;
+	}
+
 	if (capture_proxy_profiling_is_enabled(output->cp)) {
 		struct timespec start_spec;
 
@@ -3542,6 +4006,7 @@ capture_frame_notify(struct wl_listener *listener, void *data)
 
 	ret = capture_proxy_handle_frame(output->cp, NULL, fd,
 				gbm_bo_get_stride(fb->bo), CP_FORMAT_RGB, timestamp);
+	close(fd);
 	if (ret < 0) {
 		weston_log("[capture proxy] aborted: %m\n");
 		capture_proxy_destroy_from_output(output);
@@ -3556,101 +4021,35 @@ capture_frame_notify(struct wl_listener *listener, void *data)
 }
 
 
-/* Callback that is called when any application commits a surface. */
+/* Sends the surface's current buffer to the capture client. */
 static void
-capture_commit_notify(struct wl_listener *listener, void *data)
+capture_surface_export(struct ias_surface_capture *capture,
+		       struct timespec *start_spec)
 {
-	struct ias_backend *c;
-	struct ias_fb *fb;
-	int fd, ret;
+	struct ias_backend *c = capture->backend;
+	int ret;
 	int abort = false;
-	uint32_t handle;
-	uint32_t format;
-	struct weston_surface *surface = (struct weston_surface *)data;
 	struct weston_buffer *buffer;
-	struct linux_dmabuf_buffer *dmabuf;
-	struct gbm_bo *bo;
-	struct wl_shm_buffer *shm_buffer;
-	struct ias_surface_capture *capture_item = NULL;
-	struct ias_surface_capture *capture_tmp = NULL;
-	struct ias_surface_capture *capture = NULL;
-
-	static uint32_t extra_frames;
-
+	struct ias_capture_buffer *cached;
 	int64_t start = 0;
-	uint64_t frame_time; /* in microseconds */
-	struct timespec start_spec;
-	uint32_t timestamp = 0;
+	uint32_t timestamp;
 #ifdef PROFILE_REMOTE_DISPLAY
 	struct timespec end_spec;
 	int64_t duration, finish;
 #endif
 
-	/* The timestamp forms part of the RTP header and thus must be
-	 * updated per frame. It is a 32-bit value that wraps. */
-	clock_gettime(CLOCK_REALTIME, &start_spec);
-	frame_time = start_spec.tv_sec * US_IN_SEC + start_spec.tv_nsec / NS_IN_US;
-	timestamp = (PIPELINE_CLOCK * frame_time / US_IN_SEC) & 0xFFFFFFFF;
-
-	capture_item = container_of(listener, struct ias_surface_capture,
-			      capture_commit_listener);
-	c = capture_item->backend;
-
-	if (!c) {
-		weston_log("Error: capture_commit_notify: no backend\n");
-		return;
-	}
-
-	wl_list_for_each(capture_tmp, &c->capture_proxy_list, link) {
-		if (capture_tmp->capture_surface == surface) {
-			capture = capture_tmp;
-			break;
-		}
-	}
-
-	if (!capture) {
-		/* Not a surface we are tracking. */
-		return;
-	}
-
-	/* Allow a maximum of two frames to be encoded between composite
-	 * events, to reduce load on the encoder. Only allowing a single frame
-	 * is too aggressive. This could become a config option in future. */
-	if (!vsync_received(capture->cp)) {
-		extra_frames++;
-		if (extra_frames > 1) {
-			return;
-		}
-	}
-	if (vsync_received(capture->cp)) {
-		clear_vsyncs(capture->cp);
-		if (extra_frames > 1) {
-			weston_log("Dropped %d frames between composite events.\n",
-					extra_frames - 1);
-		}
-		extra_frames = 0;
-	}
-
-	if (!capture->capture_surface->buffer_ref.buffer) {
-		/* We believe this is the case when the GPU has been
-		 * bottle-necked and the buffer isn't ready in time. */
-		if (capture_proxy_verbose_is_enabled(capture->cp)) {
-			weston_log("Warning - no buffer.\n");
-		}
-		return;
-	}
+	timestamp = capture_timestamp(start_spec);
 
 	if (capture_proxy_profiling_is_enabled(capture->cp)) {
-		start = timespec_to_nsec(&start_spec);
+		start = timespec_to_nsec(start_spec);
 		weston_log("WESTON: Frame[%d] start: %ld ns for surface.\n",
 					capture_get_frame_count(capture->cp), start);
 	}
 
 	buffer = capture->capture_surface->buffer_ref.buffer;
-	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
-	if (shm_buffer) {
-		ret = capture_proxy_handle_frame(capture->cp, shm_buffer, -1, 0, CP_FORMAT_RGB, timestamp);
+	if (wl_shm_buffer_get(buffer->resource)) {
+		ret = capture_proxy_handle_frame(capture->cp, buffer, -1, 0, CP_FORMAT_RGB, timestamp);
 		if (ret < 0) {
 			weston_log("[capture proxy] shm buffer aborted: %m\n");
 			/* This error is fatal. */
@@ -3664,52 +4063,25 @@ capture_commit_notify(struct wl_listener *listener, void *data)
 				start, finish, duration);
 #endif
 		return;
-	} else {
-		if ((dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
-			struct gbm_import_fd_data gbm_dmabuf = {
-				.fd = dmabuf->attributes.fd[0],
-				.width = dmabuf->attributes.width,
-				.height = dmabuf->attributes.height,
-				.stride = dmabuf->attributes.stride[0],
-				.format = dmabuf->attributes.format
-			};
-
-			bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_FD,
-					   &gbm_dmabuf, GBM_BO_USE_SCANOUT);
-		} else {
-			bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
-					   buffer->resource, GBM_BO_USE_SCANOUT);
-		}
-
-		if (!bo) {
-			weston_log("[capture proxy]: Failed to import bo for wl_resource at %p - giving up.\n",
-					buffer->resource);
-			return;
-		}
 	}
 
-	fb = ias_capture_fb_get_from_bo(bo, buffer, c);
-	if (!fb) {
-		weston_log("[capture proxy]: Failed to get fb from bo.\n");
-		goto err_commit;
-	}
-
-	handle = gbm_bo_get_handle(fb->bo).u32;
-
-	ret = drmPrimeHandleToFD(c->drm.fd, handle,
-				 DRM_CLOEXEC, &fd);
-	if (ret) {
-		weston_log("[capture proxy]: Failed to create prime fd for front buffer.\n");
-		goto err_commit;
+	/* The bo and prime fd stay cached for as long as the client buffer
+	 * exists, so a client cycling through its buffers is only imported
+	 * once per buffer. */
+	cached = capture_buffer_get(capture, buffer);
+	if (!cached) {
+		return;
 	}
 
-	format = gbm_bo_get_format(bo);
-	if (format == GBM_FORMAT_XRGB8888 || format == GBM_FORMAT_ARGB8888) {
-		ret = capture_proxy_handle_frame(capture->cp, NULL, fd,
-				gbm_bo_get_stride(fb->bo), CP_FORMAT_RGB, timestamp);
-	} else if (format == GBM_FORMAT_NV12) {
-		ret = capture_proxy_handle_frame(capture->cp, NULL, fd,
-				gbm_bo_get_stride(fb->bo), CP_FORMAT_NV12, timestamp);
+	if (cached->format == GBM_FORMAT_XRGB8888 ||
+	    cached->format == GBM_FORMAT_ARGB8888) {
+		ret = capture_proxy_handle_frame(capture->cp, NULL,
+				cached->prime_fd, cached->stride,
+				CP_FORMAT_RGB, timestamp);
+	} else if (cached->format == GBM_FORMAT_NV12) {
+		ret = capture_proxy_handle_frame(capture->cp, NULL,
+				cached->prime_fd, cached->stride,
+				CP_FORMAT_NV12, timestamp);
 	} else {
 		weston_log("[capture proxy]: Unsupported surface format.\n");
 		ret = -1;
@@ -3718,13 +4090,9 @@ capture_commit_notify(struct wl_listener *listener, void *data)
 		abort = true;
 	}
 
-err_commit:
 	/* We've asked for the buffer to be kept alive long enough for us to
 	 * encode it, so dereference it now that we're done with it. Note that
 	 * the client keeps an open fd to the data until it is done. */
-	if (fb != NULL) {
-		gbm_bo_destroy(fb->bo);
-	}
 	weston_buffer_reference(&capture->capture_surface->buffer_ref, NULL);
 
 	if (abort) {
@@ -3743,6 +4111,78 @@ err_commit:
 }
 
 
+static void
+capture_damage_shm(struct ias_surface_capture *capture,
+		   struct weston_surface *surface)
+{
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	int i, n;
+
+	pixman_region32_init(&damage);
+	weston_surface_to_buffer_region(surface, &surface->damage, &damage);
+
+	rects = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++) {
+		capture_proxy_damage(capture->cp, rects[i].x1, rects[i].y1,
+				rects[i].x2 - rects[i].x1,
+				rects[i].y2 - rects[i].y1);
+	}
+
+	pixman_region32_fini(&damage);
+}
+
+
+/* Callback that is called when any application commits a surface. */
+static void
+capture_commit_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_surface *surface = (struct weston_surface *)data;
+	struct ias_surface_capture *capture;
+	struct timespec start_spec;
+
+	clock_gettime(CLOCK_REALTIME, &start_spec);
+
+	capture = container_of(listener, struct ias_surface_capture,
+			      capture_commit_listener);
+
+	if (!capture->backend) {
+		weston_log("Error: capture_commit_notify: no backend\n");
+		return;
+	}
+
+	/* The listener is on the output, so it sees commits of every
+	 * surface on that output. */
+	if (capture->capture_surface != surface) {
+		return;
+	}
+
+	if (!capture->capture_surface->buffer_ref.buffer) {
+		/* We believe this is the case when the GPU has been
+		 * bottle-necked and the buffer isn't ready in time. */
+		if (capture_proxy_verbose_is_enabled(capture->cp)) {
+			weston_log("Warning - no buffer.\n");
+		}
+		return;
+	}
+
+	/* Staging surfaces for shm frames are only updated where the surface
+	 * changed since they were last filled, so every change needs to be
+	 * seen, including those of frames that end up not being captured. */
+	if (wl_shm_buffer_get(surface->buffer_ref.buffer->resource)) {
+		capture_damage_shm(capture, surface);
+	}
+
+	/* Each capture has its own rate governor, so that a surface that
+	 * commits at a very high rate doesn't starve other captures. */
+	if (capture_proxy_govern_frame(capture->cp) != CP_CAPTURE) {
+		return;
+	}
+
+	capture_surface_export(capture, &start_spec);
+}
+
+
 /* Callback that is called when a vsync has occurred on the relevant
  * output. */
 static void
@@ -3750,7 +4190,17 @@ capture_vsync_notify(struct wl_listener *listener, void *data)
 {
 	struct ias_surface_capture *capture_item = container_of(
 		listener, struct ias_surface_capture, capture_vsync_listener);
+	struct timespec start_spec;
+
 	vsync_notify(capture_item->cp);
+
+	/* With the latest policy, a frame that was skipped is sent as soon
+	 * as the governor allows, unless a newer one has been sent since. */
+	if (capture_proxy_take_deferred(capture_item->cp) &&
+			capture_item->capture_surface->buffer_ref.buffer) {
+		clock_gettime(CLOCK_REALTIME, &start_spec);
+		capture_surface_export(capture_item, &start_spec);
+	}
 }
 
 
@@ -3797,7 +4247,6 @@ start_capture(struct wl_client *client,
 		/* If a weston_surface was passed in, then we're capturing the
 		 * buffers  of that surface. */
 		struct ias_surface_capture *capture_proxy_item;
-		struct ias_surface_capture *capture_check = NULL;
 
 		if (surface->output) {
 			output = container_of(surface->output, struct ias_output,
@@ -3809,11 +4258,9 @@ start_capture(struct wl_client *client,
 		}
 
 		/* Check whether we're already recording this surface... */
-		wl_list_for_each(capture_check, &ias_backend->capture_proxy_list, link) {
-			if (capture_check->capture_surface == surface) {
-				weston_log("Surface already has a capture client.\n");
-				return IAS_HMI_FCAP_ERROR_DUPLICATE;
-			}
+		if (ias_surface_capture_get(surface)) {
+			weston_log("Surface already has a capture client.\n");
+			return IAS_HMI_FCAP_ERROR_DUPLICATE;
 		}
 
 		surface->keep_buffer = 1;
@@ -3838,6 +4285,12 @@ start_capture(struct wl_client *client,
 
 		wl_list_init(&capture_proxy_item->link);
 		wl_list_insert(&ias_backend->capture_proxy_list, &capture_proxy_item->link);
+		wl_list_init(&capture_proxy_item->buffer_cache);
+
+		capture_proxy_item->surface_destroy_listener.notify =
+			capture_surface_destroy_notify;
+		wl_signal_add(&surface->destroy_signal,
+			&capture_proxy_item->surface_destroy_listener);
 
 		/* We need to know when a vsync has occurred, even if we are not
 		 * capturing an output, in order to limit the number of frames
@@ -3967,13 +4420,11 @@ release_buffer_handle(struct ias_backend *ias_backend, uint32_t surfid,
 						struct weston_surface *surface, uint32_t output_number)
 {
 	if (surface) {
-		struct ias_surface_capture *capture_item = NULL;
-		struct ias_surface_capture *tmp_item = NULL;
+		struct ias_surface_capture *capture_item;
 
-		wl_list_for_each_safe(capture_item, tmp_item, &ias_backend->capture_proxy_list, link) {
-			if (capture_item->capture_surface == surface) {
-				capture_proxy_release_buffer(capture_item->cp, surfid, bufid, imageid);
-			}
+		capture_item = ias_surface_capture_get(surface);
+		if (capture_item) {
+			capture_proxy_release_buffer(capture_item->cp, surfid, bufid, imageid);
 		}
 	} else {
 		struct ias_output *output = NULL;
@@ -3997,6 +4448,71 @@ release_buffer_handle(struct ias_backend *ias_backend, uint32_t surfid,
 	return IAS_HMI_FCAP_ERROR_OK;
 }
 
+static struct capture_proxy *
+find_capture_proxy(struct ias_backend *ias_backend,
+		struct weston_surface *surface, uint32_t output_number)
+{
+	struct ias_surface_capture *capture_item;
+	struct ias_output *output;
+
+	if (surface) {
+		capture_item = ias_surface_capture_get(surface);
+		return capture_item ? capture_item->cp : NULL;
+	}
+
+	wl_list_for_each(output, &ias_backend->compositor->output_list, base.link) {
+		if (output->base.id == output_number) {
+			return output->cp;
+		}
+	}
+
+	return NULL;
+}
+
+static int
+set_capture_rate(struct ias_backend *ias_backend,
+		struct weston_surface *surface, uint32_t output_number,
+		uint32_t target_fps, uint32_t max_burst,
+		uint32_t max_in_flight, uint32_t policy)
+{
+	struct capture_proxy *cp;
+
+	cp = find_capture_proxy(ias_backend, surface, output_number);
+	if (!cp) {
+		weston_log("set_capture_rate - No capture for surface %p or output %u.\n",
+				surface, output_number);
+		return IAS_HMI_FCAP_ERROR_INVALID;
+	}
+
+	if (policy != IAS_HMI_CAPTURE_POLICY_DROP &&
+			policy != IAS_HMI_CAPTURE_POLICY_LATEST) {
+		weston_log("set_capture_rate - Invalid policy %u.\n", policy);
+		return IAS_HMI_FCAP_ERROR_INVALID;
+	}
+
+	capture_proxy_set_rate(cp, target_fps, max_burst, max_in_flight,
+			policy == IAS_HMI_CAPTURE_POLICY_LATEST ?
+				CP_POLICY_LATEST : CP_POLICY_DROP);
+
+	return IAS_HMI_FCAP_ERROR_OK;
+}
+
+static int
+get_capture_stats(struct ias_backend *ias_backend,
+		struct weston_surface *surface, uint32_t output_number,
+		struct capture_proxy_stats *stats)
+{
+	struct capture_proxy *cp;
+
+	cp = find_capture_proxy(ias_backend, surface, output_number);
+	if (!cp) {
+		return IAS_HMI_FCAP_ERROR_INVALID;
+	}
+
+	capture_proxy_get_stats(cp, stats);
+	return IAS_HMI_FCAP_ERROR_OK;
+}
+
 #endif /*BUILD_FRAME_CAPTURE*/
 
 static int
@@ -4064,6 +4580,7 @@ create_gbm_device(int fd)
 	gl_renderer->vm_plugin_path = vm_plugin_path;
 	gl_renderer->vm_plugin_args = vm_plugin_args;
 	gl_renderer->vm_share_only = vm_share_only;
+	gl_renderer->vm_delta_keyframe = vm_delta_keyframe;
 #else
 	weston_log("Hyper dmabuf support not enabled during compilation, "
 		   "disabling surface sharing\n");
@@ -4363,6 +4880,7 @@ ias_compositor_create(struct weston_compositor *compositor,
 
 	backend->rbc_debug = rbc_debug;
 	backend->use_cursor_as_uplane = use_cursor_as_uplane;
+	backend->auto_sprites = auto_sprites;
 
 	/*
 	 * Query KMS for the number of crtc's and create
@@ -4431,6 +4949,8 @@ ias_compositor_create(struct weston_compositor *compositor,
 	backend->start_capture = start_capture;
 	backend->stop_capture = stop_capture;
 	backend->release_buffer_handle = release_buffer_handle;
+	backend->set_capture_rate = set_capture_rate;
+	backend->get_capture_stats = get_capture_stats;
 #endif
 
 	centre_pointer(backend);
@@ -5121,8 +5641,12 @@ void backend_begin(void *userdata, const char **attrs) {
 			strncpy(vm_plugin_args, attrs[1], 255);
 		} else if (strcmp(attrs[0], "use_cursor_as_uplane") == 0) {
 			use_cursor_as_uplane = atoi(attrs[1]);
+		} else if (strcmp(attrs[0], "auto_sprites") == 0) {
+			auto_sprites = atoi(attrs[1]);
 		} else if (strcmp(attrs[0], "vm_share_only") == 0) {
 			vm_share_only = atoi(attrs[1]);
+		} else if (strcmp(attrs[0], "vm_delta_keyframe") == 0) {
+			vm_delta_keyframe = atoi(attrs[1]);
 		}
 
 		attrs += 2;
@@ -5454,8 +5978,6 @@ weston_backend_init(struct weston_compositor *compositor,
 	struct ias_backend *b;
 	struct weston_ias_backend_config config = {{0, }};
 
-	TRACING_MODULE_INIT();
-
 	if (config_base == NULL ||
 	    config_base->struct_version != WESTON_IAS_BACKEND_CONFIG_VERSION ||
 	    config_base->struct_size > sizeof(struct weston_ias_backend_config)) {
@@ -66,18 +66,6 @@
 #include "trace-reporter.h"
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
-/* Storage for global tracing variables (see compositor.h) */
-WL_EXPORT struct trace_info __trace_buffer[TRACE_BUFFER_SIZE];
-WL_EXPORT unsigned int __trace_start, __trace_end;
-
-/*
- * Pointers to tracing variables above; these are what the modules
- * TRACEPOINT function will actually use (for compatibility with
- * dlopen()'d weston modules.
- */
-WL_EXPORT struct trace_info *__trace_log = __trace_buffer;
-WL_EXPORT unsigned int *__tstart = &__trace_start;
-WL_EXPORT unsigned int *__tend = &__trace_end;
 
 static void
 weston_output_update_matrix(struct weston_output *output);
@@ -489,6 +477,7 @@ weston_surface_create(struct weston_compositor *compositor)
 
 	wl_list_init(&surface->frame_callback_list);
 	wl_list_init(&surface->feedback_list);
+	wl_list_init(&surface->present_latency.link);
 
 	wl_list_init(&surface->subsurface_list);
 	wl_list_init(&surface->subsurface_list_pending);
@@ -1802,6 +1791,7 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	view->surface->compositor->view_list_dirty = true;
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -1903,6 +1893,7 @@ weston_surface_destroy(struct weston_surface *surface)
 		wl_resource_destroy(cb->resource);
 
 	weston_presentation_feedback_discard_list(&surface->feedback_list);
+	wl_list_remove(&surface->present_latency.link);
 
 	wl_list_for_each_safe(constraint, next_constraint,
 			      &surface->pointer_constraints,
@@ -2103,6 +2094,9 @@ compositor_accumulate_damage(struct weston_compositor *ec,
 	struct weston_view *ev;
 	struct weston_output *output;
 	pixman_region32_t opaque, clip;
+	struct weston_repaint_stats *stats = &repaint_output->repaint_stats;
+	struct timespec upload_start, upload_end;
+	uint64_t upload_bytes;
 
 	pixman_region32_init(&clip);
 
@@ -2133,6 +2127,9 @@ compositor_accumulate_damage(struct weston_compositor *ec,
 	wl_list_for_each(ev, &ec->view_list, link)
 		ev->surface->touched = false;
 
+	weston_compositor_read_presentation_clock(ec, &upload_start);
+	upload_bytes = ec->renderer->upload_bytes;
+
 	wl_list_for_each(ev, &ec->view_list, link) {
 		if (ev->surface->touched)
 			continue;
@@ -2154,6 +2151,16 @@ compositor_accumulate_damage(struct weston_compositor *ec,
 		if (!ev->surface->keep_buffer)
 			weston_buffer_reference(&ev->surface->buffer_ref, NULL);
 	}
+
+	/* Only frames that uploaded anything, or idle ones would swamp it */
+	upload_bytes = ec->renderer->upload_bytes - upload_bytes;
+	if (upload_bytes > 0) {
+		weston_compositor_read_presentation_clock(ec, &upload_end);
+		weston_histogram_add_interval(&stats->upload,
+					      &upload_start, &upload_end);
+		weston_histogram_add(&stats->upload_size,
+				     (upload_bytes + 1023) / 1024);
+	}
 }
 
 static void
@@ -2288,6 +2295,26 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	compositor->view_list_dirty = false;
+}
+
+/* The view list only changes with the layers and the sub-surfaces, so it
+ * is rebuilt just when one of those changed, and all outputs repainting
+ * in the meantime share it. Transforms may change any time.
+ */
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (compositor->view_list_dirty) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
 }
 
 static void
@@ -2315,6 +2342,36 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+/* Records the stage that began at *t, and starts the next one. */
+static void
+repaint_stage_done(struct weston_output *output,
+		   enum weston_repaint_stage stage, struct timespec *t)
+{
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(output->compositor, &now);
+	weston_histogram_add_interval(&output->repaint_stats.stage[stage],
+				      t, &now);
+	*t = now;
+}
+
+/* The surface's new content goes out with this frame */
+static void
+weston_output_take_present_latency(struct weston_output *output,
+				   struct weston_surface *surface)
+{
+	struct weston_present_latency *latency = &surface->present_latency;
+
+	if (timespec_is_zero(&latency->commit_time) ||
+	    !wl_list_empty(&latency->link))
+		return;
+
+	latency->repaint_commit_time = latency->commit_time;
+	latency->commit_time.tv_sec = 0;
+	latency->commit_time.tv_nsec = 0;
+	wl_list_insert(&output->present_latency_list, &latency->link);
+}
+
 static int
 weston_output_repaint(struct weston_output *output, void *repaint_data)
 {
@@ -2324,6 +2381,7 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct timespec stage_start, deadline;
 	int r;
 	uint32_t frame_time_msec;
 
@@ -2332,8 +2390,13 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	weston_compositor_read_presentation_clock(ec, &stage_start);
+	output->repaint_stats.repaint_start = stage_start;
+
+	/* Update the surface list and surface transforms up front. */
+	weston_compositor_update_view_list(ec);
+	repaint_stage_done(output, WESTON_REPAINT_STAGE_BUILD_VIEW_LIST,
+			   &stage_start);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output, repaint_data);
@@ -2343,14 +2406,20 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 			ev->psf_flags = 0;
 		}
 	}
+	repaint_stage_done(output, WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+			   &stage_start);
 
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
+		if (ev->surface->output != output)
+			continue;
+
+		weston_output_take_present_latency(output, ev->surface);
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output &&
-				!ev->surface->suspend_frame_events) {
+		if (!ev->surface->suspend_frame_events) {
 			wl_list_insert_list(&frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
@@ -2360,6 +2429,8 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	}
 
 	compositor_accumulate_damage(ec, output);
+	repaint_stage_done(output, WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE,
+			   &stage_start);
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_subtract(&output_damage,
@@ -2369,9 +2440,23 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		weston_output_update_matrix(output);
 
 	r = output->repaint(output, &output_damage, repaint_data);
+	repaint_stage_done(output, WESTON_REPAINT_STAGE_RENDER, &stage_start);
 
 	pixman_region32_fini(&output_damage);
 
+	if (r == 0) {
+		/* Work done after the vblank it was meant for */
+		timespec_add_msec(&deadline, &output->next_repaint,
+				  ec->repaint_msec);
+		if (timespec_sub_to_nsec(&stage_start, &deadline) > 0)
+			output->repaint_stats.over_budget++;
+
+		output->repaint_stats.repaint_end = stage_start;
+	} else {
+		output->repaint_stats.repaint_start.tv_sec = 0;
+		output->repaint_stats.repaint_start.tv_nsec = 0;
+	}
+
 	/*
 	 * No need to redraw again until damage happens unless the backend
 	 * tells us otherwise.
@@ -2532,6 +2617,39 @@ output_repaint_timer_handler(void *data)
 	return 0;
 }
 
+/* Ends the frame in flight; without a stamp, nothing is recorded. */
+static void
+weston_output_present_stats(struct weston_output *output,
+			    const struct timespec *stamp)
+{
+	struct weston_repaint_stats *stats = &output->repaint_stats;
+	struct weston_present_latency *latency, *tmp;
+
+	if (stamp && !timespec_is_zero(&stats->repaint_end)) {
+		weston_histogram_add_interval(
+			&stats->stage[WESTON_REPAINT_STAGE_FLIP],
+			&stats->repaint_end, stamp);
+		weston_histogram_add_interval(
+			&stats->stage[WESTON_REPAINT_STAGE_TOTAL],
+			&stats->repaint_start, stamp);
+		stats->frames++;
+	}
+
+	wl_list_for_each_safe(latency, tmp, &output->present_latency_list,
+			      link) {
+		if (stamp)
+			weston_histogram_add_interval(&latency->histogram,
+					&latency->repaint_commit_time, stamp);
+		memset(&latency->repaint_commit_time, 0,
+		       sizeof latency->repaint_commit_time);
+		wl_list_remove(&latency->link);
+		wl_list_init(&latency->link);
+	}
+
+	memset(&stats->repaint_start, 0, sizeof stats->repaint_start);
+	memset(&stats->repaint_end, 0, sizeof stats->repaint_end);
+}
+
 WL_EXPORT void
 weston_output_finish_frame(struct weston_output *output,
 			   const struct timespec *stamp,
@@ -2552,6 +2670,7 @@ weston_output_finish_frame(struct weston_output *output,
 	 * timebase to work against, so any delay just wastes time. Push a
 	 * repaint as soon as possible so we can get on with it. */
 	if (!stamp) {
+		weston_output_present_stats(output, NULL);
 		output->next_repaint = now;
 		goto out;
 	}
@@ -2560,6 +2679,24 @@ weston_output_finish_frame(struct weston_output *output,
 		 TLP_VBLANK(stamp), TLP_END);
 
 	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+
+	/* The frame was meant for the vblank right after the deadline we
+	 * computed last time, so a later one means it was missed. */
+	if (!(presented_flags & WP_PRESENTATION_FEEDBACK_INVALID)) {
+		struct timespec target;
+
+		timespec_add_msec(&target, &output->next_repaint,
+				  compositor->repaint_msec);
+		if (timespec_sub_to_nsec(stamp, &target) > refresh_nsec / 2) {
+			TL_POINT("core_missed_vblank", TLP_OUTPUT(output),
+				 TLP_VBLANK(stamp), TLP_END);
+			weston_timeline_flush("missed vblank");
+			output->repaint_stats.missed_vblank++;
+		}
+	}
+
+	weston_output_present_stats(output, stamp);
+
 	weston_presentation_feedback_present_list(&output->feedback_list,
 						  output, refresh_nsec, stamp,
 						  output->msc,
@@ -2611,17 +2748,35 @@ idle_repaint(void *data)
 	output->start_repaint_loop(output);
 }
 
+/** Marks the compositor's view list out of date
+ *
+ * \param layer The layer whose views changed
+ *
+ * The view list is rebuilt on the next repaint. The weston_layer and
+ * weston_layer_entry functions do this themselves; it is only needed after
+ * editing a layer's view list directly. Hidden layers don't contribute to
+ * the view list, so changing them doesn't count.
+ */
+WL_EXPORT void
+weston_layer_dirty(struct weston_layer *layer)
+{
+	if (layer && !wl_list_empty(&layer->link))
+		layer->compositor->view_list_dirty = true;
+}
+
 WL_EXPORT void
 weston_layer_entry_insert(struct weston_layer_entry *list,
 			  struct weston_layer_entry *entry)
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	weston_layer_dirty(entry->layer);
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	weston_layer_dirty(entry->layer);
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -2664,6 +2819,7 @@ weston_layer_set_position(struct weston_layer *layer,
 	 * background with the smallest position value */
 
 	layer->position = position;
+	layer->compositor->view_list_dirty = true;
 	wl_list_for_each_reverse(below, &layer->compositor->layer_list, link) {
 		if (below->position >= layer->position) {
 			wl_list_insert(&below->link, &layer->link);
@@ -2681,6 +2837,7 @@ weston_layer_set_position(struct weston_layer *layer,
 WL_EXPORT void
 weston_layer_unset_position(struct weston_layer *layer)
 {
+	weston_layer_dirty(layer);
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
 }
@@ -2895,11 +3052,31 @@ weston_surface_damage_subsurfaces(struct weston_subsurface *sub)
 			weston_surface_damage_subsurfaces(child);
 }
 
+static bool
+weston_surface_subsurface_order_changed(struct weston_surface *surface)
+{
+	struct weston_subsurface *sub;
+	struct wl_list *link = surface->subsurface_list.next;
+
+	/* Both lists hold the same sub-surfaces */
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (link != &sub->parent_link)
+			return true;
+		link = link->next;
+	}
+
+	return false;
+}
+
 static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	if (weston_surface_subsurface_order_changed(surface))
+		surface->compositor->view_list_dirty = true;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
@@ -3125,6 +3302,12 @@ weston_surface_commit_state(struct weston_surface *surface,
 		weston_surface_attach(surface, state->buffer);
 	weston_surface_state_set_buffer(state, NULL);
 
+	/* Latency counts from the oldest content not yet repainted */
+	if (state->newly_attached && surface->buffer_ref.buffer &&
+	    timespec_is_zero(&surface->present_latency.commit_time))
+		weston_compositor_read_presentation_clock(surface->compositor,
+				&surface->present_latency.commit_time);
+
 	weston_surface_build_buffer_matrix(surface,
 					   &surface->surface_to_buffer_matrix);
 	weston_matrix_invert(&surface->buffer_to_surface_matrix,
@@ -3579,6 +3762,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		surface->compositor->view_list_dirty = true;
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -3916,6 +4100,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	sub->surface->compositor->view_list_dirty = true;
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -3982,6 +4167,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	parent->compositor->view_list_dirty = true;
 }
 
 static void
@@ -4719,6 +4905,7 @@ weston_compositor_remove_output(struct weston_output *output)
 	}
 
 	weston_presentation_feedback_discard_list(&output->feedback_list);
+	weston_output_present_stats(output, NULL);
 
 	weston_compositor_reflow_outputs(compositor, output, output->width);
 
@@ -4973,6 +5160,7 @@ weston_output_enable(struct weston_output *output)
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
 	wl_list_init(&output->feedback_list);
+	wl_list_init(&output->present_latency_list);
 
 	/* Enable the output (set up the crtc or create a
 	 * window representing the output, set up the
@@ -5376,12 +5564,20 @@ timeline_key_binding_handler(struct weston_keyboard *keyboard,
 {
 	struct weston_compositor *compositor = data;
 
-	if (weston_timeline_enabled_)
+	if (weston_timeline_enabled_ & WESTON_TIMELINE_LOG)
 		weston_timeline_close();
 	else
 		weston_timeline_open(compositor);
 }
 
+static void
+timeline_flush_binding_handler(struct weston_keyboard *keyboard,
+			       const struct timespec *time, uint32_t key,
+			       void *data)
+{
+	weston_timeline_flush("debug binding");
+}
+
 /** Create the compositor.
  *
  * This functions creates and initializes a compositor instance.
@@ -5483,6 +5679,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	weston_compositor_add_debug_binding(ec, KEY_T,
 					    timeline_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_D,
+					    timeline_flush_binding_handler, ec);
 
 	return ec;
 
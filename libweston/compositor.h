@@ -54,6 +54,7 @@ extern "C" {
 #include <stdlib.h>
 #include <sys/time.h>
 #include "timeline-object.h"
+#include "repaint-stats.h"
 
 #ifndef MIN
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
@@ -256,6 +257,11 @@ struct weston_output {
 	int destroying;
 	struct wl_list feedback_list;
 
+	struct weston_repaint_stats repaint_stats;
+	/* Surfaces in the frame being presented,
+	 * weston_present_latency::link */
+	struct wl_list present_latency_list;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -891,6 +897,9 @@ struct weston_renderer {
 			struct weston_compositor *ec);
 	int (*get_shareable_flag)(struct weston_surface *surface);
 	uint64_t (*get_surf_id)(struct weston_surface *surface);
+
+	/* Client content copied to the renderer so far, in bytes */
+	uint64_t upload_bytes;
 };
 
 enum weston_capability {
@@ -1025,6 +1034,7 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;	/* struct weston_layer::link */
 	struct wl_list view_list;	/* struct weston_view::link */
+	bool view_list_dirty;
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -1410,6 +1420,9 @@ struct weston_surface {
 
 	struct weston_timeline_object timeline;
 
+	/* Commit to present, kept in the surface's primary output */
+	struct weston_present_latency present_latency;
+
 	bool is_mapped;
 
 	/* An list of per seat pointer constraints. */
@@ -1567,6 +1580,8 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 void
 weston_layer_entry_remove(struct weston_layer_entry *entry);
 void
+weston_layer_dirty(struct weston_layer *layer);
+void
 weston_layer_init(struct weston_layer *layer,
 		  struct weston_compositor *compositor);
 void
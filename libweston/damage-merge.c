@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "damage-merge.h"
+
+/* How many of the kept boxes a new one is compared with */
+#define DAMAGE_MERGE_WINDOW 8
+
+/* Merging can make boxes mergeable that weren't, but rarely for long */
+#define DAMAGE_MERGE_PASSES 3
+
+static uint64_t
+box_area(const struct damage_merge_box *box)
+{
+	if (box->x2 <= box->x1 || box->y2 <= box->y1)
+		return 0;
+
+	return (uint64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static void
+box_union(struct damage_merge_box *out, const struct damage_merge_box *a,
+	  const struct damage_merge_box *b)
+{
+	out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+	out->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+	out->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+}
+
+int
+damage_merge(struct damage_merge_box *boxes, int n_boxes,
+	     uint32_t call_cost, uint32_t pixel_cost)
+{
+	struct damage_merge_box u, best_box = { 0, 0, 0, 0 };
+	int64_t separate, merged, saving, best_saving;
+	int pass, i, k, n, best;
+	bool changed;
+
+	for (pass = 0; pass < DAMAGE_MERGE_PASSES; pass++) {
+		changed = false;
+		n = 0;
+
+		for (i = 0; i < n_boxes; i++) {
+			best = -1;
+			best_saving = 0;
+
+			for (k = n - 1; k >= 0 && k >= n - DAMAGE_MERGE_WINDOW;
+			     k--) {
+				box_union(&u, &boxes[k], &boxes[i]);
+
+				/* Overlaps count twice, as they'd be sent twice */
+				separate = 2 * (int64_t)call_cost +
+					   (int64_t)(box_area(&boxes[k]) +
+						     box_area(&boxes[i])) *
+					   pixel_cost;
+				merged = (int64_t)call_cost +
+					 (int64_t)box_area(&u) * pixel_cost;
+				saving = separate - merged;
+
+				if (saving > best_saving) {
+					best = k;
+					best_saving = saving;
+					best_box = u;
+				}
+			}
+
+			if (best >= 0) {
+				boxes[best] = best_box;
+				changed = true;
+			} else {
+				boxes[n++] = boxes[i];
+			}
+		}
+
+		n_boxes = n;
+		if (!changed)
+			break;
+	}
+
+	return n_boxes;
+}
+
+uint64_t
+damage_merge_cost(const struct damage_merge_box *boxes, int n_boxes,
+		  uint32_t call_cost, uint32_t pixel_cost)
+{
+	uint64_t cost = 0;
+	int i;
+
+	for (i = 0; i < n_boxes; i++)
+		cost += call_cost + box_area(&boxes[i]) * pixel_cost;
+
+	return cost;
+}
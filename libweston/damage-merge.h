@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef WESTON_DAMAGE_MERGE_H
+#define WESTON_DAMAGE_MERGE_H
+
+#include <stdint.h>
+
+/*
+ * Merges damage rectangles into fewer, larger ones where that makes an
+ * upload cheaper: every rectangle costs call_cost for the upload call
+ * plus pixel_cost per pixel. Two rectangles are replaced by their bounding
+ * box when that costs less than uploading both, so that e.g. the glyphs a
+ * terminal damages on a line go up in one call, while two small corners
+ * of a big buffer still go separately.
+ *
+ * Input is expected in the order pixman gives it, top to bottom, and each
+ * rectangle is only compared with the last few kept ones, so this stays
+ * linear in the number of rectangles.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+struct damage_merge_box {
+	int32_t x1, y1, x2, y2;
+};
+
+/* Rewrites boxes in place, returns how many there are now */
+int
+damage_merge(struct damage_merge_box *boxes, int n_boxes,
+	     uint32_t call_cost, uint32_t pixel_cost);
+
+/* Cost of uploading the boxes, for comparison */
+uint64_t
+damage_merge_cost(const struct damage_merge_box *boxes, int n_boxes,
+		  uint32_t call_cost, uint32_t pixel_cost);
+
+#endif /* WESTON_DAMAGE_MERGE_H */
@@ -29,12 +29,15 @@
 
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <GLES3/gl3.h>
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <float.h>
 #include <assert.h>
 #include <sys/stat.h>
@@ -53,6 +56,8 @@
 
 #include "gl-renderer.h"
 #include "vertex-clipping.h"
+#include "damage-merge.h"
+#include "shader-cache.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 
@@ -105,6 +110,51 @@ struct yuv_format_descriptor {
 	struct yuv_plane_descriptor plane[4];
 };
 
+/* What an upload call costs, in bytes copied, when merging damage */
+#define GL_UPLOAD_CALL_COST 16384
+
+#define GL_UPLOAD_RING_MIN_SIZE (4 * 1024 * 1024)
+#define GL_UPLOAD_RING_MAX_SIZE (64 * 1024 * 1024)
+#define GL_UPLOAD_ALIGN 64
+#define GL_UPLOAD_MAX_FENCES 16
+#define GL_UPLOAD_FENCE_TIMEOUT 1000000000ull	/* ns */
+
+/* Between the shaders set up ahead of use after the first frame */
+#define SHADER_WARM_INTERVAL_MS 1
+
+struct gl_upload_fence {
+	GLsync sync;
+	size_t start, end;
+};
+
+/*
+ * wl_shm content goes to the textures through a ring of pixel buffer
+ * memory: the damage is copied in on the CPU, and the texture updates are
+ * queued from there, to run on the GPU ahead of the draws that need them.
+ * The compositor doesn't wait for them, so uploading the next frame
+ * overlaps with the GPU still drawing this one. A fence after each upload
+ * tells when its part of the ring may be written again; it is only waited
+ * for when the ring wraps around onto it.
+ *
+ * The ring is mapped once if GL_EXT_buffer_storage is there, else for
+ * every upload. It needs GLES 3.
+ */
+struct gl_upload_ring {
+	GLuint pbo;
+	size_t size;
+	size_t head;
+	uint8_t *map;		/* persistently mapped, or NULL */
+#ifdef GL_EXT_buffer_storage
+	PFNGLBUFFERSTORAGEEXTPROC buffer_storage;
+#endif
+
+	struct gl_upload_fence fences[GL_UPLOAD_MAX_FENCES];
+	int first_fence;
+	int n_fences;
+
+	struct wl_array boxes;	/* struct damage_merge_box, scratch */
+};
+
 static PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
 
 static inline const char *
@@ -687,8 +737,7 @@ use_output(struct weston_output *output)
 
 static int
 shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
-	    const char *vertex_source, const char *fragment_source,
-	    const char *binary_name);
+	    const char *vertex_source, const char *fragment_source);
 
 void
 use_shader(struct gl_renderer *gr, struct gl_shader *shader)
@@ -698,8 +747,7 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 
 		ret =  shader_init(shader, gr,
 				   shader->vertex_source,
-				   shader->fragment_source,
-				   shader->binary_name);
+				   shader->fragment_source);
 
 		if (ret < 0)
 			weston_log("warning: failed to compile shader\n");
@@ -711,6 +759,85 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 	gr->current_shader = shader;
 }
 
+/*
+ * Compiling, or even loading, a shader on first use stalls that frame, so
+ * once the first frame is out the ones it didn't need are set up one at a
+ * time from a timer, leaving the event loop free for clients in between.
+ */
+static struct gl_shader *
+shader_warm_next(struct gl_renderer *gr)
+{
+	struct gl_shader *shaders[] = {
+		&gr->texture_shader_rgba,
+		&gr->texture_shader_rgbx,
+		&gr->solid_shader,
+		&gr->texture_shader_y_uv,
+		&gr->texture_shader_y_u_v,
+		&gr->texture_shader_y_xuxv,
+		&gr->texture_shader_egl_external,
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(shaders); i++) {
+		if (shaders[i]->program)
+			continue;
+		if (shaders[i] == &gr->texture_shader_egl_external &&
+		    !gr->has_egl_image_external)
+			continue;
+
+		return shaders[i];
+	}
+
+	return NULL;
+}
+
+static int
+shader_warm_handler(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_shader *shader;
+
+	shader = shader_warm_next(gr);
+	if (shader && shader_init(shader, gr, shader->vertex_source,
+				  shader->fragment_source) == 0 &&
+	    shader_warm_next(gr)) {
+		wl_event_source_timer_update(gr->shader_warm_source,
+					     SHADER_WARM_INTERVAL_MS);
+		return 0;
+	}
+
+	weston_log("GL shaders ready: %d loaded, %d compiled in %.1f ms\n",
+		   gr->shaders_loaded, gr->shaders_compiled,
+		   gr->shader_time_ns / 1e6);
+
+	wl_event_source_remove(gr->shader_warm_source);
+	gr->shader_warm_source = NULL;
+
+	return 0;
+}
+
+static void
+gl_renderer_first_frame(struct gl_renderer *gr, struct weston_compositor *ec)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(ec->wl_display);
+	struct timespec now;
+
+	gr->first_frame_done = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	weston_log("GL renderer: first frame %.1f ms after start, "
+		   "%.1f ms of it on shaders (%d loaded, %d compiled)\n",
+		   timespec_sub_to_nsec(&now, &gr->setup_time) / 1e6,
+		   gr->shader_time_ns / 1e6,
+		   gr->shaders_loaded, gr->shaders_compiled);
+
+	gr->shader_warm_source =
+		wl_event_loop_add_timer(loop, shader_warm_handler, gr);
+	if (gr->shader_warm_source)
+		wl_event_source_timer_update(gr->shader_warm_source,
+					     SHADER_WARM_INTERVAL_MS);
+}
+
 static void
 shader_uniforms(struct gl_shader *shader,
 		struct weston_view *view,
@@ -1231,6 +1358,9 @@ gl_renderer_repaint_output(struct weston_output *output,
 				    TIMELINE_RENDER_POINT_TYPE_BEGIN);
 	timeline_submit_render_sync(gr, compositor, output, end_render_sync,
 				    TIMELINE_RENDER_POINT_TYPE_END);
+
+	if (!gr->first_frame_done)
+		gl_renderer_first_frame(gr, compositor);
 }
 
 static int
@@ -1278,6 +1408,370 @@ static GLenum gl_format_from_internal(GLenum internal_format)
 	}
 }
 
+static int
+gl_format_bytes_per_pixel(GLenum format, GLenum type)
+{
+	if (type == GL_UNSIGNED_SHORT_5_6_5)
+		return 2;
+
+	switch (format) {
+	case GL_BGRA_EXT:
+	case GL_RGBA:
+		return 4;
+	case GL_RGB:
+		return 3;
+	case GL_RG_EXT:
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* Bytes of plane j in a width x height area of the buffer */
+static uint64_t
+gl_shm_upload_size(struct gl_surface_state *gs, int j, int width, int height)
+{
+	GLenum format = gl_format_from_internal(gs->gl_format[j]);
+
+	return (uint64_t)(width / gs->hsub[j]) *
+	       gl_format_bytes_per_pixel(format, gs->gl_pixel_type) *
+	       (height / gs->vsub[j]);
+}
+
+static struct gl_upload_ring *
+gl_upload_ring_create(const char *extensions)
+{
+	struct gl_upload_ring *ring;
+
+	ring = zalloc(sizeof *ring);
+	if (!ring)
+		return NULL;
+
+	wl_array_init(&ring->boxes);
+
+#ifdef GL_EXT_buffer_storage
+	if (weston_check_egl_extension(extensions, "GL_EXT_buffer_storage"))
+		ring->buffer_storage =
+			(void *) eglGetProcAddress("glBufferStorageEXT");
+#endif
+
+	return ring;
+}
+
+static void
+gl_upload_ring_wait_oldest(struct gl_upload_ring *ring)
+{
+	struct gl_upload_fence *fence = &ring->fences[ring->first_fence];
+
+	glClientWaitSync(fence->sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+			 GL_UPLOAD_FENCE_TIMEOUT);
+	glDeleteSync(fence->sync);
+
+	ring->first_fence = (ring->first_fence + 1) % GL_UPLOAD_MAX_FENCES;
+	ring->n_fences--;
+}
+
+/* Whether the GPU may still read from this part of the ring */
+static bool
+gl_upload_ring_busy(struct gl_upload_ring *ring, size_t start, size_t end)
+{
+	struct gl_upload_fence *fence;
+	int i;
+
+	for (i = 0; i < ring->n_fences; i++) {
+		fence = &ring->fences[(ring->first_fence + i) %
+				      GL_UPLOAD_MAX_FENCES];
+		if (fence->start < end && start < fence->end)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+gl_upload_ring_release(struct gl_upload_ring *ring)
+{
+	while (ring->n_fences > 0)
+		gl_upload_ring_wait_oldest(ring);
+
+	if (ring->map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->pbo);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	if (ring->pbo)
+		glDeleteBuffers(1, &ring->pbo);
+
+	ring->pbo = 0;
+	ring->map = NULL;
+	ring->size = 0;
+	ring->head = 0;
+}
+
+static void
+gl_upload_ring_destroy(struct gl_upload_ring *ring)
+{
+	gl_upload_ring_release(ring);
+	wl_array_release(&ring->boxes);
+	free(ring);
+}
+
+static void
+gl_upload_ring_alloc(struct gl_upload_ring *ring, size_t size)
+{
+	gl_upload_ring_release(ring);
+
+	glGenBuffers(1, &ring->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->pbo);
+
+#ifdef GL_EXT_buffer_storage
+	if (ring->buffer_storage) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT |
+					 GL_MAP_PERSISTENT_BIT_EXT |
+					 GL_MAP_COHERENT_BIT_EXT;
+
+		ring->buffer_storage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+		ring->map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+					     flags);
+		if (!ring->map) {
+			/* The storage is immutable, so start over without */
+			weston_log("Mapping the upload buffer persistently "
+				   "failed, mapping it per upload.\n");
+			ring->buffer_storage = NULL;
+			glDeleteBuffers(1, &ring->pbo);
+			glGenBuffers(1, &ring->pbo);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->pbo);
+		}
+	}
+#endif
+
+	if (!ring->map)
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+			     GL_STREAM_DRAW);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	ring->size = size;
+}
+
+/*
+ * Finds room for size bytes, waiting for the GPU only if it hasn't got
+ * to the uploads that were there yet. Leaves the buffer bound and returns
+ * where to write, or NULL if it doesn't fit.
+ */
+static uint8_t *
+gl_upload_ring_reserve(struct gl_upload_ring *ring, size_t size,
+		       size_t *offset)
+{
+	size_t new_size;
+	uint8_t *ptr;
+
+	if (size > GL_UPLOAD_RING_MAX_SIZE)
+		return NULL;
+
+	/* Room for a couple of uploads this size, so they can overlap */
+	if (size > ring->size / 2 && ring->size < GL_UPLOAD_RING_MAX_SIZE) {
+		new_size = ring->size ? ring->size : GL_UPLOAD_RING_MIN_SIZE;
+		while (new_size < 2 * size &&
+		       new_size < GL_UPLOAD_RING_MAX_SIZE)
+			new_size *= 2;
+		gl_upload_ring_alloc(ring, new_size);
+	}
+
+	if (ring->head + size > ring->size)
+		ring->head = 0;
+
+	while (ring->n_fences == GL_UPLOAD_MAX_FENCES ||
+	       gl_upload_ring_busy(ring, ring->head, ring->head + size))
+		gl_upload_ring_wait_oldest(ring);
+
+	*offset = ring->head;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->pbo);
+
+	if (ring->map)
+		return ring->map + ring->head;
+
+	/* The fences already keep us off what the GPU is reading */
+	ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, ring->head, size,
+			       GL_MAP_WRITE_BIT |
+			       GL_MAP_INVALIDATE_RANGE_BIT |
+			       GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!ptr)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return ptr;
+}
+
+/* Marks the reserved space in use until the GPU is done with it */
+static void
+gl_upload_ring_submit(struct gl_upload_ring *ring, size_t offset, size_t size)
+{
+	struct gl_upload_fence *fence;
+
+	fence = &ring->fences[(ring->first_fence + ring->n_fences) %
+			      GL_UPLOAD_MAX_FENCES];
+	fence->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	fence->start = offset;
+	fence->end = offset + size;
+	ring->n_fences++;
+
+	ring->head = (offset + size + GL_UPLOAD_ALIGN - 1) &
+		     ~(size_t)(GL_UPLOAD_ALIGN - 1);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/*
+ * Uploads the surface's texture damage through the upload ring. The
+ * damage is merged into fewer rectangles first where the extra pixels
+ * cost less than the extra calls. Returns the number of bytes uploaded,
+ * or -1 if the ring can't take it.
+ */
+static ssize_t
+gl_renderer_upload_shm_pbo(struct gl_renderer *gr,
+			   struct weston_surface *surface,
+			   struct gl_surface_state *gs,
+			   struct weston_buffer *buffer)
+{
+	struct gl_upload_ring *ring = gr->upload;
+	struct damage_merge_box *boxes, *b;
+	pixman_box32_t *rectangles = NULL, r;
+	GLenum format;
+	int bpp[3], x[3], y[3], w[3], h[3];
+	size_t size, offset, pos, stride, src_stride;
+	uint8_t *data, *dst, *src;
+	int i, j, row, n;
+
+	for (j = 0; j < gs->num_textures; j++)
+		bpp[j] = gl_format_bytes_per_pixel(
+				gl_format_from_internal(gs->gl_format[j]),
+				gs->gl_pixel_type);
+
+	if (gs->needs_full_upload) {
+		n = 1;
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+	}
+
+	ring->boxes.size = 0;
+	boxes = wl_array_add(&ring->boxes, n * sizeof *boxes);
+	if (!boxes)
+		return -1;
+
+	if (gs->needs_full_upload) {
+		boxes[0].x1 = 0;
+		boxes[0].y1 = 0;
+		boxes[0].x2 = gs->pitch;
+		boxes[0].y2 = buffer->height;
+	} else {
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			boxes[i].x1 = MAX(r.x1, 0);
+			boxes[i].y1 = MAX(r.y1, 0);
+			boxes[i].x2 = MIN(r.x2, buffer->width);
+			boxes[i].y2 = MIN(r.y2, buffer->height);
+		}
+		n = damage_merge(boxes, n, GL_UPLOAD_CALL_COST, bpp[0]);
+	}
+
+	size = 0;
+	for (i = 0; i < n; i++) {
+		b = &boxes[i];
+		if (b->x2 <= b->x1 || b->y2 <= b->y1)
+			continue;
+
+		for (j = 0; j < gs->num_textures; j++) {
+			stride = ((b->x2 - b->x1) / gs->hsub[j] * bpp[j] + 3) &
+				 ~(size_t)3;
+			size += stride * ((b->y2 - b->y1) / gs->vsub[j]);
+		}
+	}
+
+	if (size == 0)
+		return 0;
+
+	dst = gl_upload_ring_reserve(ring, size, &offset);
+	if (!dst)
+		return -1;
+
+	/* Copy everything in first, then queue the texture updates */
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	pos = 0;
+	for (i = 0; i < n; i++) {
+		b = &boxes[i];
+		if (b->x2 <= b->x1 || b->y2 <= b->y1)
+			continue;
+
+		for (j = 0; j < gs->num_textures; j++) {
+			x[j] = b->x1 / gs->hsub[j];
+			y[j] = b->y1 / gs->vsub[j];
+			w[j] = (b->x2 - b->x1) / gs->hsub[j];
+			h[j] = (b->y2 - b->y1) / gs->vsub[j];
+			stride = (w[j] * bpp[j] + 3) & ~(size_t)3;
+			src_stride = gs->pitch / gs->hsub[j] * bpp[j];
+			src = data + gs->offset[j] + y[j] * src_stride +
+			      x[j] * bpp[j];
+
+			if (stride == src_stride) {
+				memcpy(dst + pos, src, stride * h[j]);
+			} else {
+				for (row = 0; row < h[j]; row++)
+					memcpy(dst + pos + row * stride,
+					       src + row * src_stride,
+					       w[j] * bpp[j]);
+			}
+			pos += stride * h[j];
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (!ring->map)
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	/* Rows are packed, 4-byte aligned as GL_UNPACK_ALIGNMENT expects */
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+
+	pos = offset;
+	for (i = 0; i < n; i++) {
+		b = &boxes[i];
+		if (b->x2 <= b->x1 || b->y2 <= b->y1)
+			continue;
+
+		for (j = 0; j < gs->num_textures; j++) {
+			x[j] = b->x1 / gs->hsub[j];
+			y[j] = b->y1 / gs->vsub[j];
+			w[j] = (b->x2 - b->x1) / gs->hsub[j];
+			h[j] = (b->y2 - b->y1) / gs->vsub[j];
+
+			format = gl_format_from_internal(gs->gl_format[j]);
+
+			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
+			if (gs->needs_full_upload)
+				glTexImage2D(GL_TEXTURE_2D, 0,
+					     gs->gl_format[j], w[j], h[j], 0,
+					     format, gs->gl_pixel_type,
+					     (void *)(uintptr_t)pos);
+			else
+				glTexSubImage2D(GL_TEXTURE_2D, 0,
+						x[j], y[j], w[j], h[j],
+						format, gs->gl_pixel_type,
+						(void *)(uintptr_t)pos);
+
+			pos += ((w[j] * bpp[j] + 3) & ~(size_t)3) * h[j];
+		}
+	}
+
+	gl_upload_ring_submit(ring, offset, size);
+
+	return size;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -1288,6 +1782,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	bool texture_used;
 	pixman_box32_t *rectangles;
 	uint8_t *data;
+	ssize_t uploaded;
 	int i, j, n;
 
 	pixman_region32_union(&gs->texture_damage,
@@ -1315,11 +1810,22 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	    !gs->needs_full_upload)
 		goto done;
 
+	if (gr->upload) {
+		uploaded = gl_renderer_upload_shm_pbo(gr, surface, gs, buffer);
+		if (uploaded >= 0) {
+			gr->base.upload_bytes += uploaded;
+			goto done;
+		}
+	}
+
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
 	if (!gr->has_unpack_subimage) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 		for (j = 0; j < gs->num_textures; j++) {
+			gr->base.upload_bytes += gl_shm_upload_size(gs, j,
+					gs->pitch, buffer->height);
+
 			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
 			glTexImage2D(GL_TEXTURE_2D, 0,
 				     gs->gl_format[j],
@@ -1340,6 +1846,9 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 		for (j = 0; j < gs->num_textures; j++) {
+			gr->base.upload_bytes += gl_shm_upload_size(gs, j,
+					gs->pitch, buffer->height);
+
 			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
 			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
 				      gs->pitch / gs->hsub[j]);
@@ -1364,6 +1873,9 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
 
 		for (j = 0; j < gs->num_textures; j++) {
+			gr->base.upload_bytes += gl_shm_upload_size(gs, j,
+					r.x2 - r.x1, r.y2 - r.y1);
+
 			glBindTexture(GL_TEXTURE_2D, gs->textures[j]);
 			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
 				      gs->pitch / gs->hsub[j]);
@@ -2608,224 +3120,100 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
-static int
-shader_load_binary(struct gl_shader *shader)
+static void
+shader_key(struct gl_renderer *gr, const char *vertex_source,
+	   const char **sources, int count, struct shader_cache_key *key)
 {
-	char msg[512];
-	FILE *fp;
-	GLint shader_size;
-	GLenum format;
-	char *binary;
-	GLint status;
-	int ret;
-
-	fp = fopen(shader->binary_name, "rb");
-	if (!fp) {
-		return -1;
-	}
-
-	/*
-	 * First 'GLint' of the file is the size of the binary shader
-	 * data.  The second 'GLenum' is the binary format.	 The rest
-	 * of the file is the shader data itself.
-	 */
-	ret = fread(&shader_size, sizeof(shader_size), 1, fp);
-	if (ret != 1) {
-		fclose(fp);
-		return -1;
-	}
-
-	/* Allocate space for the shader binary */
-	binary = malloc(shader_size);
-	if (!binary) {
-		fclose(fp);
-		return -1;
-	}
-
-	/* Read the binary format */
-	ret = fread(&format, sizeof(format), 1, fp);
-	if (ret != 1) {
-		fclose(fp);
-		free(binary);
-		return -1;
-	}
-
-	/* Read the shader binary */
-	ret = fread(binary, shader_size, 1, fp);
-	if (ret != 1) {
-		fclose(fp);
-		free(binary);
-		return -1;
-	}
-
-	fclose(fp);
-
-	program_binary(shader->program, format, binary, shader_size);
-
-	free(binary);
-	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
-	if (!status) {
-		glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
-		weston_log("link info: %s\n", msg);
-		return -1;
-	}
+	int i;
 
-	return 0;
+	*key = gr->shader_cache_key;
+	shader_cache_key_add_string(key, vertex_source);
+	for (i = 0; i < count; i++)
+		shader_cache_key_add_string(key, sources[i]);
 }
 
-/*
- * generate_shaders()
- *
- * Compile shaders from source (ignoring any existing binaries that exist)
- * and will then generate and save new binary versions.
-*/
+/* Binaries installed next to the modules are looked up after the cache */
 static int
-generate_shaders(struct gl_shader *shader)
+shader_load_binary(struct gl_renderer *gr, struct gl_shader *shader,
+		   const struct shader_cache_key *key)
 {
-	if (shader->binary_name == NULL) {
-		return -1;
-	}
-
-	GLint program_size = 0;
-	GLenum program_format;
-	GLvoid* binary_program = NULL;
-	FILE *fp;
+	const char *dirs[] = { gr->shader_cache_dir, LIBWESTON_MODULEDIR };
+	struct shader_cache_entry entry;
+	char path[PATH_MAX];
+	GLint status;
+	unsigned int i;
 
-	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES,
-				   &program_size);
+	for (i = 0; i < ARRAY_LENGTH(dirs); i++) {
+		if (!dirs[i] ||
+		    shader_cache_path(path, sizeof path, dirs[i], key) < 0 ||
+		    shader_cache_load(path, key, &entry) < 0)
+			continue;
 
-	binary_program = malloc(program_size);
-	if (!binary_program) {
-		   weston_log("Failed to generate shader binary\n");
-		   return -1;
-	}
+		program_binary(shader->program, entry.format,
+			       entry.binary, entry.size);
+		shader_cache_entry_release(&entry);
 
-	get_program_binary(shader->program, program_size, NULL, &program_format,
-					   binary_program);
+		glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+		if (status) {
+			weston_log("Loaded binary shader %s from %s\n",
+				   shader->name, path);
+			return 0;
+		}
 
-	if (!(fp = fopen(shader->binary_name, "wb"))) {
-		weston_log("Failed to generate shader binary\n");
-		free(binary_program);
-		return -1;
+		weston_log("GL driver rejected binary shader %s\n", path);
 	}
 
-	fwrite(&program_size, sizeof(program_size), 1, fp);
-	fwrite(&program_format, sizeof(program_format), 1, fp);
-	fwrite(binary_program, program_size, 1, fp);
-	fclose(fp);
-	free(binary_program);
-
-	weston_log("Generated binary shader %s\n", shader->binary_name);
-
-	return 0;
+	return -1;
 }
 
-/*
- * shader_init_standard()
- *
- * If driver supports binary shaders, we will attempt to load those from disk.
- * If binary shader programs are not supported, or if we fail to load the
- * binary shader program for any reason, we will compile the shader with the
- * online compiler.
- */
-
-static int
-shader_init_standard(struct gl_shader *shader, struct gl_renderer *renderer,
-		   const char *vertex_source, const char *fragment_source,
-		   const char *binary_name)
+static void
+shader_store_binary(struct gl_renderer *gr, struct gl_shader *shader,
+		    const struct shader_cache_key *key)
 {
-	char msg[512];
-	GLint status;
-	int count;
-	const char *sources[3];
-
-	shader->program = glCreateProgram();
-	if (!shader->program) {
-		weston_log("Error occurs creating the program object.");
-	}
-
-	glBindAttribLocation(shader->program, 0, "position");
-	glBindAttribLocation(shader->program, 1, "texcoord");
-
-	shader->binary_name = binary_name;
-
-	/* Try to load binary shader only when DRI supports that feature */
-	if (shader->binary_name && program_binary) {
-		if (shader_load_binary(shader) < 0) {
-			weston_log("Failed to load binary shader %s\n",
-				shader->binary_name);
-
-			/* Fall back to traditional compilation below */
-			shader->binary_name = NULL;
-		} else {
-			weston_log("Loaded binary shader %s\n", shader->binary_name);
-		}
-	}
-
-	if (!shader->binary_name) {
-		shader->vertex_shader =
-			compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
-
-		if (renderer->fragment_shader_debug) {
-			sources[0] = fragment_source;
-			sources[1] = fragment_debug;
-			sources[2] = fragment_brace;
-			count = 3;
-		} else {
-			sources[0] = fragment_source;
-			sources[1] = fragment_brace;
-			count = 2;
-		}
+	const char *dir = gr->shader_cache_dir ?: LIBWESTON_MODULEDIR;
+	char path[PATH_MAX];
+	GLint size = 0;
+	GLenum format;
+	void *binary;
 
-		shader->fragment_shader =
-			compile_shader(GL_FRAGMENT_SHADER, count, sources);
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES, &size);
+	if (size <= 0 || shader_cache_path(path, sizeof path, dir, key) < 0)
+		return;
 
-		glAttachShader(shader->program, shader->vertex_shader);
-		glAttachShader(shader->program, shader->fragment_shader);
+	binary = malloc(size);
+	if (!binary)
+		return;
 
-		glLinkProgram(shader->program);
-		glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
-		if (!status) {
-			glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
-			weston_log("link info: %s\n", msg);
-			return -1;
-		}
-	}
+	get_program_binary(shader->program, size, &size, &format, binary);
 
-	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
-	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
-	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
-	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
-	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
-	shader->color_uniform = glGetUniformLocation(shader->program, "color");
+	if (shader_cache_store(path, key, format, binary, size) < 0)
+		weston_log("Failed to generate binary shader %s\n", path);
+	else
+		weston_log("Generated binary shader %s\n", path);
 
-	return 0;
+	free(binary);
 }
 
 /*
- * shader_init_generate()
+ * shader_init()
  *
- * Compile shaders from source (ignoring any existing binaries that exist)
- * and will then generate/save new binary versions.
+ * If the driver supports binary shaders, we first try to load the program
+ * from the binary cache. Otherwise, or if there is no valid binary for
+ * these sources and this driver, the shader is compiled with the online
+ * compiler and the result stored in the cache for the next start.
  */
 static int
-shader_init_generate(struct gl_shader *shader, struct gl_renderer *renderer,
-		   const char *vertex_source, const char *fragment_source,
-		   const char *binary_name)
+shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
+	    const char *vertex_source, const char *fragment_source)
 {
+	struct shader_cache_key key;
+	struct timespec begin, end;
 	char msg[512];
 	GLint status;
 	int count;
 	const char *sources[3];
 
-	shader->binary_name = binary_name;
-	shader->program = glCreateProgram();
-
-	glBindAttribLocation(shader->program, 0, "position");
-	glBindAttribLocation(shader->program, 1, "texcoord");
-
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 
 	if (renderer->fragment_shader_debug) {
 		sources[0] = fragment_source;
@@ -2838,6 +3226,25 @@ shader_init_generate(struct gl_shader *shader, struct gl_renderer *renderer,
 		count = 2;
 	}
 
+	shader->program = glCreateProgram();
+	if (!shader->program) {
+		weston_log("Error occurs creating the program object.");
+	}
+
+	glBindAttribLocation(shader->program, 0, "position");
+	glBindAttribLocation(shader->program, 1, "texcoord");
+
+	if (renderer->has_shader_cache) {
+		shader_key(renderer, vertex_source, sources, count, &key);
+
+		if (shader_load_binary(renderer, shader, &key) == 0) {
+			renderer->shaders_loaded++;
+			goto out;
+		}
+	}
+
+	shader->vertex_shader =
+		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
 	shader->fragment_shader =
 		compile_shader(GL_FRAGMENT_SHADER, count, sources);
 
@@ -2852,6 +3259,11 @@ shader_init_generate(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+	renderer->shaders_compiled++;
+	if (renderer->has_shader_cache)
+		shader_store_binary(renderer, shader, &key);
+
+out:
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
@@ -2859,38 +3271,79 @@ shader_init_generate(struct gl_shader *shader, struct gl_renderer *renderer,
 	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
 	shader->color_uniform = glGetUniformLocation(shader->program, "color");
 
-	/* Generate binary shader only when DRI supports that feature */
-	if (get_program_binary) {
-		generate_shaders(shader);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	renderer->shader_time_ns += timespec_sub_to_nsec(&end, &begin);
 
 	return 0;
 }
 
-/*
- * shader_init()
- *
- * This function will dispatch to the appropriate worker function depending on
- * whether this is a development build being used to generate new binary shader
- * programs, or whether this is a regular build.  The conditional guard used
- * here is a compile-time constant provided by the autoconf system, so the
- * compiler/linker will be able to optimize it away completely, while also
- * avoiding warnings about unused functions.
-*/
-static inline int
-shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
-		   const char *vertex_source, const char *fragment_source,
-		   const char *binary_name)
-{
-	/* Check if binary shader file exists, if so try to load it, otherwise generate it */
-	struct stat tmp;
-	if (stat(binary_name, &tmp)) {
-		return shader_init_generate(shader, renderer, vertex_source,
-					    fragment_source, binary_name);
+/* $WESTON_SHADER_CACHE_DIR, or weston/ in the XDG cache directory */
+static char *
+shader_cache_dir_create(void)
+{
+	const char *env;
+	char *base = NULL;
+	char *dir = NULL;
+
+	env = getenv("WESTON_SHADER_CACHE_DIR");
+	if (env && env[0]) {
+		dir = strdup(env);
 	} else {
-		return shader_init_standard(shader, renderer, vertex_source,
-				            fragment_source, binary_name);
+		env = getenv("XDG_CACHE_HOME");
+		if (env && env[0] == '/') {
+			base = strdup(env);
+		} else {
+			env = getenv("HOME");
+			if (env && env[0] == '/' &&
+			    asprintf(&base, "%s/.cache", env) < 0)
+				base = NULL;
+		}
+
+		if (base) {
+			mkdir(base, 0700);
+			if (asprintf(&dir, "%s/weston", base) < 0)
+				dir = NULL;
+			free(base);
+		}
 	}
+
+	if (dir && mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		weston_log("Failed to create shader cache %s: %m\n", dir);
+		free(dir);
+		dir = NULL;
+	}
+
+	return dir;
+}
+
+/*
+ * The driver's part of the cache key: anything that could make it produce
+ * a different binary from the same sources, or not accept an old one.
+ */
+static int
+shader_cache_init(struct gl_renderer *gr, GLint num_formats)
+{
+	GLint *formats;
+
+	formats = calloc(num_formats, sizeof *formats);
+	if (!formats)
+		return -1;
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS_OES, formats);
+
+	shader_cache_key_init(&gr->shader_cache_key);
+	shader_cache_key_add_string(&gr->shader_cache_key,
+				    (const char *) glGetString(GL_VENDOR));
+	shader_cache_key_add_string(&gr->shader_cache_key,
+				    (const char *) glGetString(GL_RENDERER));
+	shader_cache_key_add_string(&gr->shader_cache_key,
+				    (const char *) glGetString(GL_VERSION));
+	shader_cache_key_add(&gr->shader_cache_key, formats,
+			     num_formats * sizeof *formats);
+	free(formats);
+
+	gr->shader_cache_dir = shader_cache_dir_create();
+
+	return 0;
 }
 
 static void
@@ -3287,6 +3740,13 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	if (gr->upload)
+		gl_upload_ring_destroy(gr->upload);
+
+	if (gr->shader_warm_source)
+		wl_event_source_remove(gr->shader_warm_source);
+	free(gr->shader_cache_dir);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
@@ -3647,6 +4107,8 @@ gl_renderer_display_create(struct weston_compositor *ec, EGLenum platform,
 	if (gr == NULL)
 		return -1;
 
+	clock_gettime(CLOCK_MONOTONIC, &gr->setup_time);
+
 	gr->base.read_pixels = gl_renderer_read_pixels;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.repaint_output_base = gl_renderer_repaint_output_base;
@@ -3744,7 +4206,7 @@ gl_renderer_display_create(struct weston_compositor *ec, EGLenum platform,
 		goto fail_with_error;
 	}
 
-	VM_INIT(gr, vm_result);
+	VM_INIT(ec, gr, vm_result);
 	if (vm_result != 0)
 		goto fail_with_cleanup;
 
@@ -3773,41 +4235,34 @@ compile_shaders(struct weston_compositor *ec)
 
 	gr->texture_shader_rgba.vertex_source = vertex_shader;
 	gr->texture_shader_rgba.fragment_source = texture_fragment_shader_rgba;
-	gr->texture_shader_rgba.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_rgba.shader" : NULL;
+	gr->texture_shader_rgba.name = "rgba";
 
 	gr->texture_shader_rgbx.vertex_source = vertex_shader;
 	gr->texture_shader_rgbx.fragment_source = texture_fragment_shader_rgbx;
-	gr->texture_shader_rgbx.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_rgbax.shader" : NULL;
+	gr->texture_shader_rgbx.name = "rgbx";
 
 	gr->texture_shader_egl_external.vertex_source = vertex_shader;
 	gr->texture_shader_egl_external.fragment_source =
 		texture_fragment_shader_egl_external;
-	gr->texture_shader_egl_external.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_egl_external.shader" : NULL;
+	gr->texture_shader_egl_external.name = "egl_external";
 
 	gr->texture_shader_y_uv.vertex_source = vertex_shader;
 	gr->texture_shader_y_uv.fragment_source = texture_fragment_shader_y_uv;
-	gr->texture_shader_y_uv.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_y_uv.shader" : NULL;
+	gr->texture_shader_y_uv.name = "y_uv";
 
 	gr->texture_shader_y_u_v.vertex_source = vertex_shader;
 	gr->texture_shader_y_u_v.fragment_source =
 		texture_fragment_shader_y_u_v;
-	gr->texture_shader_y_u_v.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_y_u_v.shader" : NULL;
+	gr->texture_shader_y_u_v.name = "y_u_v";
 
 	gr->texture_shader_y_xuxv.vertex_source = vertex_shader;
 	gr->texture_shader_y_xuxv.fragment_source =
 		texture_fragment_shader_y_xuxv;
-	gr->texture_shader_y_xuxv.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_y_xuxv.shader" : NULL;
+	gr->texture_shader_y_xuxv.name = "y_xuxv";
 
 	gr->solid_shader.vertex_source = vertex_shader;
 	gr->solid_shader.fragment_source = solid_fragment_shader;
-	gr->solid_shader.binary_name =
-		program_binary ? LIBWESTON_MODULEDIR "/weston_solid.shader" : NULL;
+	gr->solid_shader.name = "solid";
 
 	return 0;
 }
@@ -3984,6 +4439,9 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	if (gr->gl_version >= GR_GL_VERSION(3, 0))
+		gr->upload = gl_upload_ring_create(extensions);
+
 	if (strstr(extensions, "GL_OES_get_program_binary")) {
 
 		/*
@@ -3991,7 +4449,8 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		 * only support zero binary formats.  Make sure our driver
 		 * supports a non-zero number of formats before we proceed.
 		*/
-		glGetIntegerv(GL_PROGRAM_BINARY_FORMATS_OES, &num_binprog_formats);
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES,
+			      &num_binprog_formats);
 	}
 
 	/*
@@ -4003,6 +4462,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 			(void *) eglGetProcAddress("glProgramBinaryOES");
 		get_program_binary =
 			(void *) eglGetProcAddress("glGetProgramBinaryOES");
+
+		if (program_binary && get_program_binary &&
+		    shader_cache_init(gr, num_binprog_formats) == 0)
+			gr->has_shader_cache = 1;
 	} else if (GENERATE_BINARY_SHADERS) {
 		weston_log("Can't generate shader binaries."
 				   "GL driver lacks binary shader program support\n");
@@ -4031,6 +4494,15 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBOs: %s\n",
+			    !gr->upload ? "no" :
+#ifdef GL_EXT_buffer_storage
+			    gr->upload->buffer_storage ? "yes, persistent" :
+#endif
+			    "yes");
+	weston_log_continue(STAMP_SPACE "program binary cache: %s\n",
+			    !gr->has_shader_cache ? "no" :
+			    gr->shader_cache_dir ?: LIBWESTON_MODULEDIR);
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
@@ -29,8 +29,10 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <time.h>
 
 #include "compositor.h"
+#include "shader-cache.h"
 
 #ifdef ENABLE_EGL
 
@@ -146,6 +148,8 @@ struct gl_renderer_interface {
 	int vm_dbg;
 	int vm_unexport_delay;
 	int vm_share_only;
+	/* Send metadata deltas with a full table every n frames, 0 = off */
+	int vm_delta_keyframe;
 	const char* vm_plugin_path;
 	const char* vm_plugin_args;
 #endif // USE_VM
@@ -159,7 +163,7 @@ struct gl_shader {
 	GLint alpha_uniform;
 	GLint color_uniform;
 	const char *vertex_source, *fragment_source;
-	const char *binary_name;
+	const char *name;
 };
 
 
@@ -193,6 +197,24 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+	/* wl_shm uploads through pixel buffer objects, NULL without */
+	struct gl_upload_ring *upload;
+
+	/* Program binary cache, see shader-cache.h. The driver's part of
+	 * the key is in shader_cache_key, entries are looked up in
+	 * shader_cache_dir and then the module directory. */
+	int has_shader_cache;
+	char *shader_cache_dir;
+	struct shader_cache_key shader_cache_key;
+
+	/* Compiles the shaders the first frame didn't need */
+	struct wl_event_source *shader_warm_source;
+	int first_frame_done;
+	struct timespec setup_time;
+	int64_t shader_time_ns;
+	int shaders_loaded;
+	int shaders_compiled;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
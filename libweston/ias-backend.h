@@ -60,6 +60,7 @@
 #include "presentation-time-server-protocol.h"
 #include "launcher-util.h"
 #include "config-parser.h"
+#include "plane-solver.h"
 
 #define MAX_OUTPUTS_PER_CRTC 4
 
@@ -155,6 +156,12 @@ struct ias_output_model {
 	/* Update sprite plane properties in preperation of a flip */
 	void (*update_sprites)(struct ias_crtc *);
 
+	/*
+	 * Check the next state of the free sprites with the kernel, without
+	 * committing it (optional).  Returns 0 if the display can show it.
+	 */
+	int (*test_sprites)(struct ias_crtc *);
+
 	/* Check if a surface is flippable in this output model */
 	uint32_t (*is_surface_flippable)(
 			struct weston_view* view,
@@ -313,6 +320,12 @@ struct ias_crtc {
 	int num_sprites;
 	int sprites_are_broken;
 
+	/*
+	 * Picks client buffers for the sprites that aren't tied to an output.
+	 * Only set if the output model has some and can test them.
+	 */
+	struct plane_solver *plane_solver;
+
 	/* Output model info */
 	struct ias_output_model *output_model;
 
@@ -387,7 +400,7 @@ struct ias_sprite {
 	int pipe_id;
 	int index;
 	struct weston_plane plane;
-	int output_id;
+	int output_id;		/* -1 if free for client buffers */
 
 	int type;
 	int rotation;
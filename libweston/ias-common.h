@@ -192,13 +192,35 @@ struct ias_output {
 };
 
 #ifdef BUILD_FRAME_CAPTURE
+struct capture_proxy_stats;
+
+/* Number of client buffers per captured surface whose imported bo and
+ * prime fd are kept, enough for triple buffering plus one spare. */
+#define IAS_CAPTURE_BUFFER_CACHE_SIZE 4
+
+struct ias_capture_buffer {
+	struct wl_list link;
+	struct weston_buffer *buffer;
+	struct gbm_bo *bo;
+	int prime_fd;
+	uint32_t stride;
+	uint32_t format;
+	struct wl_listener buffer_destroy_listener;
+};
+
 struct ias_surface_capture {
 	struct wl_list link;
 	struct capture_proxy *cp;
 	struct weston_surface *capture_surface;
 	struct wl_listener capture_commit_listener;
 	struct wl_listener capture_vsync_listener;
+	struct wl_listener surface_destroy_listener;
 	struct ias_backend *backend;
+
+	/* Most recently used first. */
+	struct wl_list buffer_cache;
+	uint32_t cache_hits;
+	uint32_t cache_misses;
 };
 #endif
 
@@ -291,6 +313,13 @@ struct ias_backend {
 	int (*release_buffer_handle)(struct ias_backend *ias_backend,
 			uint32_t surfid, uint32_t bufid, uint32_t imageid,
 			struct weston_surface *surface, uint32_t output_number);
+	int (*set_capture_rate)(struct ias_backend *ias_backend,
+			struct weston_surface *surface, uint32_t output_number,
+			uint32_t target_fps, uint32_t max_burst,
+			uint32_t max_in_flight, uint32_t policy);
+	int (*get_capture_stats)(struct ias_backend *ias_backend,
+			struct weston_surface *surface, uint32_t output_number,
+			struct capture_proxy_stats *stats);
 
 	struct wl_list capture_proxy_list;
 #endif
@@ -302,6 +331,7 @@ struct ias_backend {
 	int rbc_enabled;
 	int rbc_debug;
 	int use_cursor_as_uplane;
+	int auto_sprites;
 };
 
 /*
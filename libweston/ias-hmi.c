@@ -38,21 +38,207 @@
 
 #include "ias-hmi.h"
 #include "ias-shell.h"
+#ifdef BUILD_FRAME_CAPTURE
+#include "capture-proxy.h"
+#endif
+
+static struct hmi_callback *
+hmi_callback_from_resource(struct ias_shell *shell,
+		struct wl_resource *resource)
+{
+	struct hmi_callback *cb;
+
+	wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
+		if (cb->resource == resource) {
+			return cb;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * hmi_txn_apply_surface()
+ *
+ * Makes the held back changes of one surface take effect and takes it out
+ * of its transaction.
+ */
+static void
+hmi_txn_apply_surface(struct ias_surface *shsurf)
+{
+	struct ias_surface_txn *txn = &shsurf->txn;
+
+	wl_list_remove(&shsurf->txn_link);
+	wl_list_init(&shsurf->txn_link);
+	shsurf->txn_owner = NULL;
+
+	if (txn->behavior_update) {
+		shsurf->next_behavior = txn->behavior;
+	}
+	if (txn->zorder_update) {
+		shsurf->next_zorder = txn->zorder;
+	}
+	if (txn->position_update) {
+		shsurf->x = txn->x;
+		shsurf->y = txn->y;
+		shsurf->position_update = 1;
+	}
+	if (txn->alpha_update) {
+		shsurf->view->alpha = txn->alpha;
+		weston_surface_damage(shsurf->surface);
+	}
+	memset(txn, 0, sizeof *txn);
+
+	ias_committed(shsurf->surface, 0, 0);
+}
+
+/*
+ * hmi_txn_apply()
+ *
+ * Makes the changes held back by an ias_hmi transaction take effect. They
+ * all end up in the same repaint, and ias_committed() sends one surface_info
+ * per surface.
+ */
+static void
+hmi_txn_apply(struct ias_shell *shell, struct hmi_callback *cb)
+{
+	struct ias_surface *shsurf, *next;
+
+	wl_list_for_each_safe(shsurf, next, &cb->txn_surfaces, txn_link) {
+		hmi_txn_apply_surface(shsurf);
+	}
+
+	if (cb->txn_damage_all) {
+		weston_compositor_damage_all(shell->compositor);
+		cb->txn_damage_all = 0;
+	}
+}
+
+/*
+ * hmi_surface_claim()
+ *
+ * Called before a request updates the pending state of a surface. Only one
+ * transaction can hold a surface back, so if another HMI client's
+ * transaction has it, that client's changes take effect now instead of
+ * being mixed up with this request's.
+ */
+static void
+hmi_surface_claim(struct wl_resource *shell_resource,
+		struct ias_surface *shsurf)
+{
+	struct ias_shell *shell = shell_resource->data;
+
+	if (wl_list_empty(&shsurf->txn_link) ||
+			shsurf->txn_owner ==
+			hmi_callback_from_resource(shell, shell_resource)) {
+		return;
+	}
+
+	hmi_txn_apply_surface(shsurf);
+}
+
+/*
+ * hmi_in_txn()
+ *
+ * Whether the requests of an HMI client only update the transaction state
+ * of its surfaces (shsurf->txn) rather than their pending state.
+ */
+static int
+hmi_in_txn(struct wl_resource *shell_resource)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+
+	return cb && cb->txn_depth;
+}
+
+/*
+ * hmi_surface_changed()
+ *
+ * Called once a request has updated the pending state of a surface. Outside
+ * of a transaction the state takes effect right away, otherwise the surface
+ * is queued up for the commit request.
+ */
+static void
+hmi_surface_changed(struct wl_resource *shell_resource,
+		struct ias_surface *shsurf,
+		int damage_all)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+	if (cb && cb->txn_depth) {
+		if (wl_list_empty(&shsurf->txn_link)) {
+			wl_list_insert(cb->txn_surfaces.prev, &shsurf->txn_link);
+			shsurf->txn_owner = cb;
+		}
+		cb->txn_damage_all |= damage_all;
+		return;
+	}
+
+	ias_committed(shsurf->surface, 0, 0);
+	if (damage_all) {
+		weston_compositor_damage_all(shell->compositor);
+	}
+}
+
+/*
+ * Behavior, zorder, position and alpha a surface will have once its pending
+ * changes are applied, so that changes made relative to them stack up within
+ * a transaction.
+ */
+static uint32_t
+surface_next_behavior(struct ias_surface *shsurf)
+{
+	if (shsurf->txn.behavior_update) {
+		return shsurf->txn.behavior;
+	}
+
+	return shsurf->next_behavior;
+}
+
+static void
+surface_next_position(struct ias_surface *shsurf, int32_t *x, int32_t *y)
+{
+	if (shsurf->txn.position_update) {
+		*x = shsurf->txn.x;
+		*y = shsurf->txn.y;
+	} else if (shsurf->position_update) {
+		*x = shsurf->x;
+		*y = shsurf->y;
+	} else {
+		*x = (int32_t)shsurf->view->geometry.x;
+		*y = (int32_t)shsurf->view->geometry.y;
+	}
+}
+
+static uint32_t
+surface_next_alpha(struct ias_surface *shsurf)
+{
+	if (shsurf->txn.alpha_update) {
+		return (uint32_t)(shsurf->txn.alpha * 0xFF);
+	}
+
+	return (uint32_t)(shsurf->view->alpha * 0xFF);
+}
 
 static void
 destroy_ias_hmi_resource(struct wl_resource *resource)
 {
-	struct hmi_callback *hmi, *next;
 	struct ias_shell *shell = resource->data;
+	struct hmi_callback *hmi;
 
-	wl_list_for_each_safe(hmi, next, &shell->sfc_change_callbacks, link) {
-		if (resource == hmi->resource) {
-			/* Remove ourselves from the surface's destructor list */
-			wl_list_remove(&hmi->link);
-			free(hmi);
+	hmi = hmi_callback_from_resource(shell, resource);
+	if (hmi) {
+		/* Don't leave changes of an unfinished transaction behind */
+		hmi_txn_apply(shell, hmi);
 
-			return;
-		}
+		/* Remove ourselves from the surface's destructor list */
+		wl_list_remove(&hmi->link);
+		free(hmi);
 	}
 }
 
@@ -66,15 +252,21 @@ ias_hmi_set_behavior(struct wl_client *client,
 	struct ias_shell *shell = shell_resource->data;
 	struct ias_surface *shsurf;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			shsurf->next_behavior = (behavior & 0x00ffffff) |
-				(shsurf->behavior & 0xff000000);
-			ias_committed(shsurf->surface, 0, 0);
-			return;
-		}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
 	}
+
+	hmi_surface_claim(shell_resource, shsurf);
+
+	behavior = (behavior & 0x00ffffff) | (shsurf->behavior & 0xff000000);
+	if (hmi_in_txn(shell_resource)) {
+		shsurf->txn.behavior = behavior;
+		shsurf->txn.behavior_update = 1;
+	} else {
+		shsurf->next_behavior = behavior;
+	}
+	hmi_surface_changed(shell_resource, shsurf, 0);
 }
 
 static void
@@ -89,37 +281,42 @@ ias_hmi_set_constant_alpha(struct wl_client *client,
 	int32_t rel_alpha;
 	int32_t new_alpha;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			rel_alpha = alpha - (uint32_t)(shsurf->view->alpha * 0xFF);
-
-			if (alpha <= 0xFF) {
-				shsurf->view->alpha =
-						(GLfloat)((GLfloat) alpha / (GLfloat) 0xFF);
-				weston_surface_damage(shsurf->surface);
-
-				/* Need to modify the alpha value for descendant surfaces */
-				wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
-					new_alpha =
-						(uint32_t)(child_shsurf->view->alpha * 0xFF) +
-						rel_alpha;
-
-					if (new_alpha < 0) {
-						new_alpha = 0;
-					} else if (new_alpha > 0xFF) {
-						new_alpha = 0xFF;
-					}
-
-					ias_hmi_set_constant_alpha(client, shell_resource,
-							SURFPTR2ID(child_shsurf), new_alpha);
-				}
-
-			} else {
-				IAS_DEBUG("Invalid alpha value specified");
-			}
-			return;
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
+
+	hmi_surface_claim(shell_resource, shsurf);
+
+	if (alpha > 0xFF) {
+		IAS_DEBUG("Invalid alpha value specified");
+		return;
+	}
+
+	rel_alpha = alpha - surface_next_alpha(shsurf);
+
+	if (hmi_in_txn(shell_resource)) {
+		shsurf->txn.alpha = (GLfloat)((GLfloat) alpha / (GLfloat) 0xFF);
+		shsurf->txn.alpha_update = 1;
+		hmi_surface_changed(shell_resource, shsurf, 0);
+	} else {
+		shsurf->view->alpha = (GLfloat)((GLfloat) alpha / (GLfloat) 0xFF);
+		shsurf->txn.alpha_update = 0;
+		weston_surface_damage(shsurf->surface);
+	}
+
+	/* Need to modify the alpha value for descendant surfaces */
+	wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
+		new_alpha = surface_next_alpha(child_shsurf) + rel_alpha;
+
+		if (new_alpha < 0) {
+			new_alpha = 0;
+		} else if (new_alpha > 0xFF) {
+			new_alpha = 0xFF;
 		}
+
+		ias_hmi_set_constant_alpha(client, shell_resource,
+				SURFPTR2ID(child_shsurf), new_alpha);
 	}
 }
 
@@ -133,36 +330,44 @@ ias_hmi_move_surface(struct wl_client *client,
 	struct ias_surface *shsurf;
 	struct ias_surface *child_shsurf;
 	int32_t relx, rely;
+	int32_t oldx, oldy;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			/* Don't try to move fullscreen or background surfaces */
-			if (shsurf->zorder == SHELL_SURFACE_ZORDER_BACKGROUND ||
-					shsurf->zorder == SHELL_SURFACE_ZORDER_FULLSCREEN) {
-				return;
-			}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
 
-			/* Store the relative change in position so we know how much
-			 * to move the child surfaces. When a surface is first created,
-			 * shsurf->x still has the value of 0.
-			 */
-			relx = x - (int32_t)shsurf->view->geometry.x;
-			rely = y - (int32_t)shsurf->view->geometry.y;
-			shsurf->x = x;
-			shsurf->y = y;
-			shsurf->position_update = 1;
-			ias_committed(shsurf->surface, 0, 0);
-
-			wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
-				ias_hmi_move_surface(client, shell_resource,
-						SURFPTR2ID(child_shsurf),
-						child_shsurf->view->geometry.x + relx,
-						child_shsurf->view->geometry.y + rely);
-			}
+	hmi_surface_claim(shell_resource, shsurf);
 
-			return;
-		}
+	/* Don't try to move fullscreen or background surfaces */
+	if (shsurf->zorder == SHELL_SURFACE_ZORDER_BACKGROUND ||
+			shsurf->zorder == SHELL_SURFACE_ZORDER_FULLSCREEN) {
+		return;
+	}
+
+	/* Store the relative change in position so we know how much
+	 * to move the child surfaces. When a surface is first created,
+	 * shsurf->x still has the value of 0.
+	 */
+	surface_next_position(shsurf, &oldx, &oldy);
+	relx = x - oldx;
+	rely = y - oldy;
+	if (hmi_in_txn(shell_resource)) {
+		shsurf->txn.x = x;
+		shsurf->txn.y = y;
+		shsurf->txn.position_update = 1;
+	} else {
+		shsurf->x = x;
+		shsurf->y = y;
+		shsurf->position_update = 1;
+	}
+	hmi_surface_changed(shell_resource, shsurf, 0);
+
+	wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
+		surface_next_position(child_shsurf, &oldx, &oldy);
+		ias_hmi_move_surface(client, shell_resource,
+				SURFPTR2ID(child_shsurf),
+				oldx + relx, oldy + rely);
 	}
 }
 
@@ -177,48 +382,34 @@ ias_hmi_resize_surface(struct wl_client *client,
 	struct weston_surface *es;
 	struct weston_frame_callback *cb, *cnext;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			if (shsurf->zorder == SHELL_SURFACE_ZORDER_BACKGROUND ||
-					shsurf->zorder == SHELL_SURFACE_ZORDER_FULLSCREEN ||
-					(width <= 0 || height <= 0)) {
-				ias_hmi_send_surface_info(client_resource, SURFPTR2ID(shsurf),
-						shsurf->title,
-						shsurf->zorder,
-						(int32_t)shsurf->view->geometry.x,
-						(int32_t)shsurf->view->geometry.y,
-						shsurf->surface->width,
-						shsurf->surface->height,
-						(uint32_t) (shsurf->view->alpha * 0xFF),
-						(uint32_t) (shsurf->behavior),
-						shsurf->pid,
-						shsurf->pname,
-						shsurf->view->output ? shsurf->view->output->id : 0,
-						ias_surface_is_flipped(shsurf));
-
-				return;
-			}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
 
-			shsurf->hmi_client->send_configure(shsurf->surface,
-					width, height);
-
-			/*
-			 * Send callbacks for any outstanding 'frame' requests; it's
-			 * possible that the changes we made here caused the surface
-			 * to become visible even though it wasn't before.  If we
-			 * don't send a frame event to get things moving again, the
-			 * client will never send us a new buffer and the configure
-			 * event above will have no effect.
-			 */
-			es = shsurf->surface;
-			wl_list_for_each_safe(cb, cnext, &es->frame_callback_list, link) {
-				wl_callback_send_done(cb->resource, 0);
-				wl_resource_destroy(cb->resource);
-			}
+	if (shsurf->zorder == SHELL_SURFACE_ZORDER_BACKGROUND ||
+			shsurf->zorder == SHELL_SURFACE_ZORDER_FULLSCREEN ||
+			(width <= 0 || height <= 0)) {
+		ias_shell_send_surface_info(client_resource, shsurf);
 
-			return;
-		}
+		return;
+	}
+
+	shsurf->hmi_client->send_configure(shsurf->surface,
+			width, height);
+
+	/*
+	 * Send callbacks for any outstanding 'frame' requests; it's
+	 * possible that the changes we made here caused the surface
+	 * to become visible even though it wasn't before.  If we
+	 * don't send a frame event to get things moving again, the
+	 * client will never send us a new buffer and the configure
+	 * event above will have no effect.
+	 */
+	es = shsurf->surface;
+	wl_list_for_each_safe(cb, cnext, &es->frame_callback_list, link) {
+		wl_callback_send_done(cb->resource, 0);
+		wl_resource_destroy(cb->resource);
 	}
 }
 
@@ -231,22 +422,28 @@ ias_hmi_zorder_surface(struct wl_client *client,
 	struct ias_shell *shell = shell_resource->data;
 	struct ias_surface *shsurf;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			/*
-			 * Don't allow changing the zorder of "special" surfaces
-			 * (background, fullscreen, or popup).
-			 */
-			if (shsurf->zorder & 0xff000000) {
-				return;
-			}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
 
-			shsurf->next_zorder = (zorder & 0xffffff);
-			ias_committed(shsurf->surface, 0, 0);
-			return;
-		}
+	hmi_surface_claim(shell_resource, shsurf);
+
+	/*
+	 * Don't allow changing the zorder of "special" surfaces
+	 * (background, fullscreen, or popup).
+	 */
+	if (shsurf->zorder & 0xff000000) {
+		return;
 	}
+
+	if (hmi_in_txn(shell_resource)) {
+		shsurf->txn.zorder = (zorder & 0xffffff);
+		shsurf->txn.zorder_update = 1;
+	} else {
+		shsurf->next_zorder = (zorder & 0xffffff);
+	}
+	hmi_surface_changed(shell_resource, shsurf, 0);
 }
 
 static void
@@ -258,33 +455,42 @@ ias_hmi_set_visible(struct wl_client *client,
 	struct ias_shell *shell = shell_resource->data;
 	struct ias_surface *shsurf;
 	struct ias_surface *child_shsurf;
+	uint32_t behavior;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			/*
-			 * If the client wants to make this surface visible and
-			 * its already not visible, then we will make it visible
-			 */
-			if (visibility == IAS_HMI_VISIBLE_OPTIONS_VISIBLE &&
-					shsurf->behavior & SHELL_SURFACE_BEHAVIOR_HIDDEN) {
-				shsurf->next_behavior &= ~SHELL_SURFACE_BEHAVIOR_HIDDEN;
-				ias_committed(shsurf->surface, 0, 0);
-				weston_compositor_damage_all(shell->compositor);
-			} else if (visibility == IAS_HMI_VISIBLE_OPTIONS_HIDDEN &&
-					!(shsurf->behavior & SHELL_SURFACE_BEHAVIOR_HIDDEN)) {
-				shsurf->next_behavior |= SHELL_SURFACE_BEHAVIOR_HIDDEN;
-				ias_committed(shsurf->surface, 0, 0);
-				weston_compositor_damage_all(shell->compositor);
-			}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
 
-			/* Set the visibility for child and descendant surfaces. */
-			wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
-				ias_hmi_set_visible(client, shell_resource,
-						SURFPTR2ID(child_shsurf), visibility);
-			}
-			return;
+	hmi_surface_claim(shell_resource, shsurf);
+
+	/*
+	 * If the client wants to make this surface visible and
+	 * its already not visible, then we will make it visible
+	 */
+	behavior = surface_next_behavior(shsurf);
+	if (visibility == IAS_HMI_VISIBLE_OPTIONS_VISIBLE &&
+			behavior & SHELL_SURFACE_BEHAVIOR_HIDDEN) {
+		behavior &= ~SHELL_SURFACE_BEHAVIOR_HIDDEN;
+	} else if (visibility == IAS_HMI_VISIBLE_OPTIONS_HIDDEN &&
+			!(behavior & SHELL_SURFACE_BEHAVIOR_HIDDEN)) {
+		behavior |= SHELL_SURFACE_BEHAVIOR_HIDDEN;
+	}
+
+	if (behavior != surface_next_behavior(shsurf)) {
+		if (hmi_in_txn(shell_resource)) {
+			shsurf->txn.behavior = behavior;
+			shsurf->txn.behavior_update = 1;
+		} else {
+			shsurf->next_behavior = behavior;
 		}
+		hmi_surface_changed(shell_resource, shsurf, 1);
+	}
+
+	/* Set the visibility for child and descendant surfaces. */
+	wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
+		ias_hmi_set_visible(client, shell_resource,
+				SURFPTR2ID(child_shsurf), visibility);
 	}
 }
 
@@ -322,12 +528,10 @@ ias_hmi_start_capture(struct wl_client *client,
 	}
 
 	if (surfid){
-		wl_list_for_each(shsurf, &ias_shell->client_surfaces, surface_link) {
-			if (SURFPTR2ID(shsurf) == surfid) {
-				surface = shsurf->surface;
-				printf("Starting capture for surface %p.\n", surface);
-				break;
-			}
+		shsurf = ias_shell_find_surface(ias_shell, surfid);
+		if (shsurf) {
+			surface = shsurf->surface;
+			printf("Starting capture for surface %p.\n", surface);
 		}
 	} else {
 		printf("Starting capture for output %u.\n", output_number);
@@ -377,12 +581,10 @@ ias_hmi_stop_capture(struct wl_client *client,
 	}
 
 	if (surfid){
-		wl_list_for_each(shsurf, &ias_shell->client_surfaces, surface_link) {
-			if (SURFPTR2ID(shsurf) == surfid) {
-				surface = shsurf->surface;
-				printf("Stopping capture for surface %p.\n", surface);
-				break;
-			}
+		shsurf = ias_shell_find_surface(ias_shell, surfid);
+		if (shsurf) {
+			surface = shsurf->surface;
+			printf("Stopping capture for surface %p.\n", surface);
 		}
 	} else {
 		printf("Stopping capture for output %u.\n", output_number);
@@ -423,11 +625,9 @@ ias_hmi_release_buffer_handle(struct wl_client *client,
 		struct ias_surface *shsurf;
 
 		if (surfid) {
-			wl_list_for_each(shsurf, &ias_shell->client_surfaces, surface_link) {
-				if (SURFPTR2ID(shsurf) == surfid) {
-					surface = shsurf->surface;
-					break;
-				}
+			shsurf = ias_shell_find_surface(ias_shell, surfid);
+			if (shsurf) {
+				surface = shsurf->surface;
 			}
 		}
 	}
@@ -454,6 +654,117 @@ ias_hmi_release_buffer_handle(struct wl_client *client,
 #endif
 }
 
+#ifdef BUILD_FRAME_CAPTURE
+static struct weston_surface *
+capture_surface_from_id(struct ias_shell *ias_shell, uint32_t surfid)
+{
+	struct ias_surface *shsurf;
+
+	if (!surfid) {
+		return NULL;
+	}
+
+	shsurf = ias_shell_find_surface(ias_shell, surfid);
+
+	return shsurf ? shsurf->surface : NULL;
+}
+#endif
+
+static void
+ias_hmi_set_capture_rate(struct wl_client *client,
+		struct wl_resource *shell_resource,
+		uint32_t surfid, uint32_t output_number,
+		uint32_t target_fps, uint32_t max_burst,
+		uint32_t max_in_flight, uint32_t policy)
+{
+#ifdef BUILD_FRAME_CAPTURE
+	struct ias_shell *ias_shell = shell_resource->data;
+	struct ias_backend *ias_backend =
+			(struct ias_backend *)ias_shell->compositor->backend;
+	struct weston_surface *surface;
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+	int ret;
+
+	/* Make sure that we're using the IAS backend... */
+	if (ias_backend->magic != BACKEND_MAGIC) {
+		IAS_ERROR("Backend does not match.");
+		return;
+	}
+
+	/* Only allow root to control the recorder... */
+	wl_client_get_credentials(client, &pid, &uid, &gid);
+	if (gid != 0) {
+		wl_resource_post_error(shell_resource,
+			WL_SHELL_ERROR_ROLE, "Frame capture requires root access.");
+		return;
+	}
+
+	surface = capture_surface_from_id(ias_shell, surfid);
+	if (surfid && !surface) {
+		ias_hmi_send_capture_error(shell_resource, (int32_t)pid,
+				IAS_HMI_FCAP_ERROR_INVALID);
+		return;
+	}
+
+	ret = ias_backend->set_capture_rate(ias_backend, surface, output_number,
+			target_fps, max_burst, max_in_flight, policy);
+	if (ret) {
+		IAS_ERROR("Failed to set capture rate.");
+		ias_hmi_send_capture_error(shell_resource, (int32_t)pid, ret);
+	}
+#else
+	wl_resource_post_error(shell_resource,
+			WL_SHELL_ERROR_ROLE, "Frame capture not compiled in, to use frame capture configure with --enable-frame-capture");
+#endif
+}
+
+static void
+ias_hmi_get_capture_stats(struct wl_client *client,
+		struct wl_resource *shell_resource,
+		uint32_t surfid, uint32_t output_number)
+{
+#ifdef BUILD_FRAME_CAPTURE
+	struct ias_shell *ias_shell = shell_resource->data;
+	struct ias_backend *ias_backend =
+			(struct ias_backend *)ias_shell->compositor->backend;
+	struct capture_proxy_stats stats;
+	struct weston_surface *surface;
+	pid_t pid;
+	int ret;
+
+	/* Make sure that we're using the IAS backend... */
+	if (ias_backend->magic != BACKEND_MAGIC) {
+		IAS_ERROR("Backend does not match.");
+		return;
+	}
+
+	wl_client_get_credentials(client, &pid, NULL, NULL);
+
+	surface = capture_surface_from_id(ias_shell, surfid);
+	if (surfid && !surface) {
+		ias_hmi_send_capture_error(shell_resource, (int32_t)pid,
+				IAS_HMI_FCAP_ERROR_INVALID);
+		return;
+	}
+
+	ret = ias_backend->get_capture_stats(ias_backend, surface,
+			output_number, &stats);
+	if (ret) {
+		ias_hmi_send_capture_error(shell_resource, (int32_t)pid, ret);
+		return;
+	}
+
+	ias_hmi_send_capture_stats(shell_resource, surfid, output_number,
+			stats.captured, stats.skipped_rate,
+			stats.skipped_busy, stats.deferred);
+#else
+	wl_resource_post_error(shell_resource,
+			WL_SHELL_ERROR_ROLE, "Frame capture not compiled in, to use frame capture configure with --enable-frame-capture");
+#endif
+}
+
 
 static void
 ias_hmi_set_shareable(struct wl_client *client,
@@ -466,27 +777,26 @@ ias_hmi_set_shareable(struct wl_client *client,
 	struct ias_surface *child_shsurf;
 	struct hmi_callback *cb;
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			 shsurf->shareable = shareable;
-
-			/* Notify ias_hmi listeners of the surface sharing flag change  */
-			wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
-				ias_hmi_send_surface_sharing_info(cb->resource, SURFPTR2ID(shsurf),
-					shsurf->title,
-					shsurf->shareable,
-					shsurf->pid,
-					shsurf->pname);
-			}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
 
-			 /* Set the shareable flag for child and descendant surfaces. */
-			 wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
-				ias_hmi_set_shareable(client, shell_resource,
-						SURFPTR2ID(child_shsurf), shareable);
-			}
-			return;
-		}
+	shsurf->shareable = shareable;
+
+	/* Notify ias_hmi listeners of the surface sharing flag change  */
+	wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
+		ias_hmi_send_surface_sharing_info(cb->resource, SURFPTR2ID(shsurf),
+			shsurf->title,
+			shsurf->shareable,
+			shsurf->pid,
+			shsurf->pname);
+	}
+
+	/* Set the shareable flag for child and descendant surfaces. */
+	wl_list_for_each(child_shsurf, &shsurf->child_list, child_link) {
+		ias_hmi_set_shareable(client, shell_resource,
+				SURFPTR2ID(child_shsurf), shareable);
 	}
 }
 
@@ -498,18 +808,76 @@ ias_hmi_get_surface_sharing_info(struct wl_client *client,
 	struct ias_surface *shsurf;
 	struct hmi_callback *cb;
 
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		if (SURFPTR2ID(shsurf) == id) {
-			/* Notify ias_hmi listeners of the surface sharing flag status  */
-			wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
-				ias_hmi_send_surface_sharing_info(cb->resource, SURFPTR2ID(shsurf),
-					shsurf->title,
-					shsurf->shareable,
-					shsurf->pid,
-					shsurf->pname);
-			}
-			return;
-		}
+	shsurf = ias_shell_find_surface(shell, id);
+	if (!shsurf) {
+		return;
+	}
+
+	/* Notify ias_hmi listeners of the surface sharing flag status  */
+	wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
+		ias_hmi_send_surface_sharing_info(cb->resource, SURFPTR2ID(shsurf),
+			shsurf->title,
+			shsurf->shareable,
+			shsurf->pid,
+			shsurf->pname);
+	}
+}
+
+static void
+ias_hmi_begin(struct wl_client *client,
+		struct wl_resource *shell_resource)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+	if (cb) {
+		cb->txn_depth++;
+	}
+}
+
+static void
+ias_hmi_commit(struct wl_client *client,
+		struct wl_resource *shell_resource)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+	if (!cb || !cb->txn_depth) {
+		return;
+	}
+
+	if (--cb->txn_depth == 0) {
+		hmi_txn_apply(shell, cb);
+	}
+}
+
+static void
+ias_hmi_set_surface_info_mask(struct wl_client *client,
+		struct wl_resource *shell_resource,
+		uint32_t mask)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+	if (cb) {
+		cb->info_mask = mask;
+	}
+}
+
+static void
+ias_hmi_get_surface_info_stats(struct wl_client *client,
+		struct wl_resource *shell_resource)
+{
+	struct ias_shell *shell = shell_resource->data;
+	struct hmi_callback *cb;
+
+	cb = hmi_callback_from_resource(shell, shell_resource);
+	if (cb) {
+		ias_hmi_send_surface_info_stats(shell_resource, cb->info_sent,
+				cb->info_coalesced, cb->info_filtered);
 	}
 }
 
@@ -525,6 +893,12 @@ static const struct ias_hmi_interface ias_hmi_implementation = {
 	ias_hmi_start_capture,
 	ias_hmi_stop_capture,
 	ias_hmi_release_buffer_handle,
+	ias_hmi_set_capture_rate,
+	ias_hmi_get_capture_stats,
+	ias_hmi_begin,
+	ias_hmi_commit,
+	ias_hmi_set_surface_info_mask,
+	ias_hmi_get_surface_info_stats,
 };
 
 
@@ -552,28 +926,19 @@ bind_ias_hmi(struct wl_client *client,
 	}
 
 	cb->resource = wl_resource_create(client,
-						&ias_hmi_interface, 1, id);
+						&ias_hmi_interface, version, id);
 	wl_resource_set_implementation(cb->resource,
 						&ias_hmi_implementation,
 						shell, destroy_ias_hmi_resource);
 
+	wl_list_init(&cb->txn_surfaces);
+	cb->info_mask = ~0u;
+
 	/* Add callback to shell's list */
 	wl_list_insert(&shell->sfc_change_callbacks, &cb->link);
 
 	/* Send the list of surfaces to this client only */
 	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
-		ias_hmi_send_surface_info(cb->resource, SURFPTR2ID(shsurf),
-							shsurf->title,
-							shsurf->zorder,
-							(int32_t)shsurf->view->geometry.x,
-							(int32_t)shsurf->view->geometry.y,
-							shsurf->surface->width,
-							shsurf->surface->height,
-							(uint32_t) (shsurf->view->alpha * 0xFF),
-							(uint32_t) (shsurf->behavior),
-							shsurf->pid,
-							shsurf->pname,
-							shsurf->view->output ? shsurf->view->output->id : 0,
-							ias_surface_is_flipped(shsurf));
+		ias_shell_send_surface_info(cb->resource, shsurf);
 	}
 }
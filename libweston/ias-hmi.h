@@ -42,6 +42,23 @@
 struct hmi_callback {
 	struct wl_resource *resource;
 	struct wl_list link;
+
+	/* Nesting depth of begin requests; changes are held back while > 0 */
+	int txn_depth;
+
+	/* Surfaces changed within the transaction (ias_surface.txn_link) */
+	struct wl_list txn_surfaces;
+
+	/* Surface visibility changed within the transaction */
+	int txn_damage_all;
+
+	/* surface_info fields the listener wants to hear about */
+	uint32_t info_mask;
+
+	/* surface_info events sent, merged and masked out */
+	uint32_t info_sent;
+	uint32_t info_coalesced;
+	uint32_t info_filtered;
 };
 
 void
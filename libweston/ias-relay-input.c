@@ -61,14 +61,11 @@ ias_relay_input_send_touch(struct wl_client *client,
 
 	printf("Touch event received in server.\n");
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
+	shsurf = ias_shell_find_surface(shell, surfid);
+	if (shsurf) {
 		printf("Surface ID: %u\n", SURFPTR2ID(shsurf));
-		if (SURFPTR2ID(shsurf) == surfid) {
-			surf_resource = shsurf->resource;
-			ws_resource = shsurf->surface->resource;
-			break;
-		}
+		surf_resource = shsurf->resource;
+		ws_resource = shsurf->surface->resource;
 	}
 
 	if (surf_resource == NULL) {
@@ -160,14 +157,11 @@ ias_relay_input_send_key(struct wl_client *client,
 
 	printf("Key event received in server.\n");
 
-	/* Walk the surface list looking for the requested surface.  */
-	wl_list_for_each(shsurf, &shell->client_surfaces, surface_link) {
+	shsurf = ias_shell_find_surface(shell, surfid);
+	if (shsurf) {
 		printf("Surface ID: %u\n", SURFPTR2ID(shsurf));
-		if (SURFPTR2ID(shsurf) == surfid) {
-			surf_resource = shsurf->resource;
-			ws_resource = shsurf->surface->resource;
-			break;
-		}
+		surf_resource = shsurf->resource;
+		ws_resource = shsurf->surface->resource;
 	}
 
 	if (surf_resource == NULL) {
@@ -43,6 +43,12 @@
 
 #define TARGET_NUM_SECONDS 5
 
+/*
+ * Longest time that surface changes wait to be reported to HMI listeners
+ * when no output gets repainted.
+ */
+#define SURFACE_INFO_TIMEOUT_MS 100
+
 static struct ias_shell *self;
 
 static void (*renderer_attach)(struct weston_surface *es, struct weston_buffer *buffer);
@@ -67,6 +73,17 @@ struct bound_client {
 	struct wl_list link;
 };
 
+/*
+ * Repaint listener for an output, used to report surface changes to HMI
+ * listeners once per frame.
+ */
+struct shell_output {
+	struct ias_shell *shell;
+	struct wl_listener frame_listener;
+	struct wl_listener destroy_listener;
+	struct wl_list link;
+};
+
 /*
  * Handy linked list function not provided by wayland utilities.
  */
@@ -88,6 +105,15 @@ ias_surface_constructor(void *, struct weston_surface *,
 static void
 ias_shell_output_change_notify(struct wl_listener *listener, void *data);
 
+static void
+surface_info_get(struct ias_surface *shsurf, struct ias_surface_info *info);
+
+static void
+shell_output_create(struct ias_shell *shell, struct weston_output *output);
+
+static void
+shell_output_destroy(struct shell_output *so);
+
 static void
 send_configure(struct weston_surface *surface,
 		int32_t width,
@@ -106,6 +132,9 @@ static bool
 surface_exists(struct weston_surface *surface,
 			struct ias_shell *shell);
 
+static struct wl_list *
+surface_id_bucket(struct ias_shell *shell, uint32_t id);
+
 static void
 surface_revert_keyboard_focus(struct ias_surface *shsurf,
 				struct ias_shell *shell);
@@ -895,21 +924,13 @@ ias_shell_get_ias_surface_internal(struct wl_client *client,
 	 * identifier.
 	 */
 	wl_list_insert(&shell->client_surfaces, &shsurf->surface_link);
+	wl_list_insert(surface_id_bucket(shell, SURFPTR2ID(shsurf)),
+			&shsurf->id_link);
 
+	/* Creation is reported right away, changes are batched from here on */
+	surface_info_get(shsurf, &shsurf->info);
 	wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
-		ias_hmi_send_surface_info(cb->resource, SURFPTR2ID(shsurf),
-				shsurf->title,
-				shsurf->zorder,
-				(int32_t)shsurf->view->geometry.x,
-				(int32_t)shsurf->view->geometry.y,
-				shsurf->surface->width,
-				shsurf->surface->height,
-				(uint32_t) (shsurf->view->alpha * 0xFF),
-				(uint32_t) (shsurf->behavior),
-				shsurf->pid,
-				shsurf->pname,
-				shsurf->view->output ? shsurf->view->output->id : 0,
-				ias_surface_is_flipped(shsurf));
+		ias_shell_send_surface_info(cb->resource, shsurf);
 	}
 }
 
@@ -1014,6 +1035,7 @@ ias_shell_destructor(struct wl_listener *listener, void *data)
 {
 	struct ias_shell *shell =
 		container_of(listener, struct ias_shell, destroy_listener);
+	struct shell_output *so, *next;
 
 	/* Kill the HMI client */
 	if (shell->hmi.client) {
@@ -1021,6 +1043,14 @@ ias_shell_destructor(struct wl_listener *listener, void *data)
 	}
 	free(shell->hmi.execname);
 
+	wl_list_for_each_safe(so, next, &shell->outputs, link) {
+		shell_output_destroy(so);
+	}
+	wl_list_remove(&shell->output_created_listener.link);
+	if (shell->info_timer) {
+		wl_event_source_remove(shell->info_timer);
+	}
+
 	free(shell);
 }
 
@@ -1304,6 +1334,9 @@ ias_surface_destructor(struct ias_surface *shsurf)
 
 	/* Remove surface from surface lists */
 	wl_list_remove(&shsurf->surface_link);
+	wl_list_remove(&shsurf->id_link);
+	wl_list_remove(&shsurf->txn_link);
+	wl_list_remove(&shsurf->info_link);
 
 	/* Remove surface from popup/background special surface lists */
 	wl_list_remove(&shsurf->special_link);
@@ -1436,6 +1469,9 @@ ias_surface_constructor(void *shellptr,
 	wl_list_init(&shsurf->special_link);
 
 	wl_list_init(&shsurf->surface_link);
+	wl_list_init(&shsurf->id_link);
+	wl_list_init(&shsurf->txn_link);
+	wl_list_init(&shsurf->info_link);
 
 	/*
 	 * Initialize process id and name for the client app associated with this
@@ -1486,6 +1522,36 @@ get_ias_surface(struct weston_surface *surface)
 	}
 }
 
+static struct wl_list *
+surface_id_bucket(struct ias_shell *shell, uint32_t id)
+{
+	/*
+	 * Ids are truncated heap addresses, so the low bits carry little
+	 * information; mix them in with a multiplicative hash.
+	 */
+	return &shell->surface_ids[(id * 2654435761u) >>
+			(32 - IAS_SURFACE_ID_BITS)];
+}
+
+/*
+ * ias_shell_find_surface()
+ *
+ * Looks up a client surface by the id that HMI clients know it by.
+ */
+struct ias_surface *
+ias_shell_find_surface(struct ias_shell *shell, uint32_t id)
+{
+	struct ias_surface *shsurf;
+
+	wl_list_for_each(shsurf, surface_id_bucket(shell, id), id_link) {
+		if (SURFPTR2ID(shsurf) == id) {
+			return shsurf;
+		}
+	}
+
+	return NULL;
+}
+
 /*
  * Range from SHELL_SURFACE_ZORDER_DEFAULT to
  * SHELL_SURFACE_ZORDER_BACKGROUND - 1,
@@ -1856,6 +1922,208 @@ static void scale_surface_if_fullscreen(struct ias_surface *shsurf)
 	}
 }
 
+/*
+ * surface_info_get()
+ *
+ * Collects the values reported in a surface_info event.
+ */
+static void
+surface_info_get(struct ias_surface *shsurf, struct ias_surface_info *info)
+{
+	info->x = (int32_t)shsurf->view->geometry.x;
+	info->y = (int32_t)shsurf->view->geometry.y;
+	info->width = shsurf->surface->width;
+	info->height = shsurf->surface->height;
+	info->zorder = shsurf->zorder;
+	info->alpha = (uint32_t) (shsurf->view->alpha * 0xFF);
+	info->behavior = shsurf->behavior;
+	info->output = shsurf->view->output ? shsurf->view->output->id : 0;
+	info->flipped = ias_surface_is_flipped(shsurf);
+}
+
+/*
+ * ias_shell_send_surface_info()
+ *
+ * Sends the current state of a surface to one HMI listener.
+ */
+void
+ias_shell_send_surface_info(struct wl_resource *resource,
+		struct ias_surface *shsurf)
+{
+	struct ias_surface_info info;
+
+	surface_info_get(shsurf, &info);
+	ias_hmi_send_surface_info(resource, SURFPTR2ID(shsurf),
+			shsurf->title,
+			info.zorder,
+			info.x,
+			info.y,
+			info.width,
+			info.height,
+			info.alpha,
+			info.behavior,
+			shsurf->pid,
+			shsurf->pname,
+			info.output,
+			info.flipped);
+}
+
+/*
+ * surface_info_changed()
+ *
+ * Notes that a surface has changed; HMI listeners hear about it when the
+ * next frame is drawn, together with any other changes made until then.
+ */
+static void
+surface_info_changed(struct ias_surface *shsurf)
+{
+	struct ias_shell *shell = shsurf->shell;
+
+	if (wl_list_empty(&shsurf->info_link)) {
+		if (wl_list_empty(&shell->info_dirty)) {
+			wl_event_source_timer_update(shell->info_timer,
+					SURFACE_INFO_TIMEOUT_MS);
+		}
+		wl_list_insert(shell->info_dirty.prev, &shsurf->info_link);
+	}
+
+	shsurf->info_changes++;
+}
+
+/*
+ * surface_info_flush()
+ *
+ * Sends one surface_info per changed surface to each HMI listener that
+ * is interested in the fields that changed.
+ */
+static void
+surface_info_flush(struct ias_shell *shell)
+{
+	struct ias_surface *shsurf, *next;
+	struct ias_surface_info info;
+	struct hmi_callback *cb;
+	uint32_t fields;
+
+	if (wl_list_empty(&shell->info_dirty)) {
+		return;
+	}
+
+	wl_list_for_each_safe(shsurf, next, &shell->info_dirty, info_link) {
+		surface_info_get(shsurf, &info);
+
+		fields = 0;
+		if (info.x != shsurf->info.x || info.y != shsurf->info.y) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_POSITION;
+		}
+		if (info.width != shsurf->info.width ||
+				info.height != shsurf->info.height) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_SIZE;
+		}
+		if (info.zorder != shsurf->info.zorder) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_Z_ORDER;
+		}
+		if (info.alpha != shsurf->info.alpha) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_ALPHA;
+		}
+		if (info.behavior != shsurf->info.behavior) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_BEHAVIOR;
+		}
+		if (info.output != shsurf->info.output) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_OUTPUT;
+		}
+		if (info.flipped != shsurf->info.flipped) {
+			fields |= IAS_HMI_SURFACE_INFO_FIELD_FLIPPED;
+		}
+
+		wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
+			/* All but the last change got merged into this event */
+			cb->info_coalesced += shsurf->info_changes - 1;
+
+			if (fields & cb->info_mask) {
+				ias_shell_send_surface_info(cb->resource, shsurf);
+				cb->info_sent++;
+			} else if (fields) {
+				cb->info_filtered++;
+			} else {
+				/* Changed back to what was last reported */
+				cb->info_coalesced++;
+			}
+		}
+
+		shsurf->info = info;
+		shsurf->info_changes = 0;
+		wl_list_remove(&shsurf->info_link);
+		wl_list_init(&shsurf->info_link);
+	}
+
+	wl_event_source_timer_update(shell->info_timer, 0);
+}
+
+static int
+surface_info_timeout(void *data)
+{
+	struct ias_shell *shell = data;
+
+	surface_info_flush(shell);
+
+	return 0;
+}
+
+static void
+shell_output_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct shell_output *so =
+		container_of(listener, struct shell_output, frame_listener);
+
+	surface_info_flush(so->shell);
+}
+
+static void
+shell_output_destroy(struct shell_output *so)
+{
+	wl_list_remove(&so->frame_listener.link);
+	wl_list_remove(&so->destroy_listener.link);
+	wl_list_remove(&so->link);
+	free(so);
+}
+
+static void
+shell_output_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct shell_output *so =
+		container_of(listener, struct shell_output, destroy_listener);
+
+	shell_output_destroy(so);
+}
+
+static void
+shell_output_create(struct ias_shell *shell, struct weston_output *output)
+{
+	struct shell_output *so;
+
+	so = calloc(1, sizeof *so);
+	if (!so) {
+		IAS_ERROR("Failed to allocate output listener.");
+		return;
+	}
+
+	so->shell = shell;
+	so->frame_listener.notify = shell_output_frame_notify;
+	wl_signal_add(&output->frame_signal, &so->frame_listener);
+	so->destroy_listener.notify = shell_output_destroy_notify;
+	wl_signal_add(&output->destroy_signal, &so->destroy_listener);
+	wl_list_insert(&shell->outputs, &so->link);
+}
+
+static void
+shell_output_created_notify(struct wl_listener *listener, void *data)
+{
+	struct ias_shell *shell =
+		container_of(listener, struct ias_shell, output_created_listener);
+
+	shell_output_create(shell, data);
+}
+
 /*
  * ias_committed()
  *
@@ -1874,7 +2142,6 @@ ias_committed(struct weston_surface *surface, int32_t relx, int32_t rely)
 	int32_t sx = 0, sy = 0;
 	uint32_t old_hidden;
 	uint32_t new_hidden;
-	struct hmi_callback *cb;
 
 	/* Shouldn't be possible to get here with non-IAS surfaces */
 	assert(shsurf);
@@ -2013,21 +2280,7 @@ ias_committed(struct weston_surface *surface, int32_t relx, int32_t rely)
 		/* We must damage the surface after updating its transform */
 		weston_surface_damage(surface);
 
-		wl_list_for_each(cb, &shell->sfc_change_callbacks, link) {
-			ias_hmi_send_surface_info(cb->resource, SURFPTR2ID(shsurf),
-				shsurf->title,
-				shsurf->zorder,
-				(int32_t)shsurf->view->geometry.x,
-				(int32_t)shsurf->view->geometry.y,
-				shsurf->surface->width,
-				shsurf->surface->height,
-				(uint32_t) (shsurf->view->alpha * 0xFF),
-				(uint32_t) (shsurf->behavior),
-				shsurf->pid,
-				shsurf->pname,
-				shsurf->view->output ? shsurf->view->output->id : 0,
-				ias_surface_is_flipped(shsurf));
-		}
+		surface_info_changed(shsurf);
 	}
 }
 
@@ -2333,6 +2586,7 @@ WL_EXPORT int wet_shell_init(struct weston_compositor *compositor,
 	struct ias_backend *ias_compositor;
 	struct weston_output *output;
 	struct ias_output *ias_output;
+	int i;
 
 	/* Allocate shell object */
 	shell = calloc(1, sizeof *shell);
@@ -2385,10 +2639,31 @@ WL_EXPORT int wet_shell_init(struct weston_compositor *compositor,
 	wl_list_init(&shell->background_surfaces);
 	wl_list_init(&shell->popup_surfaces);
 	wl_list_init(&shell->client_surfaces);
+	for (i = 0; i < IAS_SURFACE_ID_BUCKETS; i++) {
+		wl_list_init(&shell->surface_ids[i]);
+	}
 
 	/* Initialize hmi callback list */
 	wl_list_init(&shell->sfc_change_callbacks);
 
+	/* Report surface changes to the hmi callbacks once per frame */
+	wl_list_init(&shell->info_dirty);
+	wl_list_init(&shell->outputs);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		shell_output_create(shell, output);
+	}
+	shell->output_created_listener.notify = shell_output_created_notify;
+	wl_signal_add(&compositor->output_created_signal,
+			&shell->output_created_listener);
+
+	shell->info_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(
+				compositor->wl_display), surface_info_timeout, shell);
+	if (!shell->info_timer) {
+		IAS_ERROR("Failed to create surface info timer.");
+		return -1;
+	}
+
 	/* Initialize shell client lists */
 	wl_list_init(&shell->ias_shell_clients);
 	wl_list_init(&shell->wl_shell_clients);
@@ -2475,7 +2750,7 @@ WL_EXPORT int wet_shell_init(struct weston_compositor *compositor,
 		return -1;
 	}
 	if (!wl_global_create(compositor->wl_display,
-				&ias_hmi_interface, 1, shell, bind_ias_hmi))
+				&ias_hmi_interface, 4, shell, bind_ias_hmi))
 	{
 		return -1;
 	}
@@ -42,11 +42,22 @@
 
 #define CFG_FILENAME "ias.conf"
 
+/* Size of the surface id hash, in bits */
+#define IAS_SURFACE_ID_BITS 8
+#define IAS_SURFACE_ID_BUCKETS (1 << IAS_SURFACE_ID_BITS)
+
 struct ias_shell;
 
 WL_EXPORT struct ias_surface*
 get_ias_surface(struct weston_surface *);
 
+struct ias_surface *
+ias_shell_find_surface(struct ias_shell *shell, uint32_t id);
+
+void
+ias_shell_send_surface_info(struct wl_resource *resource,
+		struct ias_surface *shsurf);
+
 void
 ias_committed(struct weston_surface *surface, int32_t relx, int32_t rely);
 
@@ -89,6 +100,12 @@ struct ias_shell {
 	struct wl_list popup_surfaces;
 	struct wl_list client_surfaces;
 
+	/*
+	 * Client surfaces hashed by the id handed out to HMI clients
+	 * (SURFPTR2ID), for ias_shell_find_surface().
+	 */
+	struct wl_list surface_ids[IAS_SURFACE_ID_BUCKETS];
+
 #ifdef IASDEBUG
 	/*
 	 * Special 'default' background surface.  An HMI should really set the
@@ -109,6 +126,18 @@ struct ias_shell {
 	/* Callback list to notify when surface changes */
 	struct wl_list sfc_change_callbacks;
 
+	/*
+	 * Surfaces with changes not yet reported to the HMI listeners. They
+	 * are reported at the next output repaint, or when info_timer fires
+	 * if nothing gets repainted.
+	 */
+	struct wl_list info_dirty;
+	struct wl_event_source *info_timer;
+
+	/* Repaint listeners, one per output */
+	struct wl_list outputs;
+	struct wl_listener output_created_listener;
+
 	/* Keep track of which clients are bound to which shell interface */
 	struct wl_list wl_shell_clients;
 	struct wl_list ias_shell_clients;
@@ -219,6 +248,46 @@ struct ias_surface {
 	 * special surface list like popup list */
 	struct wl_list surface_link;
 
+	/* Node in the shell's surface id hash */
+	struct wl_list id_link;
+
+	/* Node in the changed surface list of an ias_hmi transaction, and
+	 * the HMI client whose transaction that is */
+	struct wl_list txn_link;
+	struct hmi_callback *txn_owner;
+
+	/*
+	 * surface_info as last reported to the HMI listeners, node in the
+	 * shell's info_dirty list and number of changes since then.
+	 */
+	struct ias_surface_info {
+		int32_t x, y;
+		uint32_t width, height;
+		uint32_t zorder;
+		uint32_t alpha;
+		uint32_t behavior;
+		uint32_t output;
+		uint32_t flipped;
+	} info;
+	struct wl_list info_link;
+	uint32_t info_changes;
+
+	/*
+	 * State set within an ias_hmi transaction, not yet applied. It is
+	 * kept apart from the next_* fields so that the client's own
+	 * commits don't apply it before the HMI commits.
+	 */
+	struct ias_surface_txn {
+		int behavior_update;
+		uint32_t behavior;
+		int zorder_update;
+		uint32_t zorder;
+		int position_update;
+		int32_t x, y;
+		int alpha_update;
+		float alpha;
+	} txn;
+
 	/* Node in special surface list (popup list, background list, etc.) */
 	struct wl_list special_link;
 
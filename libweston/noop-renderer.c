@@ -116,6 +116,7 @@ noop_renderer_init(struct weston_compositor *ec)
 	renderer->attach = noop_renderer_attach;
 	renderer->surface_set_color = noop_renderer_surface_set_color;
 	renderer->destroy = noop_renderer_destroy;
+	renderer->upload_bytes = 0;
 	ec->renderer = renderer;
 
 	return 0;
@@ -33,14 +33,24 @@
 #include <assert.h>
 
 #include "pixman-renderer.h"
+#include "tile-pool.h"
 #include "shared/helpers.h"
+#include "shared/string-helpers.h"
 
 #include <linux/input.h>
 
+/* Side of the square tiles of a tiled repaint, in global coordinates */
+#define TILE_SIZE 128
+
 struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* Images of the shadow_buffer and hw_buffer pixels, one of each
+	 * for every repaint thread to clip */
+	pixman_image_t *thread_images[TILE_POOL_MAX_THREADS];
+	pixman_image_t *thread_hw_images[TILE_POOL_MAX_THREADS];
 };
 
 struct pixman_surface_state {
@@ -49,6 +59,10 @@ struct pixman_surface_state {
 	pixman_image_t *image;
 	struct weston_buffer_reference buffer_ref;
 
+	/* ps->image is a solid fill of this color */
+	bool solid;
+	pixman_color_t color;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
@@ -61,9 +75,55 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	/* 0 to repaint without tiles, on the compositor thread only */
+	int threads;
+	struct tile_pool *pool;
+
+	/* Scratch space of repaint_tiled() */
+	struct tile_view *tile_views;
+	struct tile_paint *tile_paints;	/* tile_views_size for each thread */
+	int tile_views_size;
+	int *tiles;
+	int tiles_size;
+
+	uint64_t pixels_written;
+
 	struct wl_signal destroy_signal;
 };
 
+/* Where a paint goes */
+struct pixman_target {
+	pixman_image_t *image;
+
+	/* Paint from a source image of its own rather than ps->image, whose
+	 * transform and filter other threads may be setting */
+	bool private_source;
+
+	uint64_t pixels;
+};
+
+/* A primary plane view, for the tiles to cull against */
+struct tile_view {
+	struct weston_view *view;
+	pixman_region32_t cover;	/* what it paints over, global */
+};
+
+/* A view left in a tile, and the part of the tile to paint it on */
+struct tile_paint {
+	struct weston_view *view;
+	pixman_region32_t damage;
+};
+
+struct tile_repaint {
+	struct pixman_renderer *pr;
+	struct weston_output *output;
+	pixman_region32_t *damage;
+	int n_views;
+	int x, y;			/* of the first tile */
+	int tiles_x;
+	uint64_t pixels[TILE_POOL_MAX_THREADS];
+};
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -316,10 +376,48 @@ composite_clipped(pixman_image_t *src,
 	}
 }
 
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *boxes;
+	uint64_t area = 0;
+	int n_box, i;
+
+	boxes = pixman_region32_rectangles(region, &n_box);
+	for (i = 0; i < n_box; i++)
+		area += (uint64_t)(boxes[i].x2 - boxes[i].x1) *
+			(boxes[i].y2 - boxes[i].y1);
+
+	return area;
+}
+
+/* Another image of the same pixels, with a clip, transform and filter of
+ * its own */
+static pixman_image_t *
+create_image_alias(pixman_image_t *image)
+{
+	return pixman_image_create_bits_no_clear(
+			pixman_image_get_format(image),
+			pixman_image_get_width(image),
+			pixman_image_get_height(image),
+			pixman_image_get_data(image),
+			pixman_image_get_stride(image));
+}
+
+static pixman_image_t *
+create_source_image(struct pixman_surface_state *ps)
+{
+	if (ps->solid)
+		return pixman_image_create_solid_fill(&ps->color);
+
+	return create_image_alias(ps->image);
+}
+
 /** Paint an intersected region
  *
  * \param ev The view to be painted.
  * \param output The output being painted.
+ * \param target The image to paint into, over the output's shadow buffer.
  * \param repaint_output The region to be painted in output coordinates.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
@@ -327,6 +425,7 @@ composite_clipped(pixman_image_t *src,
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       struct pixman_target *target,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
@@ -334,15 +433,16 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
+	pixman_image_t *src_image;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
 	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
+	pixman_image_set_clip_region32(target->image, repaint_output);
+	target->pixels += region_area(repaint_output);
 
 	pixman_renderer_compute_transform(&transform, ev, output);
 
@@ -361,12 +461,19 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
+	if (target->private_source)
+		src_image = create_source_image(ps);
+	else
+		src_image = pixman_image_ref(ps->image);
+
 	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
+		composite_clipped(src_image, mask_image, target->image,
 				  &transform, filter, source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		composite_whole(pixman_op, src_image, mask_image,
+				target->image, &transform, filter);
+
+	pixman_image_unref(src_image);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
@@ -378,18 +485,19 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		pixman_image_composite32(PIXMAN_OP_OVER,
 					 pr->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 target->image, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (target->image), /* width */
+					 pixman_image_get_height (target->image) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (target->image, NULL);
 }
 
 static void
 draw_view_translated(struct weston_view *view, struct weston_output *output,
+		     struct pixman_target *target,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -417,8 +525,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  view);
 			region_global_to_output(output, &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+			repaint_region(view, output, target, &repaint_output,
+				       NULL, PIXMAN_OP_SRC);
 		}
 	}
 
@@ -428,7 +536,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 						  &surface_blend, view);
 		region_global_to_output(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
+		repaint_region(view, output, target, &repaint_output, NULL,
 			       PIXMAN_OP_OVER);
 	}
 
@@ -439,6 +547,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 static void
 draw_view_source_clipped(struct weston_view *view,
 			 struct weston_output *output,
+			 struct pixman_target *target,
 			 pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -464,7 +573,7 @@ draw_view_source_clipped(struct weston_view *view,
 	pixman_region32_copy(&repaint_output, repaint_global);
 	region_global_to_output(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
+	repaint_region(view, output, target, &repaint_output, &buffer_region,
 		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
@@ -474,6 +583,7 @@ draw_view_source_clipped(struct weston_view *view,
 
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
+	  struct pixman_target *target,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
@@ -500,7 +610,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(ev, output, target, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -509,7 +619,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(ev, output, target, &repaint);
 	}
 
 out:
@@ -519,11 +629,281 @@ static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_target target = { po->shadow_image, false, 0 };
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
 		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+			draw_view(view, output, &target, damage);
+
+	pr->pixels_written += target.pixels;
+}
+
+/* Whether the view paints all of its bounding box opaque, wherever the
+ * client says its surface is opaque or not */
+static bool
+view_fills_bounding_box(struct weston_view *ev, struct weston_output *output)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
+	float x, y;
+
+	if (!ps->image || ev->alpha < 1.0 ||
+	    !view_transformation_is_translation(ev))
+		return false;
+
+	if (ps->solid)
+		return ps->color.alpha == 0xffff;
+
+	/* Otherwise the edges sample between or outside the buffer pixels */
+	weston_view_to_global_float(ev, 0, 0, &x, &y);
+	if (x != (int)x || y != (int)y)
+		return false;
+	if (vp->buffer.scale != output->current_scale ||
+	    vp->buffer.src_width != wl_fixed_from_int(-1) ||
+	    vp->surface.width != -1)
+		return false;
+
+	switch (pixman_image_get_format(ps->image)) {
+	case PIXMAN_x8r8g8b8:
+	case PIXMAN_r5g6b5:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+repaint_tile(void *data, int job, int thread)
+{
+	struct tile_repaint *tr = data;
+	struct pixman_renderer *pr = tr->pr;
+	struct pixman_output_state *po = get_output_state(tr->output);
+	struct pixman_target target = { po->thread_images[thread], true, 0 };
+	struct tile_paint *paints =
+		&pr->tile_paints[thread * pr->tile_views_size];
+	pixman_image_t *hw_image = po->thread_hw_images[thread];
+	struct tile_view *tv;
+	pixman_region32_t damage;
+	pixman_region32_t uncovered;
+	int tile = pr->tiles[job];
+	int x = tr->x + tile % tr->tiles_x * TILE_SIZE;
+	int y = tr->y + tile / tr->tiles_x * TILE_SIZE;
+	int i, n = 0;
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect_rect(&damage, tr->damage,
+				       x, y, TILE_SIZE, TILE_SIZE);
+	pixman_region32_init(&uncovered);
+	pixman_region32_copy(&uncovered, &damage);
+
+	/* Front to back, until the views so far cover the whole tile */
+	for (i = 0; i < tr->n_views; i++) {
+		if (!pixman_region32_not_empty(&uncovered))
+			break;
+
+		tv = &pr->tile_views[i];
+		pixman_region32_init(&paints[n].damage);
+		pixman_region32_intersect(&paints[n].damage, &uncovered,
+					  &tv->view->transform.boundingbox);
+		if (!pixman_region32_not_empty(&paints[n].damage)) {
+			pixman_region32_fini(&paints[n].damage);
+			continue;
+		}
+
+		paints[n++].view = tv->view;
+		pixman_region32_subtract(&uncovered, &uncovered, &tv->cover);
+	}
+
+	while (n--) {
+		draw_view(paints[n].view, tr->output, &target,
+			  &paints[n].damage);
+		pixman_region32_fini(&paints[n].damage);
+	}
+
+	/* The tile's share of copy_to_hw_buffer() */
+	region_global_to_output(tr->output, &damage);
+	pixman_image_set_clip_region32(hw_image, &damage);
+	target.pixels += region_area(&damage);
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 target.image, /* src */
+				 NULL /* mask */,
+				 hw_image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 pixman_image_get_width (hw_image), /* width */
+				 pixman_image_get_height (hw_image) /* height */);
+
+	pixman_image_set_clip_region32(hw_image, NULL);
+
+	pixman_region32_fini(&uncovered);
+	pixman_region32_fini(&damage);
+
+	tr->pixels[thread] += target.pixels;
+}
+
+static int
+reserve_tile_scratch(struct pixman_renderer *pr, int n_views, int n_tiles)
+{
+	int size;
+
+	if (n_views > pr->tile_views_size) {
+		size = MAX(n_views, 2 * pr->tile_views_size);
+
+		free(pr->tile_views);
+		free(pr->tile_paints);
+		pr->tile_views_size = 0;
+
+		pr->tile_views = malloc(size * sizeof *pr->tile_views);
+		pr->tile_paints = malloc(size * TILE_POOL_MAX_THREADS *
+					 sizeof *pr->tile_paints);
+		if (!pr->tile_views || !pr->tile_paints)
+			return -1;
+		pr->tile_views_size = size;
+	}
+
+	if (n_tiles > pr->tiles_size) {
+		free(pr->tiles);
+		pr->tiles_size = 0;
+
+		pr->tiles = malloc(n_tiles * sizeof *pr->tiles);
+		if (!pr->tiles)
+			return -1;
+		pr->tiles_size = n_tiles;
+	}
+
+	return 0;
+}
+
+static int
+create_thread_images(struct pixman_output_state *po, int threads)
+{
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		if (!po->thread_images[i])
+			po->thread_images[i] =
+				create_image_alias(po->shadow_image);
+		if (!po->thread_hw_images[i])
+			po->thread_hw_images[i] =
+				create_image_alias(po->hw_buffer);
+		if (!po->thread_images[i] || !po->thread_hw_images[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+release_thread_images(pixman_image_t **images)
+{
+	int i;
+
+	for (i = 0; i < TILE_POOL_MAX_THREADS; i++) {
+		if (images[i])
+			pixman_image_unref(images[i]);
+		images[i] = NULL;
+	}
+}
+
+/*
+ * Splits the damage into tiles that the renderer threads repaint and copy
+ * to the hw buffer. Each tile only paints the views that show through
+ * the opaque views above them: ev->clip takes care of the regions clients
+ * declared opaque, the tiles also cull what is below views that are
+ * opaque by their format or color.
+ *
+ * The tiles don't overlap in the shadow buffer, and the threads only read
+ * the views and surface states. Each thread paints through its own image
+ * of the shadow buffer and its own source images, for their clips,
+ * transforms and filters.
+ */
+static int
+repaint_tiled(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct tile_repaint tr = { 0 };
+	struct weston_view *view;
+	pixman_box32_t *extents;
+	pixman_box32_t box;
+	int n_views = 0, n_tiles = 0;
+	int tiles_x, tiles_y;
+	int x1, y1, x2, y2, x, y, i;
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		if (view->plane == &compositor->primary_plane)
+			n_views++;
+
+	tiles_x = (output->width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = (output->height + TILE_SIZE - 1) / TILE_SIZE;
+
+	if (reserve_tile_scratch(pr, n_views, tiles_x * tiles_y) < 0 ||
+	    create_thread_images(po, pr->threads) < 0) {
+		weston_log("Pixman renderer: out of memory for tiles\n");
+		return -1;
+	}
+
+	/* Front to back. Also creates the surface states, the threads
+	 * can't. */
+	i = 0;
+	wl_list_for_each(view, &compositor->view_list, link) {
+		struct tile_view *tv = &pr->tile_views[i];
+
+		if (view->plane != &compositor->primary_plane)
+			continue;
+
+		tv->view = view;
+		pixman_region32_init(&tv->cover);
+		if (view_fills_bounding_box(view, output))
+			pixman_region32_copy(&tv->cover,
+					     &view->transform.boundingbox);
+		else
+			pixman_region32_copy(&tv->cover,
+					     &view->transform.opaque);
+		i++;
+	}
+
+	/* The tiles the damage touches */
+	extents = pixman_region32_extents(damage);
+	x1 = MAX(extents->x1 - output->x, 0) / TILE_SIZE;
+	y1 = MAX(extents->y1 - output->y, 0) / TILE_SIZE;
+	x2 = MIN((extents->x2 - output->x + TILE_SIZE - 1) / TILE_SIZE,
+		 tiles_x);
+	y2 = MIN((extents->y2 - output->y + TILE_SIZE - 1) / TILE_SIZE,
+		 tiles_y);
+	for (y = y1; y < y2; y++) {
+		for (x = x1; x < x2; x++) {
+			box.x1 = output->x + x * TILE_SIZE;
+			box.y1 = output->y + y * TILE_SIZE;
+			box.x2 = box.x1 + TILE_SIZE;
+			box.y2 = box.y1 + TILE_SIZE;
+			if (pixman_region32_contains_rectangle(damage, &box) !=
+			    PIXMAN_REGION_OUT)
+				pr->tiles[n_tiles++] = y * tiles_x + x;
+		}
+	}
+
+	tr.pr = pr;
+	tr.output = output;
+	tr.damage = damage;
+	tr.n_views = n_views;
+	tr.x = output->x;
+	tr.y = output->y;
+	tr.tiles_x = tiles_x;
+	tile_pool_run(pr->pool, n_tiles, repaint_tile, &tr);
+
+	for (i = 0; i < pr->threads; i++)
+		pr->pixels_written += tr.pixels[i];
+	for (i = 0; i < n_views; i++)
+		pixman_region32_fini(&pr->tile_views[i].cover);
+
+	return 0;
 }
 
 static void
@@ -538,6 +918,8 @@ copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 	region_global_to_output(output, &output_region);
 
 	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	get_renderer(output->compositor)->pixels_written +=
+		region_area(&output_region);
 	pixman_region32_fini(&output_region);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
@@ -558,12 +940,18 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	/* The debug color is shared, and zoom doesn't transform regions
+	 * exactly: tiles could overlap */
+	if (pr->threads == 0 || pr->repaint_debug || output->zoom.active ||
+	    repaint_tiled(output, output_damage) < 0) {
+		repaint_surfaces(output, output_damage);
+		copy_to_hw_buffer(output, output_damage);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -611,6 +999,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->solid = false;
 
 	if (!buffer)
 		return;
@@ -742,6 +1131,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	}
 
 	ps->image = pixman_image_create_solid_fill(&color);
+	ps->solid = true;
+	ps->color = color;
 }
 
 static void
@@ -751,6 +1142,12 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+
+	if (pr->pool)
+		tile_pool_destroy(pr->pool);
+	free(pr->tile_views);
+	free(pr->tile_paints);
+	free(pr->tiles);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -824,10 +1221,47 @@ debug_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 	}
 }
 
+static int
+set_threads(struct pixman_renderer *pr, int threads)
+{
+	struct tile_pool *pool = NULL;
+
+	if (threads < 0 || threads > TILE_POOL_MAX_THREADS)
+		return -1;
+
+	if (threads > 0) {
+		pool = tile_pool_create(threads);
+		if (!pool)
+			return -1;
+	}
+
+	if (pr->pool)
+		tile_pool_destroy(pr->pool);
+	pr->pool = pool;
+	pr->threads = threads;
+
+	return 0;
+}
+
+/* The tiled repaint is opt-in until it has been measured against the
+ * untiled one on real hardware */
+static int
+default_threads(void)
+{
+	const char *env = getenv("WESTON_PIXMAN_THREADS");
+	int32_t threads;
+
+	if (env && safe_strtoint(env, &threads))
+		return threads;
+
+	return 0;
+}
+
 WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	int threads;
 
 	renderer = zalloc(sizeof *renderer);
 	if (renderer == NULL)
@@ -858,9 +1292,54 @@ pixman_renderer_init(struct weston_compositor *ec)
 
 	wl_signal_init(&renderer->destroy_signal);
 
+	threads = default_threads();
+	if (set_threads(renderer, threads) < 0) {
+		weston_log("Pixman renderer: can't repaint on %d threads\n",
+			   threads);
+		set_threads(renderer, 0);
+	}
+	if (renderer->threads > 0)
+		weston_log("Pixman renderer: repainting %dx%d tiles on %d "
+			   "threads\n", TILE_SIZE, TILE_SIZE, renderer->threads);
+
 	return 0;
 }
 
+WL_EXPORT int
+pixman_renderer_set_threads(struct weston_compositor *ec, int threads)
+{
+	if (!ec->renderer ||
+	    ec->renderer->repaint_output != pixman_renderer_repaint_output)
+		return -1;
+
+	if (set_threads(get_renderer(ec), threads) < 0)
+		return -1;
+
+	weston_compositor_damage_all(ec);
+
+	return 0;
+}
+
+WL_EXPORT int
+pixman_renderer_get_threads(struct weston_compositor *ec)
+{
+	if (!ec->renderer ||
+	    ec->renderer->repaint_output != pixman_renderer_repaint_output)
+		return -1;
+
+	return get_renderer(ec)->threads;
+}
+
+WL_EXPORT uint64_t
+pixman_renderer_get_pixels_written(struct weston_compositor *ec)
+{
+	if (!ec->renderer ||
+	    ec->renderer->repaint_output != pixman_renderer_repaint_output)
+		return 0;
+
+	return get_renderer(ec)->pixels_written;
+}
+
 WL_EXPORT void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer)
 {
@@ -869,6 +1348,7 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 	po->hw_buffer = buffer;
+	release_thread_images(po->thread_hw_images);
 
 	if (po->hw_buffer) {
 		output->compositor->read_format = pixman_image_get_format(po->hw_buffer);
@@ -917,6 +1397,9 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	release_thread_images(po->thread_images);
+	release_thread_images(po->thread_hw_images);
+
 	pixman_image_unref(po->shadow_image);
 
 	if (po->hw_buffer)
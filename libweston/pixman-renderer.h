@@ -38,3 +38,16 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 
 void
 pixman_renderer_output_destroy(struct weston_output *output);
+
+/* 0 repaints on the compositor thread alone, without tiles. Returns -1
+ * if the compositor doesn't use the pixman renderer. */
+int
+pixman_renderer_set_threads(struct weston_compositor *ec, int threads);
+
+/* -1 if the compositor doesn't use the pixman renderer */
+int
+pixman_renderer_get_threads(struct weston_compositor *ec);
+
+/* Painted into the shadow buffers and copied to the hw buffers, so far */
+uint64_t
+pixman_renderer_get_pixels_written(struct weston_compositor *ec);
@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "plane-solver.h"
+
+struct plane_solver {
+	int max_views;
+	int n_sprites;
+	int max_tests;
+
+	/* State of the running search */
+	struct plane_solver_kms *kms;
+	const struct plane_solver_view *views;
+	int n_views;
+	int n_tests;
+	int *current;
+	int *best;
+	uint64_t best_area;
+	uint64_t *remaining;	/* area of the candidates from view i on */
+};
+
+struct plane_solver *
+plane_solver_create(int max_views, int n_sprites, int max_tests)
+{
+	struct plane_solver *solver;
+
+	if (max_views <= 0 || n_sprites < 0 ||
+	    n_sprites > PLANE_SOLVER_MAX_SPRITES)
+		return NULL;
+
+	solver = calloc(1, sizeof *solver);
+	if (!solver)
+		return NULL;
+
+	solver->current = calloc(max_views, sizeof *solver->current);
+	solver->best = calloc(max_views, sizeof *solver->best);
+	solver->remaining = calloc(max_views + 1, sizeof *solver->remaining);
+	if (!solver->current || !solver->best || !solver->remaining) {
+		plane_solver_destroy(solver);
+		return NULL;
+	}
+	solver->max_views = max_views;
+	solver->n_sprites = n_sprites;
+	solver->max_tests = max_tests;
+
+	return solver;
+}
+
+void
+plane_solver_destroy(struct plane_solver *solver)
+{
+	free(solver->current);
+	free(solver->best);
+	free(solver->remaining);
+	free(solver);
+}
+
+static uint64_t
+view_area(const struct plane_solver_view *view)
+{
+	if (view->x2 <= view->x1 || view->y2 <= view->y1)
+		return 0;
+
+	return (uint64_t)(view->x2 - view->x1) * (view->y2 - view->y1);
+}
+
+static bool
+views_overlap(const struct plane_solver_view *a,
+	      const struct plane_solver_view *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static uint32_t
+usable_sprites(struct plane_solver *solver, const struct plane_solver_view *view)
+{
+	if (solver->n_sprites == PLANE_SOLVER_MAX_SPRITES)
+		return view->sprite_mask;
+
+	return view->sprite_mask & ((1u << solver->n_sprites) - 1);
+}
+
+/*
+ * The topmost sprite view i can go on given the views above it, or -1 if
+ * it is covered by something composited.
+ */
+static int
+highest_sprite(struct plane_solver *solver, int i)
+{
+	int highest = solver->n_sprites - 1;
+	int j;
+
+	for (j = 0; j < i; j++) {
+		if (!views_overlap(&solver->views[j], &solver->views[i]))
+			continue;
+
+		if (solver->current[j] < 0)
+			return -1;
+		if (solver->current[j] <= highest)
+			highest = solver->current[j] - 1;
+	}
+
+	return highest;
+}
+
+static void
+search(struct plane_solver *solver, int i, uint64_t area, uint32_t used)
+{
+	const struct plane_solver_view *view = &solver->views[i];
+	uint32_t free_sprites;
+	int s;
+
+	/* Nothing further down can beat what we already have */
+	if (area + solver->remaining[i] <= solver->best_area)
+		return;
+
+	if (i == solver->n_views) {
+		solver->best_area = area;
+		for (s = 0; s < solver->n_views; s++)
+			solver->best[s] = solver->current[s];
+		return;
+	}
+
+	free_sprites = usable_sprites(solver, view) & ~used;
+	if (free_sprites) {
+		for (s = highest_sprite(solver, i); s >= 0; s--) {
+			if (!(free_sprites & (1u << s)))
+				continue;
+			if (solver->n_tests >= solver->max_tests ||
+			    area + solver->remaining[i] <= solver->best_area)
+				break;
+
+			solver->current[i] = s;
+			solver->n_tests++;
+			if (solver->kms->test(solver->kms, solver->views,
+					      solver->current, i + 1) == 0)
+				search(solver, i + 1, area + view_area(view),
+				       used | (1u << s));
+		}
+	}
+
+	solver->current[i] = -1;
+	search(solver, i + 1, area, used);
+}
+
+void
+plane_solver_solve(struct plane_solver *solver, struct plane_solver_kms *kms,
+		   const struct plane_solver_view *views, int n_views,
+		   int *sprite, struct plane_solver_result *result)
+{
+	int n = n_views < solver->max_views ? n_views : solver->max_views;
+	int i;
+
+	solver->kms = kms;
+	solver->views = views;
+	solver->n_views = n;
+	solver->n_tests = 0;
+	solver->best_area = 0;
+
+	solver->remaining[n] = 0;
+	for (i = n - 1; i >= 0; i--) {
+		solver->remaining[i] = solver->remaining[i + 1];
+		if (usable_sprites(solver, &views[i]))
+			solver->remaining[i] += view_area(&views[i]);
+		solver->best[i] = -1;
+	}
+
+	search(solver, 0, 0, 0);
+
+	result->n_scanout = 0;
+	result->scanout_area = 0;
+	result->composited_area = 0;
+	result->n_tests = solver->n_tests;
+
+	for (i = 0; i < n_views; i++) {
+		sprite[i] = i < n ? solver->best[i] : -1;
+
+		if (sprite[i] >= 0) {
+			result->n_scanout++;
+			result->scanout_area += view_area(&views[i]);
+		} else {
+			result->composited_area += view_area(&views[i]);
+		}
+	}
+}
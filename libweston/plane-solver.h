@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PLANE_SOLVER_H
+#define WESTON_PLANE_SOLVER_H
+
+#include <stdint.h>
+
+/*
+ * Picks which views of an output go on sprite planes, so that as much of
+ * the output as possible is scanned out rather than composited.
+ *
+ * Views are given top to bottom, sprites are numbered bottom to top in
+ * their hardware stacking order, all of them above the composited
+ * contents. An assignment is valid when:
+ *
+ * - every view is on a sprite of its sprite_mask, or composited
+ * - no composited view is above a view on a sprite and overlaps it
+ * - of two overlapping views on sprites, the upper one is on the upper
+ *   sprite
+ * - the kms test accepts it
+ *
+ * The search places the topmost views first, each on the topmost sprite
+ * it may use, and then backtracks for assignments that scan out more,
+ * until it has used up its kms tests. Format, scaling or bandwidth limits
+ * are left to the kms test; on hardware it is an atomic TEST_ONLY commit.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+#define PLANE_SOLVER_MAX_SPRITES 32
+
+struct plane_solver_view {
+	int32_t x1, y1, x2, y2;	/* bounding box, output coordinates */
+	uint32_t sprite_mask;	/* 0 if it must be composited */
+};
+
+/*
+ * sprite[i] is the sprite of view i or -1 if it is composited. Views from
+ * n_views on are composited. Returns 0 if the hardware can do it.
+ */
+struct plane_solver_kms {
+	int (*test)(struct plane_solver_kms *kms,
+		    const struct plane_solver_view *views,
+		    const int *sprite, int n_views);
+};
+
+struct plane_solver_result {
+	int n_scanout;			/* views put on sprites */
+	uint64_t scanout_area;		/* pixels taken off the renderer */
+	uint64_t composited_area;	/* pixels left to the renderer */
+	int n_tests;
+};
+
+struct plane_solver;
+
+/* Views from max_views on are always composited */
+struct plane_solver *
+plane_solver_create(int max_views, int n_sprites, int max_tests);
+
+void
+plane_solver_destroy(struct plane_solver *solver);
+
+/* Fills in sprite[] for all n_views views */
+void
+plane_solver_solve(struct plane_solver *solver, struct plane_solver_kms *kms,
+		   const struct plane_solver_view *views, int n_views,
+		   int *sprite, struct plane_solver_result *result);
+
+#endif /* WESTON_PLANE_SOLVER_H */
@@ -0,0 +1,152 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-util.h>
+
+#include "repaint-stats.h"
+
+/* Values below this get a bucket each */
+#define LINEAR_LIMIT 8
+
+static unsigned int
+bucket_index(uint32_t usec)
+{
+	unsigned int msb, bucket;
+
+	if (usec < LINEAR_LIMIT)
+		return usec;
+
+	/* The top three bits of the value pick the bucket */
+	msb = 31 - __builtin_clz(usec);
+	bucket = LINEAR_LIMIT + (msb - 3) * 4 + ((usec >> (msb - 2)) & 3);
+
+	if (bucket >= WESTON_HISTOGRAM_BUCKETS)
+		bucket = WESTON_HISTOGRAM_BUCKETS - 1;
+
+	return bucket;
+}
+
+WL_EXPORT uint32_t
+weston_histogram_bucket_start(unsigned int bucket)
+{
+	unsigned int msb;
+
+	if (bucket < LINEAR_LIMIT)
+		return bucket;
+
+	msb = 3 + (bucket - LINEAR_LIMIT) / 4;
+
+	return (4 + (bucket - LINEAR_LIMIT) % 4) << (msb - 2);
+}
+
+WL_EXPORT void
+weston_histogram_add(struct weston_histogram *h, uint32_t usec)
+{
+	if (h->count == 0 || usec < h->min)
+		h->min = usec;
+	if (usec > h->max)
+		h->max = usec;
+
+	h->count++;
+	h->sum += usec;
+	h->buckets[bucket_index(usec)]++;
+}
+
+WL_EXPORT void
+weston_histogram_add_interval(struct weston_histogram *h,
+			      const struct timespec *start,
+			      const struct timespec *end)
+{
+	int64_t nsec;
+
+	if (start->tv_sec == 0 && start->tv_nsec == 0)
+		return;
+
+	nsec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 +
+	       (end->tv_nsec - start->tv_nsec);
+	if (nsec < 0)
+		nsec = 0;
+	if (nsec / 1000 > UINT32_MAX)
+		nsec = (int64_t)UINT32_MAX * 1000;
+
+	weston_histogram_add(h, nsec / 1000);
+}
+
+WL_EXPORT uint32_t
+weston_histogram_percentile(const struct weston_histogram *h,
+			    unsigned int percent)
+{
+	uint64_t rank, seen = 0;
+	uint32_t end;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = ((uint64_t)h->count * percent + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < WESTON_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == WESTON_HISTOGRAM_BUCKETS - 1)
+		return h->max;
+
+	/* The largest value the bucket could hold, but no more than seen */
+	end = weston_histogram_bucket_start(i + 1) - 1;
+
+	return end < h->max ? end : h->max;
+}
+
+WL_EXPORT void
+weston_histogram_reset(struct weston_histogram *h)
+{
+	memset(h, 0, sizeof *h);
+}
+
+WL_EXPORT void
+weston_repaint_stats_reset(struct weston_repaint_stats *stats)
+{
+	unsigned int i;
+
+	for (i = 0; i < WESTON_REPAINT_STAGE_COUNT; i++)
+		weston_histogram_reset(&stats->stage[i]);
+	weston_histogram_reset(&stats->upload);
+	weston_histogram_reset(&stats->upload_size);
+
+	stats->frames = 0;
+	stats->missed_vblank = 0;
+	stats->over_budget = 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_REPAINT_STATS_H
+#define WESTON_REPAINT_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <wayland-util.h>
+
+/*
+ * Always-on repaint loop statistics: how long each stage of an output
+ * repaint takes, and how long surface content waits from commit until it
+ * is on screen. Recording is a couple of clock reads and an increment per
+ * stage, so this stays enabled.
+ *
+ * These structs are embedded in weston_output and weston_surface and only
+ * need zero-initializing, apart from the list link.
+ */
+
+/*
+ * Log-linear buckets in microseconds: 0-7 us get a bucket each, after that
+ * every power of two is split into four. The last bucket collects
+ * everything from about 115 ms up.
+ */
+#define WESTON_HISTOGRAM_BUCKETS 64
+
+struct weston_histogram {
+	uint32_t count;
+	uint32_t min, max;	/* us */
+	uint64_t sum;		/* us */
+	uint32_t buckets[WESTON_HISTOGRAM_BUCKETS];
+};
+
+void
+weston_histogram_add(struct weston_histogram *h, uint32_t usec);
+
+/* Smallest value that falls into the bucket */
+uint32_t
+weston_histogram_bucket_start(unsigned int bucket);
+
+/* Upper estimate of the given percentile, 0 if empty */
+uint32_t
+weston_histogram_percentile(const struct weston_histogram *h,
+			    unsigned int percent);
+
+void
+weston_histogram_reset(struct weston_histogram *h);
+
+enum weston_repaint_stage {
+	WESTON_REPAINT_STAGE_BUILD_VIEW_LIST = 0,
+	WESTON_REPAINT_STAGE_ASSIGN_PLANES,
+	WESTON_REPAINT_STAGE_ACCUMULATE_DAMAGE,
+	WESTON_REPAINT_STAGE_RENDER,	/* weston_output::repaint */
+	WESTON_REPAINT_STAGE_FLIP,	/* repaint done until presented */
+	WESTON_REPAINT_STAGE_TOTAL,	/* repaint start until presented */
+	WESTON_REPAINT_STAGE_COUNT
+};
+
+struct weston_repaint_stats {
+	struct weston_histogram stage[WESTON_REPAINT_STAGE_COUNT];
+
+	uint32_t frames;
+	uint32_t missed_vblank;	/* presented after the vblank aimed for */
+	uint32_t over_budget;	/* repaint took longer than repaint_msec */
+
+	/*
+	 * Renderer uploads of client content during accumulate damage, for
+	 * the frames that had any: the time taken, and the size in KiB.
+	 */
+	struct weston_histogram upload;
+	struct weston_histogram upload_size;
+
+	/* Frame in flight, zero if none */
+	struct timespec repaint_start;
+	struct timespec repaint_end;
+};
+
+/* Adds the time from start until end, if start is set */
+void
+weston_histogram_add_interval(struct weston_histogram *h,
+			      const struct timespec *start,
+			      const struct timespec *end);
+
+void
+weston_repaint_stats_reset(struct weston_repaint_stats *stats);
+
+struct weston_present_latency {
+	struct weston_histogram histogram;
+
+	/* Oldest new content not yet repainted, zero once repainted */
+	struct timespec commit_time;
+
+	/* Content in the frame waiting to be presented, zero once presented */
+	struct timespec repaint_commit_time;
+	struct wl_list link;	/* weston_output::present_latency_list */
+};
+
+#endif /* WESTON_REPAINT_STATS_H */
@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shader-cache.h"
+
+#define SHADER_CACHE_MAGIC "WSHADER"
+#define SHADER_CACHE_VERSION 1
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct shader_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t format;
+	uint64_t key;
+	uint64_t checksum;
+	uint32_t size;
+	uint32_t pad;
+};
+
+static uint64_t
+fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+void
+shader_cache_key_init(struct shader_cache_key *key)
+{
+	key->hash = FNV_OFFSET_BASIS;
+}
+
+void
+shader_cache_key_add(struct shader_cache_key *key,
+		     const void *data, size_t size)
+{
+	uint64_t len = size;
+
+	key->hash = fnv1a(key->hash, &len, sizeof len);
+	key->hash = fnv1a(key->hash, data, size);
+}
+
+void
+shader_cache_key_add_string(struct shader_cache_key *key, const char *str)
+{
+	if (!str)
+		str = "";
+
+	shader_cache_key_add(key, str, strlen(str));
+}
+
+int
+shader_cache_path(char *path, size_t size, const char *dir,
+		  const struct shader_cache_key *key)
+{
+	int len;
+
+	len = snprintf(path, size, "%s/weston-%016llx.shader", dir,
+		       (unsigned long long)key->hash);
+	if (len < 0 || (size_t)len >= size)
+		return -1;
+
+	return 0;
+}
+
+int
+shader_cache_load(const char *path, const struct shader_cache_key *key,
+		  struct shader_cache_entry *entry)
+{
+	const struct shader_cache_header *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 ||
+	    st.st_size < (off_t)sizeof *header) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	entry->map = map;
+	entry->map_size = st.st_size;
+
+	header = map;
+	if (memcmp(header->magic, SHADER_CACHE_MAGIC,
+		   sizeof SHADER_CACHE_MAGIC) != 0 ||
+	    header->version != SHADER_CACHE_VERSION ||
+	    header->key != key->hash ||
+	    header->size != st.st_size - sizeof *header)
+		goto invalid;
+
+	entry->binary = header + 1;
+	entry->size = header->size;
+	entry->format = header->format;
+
+	if (fnv1a(FNV_OFFSET_BASIS, entry->binary, entry->size) !=
+	    header->checksum)
+		goto invalid;
+
+	return 0;
+
+invalid:
+	shader_cache_entry_release(entry);
+	return -1;
+}
+
+void
+shader_cache_entry_release(struct shader_cache_entry *entry)
+{
+	if (entry->map)
+		munmap(entry->map, entry->map_size);
+
+	memset(entry, 0, sizeof *entry);
+}
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+
+		p += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+int
+shader_cache_store(const char *path, const struct shader_cache_key *key,
+		   uint32_t format, const void *binary, uint32_t size)
+{
+	struct shader_cache_header header;
+	char *tmp;
+	int fd;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof SHADER_CACHE_MAGIC);
+	header.version = SHADER_CACHE_VERSION;
+	header.format = format;
+	header.key = key->hash;
+	header.checksum = fnv1a(FNV_OFFSET_BASIS, binary, size);
+	header.size = size;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		return -1;
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		free(tmp);
+		return -1;
+	}
+
+	/* mkostemp() makes it private, but other users may share the
+	 * directory, as with binaries installed next to the modules. No
+	 * fsync(): after a crash a half written entry fails its checksum. */
+	if (fchmod(fd, 0644) < 0 ||
+	    write_all(fd, &header, sizeof header) < 0 ||
+	    write_all(fd, binary, size) < 0) {
+		close(fd);
+		goto err;
+	}
+
+	if (close(fd) < 0 || rename(tmp, path) < 0)
+		goto err;
+
+	free(tmp);
+
+	return 0;
+
+err:
+	unlink(tmp);
+	free(tmp);
+	return -1;
+}
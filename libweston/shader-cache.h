@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SHADER_CACHE_H
+#define WESTON_SHADER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk cache of linked GL program binaries.
+ *
+ * Entries are named after a hash of everything that went into the binary:
+ * the shader sources and whatever identifies the driver, GL_RENDERER,
+ * GL_VERSION and the binary formats it offers. A driver update or a
+ * shader change thus looks up a different file instead of handing a stale
+ * binary to the driver. The header repeats the key and a checksum of the
+ * binary, so a truncated or foreign file is rejected before GL sees it.
+ *
+ * Entries are written to a temporary file that is renamed into place, so
+ * a reader never sees a partial one, and are mapped rather than read on
+ * load. Binaries are only meaningful to the driver that made them, so
+ * the file is in native byte order.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+struct shader_cache_key {
+	uint64_t hash;
+};
+
+struct shader_cache_entry {
+	void *map;
+	size_t map_size;
+
+	const void *binary;	/* points into map */
+	uint32_t size;
+	uint32_t format;	/* as returned by glGetProgramBinary */
+};
+
+void
+shader_cache_key_init(struct shader_cache_key *key);
+
+/* Chunks are length prefixed, so "ab" + "c" differs from "a" + "bc" */
+void
+shader_cache_key_add(struct shader_cache_key *key,
+		     const void *data, size_t size);
+
+/* A NULL string is hashed as an empty one */
+void
+shader_cache_key_add_string(struct shader_cache_key *key, const char *str);
+
+/* Returns -1 if the path doesn't fit */
+int
+shader_cache_path(char *path, size_t size, const char *dir,
+		  const struct shader_cache_key *key);
+
+/* Returns -1 unless path holds a valid entry for key */
+int
+shader_cache_load(const char *path, const struct shader_cache_key *key,
+		  struct shader_cache_entry *entry);
+
+void
+shader_cache_entry_release(struct shader_cache_entry *entry);
+
+int
+shader_cache_store(const char *path, const struct shader_cache_key *key,
+		   uint32_t format, const void *binary, uint32_t size);
+
+#endif /* WESTON_SHADER_CACHE_H */
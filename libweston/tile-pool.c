@@ -0,0 +1,201 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "tile-pool.h"
+
+struct tile_pool_worker {
+	struct tile_pool *pool;
+	pthread_t thread;
+	int index;
+	uint32_t batch;		/* last batch it worked on */
+};
+
+struct tile_pool {
+	int n_threads;
+	struct tile_pool_worker workers[TILE_POOL_MAX_THREADS];
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	bool quit;
+
+	/* The current batch, under lock */
+	uint32_t batch;
+	tile_pool_job_func_t func;
+	void *data;
+	int n_jobs;
+	int next_job;
+	int running;		/* threads not done with the batch yet */
+};
+
+/* Called and returns with the lock held */
+static void
+run_jobs(struct tile_pool *pool, int thread)
+{
+	int job;
+
+	while (pool->next_job < pool->n_jobs) {
+		job = pool->next_job++;
+
+		pthread_mutex_unlock(&pool->lock);
+		pool->func(pool->data, job, thread);
+		pthread_mutex_lock(&pool->lock);
+	}
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct tile_pool_worker *worker = data;
+	struct tile_pool *pool = worker->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && worker->batch == pool->batch)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+
+		worker->batch = pool->batch;
+		run_jobs(pool, worker->index);
+
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct tile_pool *
+tile_pool_create(int n_threads)
+{
+	struct tile_pool *pool;
+	sigset_t all, old;
+	int i;
+
+	if (n_threads < 1 || n_threads > TILE_POOL_MAX_THREADS)
+		return NULL;
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* Signals are for the event loop. Not the ones the jobs raise
+	 * themselves: SIGBUS is how wl_shm catches truncated client
+	 * buffers. */
+	sigfillset(&all);
+	sigdelset(&all, SIGBUS);
+	sigdelset(&all, SIGSEGV);
+	sigdelset(&all, SIGFPE);
+	sigdelset(&all, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	pool->n_threads = 1;
+	for (i = 1; i < n_threads; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		if (pthread_create(&pool->workers[i].thread, NULL,
+				   worker_thread, &pool->workers[i]) != 0)
+			break;
+		pool->n_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (pool->n_threads < n_threads) {
+		tile_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void
+tile_pool_destroy(struct tile_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->n_threads; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int
+tile_pool_get_threads(struct tile_pool *pool)
+{
+	return pool->n_threads;
+}
+
+void
+tile_pool_run(struct tile_pool *pool, int n_jobs,
+	      tile_pool_job_func_t func, void *data)
+{
+	int job;
+
+	/* Not worth waking anyone up */
+	if (n_jobs <= 1 || pool->n_threads == 1) {
+		for (job = 0; job < n_jobs; job++)
+			func(data, job, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->data = data;
+	pool->n_jobs = n_jobs;
+	pool->next_job = 0;
+	pool->running = pool->n_threads;
+	pool->batch++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	run_jobs(pool, 0);
+
+	pool->running--;
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
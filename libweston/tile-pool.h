@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_TILE_POOL_H
+#define WESTON_TILE_POOL_H
+
+/*
+ * A fixed set of threads that work through batches of independent jobs,
+ * such as the tiles of one output repaint. tile_pool_run() hands out the
+ * jobs of a batch one at a time to whichever thread is free, and returns
+ * once all of them are done. The calling thread works on the batch too:
+ * a pool of n threads starts n - 1 workers.
+ *
+ * Jobs get the index of the thread running them, from 0 for the caller to
+ * n - 1, so they can keep per-thread state without locking.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+#define TILE_POOL_MAX_THREADS 16
+
+struct tile_pool;
+
+typedef void (*tile_pool_job_func_t)(void *data, int job, int thread);
+
+/* n_threads includes the caller, between 1 and TILE_POOL_MAX_THREADS */
+struct tile_pool *
+tile_pool_create(int n_threads);
+
+void
+tile_pool_destroy(struct tile_pool *pool);
+
+int
+tile_pool_get_threads(struct tile_pool *pool);
+
+/* Runs func(data, job, thread) for job from 0 to n_jobs - 1 */
+void
+tile_pool_run(struct tile_pool *pool, int n_jobs,
+	      tile_pool_job_func_t func, void *data);
+
+#endif /* WESTON_TILE_POOL_H */
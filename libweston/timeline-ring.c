@@ -0,0 +1,403 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <wayland-util.h>
+
+#include "timeline-ring.h"
+
+WL_EXPORT struct timeline_ring *
+timeline_ring_create(uint32_t n_points, uint32_t n_descs)
+{
+	struct timeline_ring *ring;
+
+	if (n_points == 0 || n_descs == 0)
+		return NULL;
+
+	ring = calloc(1, sizeof *ring);
+	if (!ring)
+		return NULL;
+
+	ring->points = calloc(n_points, sizeof *ring->points);
+	ring->descs = calloc(n_descs, sizeof *ring->descs);
+	if (!ring->points || !ring->descs) {
+		timeline_ring_destroy(ring);
+		return NULL;
+	}
+	ring->n_points = n_points;
+	ring->n_descs = n_descs;
+
+	return ring;
+}
+
+WL_EXPORT void
+timeline_ring_destroy(struct timeline_ring *ring)
+{
+	free(ring->points);
+	free(ring->descs);
+	free(ring);
+}
+
+WL_EXPORT struct timeline_ring *
+timeline_ring_copy(const struct timeline_ring *ring)
+{
+	struct timeline_ring *copy;
+
+	copy = timeline_ring_create(ring->n_points, ring->n_descs);
+	if (!copy)
+		return NULL;
+
+	memcpy(copy->points, ring->points,
+	       ring->n_points * sizeof *ring->points);
+	memcpy(copy->descs, ring->descs, ring->n_descs * sizeof *ring->descs);
+	copy->points_written = ring->points_written;
+	copy->descs_written = ring->descs_written;
+
+	return copy;
+}
+
+static const struct timeline_ring_point *
+ring_point(const struct timeline_ring *ring, uint32_t i)
+{
+	uint64_t first = 0;
+
+	if (ring->points_written > ring->n_points)
+		first = ring->points_written - ring->n_points;
+
+	return &ring->points[(first + i) % ring->n_points];
+}
+
+static const struct timeline_ring_desc *
+ring_desc(const struct timeline_ring *ring, uint32_t i)
+{
+	uint64_t first = 0;
+
+	if (ring->descs_written > ring->n_descs)
+		first = ring->descs_written - ring->n_descs;
+
+	return &ring->descs[(first + i) % ring->n_descs];
+}
+
+/* There are a handful of point names, so a list does */
+static uint32_t
+lookup_name(const char **names, uint32_t *n_names, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < *n_names; i++) {
+		if (names[i] == name)
+			return i;
+	}
+
+	names[*n_names] = name;
+	return (*n_names)++;
+}
+
+WL_EXPORT int
+timeline_ring_serialize(const struct timeline_ring *ring,
+			char **data, size_t *size)
+{
+	struct timeline_dump_header header;
+	const struct timeline_ring_point *point;
+	const char **names;
+	uint32_t *point_names;
+	uint32_t n_names = 0, n_points, n_descs, i;
+	uint32_t length;
+	char *p;
+
+	n_points = ring->points_written < ring->n_points ?
+		   ring->points_written : ring->n_points;
+	n_descs = ring->descs_written < ring->n_descs ?
+		  ring->descs_written : ring->n_descs;
+
+	names = calloc(n_points + 1, sizeof *names);
+	point_names = calloc(n_points + 1, sizeof *point_names);
+	if (!names || !point_names)
+		goto err;
+
+	for (i = 0; i < n_points; i++)
+		point_names[i] = lookup_name(names, &n_names,
+					     ring_point(ring, i)->name);
+
+	*size = sizeof header +
+		n_descs * sizeof(struct timeline_ring_desc) +
+		n_points * sizeof(struct timeline_dump_point);
+	for (i = 0; i < n_names; i++)
+		*size += sizeof length + strlen(names[i]);
+
+	*data = malloc(*size);
+	if (!*data)
+		goto err;
+	p = *data;
+
+	memcpy(header.magic, TIMELINE_DUMP_MAGIC, sizeof header.magic);
+	header.version = TIMELINE_DUMP_VERSION;
+	header.n_strings = n_names;
+	header.n_descs = n_descs;
+	header.n_points = n_points;
+	header.lost_points = ring->points_written - n_points;
+	memcpy(p, &header, sizeof header);
+	p += sizeof header;
+
+	for (i = 0; i < n_names; i++) {
+		length = strlen(names[i]);
+		memcpy(p, &length, sizeof length);
+		p += sizeof length;
+		memcpy(p, names[i], length);
+		p += length;
+	}
+
+	for (i = 0; i < n_descs; i++) {
+		memcpy(p, ring_desc(ring, i), sizeof(struct timeline_ring_desc));
+		p += sizeof(struct timeline_ring_desc);
+	}
+
+	for (i = 0; i < n_points; i++) {
+		struct timeline_dump_point dp;
+
+		point = ring_point(ring, i);
+		dp.timestamp = point->timestamp;
+		dp.name = point_names[i];
+		memcpy(dp.type, point->type, sizeof dp.type);
+		memcpy(dp.value, point->value, sizeof dp.value);
+		/* Names leave points unaligned */
+		memcpy(p, &dp, sizeof dp);
+		p += sizeof dp;
+	}
+
+	free(names);
+	free(point_names);
+	return 0;
+
+err:
+	free(names);
+	free(point_names);
+	return -1;
+}
+
+struct json_object {
+	uint32_t id;
+	uint32_t desc;		/* index of the latest description */
+	int emitted;
+};
+
+struct json_context {
+	FILE *out;
+	struct timeline_ring_desc *descs;
+	struct json_object *objects;
+	uint32_t size;
+};
+
+static struct json_object *
+json_object_lookup(struct json_context *ctx, uint32_t id)
+{
+	uint32_t mask = ctx->size - 1;
+	uint32_t slot = id * 2654435761u & mask;
+
+	while (ctx->objects[slot].id && ctx->objects[slot].id != id)
+		slot = (slot + 1) & mask;
+
+	return &ctx->objects[slot];
+}
+
+static void
+json_quoted_string(FILE *fp, const char *str, size_t max)
+{
+	if (str[0] == '\0')
+		fprintf(fp, "null");
+	else
+		fprintf(fp, "\"%.*s\"", (int)strnlen(str, max), str);
+}
+
+/* Same output as the description in timeline.c */
+static void
+json_emit_desc(struct json_context *ctx, uint32_t id)
+{
+	struct json_object *obj = json_object_lookup(ctx, id);
+	const struct timeline_ring_desc *desc;
+
+	/* Described before the oldest description still in the ring */
+	if (obj->id == 0 || obj->emitted)
+		return;
+
+	obj->emitted = 1;
+	desc = &ctx->descs[obj->desc];
+
+	if (desc->type == TIMELINE_RING_OUTPUT) {
+		fprintf(ctx->out, "{ \"id\":%u, "
+			"\"type\":\"weston_output\", \"name\":", desc->id);
+		json_quoted_string(ctx->out, desc->desc, sizeof desc->desc);
+		fprintf(ctx->out, " }\n");
+		return;
+	}
+
+	if (desc->main_surface)
+		json_emit_desc(ctx, desc->main_surface);
+
+	fprintf(ctx->out, "{ \"id\":%u, "
+		"\"type\":\"weston_surface\", \"desc\":", desc->id);
+	json_quoted_string(ctx->out, desc->desc, sizeof desc->desc);
+	if (desc->main_surface)
+		fprintf(ctx->out, ", \"main_surface\":%u", desc->main_surface);
+	fprintf(ctx->out, " }\n");
+}
+
+static void
+json_emit_timestamp(FILE *fp, const char *key, uint64_t ns)
+{
+	fprintf(fp, "\"%s\":[%" PRId64 ", %ld]", key,
+		(int64_t)(ns / 1000000000), (long)(ns % 1000000000));
+}
+
+WL_EXPORT int
+timeline_dump_to_json(const char *data, size_t size, FILE *out)
+{
+	struct timeline_dump_header header;
+	struct timeline_dump_point point;
+	struct json_context ctx = { out };
+	struct json_object *obj;
+	const char **names = NULL;
+	uint32_t *name_lengths = NULL;
+	const char *p = data, *end = data + size;
+	uint32_t d = 0, i, j;
+	int ret = -1;
+
+	if (size < sizeof header)
+		return -1;
+	memcpy(&header, p, sizeof header);
+	p += sizeof header;
+
+	if (memcmp(header.magic, TIMELINE_DUMP_MAGIC, sizeof header.magic) ||
+	    header.version != TIMELINE_DUMP_VERSION)
+		return -1;
+
+	names = calloc(header.n_strings + 1, sizeof *names);
+	name_lengths = calloc(header.n_strings + 1, sizeof *name_lengths);
+	if (!names || !name_lengths)
+		goto out;
+
+	for (i = 0; i < header.n_strings; i++) {
+		if ((size_t)(end - p) < sizeof name_lengths[i])
+			goto out;
+		memcpy(&name_lengths[i], p, sizeof name_lengths[i]);
+		p += sizeof name_lengths[i];
+		if ((size_t)(end - p) < name_lengths[i])
+			goto out;
+		names[i] = p;
+		p += name_lengths[i];
+	}
+
+	if ((size_t)(end - p) <
+	    (uint64_t)header.n_descs * sizeof(struct timeline_ring_desc) +
+	    (uint64_t)header.n_points * sizeof point)
+		goto out;
+
+	/* Copied, as the names may have left them unaligned */
+	ctx.descs = malloc((header.n_descs + 1) * sizeof *ctx.descs);
+	ctx.size = 16;
+	while (ctx.size < header.n_descs * 2)
+		ctx.size <<= 1;
+	ctx.objects = calloc(ctx.size, sizeof *ctx.objects);
+	if (!ctx.descs || !ctx.objects)
+		goto out;
+	memcpy(ctx.descs, p,
+	       header.n_descs * sizeof(struct timeline_ring_desc));
+	p += header.n_descs * sizeof(struct timeline_ring_desc);
+
+	if (header.lost_points)
+		fprintf(stderr, "%" PRIu64 " older points were overwritten\n",
+			header.lost_points);
+
+	for (i = 0; i < header.n_points; i++) {
+		memcpy(&point, p, sizeof point);
+		p += sizeof point;
+
+		/* Descriptions made up to this point replace older ones */
+		for (; d < header.n_descs &&
+		       ctx.descs[d].timestamp <= point.timestamp; d++) {
+			if (ctx.descs[d].id == 0)
+				continue;
+			obj = json_object_lookup(&ctx, ctx.descs[d].id);
+			obj->id = ctx.descs[d].id;
+			obj->desc = d;
+			obj->emitted = 0;
+		}
+
+		if (point.name >= header.n_strings)
+			goto out;
+
+		for (j = 0; j < TIMELINE_RING_MAX_ARGS; j++) {
+			if (point.type[j] == TIMELINE_RING_OUTPUT ||
+			    point.type[j] == TIMELINE_RING_SURFACE)
+				json_emit_desc(&ctx, point.value[j]);
+		}
+
+		fprintf(out, "{ ");
+		json_emit_timestamp(out, "T", point.timestamp);
+		fprintf(out, ", \"N\":\"%.*s\"", (int)name_lengths[point.name],
+			names[point.name]);
+
+		for (j = 0; j < TIMELINE_RING_MAX_ARGS; j++) {
+			switch (point.type[j]) {
+			case TIMELINE_RING_OUTPUT:
+				fprintf(out, ", \"wo\":%u",
+					(uint32_t)point.value[j]);
+				break;
+			case TIMELINE_RING_SURFACE:
+				fprintf(out, ", \"ws\":%u",
+					(uint32_t)point.value[j]);
+				break;
+			case TIMELINE_RING_VBLANK:
+				fprintf(out, ", ");
+				json_emit_timestamp(out, "vblank",
+						    point.value[j]);
+				break;
+			case TIMELINE_RING_GPU:
+				fprintf(out, ", ");
+				json_emit_timestamp(out, "gpu", point.value[j]);
+				break;
+			default:
+				break;
+			}
+		}
+
+		fprintf(out, " }\n");
+	}
+
+	ret = 0;
+
+out:
+	free(names);
+	free(name_lengths);
+	free(ctx.descs);
+	free(ctx.objects);
+	return ret;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_TIMELINE_RING_H
+#define WESTON_TIMELINE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * In-memory timeline, the flight recorder version of the timeline log.
+ *
+ * Points go into a preallocated ring that overwrites its oldest entries,
+ * so the last few seconds are always at hand when something goes wrong.
+ * Object descriptions are kept in a ring of their own, as they are rare
+ * and must outlive the points that first referred to them.
+ *
+ * Only the compositor thread records. Copies of the ring may be handed
+ * to other threads for serializing.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+/* Matches enum timeline_type */
+enum timeline_ring_type {
+	TIMELINE_RING_END = 0,
+	TIMELINE_RING_OUTPUT,
+	TIMELINE_RING_SURFACE,
+	TIMELINE_RING_VBLANK,
+	TIMELINE_RING_GPU,
+};
+
+#define TIMELINE_RING_MAX_ARGS 3
+
+struct timeline_ring_point {
+	uint64_t timestamp;	/* ns */
+	const char *name;	/* string literal */
+	uint8_t type[TIMELINE_RING_MAX_ARGS + 1];
+	uint32_t padding;
+	uint64_t value[TIMELINE_RING_MAX_ARGS];	/* object id, or ns */
+};
+
+struct timeline_ring_desc {
+	uint64_t timestamp;	/* ns */
+	uint32_t id;
+	uint32_t type;
+	uint32_t main_surface;	/* 0 if none */
+	char desc[108];		/* empty if none */
+};
+
+struct timeline_ring {
+	struct timeline_ring_point *points;
+	uint32_t n_points;
+	uint64_t points_written;
+
+	struct timeline_ring_desc *descs;
+	uint32_t n_descs;
+	uint64_t descs_written;
+};
+
+struct timeline_ring *
+timeline_ring_create(uint32_t n_points, uint32_t n_descs);
+
+void
+timeline_ring_destroy(struct timeline_ring *ring);
+
+/* Slot for a new entry, overwriting the oldest one if the ring is full */
+static inline struct timeline_ring_point *
+timeline_ring_add_point(struct timeline_ring *ring)
+{
+	return &ring->points[ring->points_written++ % ring->n_points];
+}
+
+static inline struct timeline_ring_desc *
+timeline_ring_add_desc(struct timeline_ring *ring)
+{
+	return &ring->descs[ring->descs_written++ % ring->n_descs];
+}
+
+/* Copies a ring, for serializing it on another thread */
+struct timeline_ring *
+timeline_ring_copy(const struct timeline_ring *ring);
+
+/*
+ * Binary dump of a ring, in host byte order:
+ *
+ *   struct timeline_dump_header
+ *   uint32_t length, char[length]	x n_strings
+ *   struct timeline_ring_desc		x n_descs
+ *   struct timeline_dump_point		x n_points
+ *
+ * Points refer to their names by index. Both lists are in time order.
+ */
+#define TIMELINE_DUMP_MAGIC "WTIMELN\0"
+#define TIMELINE_DUMP_VERSION 1
+
+struct timeline_dump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_strings;
+	uint32_t n_descs;
+	uint32_t n_points;
+	uint64_t lost_points;	/* overwritten before the dump */
+};
+
+struct timeline_dump_point {
+	uint64_t timestamp;
+	uint32_t name;
+	uint8_t type[TIMELINE_RING_MAX_ARGS + 1];
+	uint64_t value[TIMELINE_RING_MAX_ARGS];
+};
+
+int
+timeline_ring_serialize(const struct timeline_ring *ring,
+			char **data, size_t *size);
+
+/*
+ * Writes a dump in the format of the timeline log file. Descriptions are
+ * written just before the first point that refers to them.
+ */
+int
+timeline_dump_to_json(const char *data, size_t size, FILE *out);
+
+#endif /* WESTON_TIMELINE_RING_H */
@@ -31,16 +31,30 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "timeline.h"
+#include "timeline-ring.h"
 #include "compositor.h"
 #include "file-util.h"
+#include "shared/timespec-util.h"
+
+/* Flight recorder dumps closer together than this are skipped */
+#define TIMELINE_FLUSH_INTERVAL_NSEC 1000000000LL
+
+/* Outputs and surfaces described, most of which are long gone */
+#define TIMELINE_RING_DESCS 1024
 
 struct timeline_log {
 	clock_t clk_id;
 	FILE *file;
 	unsigned series;
 	struct wl_listener compositor_destroy_listener;
+
+	struct timeline_ring *ring;
+	struct wl_listener ring_destroy_listener;
+	struct timespec last_flush;
+	int flushing;
 };
 
 WL_EXPORT int weston_timeline_enabled_;
@@ -85,7 +99,7 @@ timeline_notify_destroy(struct wl_listener *listener, void *data)
 void
 weston_timeline_open(struct weston_compositor *compositor)
 {
-	if (weston_timeline_enabled_)
+	if (weston_timeline_enabled_ & WESTON_TIMELINE_LOG)
 		return;
 
 	if (weston_timeline_do_open() < 0)
@@ -98,16 +112,20 @@ weston_timeline_open(struct weston_compositor *compositor)
 	if (++timeline_.series == 0)
 		++timeline_.series;
 
-	weston_timeline_enabled_ = 1;
+	weston_timeline_enabled_ |= WESTON_TIMELINE_LOG;
 }
 
 void
 weston_timeline_close(void)
 {
-	if (!weston_timeline_enabled_)
+	if (!(weston_timeline_enabled_ & WESTON_TIMELINE_LOG))
 		return;
 
-	weston_timeline_enabled_ = 0;
+	/* Descriptions went to the file, the ring needs them again */
+	if (++timeline_.series == 0)
+		++timeline_.series;
+
+	weston_timeline_enabled_ &= ~WESTON_TIMELINE_LOG;
 
 	wl_list_remove(&timeline_.compositor_destroy_listener.link);
 
@@ -116,6 +134,156 @@ weston_timeline_close(void)
 	weston_log("Timeline log file closed.\n");
 }
 
+static void
+timeline_ring_notify_destroy(struct wl_listener *listener, void *data)
+{
+	weston_timeline_close_ring();
+}
+
+/** Start recording the timeline into memory
+ *
+ * \param compositor The compositor.
+ * \param n_points How many of the latest points to keep.
+ *
+ * The points are only written out by weston_timeline_flush(). While the
+ * timeline log file is open, points go to the file instead.
+ */
+WL_EXPORT void
+weston_timeline_open_ring(struct weston_compositor *compositor,
+			  uint32_t n_points)
+{
+	if (timeline_.ring)
+		return;
+
+	timeline_.ring = timeline_ring_create(n_points, TIMELINE_RING_DESCS);
+	if (!timeline_.ring) {
+		weston_log("Cannot allocate timeline ring of %u points\n",
+			   n_points);
+		return;
+	}
+
+	timeline_.ring_destroy_listener.notify = timeline_ring_notify_destroy;
+	wl_signal_add(&compositor->destroy_signal,
+		      &timeline_.ring_destroy_listener);
+
+	if (++timeline_.series == 0)
+		++timeline_.series;
+
+	weston_timeline_enabled_ |= WESTON_TIMELINE_RING;
+	weston_log("Timeline flight recorder keeps the last %u points.\n",
+		   n_points);
+}
+
+WL_EXPORT void
+weston_timeline_close_ring(void)
+{
+	if (!timeline_.ring)
+		return;
+
+	weston_timeline_enabled_ &= ~WESTON_TIMELINE_RING;
+
+	wl_list_remove(&timeline_.ring_destroy_listener.link);
+
+	timeline_ring_destroy(timeline_.ring);
+	timeline_.ring = NULL;
+}
+
+struct timeline_flush {
+	struct timeline_ring *ring;
+	FILE *file;
+};
+
+static void *
+timeline_flush_thread(void *data)
+{
+	struct timeline_flush *flush = data;
+	char *dump;
+	size_t size;
+
+	/* Failures only cost us the dump, and there is no one to tell */
+	if (timeline_ring_serialize(flush->ring, &dump, &size) == 0) {
+		fwrite(dump, 1, size, flush->file);
+		free(dump);
+	}
+
+	fclose(flush->file);
+	timeline_ring_destroy(flush->ring);
+	free(flush);
+
+	__atomic_store_n(&timeline_.flushing, 0, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/** Write the in-memory timeline to a file
+ *
+ * \param reason Logged with the file name.
+ *
+ * Copies the ring and leaves the writing to a thread of its own, so this
+ * is cheap enough to call when a frame was just missed. Dumps are limited
+ * to one per second, and one at a time.
+ */
+WL_EXPORT void
+weston_timeline_flush(const char *reason)
+{
+	const char *prefix = "weston-timeline-";
+	const char *suffix = ".bin";
+	struct timeline_flush *flush;
+	struct timespec now;
+	pthread_attr_t attr;
+	pthread_t thread;
+	char fname[1000];
+	int ret;
+
+	if (!timeline_.ring)
+		return;
+
+	clock_gettime(timeline_.clk_id, &now);
+	if (!timespec_is_zero(&timeline_.last_flush) &&
+	    timespec_sub_to_nsec(&now, &timeline_.last_flush) <
+	    TIMELINE_FLUSH_INTERVAL_NSEC)
+		return;
+
+	if (__atomic_load_n(&timeline_.flushing, __ATOMIC_ACQUIRE))
+		return;
+
+	flush = zalloc(sizeof *flush);
+	if (!flush)
+		return;
+
+	flush->ring = timeline_ring_copy(timeline_.ring);
+	if (!flush->ring) {
+		free(flush);
+		return;
+	}
+
+	flush->file = file_create_dated(NULL, prefix, suffix,
+					fname, sizeof(fname));
+	if (!flush->file) {
+		weston_log("Cannot open '%s*%s' for writing: %s\n",
+			   prefix, suffix, strerror(errno));
+		timeline_ring_destroy(flush->ring);
+		free(flush);
+		return;
+	}
+
+	timeline_.last_flush = now;
+	timeline_.flushing = 1;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread, &attr, timeline_flush_thread, flush);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		weston_log("Cannot start timeline writer: %s\n",
+			   strerror(ret));
+		timeline_flush_thread(flush);
+		return;
+	}
+
+	weston_log("Writing timeline to '%s' (%s)\n", fname, reason);
+}
+
 struct timeline_emit_context {
 	FILE *cur;
 	FILE *out;
@@ -243,6 +411,115 @@ emit_gpu_timestamp(struct timeline_emit_context *ctx, void *obj)
 	return 1;
 }
 
+static struct timeline_ring_desc *
+ring_add_desc(uint64_t timestamp)
+{
+	struct timeline_ring_desc *desc;
+
+	/* Every half lap, have everything describe itself again, so that
+	 * objects still in use are never without a description */
+	if (timeline_.ring->descs_written % (TIMELINE_RING_DESCS / 2) ==
+	    TIMELINE_RING_DESCS / 2 - 1) {
+		if (++timeline_.series == 0)
+			++timeline_.series;
+	}
+
+	desc = timeline_ring_add_desc(timeline_.ring);
+	desc->timestamp = timestamp;
+
+	return desc;
+}
+
+static void
+ring_describe_output(struct timeline_emit_context *ctx,
+		     struct weston_output *o, uint64_t timestamp)
+{
+	struct timeline_ring_desc *desc;
+
+	if (!check_series(ctx, &o->timeline))
+		return;
+
+	desc = ring_add_desc(timestamp);
+	desc->id = o->timeline.id;
+	desc->type = TLT_OUTPUT;
+	desc->main_surface = 0;
+	snprintf(desc->desc, sizeof desc->desc, "%s", o->name ? o->name : "");
+}
+
+static void
+ring_describe_surface(struct timeline_emit_context *ctx,
+		      struct weston_surface *s, uint64_t timestamp)
+{
+	struct timeline_ring_desc *desc;
+	struct weston_surface *mains;
+
+	if (!check_series(ctx, &s->timeline))
+		return;
+
+	mains = weston_surface_get_main_surface(s);
+	if (mains != s)
+		ring_describe_surface(ctx, mains, timestamp);
+
+	desc = ring_add_desc(timestamp);
+	desc->id = s->timeline.id;
+	desc->type = TLT_SURFACE;
+	desc->main_surface = mains != s ? mains->timeline.id : 0;
+	if (!s->get_label ||
+	    s->get_label(s, desc->desc, sizeof desc->desc) < 0)
+		desc->desc[0] = '\0';
+}
+
+/* No formatting here, that is left to the converter */
+static void
+ring_point(const struct timespec *ts, const char *name, va_list argp)
+{
+	struct timeline_emit_context ctx = { NULL, NULL, timeline_.series };
+	struct timeline_ring_point *p;
+	struct weston_output *o;
+	struct weston_surface *s;
+	enum timeline_type otype;
+	uint64_t timestamp = timespec_to_nsec(ts);
+	void *obj;
+	int i = 0;
+
+	p = timeline_ring_add_point(timeline_.ring);
+	p->timestamp = timestamp;
+	p->name = name;
+
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		if (i == TIMELINE_RING_MAX_ARGS)
+			continue;
+
+		switch (otype) {
+		case TLT_OUTPUT:
+			o = obj;
+			ring_describe_output(&ctx, o, timestamp);
+			p->value[i] = o->timeline.id;
+			break;
+		case TLT_SURFACE:
+			s = obj;
+			ring_describe_surface(&ctx, s, timestamp);
+			p->value[i] = s->timeline.id;
+			break;
+		case TLT_VBLANK:
+		case TLT_GPU:
+			p->value[i] = timespec_to_nsec(obj);
+			break;
+		default:
+			continue;
+		}
+		p->type[i++] = otype;
+	}
+
+	for (; i <= TIMELINE_RING_MAX_ARGS; i++)
+		p->type[i] = TLT_END;
+}
+
 typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
 
 static const type_func type_dispatch[] = {
@@ -264,6 +541,13 @@ weston_timeline_point(const char *name, ...)
 
 	clock_gettime(timeline_.clk_id, &ts);
 
+	if (!(weston_timeline_enabled_ & WESTON_TIMELINE_LOG)) {
+		va_start(argp, name);
+		ring_point(&ts, name, argp);
+		va_end(argp);
+		return;
+	}
+
 	ctx.out = timeline_.file;
 	ctx.cur = fmemopen(buf, sizeof(buf), "w");
 	ctx.series = timeline_.series;
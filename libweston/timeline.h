@@ -27,6 +27,12 @@
 #ifndef WESTON_TIMELINE_H
 #define WESTON_TIMELINE_H
 
+#include <stdint.h>
+
+/* Where the points go, the log file taking precedence */
+#define WESTON_TIMELINE_LOG (1 << 0)
+#define WESTON_TIMELINE_RING (1 << 1)
+
 extern int weston_timeline_enabled_;
 
 struct weston_compositor;
@@ -37,6 +43,16 @@ weston_timeline_open(struct weston_compositor *compositor);
 void
 weston_timeline_close(void);
 
+void
+weston_timeline_open_ring(struct weston_compositor *compositor,
+			  uint32_t n_points);
+
+void
+weston_timeline_close_ring(void);
+
+void
+weston_timeline_flush(const char *reason);
+
 enum timeline_type {
 	TLT_END = 0,
 	TLT_OUTPUT,
@@ -30,53 +30,61 @@
  *-----------------------------------------------------------------------------
  */
 
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "compositor.h"
 #include "trace-reporter.h"
 #include "trace-reporter-server-protocol.h"
 
-TRACING_DECLARATIONS;
+/* First version whose clients know the upload repaint stages. Defined
+ * here because the wayland-scanner of the oldest wayland we build
+ * against (1.12) emits no *_SINCE_VERSION macros for enum entries */
+#define TRACE_REPORTER_UPLOAD_STAGES_VERSION 4
 
-/*
- * clear_log()
- *
- * Clears the tracing log data by setting start = end = 0.  This may be called
- * upon completion of either an event log or a stdout log if requested.
- *
- * Note that actual messages/timing information won't be cleared from the
- * log array, so this won't disrupt inspection of the log via an attached
- * gdb session.
- */
-static void
-clear_log(void)
-{
-    *__tstart = *__tend = 0;
-}
+/* A binary report being written out as the fd allows */
+struct binary_report {
+	struct wl_resource *resource;
+	struct wl_listener resource_destroy_listener;
+	struct wl_event_source *source;
+	int fd;
+	char *data;
+	size_t size, written;
+};
 
 /*
  * event_report()
  *
  * Send tracing report information via protocol events to the client.
+ * Entries carrying an id or counter value are reported by message only.
  */
 static void
 event_report(struct wl_client *client,
 		struct wl_resource *r,
 		uint32_t clear)
 {
-    unsigned int i;
-
-    for (i = *__tstart; i != *__tend; i++, i %= TRACE_BUFFER_SIZE) {
-	trace_reporter_send_tracepoint(r,
-		__trace_log[i].msg,
-		__trace_log[i].timestamp.tv_sec,
-		__trace_log[i].timestamp.tv_usec);
-    }
+	struct trace_snapshot snap;
+	uint64_t ts;
+	uint32_t i;
 
-    /* Send a completion event to let clients know we reached the end */
-    trace_reporter_send_trace_end(r);
+	if (trace_ring_snapshot(&snap, clear) == 0) {
+		for (i = 0; i < snap.n_records; i++) {
+			ts = snap.records[i].entry.timestamp;
+			trace_reporter_send_tracepoint(r,
+				snap.records[i].entry.msg,
+				ts / 1000000000,
+				(ts % 1000000000) / 1000);
+		}
+		trace_snapshot_release(&snap);
+	}
 
-    if (clear) {
-	clear_log();
-    }
+	/* Send a completion event to let clients know we reached the end */
+	trace_reporter_send_trace_end(r);
 }
 
 /*
@@ -89,48 +97,261 @@ stdout_report(struct wl_client *client,
 		struct wl_resource *r,
 		uint32_t clear)
 {
-    unsigned int i;
-	unsigned long lastsec, lastusec;
-	unsigned long firstsec, firstusec;
-	unsigned long cursec, curusec;
-	const char *msg;
+	struct trace_snapshot snap;
+	struct trace_record *rec;
+	uint64_t first, last;
+	uint32_t i;
+
+	if (trace_ring_snapshot(&snap, clear) < 0) {
+		return;
+	}
 
 	/* Set time since last event to timestamp of first event */
-	lastsec  = firstsec  = __trace_log[*__tstart].timestamp.tv_sec;
-	lastusec = firstusec = __trace_log[*__tstart].timestamp.tv_usec;
-
-	printf("   Time  Cumulative  Event\n");
-	printf("=======  ==========  ===========================================================\n");
-	for (i = *__tstart; i != *__tend; i++, i %= TRACE_BUFFER_SIZE) {
-		cursec  = __trace_log[i].timestamp.tv_sec;
-		curusec = __trace_log[i].timestamp.tv_usec;
-		msg     = __trace_log[i].msg;
-
-		if (curusec < lastusec) {
-			curusec += 1000000;
-			cursec--;
-		}
+	first = last = snap.n_records ? snap.records[0].entry.timestamp : 0;
+
+	printf("   Time  Cumulative  Thread           Event\n");
+	printf("=======  ==========  ===============  ==============================================\n");
+	for (i = 0; i < snap.n_records; i++) {
+		rec = &snap.records[i];
 
 		/* Print times rounded to ms */
-		printf("%3lu.%03lu     %3lu.%03lu  %s\n",
-				(cursec - lastsec),
-				(curusec - lastusec + 500) / 1000,
-				(cursec - firstsec),
-				(curusec - firstusec + 500) / 1000,
-				msg);
-
-		if (curusec >= 1000000) {
-			curusec -= 1000000;
-			cursec++;
+		printf("%3lu.%03lu     %3lu.%03lu  %-15.15s  %s",
+				(unsigned long)((rec->entry.timestamp - last) / 1000000000),
+				(unsigned long)(((rec->entry.timestamp - last) % 1000000000 + 500000) / 1000000),
+				(unsigned long)((rec->entry.timestamp - first) / 1000000000),
+				(unsigned long)(((rec->entry.timestamp - first) % 1000000000 + 500000) / 1000000),
+				snap.threads[rec->thread].name,
+				rec->entry.msg);
+
+		if (rec->entry.kind == TRACE_KIND_COUNTER) {
+			printf(" = %lld", (long long)rec->entry.value);
 		}
+		if (rec->entry.id) {
+			printf(" (%u)", rec->entry.id);
+		}
+		printf("\n");
 
-		lastsec = cursec;
-		lastusec = curusec;
+		last = rec->entry.timestamp;
 	}
 
-	if (clear) {
-		clear_log();
+	for (i = 0; i < snap.n_threads; i++) {
+		if (snap.threads[i].dropped) {
+			printf("%u entries dropped on thread %u (%s)\n",
+					snap.threads[i].dropped,
+					snap.threads[i].tid,
+					snap.threads[i].name);
+		}
 	}
+
+	trace_snapshot_release(&snap);
+}
+
+
+static void
+binary_report_destroy(struct binary_report *report)
+{
+	wl_list_remove(&report->resource_destroy_listener.link);
+	if (report->source) {
+		wl_event_source_remove(report->source);
+	}
+	close(report->fd);
+	free(report->data);
+	free(report);
+}
+
+static void
+binary_report_resource_destroyed(struct wl_listener *listener, void *data)
+{
+	struct binary_report *report =
+		container_of(listener, struct binary_report,
+				resource_destroy_listener);
+
+	binary_report_destroy(report);
+}
+
+static int
+binary_report_write(int fd, uint32_t mask, void *data)
+{
+	struct binary_report *report = data;
+	ssize_t ret;
+
+	while (report->written < report->size) {
+		ret = write(report->fd, report->data + report->written,
+				report->size - report->written);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0 && errno == EAGAIN) {
+			/* Wait for the reader to catch up */
+			return 0;
+		}
+		if (ret <= 0) {
+			weston_log("trace reporter: write failed: %m\n");
+			break;
+		}
+		report->written += ret;
+	}
+
+	trace_reporter_send_trace_end(report->resource);
+	binary_report_destroy(report);
+
+	return 0;
+}
+
+/*
+ * binary_report()
+ *
+ * Write the tracing log to a client-provided fd in one go, rather than an
+ * event per entry.  The dump is streamed from the event loop, so a slow
+ * reader on the other end of a pipe doesn't stall the compositor.
+ */
+static void
+binary_report(struct wl_client *client,
+		struct wl_resource *r,
+		int32_t fd,
+		uint32_t clear)
+{
+	struct weston_compositor *compositor = wl_resource_get_user_data(r);
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+	struct binary_report *report;
+	struct trace_snapshot snap;
+	int ret;
+
+	report = zalloc(sizeof *report);
+	if (!report) {
+		close(fd);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	report->resource = r;
+	report->fd = fd;
+	report->resource_destroy_listener.notify =
+		binary_report_resource_destroyed;
+	wl_resource_add_destroy_listener(r, &report->resource_destroy_listener);
+
+	if (trace_ring_snapshot(&snap, clear) < 0) {
+		binary_report_destroy(report);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	ret = trace_snapshot_serialize(&snap, &report->data, &report->size);
+	trace_snapshot_release(&snap);
+	if (ret < 0) {
+		binary_report_destroy(report);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	report->source = wl_event_loop_add_fd(loop, fd, WL_EVENT_WRITABLE,
+			binary_report_write, report);
+	if (!report->source) {
+		binary_report_destroy(report);
+		wl_client_post_no_memory(client);
+	}
+}
+
+
+static void
+send_histogram(struct wl_resource *r,
+		const char *name,
+		uint32_t stage,
+		const struct weston_histogram *h)
+{
+	struct wl_array buckets;
+
+	wl_array_init(&buckets);
+	if (!wl_array_add(&buckets, sizeof h->buckets)) {
+		wl_client_post_no_memory(wl_resource_get_client(r));
+		return;
+	}
+	memcpy(buckets.data, h->buckets, sizeof h->buckets);
+
+	trace_reporter_send_histogram(r, name, stage, h->count, h->min, h->max,
+			h->count ? h->sum / h->count : 0,
+			weston_histogram_percentile(h, 50),
+			weston_histogram_percentile(h, 90),
+			weston_histogram_percentile(h, 99),
+			&buckets);
+
+	wl_array_release(&buckets);
+}
+
+/*
+ * repaint_stats()
+ *
+ * Report the repaint stage histograms and counters of every output, and
+ * the present latency of every mapped surface.
+ */
+static void
+repaint_stats(struct wl_client *client,
+		struct wl_resource *r,
+		uint32_t clear)
+{
+	struct weston_compositor *compositor = wl_resource_get_user_data(r);
+	struct weston_output *output;
+	struct weston_view *view;
+	struct weston_surface *surface;
+	struct weston_repaint_stats *stats;
+	char name[128];
+	uint32_t stage;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		stats = &output->repaint_stats;
+
+		trace_reporter_send_output_stats(r, output->name,
+				stats->frames,
+				stats->missed_vblank,
+				stats->over_budget);
+		for (stage = 0; stage < WESTON_REPAINT_STAGE_COUNT; stage++) {
+			send_histogram(r, output->name, stage,
+					&stats->stage[stage]);
+		}
+		/* Older clients don't know these stages */
+		if (wl_resource_get_version(r) >=
+				TRACE_REPORTER_UPLOAD_STAGES_VERSION) {
+			send_histogram(r, output->name,
+					TRACE_REPORTER_REPAINT_STAGE_UPLOAD,
+					&stats->upload);
+			send_histogram(r, output->name,
+					TRACE_REPORTER_REPAINT_STAGE_UPLOAD_SIZE,
+					&stats->upload_size);
+		}
+
+		if (clear) {
+			weston_repaint_stats_reset(stats);
+		}
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		surface = view->surface;
+
+		/* Once per surface, however many views it has */
+		if (surface->views.next != &view->surface_link ||
+		    surface->present_latency.histogram.count == 0) {
+			continue;
+		}
+
+		if (!surface->get_label ||
+		    surface->get_label(surface, name, sizeof name) < 0) {
+			snprintf(name, sizeof name, "wl_surface@%u",
+				 surface->resource ?
+				 wl_resource_get_id(surface->resource) : 0);
+		}
+
+		send_histogram(r, name,
+				TRACE_REPORTER_REPAINT_STAGE_PRESENT_LATENCY,
+				&surface->present_latency.histogram);
+
+		if (clear) {
+			weston_histogram_reset(
+				&surface->present_latency.histogram);
+		}
+	}
+
+	trace_reporter_send_trace_end(r);
 }
 
 
@@ -161,6 +382,8 @@ static const struct trace_reporter_interface trace_reporter_implementation = {
 	event_report,
 	stdout_report,
 	log_tracepoint,
+	binary_report,
+	repaint_stats,
 };
 
 
@@ -176,7 +399,8 @@ bind_trace_reporter(struct wl_client *client,
 		uint32_t id)
 {
 	struct wl_resource *resource;
-	resource = wl_resource_create(client, &trace_reporter_interface, 1, id);
+	resource = wl_resource_create(client, &trace_reporter_interface,
+			MIN(version, 4), id);
 	if (resource) {
 		wl_resource_set_implementation(resource,
 				&trace_reporter_implementation, data, NULL);
@@ -194,12 +418,10 @@ int wet_module_init(struct weston_compositor *compositor,
 WL_EXPORT int wet_module_init(struct weston_compositor *compositor,
 			int *argc, char *argv[])
 {
-	TRACING_MODULE_INIT();
-
 	/* Expose the tracing_manager interface to clients */
 	if (!wl_global_create(compositor->wl_display,
 				&trace_reporter_interface,
-				1,
+				4,
 				compositor,
 				bind_trace_reporter)) {
 		weston_log("Failed to add global trace reporter object!\n");
@@ -36,27 +36,24 @@
 #include "config.h"
 
 
+#include "trace-ring.h"
+
 /*
  * Lightweight tracing support.
  *
  * We want the ability to measure timing information about various components
  * of compositor startup while having a minimal impact on the actual startup
  * time.  We support low-overhead tracepoints by just storing a pointer to
- * a string literal and a timestamp into a fixed size circular buffer.  This
- * circular buffer behaves similarly to dmesg; if too much tracing information
- * is stored, the older entries are replaced by new ones.
+ * a string literal, a CLOCK_MONOTONIC timestamp and optionally an id or a
+ * counter value into a fixed size circular buffer of the calling thread
+ * (see trace-ring.h), so tracepoints can be hit from any thread.  Once a
+ * thread's buffer is full, further entries are dropped and counted until
+ * the log is cleared.
  *
  * It is expected that this tracing information will be analyzed later
  * (either via a loaded weston module or manually via gdb) to determine
  * bottlenecks in system startup.
  */
-struct trace_info {
-	const char *msg;
-	struct timeval timestamp;
-};
-
-extern struct trace_info *__trace_log;
-extern unsigned int *__tstart, *__tend;
 
 /*
  * TRACEPOINT()
@@ -68,20 +65,56 @@ static inline void
 TRACEPOINT(const char *msg)
 {
 #ifdef ENABLE_TRACING
-	__trace_log[*__tend].msg = msg;
-	gettimeofday(&__trace_log[*__tend].timestamp, NULL);
+	trace_ring_record(msg, TRACE_KIND_INSTANT, 0, 0);
+#endif
+}
+
+/*
+ * TRACEPOINT_ID()
+ *
+ * Like TRACEPOINT(), with the id of the object (surface, output, frame...)
+ * the event is about.
+ */
+static inline void
+TRACEPOINT_ID(const char *msg, uint32_t id)
+{
+#ifdef ENABLE_TRACING
+	trace_ring_record(msg, TRACE_KIND_INSTANT, id, 0);
+#endif
+}
+
+/*
+ * TRACE_BEGIN() / TRACE_END()
+ *
+ * Mark the start and end of an operation on the calling thread.  Both ends
+ * should use the same message.
+ */
+static inline void
+TRACE_BEGIN(const char *msg, uint32_t id)
+{
+#ifdef ENABLE_TRACING
+	trace_ring_record(msg, TRACE_KIND_BEGIN, id, 0);
+#endif
+}
 
-	(*__tend)++;
-	(*__tend) %= TRACE_BUFFER_SIZE;
+static inline void
+TRACE_END(const char *msg, uint32_t id)
+{
+#ifdef ENABLE_TRACING
+	trace_ring_record(msg, TRACE_KIND_END, id, 0);
+#endif
+}
 
-	/*
-	 * If we've filled the buffer, each new entry replaces the oldest
-	 * entry in the buffer.
-	 */
-	if (*__tend == *__tstart) {
-		(*__tstart)++;
-		(*__tstart) %= TRACE_BUFFER_SIZE;
-	}
+/*
+ * TRACE_COUNTER()
+ *
+ * Records a sample of a counter, such as a queue depth.
+ */
+static inline void
+TRACE_COUNTER(const char *msg, uint32_t id, int64_t value)
+{
+#ifdef ENABLE_TRACING
+	trace_ring_record(msg, TRACE_KIND_COUNTER, id, value);
 #endif
 }
 
@@ -99,32 +132,4 @@ TRACEPOINT(const char *msg)
 	}                                                \
 }
 
-/*
- * TRACING_MODULE_DECLARATIONS
- *
- * Should be placed in the global variable section of any module
- * dlopen()'d by weston that wants to make use of the tracepoint
- * framework.  Provides local pointers for the compositor's
- * global symbols.
- */
-#define TRACING_DECLARATIONS        \
-	struct trace_info *__trace_log; \
-	unsigned int *__tstart, *__tend;
-
-/*
- * TRACING_MODULE_INIT()
- *
- * Should be called by any weston module using tracepoints, before
- * the first TRACEPOINT() call is hit.
- */
-#define TRACING_MODULE_INIT() {                                   \
-	void *thisprog = dlopen(NULL, RTLD_LAZY | RTLD_GLOBAL);       \
-	__tstart = (unsigned int *)dlsym(thisprog, "__trace_start");  \
-	assert(__tstart);                                             \
-	__tend = (unsigned int *)dlsym(thisprog, "__trace_end");      \
-	assert(__tend);                                               \
-	__trace_log = dlsym(thisprog, "__trace_buffer");              \
-	assert(__trace_log);                                          \
-}
-
 #endif //_WAYLAND_TRACE_REPORTER_H_
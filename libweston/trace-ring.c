@@ -0,0 +1,405 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include <wayland-util.h>
+
+#include "trace-ring.h"
+
+/* Entries per thread, one of which is always kept free */
+#if defined(TRACE_BUFFER_SIZE) && TRACE_BUFFER_SIZE > 1
+#define TRACE_RING_SIZE TRACE_BUFFER_SIZE
+#else
+#define TRACE_RING_SIZE 1024
+#endif
+
+struct trace_ring {
+	struct trace_entry entries[TRACE_RING_SIZE];
+	unsigned int head;	/* next entry to write, owning thread only */
+	unsigned int tail;	/* oldest entry, reader only */
+	unsigned int dropped;
+	int owned;
+
+	uint32_t tid;
+	char name[16];
+
+	/* Rings are never freed, so the list only ever grows at its head */
+	struct trace_ring *next;
+};
+
+static struct trace_ring *rings;
+static __thread struct trace_ring *thread_ring;
+
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+
+static void
+ring_release(void *data)
+{
+	struct trace_ring *ring = data;
+
+	__atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void
+ring_key_create(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+static unsigned int
+ring_count(unsigned int head, unsigned int tail)
+{
+	return (head + TRACE_RING_SIZE - tail) % TRACE_RING_SIZE;
+}
+
+/* Takes over the ring of an exited thread, if it has been read empty. */
+static struct trace_ring *
+ring_claim_unowned(void)
+{
+	struct trace_ring *ring;
+	int unowned;
+
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	     ring; ring = ring->next) {
+		if (ring_count(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+			       __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)))
+			continue;
+
+		unowned = 0;
+		if (__atomic_compare_exchange_n(&ring->owned, &unowned, 1, 0,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			return ring;
+	}
+
+	return NULL;
+}
+
+static struct trace_ring *
+ring_claim(void)
+{
+	struct trace_ring *ring, *head;
+
+	pthread_once(&ring_key_once, ring_key_create);
+
+	ring = ring_claim_unowned();
+	if (!ring) {
+		ring = calloc(1, sizeof *ring);
+		if (!ring)
+			return NULL;
+
+		ring->owned = 1;
+		head = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+		do {
+			ring->next = head;
+		} while (!__atomic_compare_exchange_n(&rings, &head, ring, 0,
+						      __ATOMIC_RELEASE,
+						      __ATOMIC_RELAXED));
+	}
+
+	ring->tid = syscall(SYS_gettid);
+	memset(ring->name, 0, sizeof ring->name);
+	prctl(PR_GET_NAME, ring->name);
+	pthread_setspecific(ring_key, ring);
+
+	return ring;
+}
+
+WL_EXPORT void
+trace_ring_record(const char *msg, enum trace_kind kind, uint32_t id,
+		  int64_t value)
+{
+	struct trace_ring *ring = thread_ring;
+	struct trace_entry *entry;
+	struct timespec ts;
+	unsigned int head, next;
+
+	if (!ring) {
+		ring = thread_ring = ring_claim();
+		if (!ring)
+			return;
+	}
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	next = (head + 1) % TRACE_RING_SIZE;
+	if (next == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	entry = &ring->entries[head];
+	entry->timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	entry->msg = msg;
+	entry->kind = kind;
+	entry->id = id;
+	entry->value = value;
+
+	__atomic_store_n(&ring->head, next, __ATOMIC_RELEASE);
+}
+
+struct ring_cursor {
+	struct trace_ring *ring;
+	unsigned int pos, end;
+	uint32_t thread;
+};
+
+WL_EXPORT int
+trace_ring_snapshot(struct trace_snapshot *snap, int clear)
+{
+	struct trace_ring *first, *ring;
+	struct ring_cursor *cursors, *c, *next;
+	unsigned int n_rings = 0, n_cursors = 0, total = 0, i;
+
+	memset(snap, 0, sizeof *snap);
+
+	/* Rings added from here on aren't part of the snapshot */
+	first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	for (ring = first; ring; ring = ring->next)
+		n_rings++;
+
+	if (n_rings == 0)
+		return 0;
+
+	cursors = calloc(n_rings, sizeof *cursors);
+	snap->threads = calloc(n_rings, sizeof *snap->threads);
+	if (!cursors || !snap->threads)
+		goto err;
+
+	for (ring = first; ring; ring = ring->next) {
+		unsigned int dropped;
+
+		c = &cursors[n_cursors];
+		c->ring = ring;
+		c->pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		c->end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		if (clear)
+			dropped = __atomic_exchange_n(&ring->dropped, 0,
+						      __ATOMIC_RELAXED);
+		else
+			dropped = __atomic_load_n(&ring->dropped,
+						  __ATOMIC_RELAXED);
+
+		if (c->pos == c->end && dropped == 0)
+			continue;
+
+		c->thread = snap->n_threads++;
+		snap->threads[c->thread].tid = ring->tid;
+		snap->threads[c->thread].dropped = dropped;
+		memcpy(snap->threads[c->thread].name, ring->name,
+		       sizeof ring->name);
+
+		total += ring_count(c->end, c->pos);
+		n_cursors++;
+	}
+
+	if (total > 0) {
+		snap->records = calloc(total, sizeof *snap->records);
+		if (!snap->records)
+			goto err;
+	}
+
+	/* Each ring is in order already; merge them */
+	while (snap->n_records < total) {
+		next = NULL;
+		for (i = 0; i < n_cursors; i++) {
+			c = &cursors[i];
+			if (c->pos == c->end)
+				continue;
+			if (!next || c->ring->entries[c->pos].timestamp <
+				     next->ring->entries[next->pos].timestamp)
+				next = c;
+		}
+
+		snap->records[snap->n_records].entry =
+			next->ring->entries[next->pos];
+		snap->records[snap->n_records].thread = next->thread;
+		snap->n_records++;
+		next->pos = (next->pos + 1) % TRACE_RING_SIZE;
+	}
+
+	if (clear) {
+		for (i = 0; i < n_cursors; i++)
+			__atomic_store_n(&cursors[i].ring->tail, cursors[i].end,
+					 __ATOMIC_RELEASE);
+	}
+
+	free(cursors);
+	return 0;
+
+err:
+	free(cursors);
+	trace_snapshot_release(snap);
+	return -1;
+}
+
+WL_EXPORT void
+trace_snapshot_release(struct trace_snapshot *snap)
+{
+	free(snap->threads);
+	free(snap->records);
+	memset(snap, 0, sizeof *snap);
+}
+
+struct string_table {
+	const char **keys;
+	uint32_t *index;
+	uint32_t size;
+	uint32_t count;
+};
+
+/* Messages are string literals, so they are told apart by address */
+static uint32_t
+string_table_lookup(struct string_table *table, const char *msg)
+{
+	uint32_t mask = table->size - 1;
+	uint32_t slot = ((uintptr_t)msg >> 3) * 2654435761u & mask;
+
+	while (table->keys[slot] && table->keys[slot] != msg)
+		slot = (slot + 1) & mask;
+
+	if (!table->keys[slot]) {
+		table->keys[slot] = msg;
+		table->index[slot] = table->count++;
+	}
+
+	return table->index[slot];
+}
+
+WL_EXPORT int
+trace_snapshot_serialize(const struct trace_snapshot *snap,
+			 char **data, size_t *size)
+{
+	struct string_table table = { 0 };
+	struct trace_dump_header header;
+	struct trace_dump_thread *thread;
+	const char **strings;
+	uint32_t *event_strings;
+	size_t len;
+	char *p;
+	uint32_t i;
+
+	table.size = 16;
+	while (table.size < snap->n_records * 2)
+		table.size <<= 1;
+	table.keys = calloc(table.size, sizeof *table.keys);
+	table.index = calloc(table.size, sizeof *table.index);
+	event_strings = calloc(snap->n_records + 1, sizeof *event_strings);
+	if (!table.keys || !table.index || !event_strings)
+		goto err;
+
+	for (i = 0; i < snap->n_records; i++)
+		event_strings[i] = string_table_lookup(&table,
+						snap->records[i].entry.msg);
+
+	strings = calloc(table.count + 1, sizeof *strings);
+	if (!strings)
+		goto err;
+	for (i = 0; i < table.size; i++) {
+		if (table.keys[i])
+			strings[table.index[i]] = table.keys[i];
+	}
+
+	*size = sizeof header +
+		snap->n_threads * sizeof(struct trace_dump_thread) +
+		snap->n_records * sizeof(struct trace_dump_event);
+	for (i = 0; i < table.count; i++)
+		*size += sizeof(uint32_t) + strlen(strings[i]);
+
+	*data = malloc(*size);
+	if (!*data) {
+		free(strings);
+		goto err;
+	}
+	p = *data;
+
+	memcpy(header.magic, TRACE_DUMP_MAGIC, sizeof header.magic);
+	header.version = TRACE_DUMP_VERSION;
+	header.n_threads = snap->n_threads;
+	header.n_strings = table.count;
+	header.n_events = snap->n_records;
+	memcpy(p, &header, sizeof header);
+	p += sizeof header;
+
+	for (i = 0; i < snap->n_threads; i++) {
+		thread = (struct trace_dump_thread *)p;
+		thread->tid = snap->threads[i].tid;
+		thread->dropped = snap->threads[i].dropped;
+		memcpy(thread->name, snap->threads[i].name,
+		       sizeof thread->name);
+		p += sizeof *thread;
+	}
+
+	for (i = 0; i < table.count; i++) {
+		uint32_t length;
+
+		len = strlen(strings[i]);
+		length = len;
+		memcpy(p, &length, sizeof length);
+		p += sizeof length;
+		memcpy(p, strings[i], len);
+		p += len;
+	}
+
+	for (i = 0; i < snap->n_records; i++) {
+		struct trace_dump_event ev;
+		const struct trace_entry *entry = &snap->records[i].entry;
+
+		ev.timestamp = entry->timestamp;
+		ev.value = entry->value;
+		ev.thread = snap->records[i].thread;
+		ev.string = event_strings[i];
+		ev.kind = entry->kind;
+		ev.id = entry->id;
+		/* Strings leave events unaligned */
+		memcpy(p, &ev, sizeof ev);
+		p += sizeof ev;
+	}
+
+	free(strings);
+	free(event_strings);
+	free(table.keys);
+	free(table.index);
+	return 0;
+
+err:
+	free(event_strings);
+	free(table.keys);
+	free(table.index);
+	return -1;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _TRACE_RING_H_
+#define _TRACE_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Per-thread trace rings.
+ *
+ * Every thread that records a tracepoint gets a ring of its own, so
+ * recording takes no locks: the thread is the only writer of its ring and
+ * whoever reports the trace is the only reader. A full ring drops new
+ * entries and counts them, rather than overwriting entries a reader may
+ * be looking at. Rings of threads that exited are handed to new threads.
+ *
+ * This file doesn't depend on the rest of libweston.
+ */
+
+enum trace_kind {
+	TRACE_KIND_INSTANT,
+	TRACE_KIND_BEGIN,
+	TRACE_KIND_END,
+	TRACE_KIND_COUNTER,
+};
+
+struct trace_entry {
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, ns */
+	const char *msg;	/* string literal */
+	uint32_t kind;
+	uint32_t id;		/* surface, output, frame... */
+	int64_t value;		/* counter value */
+};
+
+/* Records an entry in the calling thread's ring. */
+void
+trace_ring_record(const char *msg, enum trace_kind kind, uint32_t id,
+		  int64_t value);
+
+struct trace_thread {
+	uint32_t tid;
+	uint32_t dropped;
+	char name[16];
+};
+
+struct trace_record {
+	struct trace_entry entry;
+	uint32_t thread;	/* index into trace_snapshot.threads */
+};
+
+/* All rings, merged in timestamp order */
+struct trace_snapshot {
+	struct trace_thread *threads;
+	uint32_t n_threads;
+	struct trace_record *records;
+	uint32_t n_records;
+};
+
+/*
+ * Copies the recorded entries out of all rings. With clear set, they are
+ * removed from the rings. Only one thread may take snapshots at a time.
+ */
+int
+trace_ring_snapshot(struct trace_snapshot *snap, int clear);
+void
+trace_snapshot_release(struct trace_snapshot *snap);
+
+/*
+ * Binary dump of a snapshot, in host byte order:
+ *
+ *   struct trace_dump_header
+ *   struct trace_dump_thread		x n_threads
+ *   uint32_t length, char[length]	x n_strings
+ *   struct trace_dump_event		x n_events
+ *
+ * Events refer to threads and strings by index.
+ */
+#define TRACE_DUMP_MAGIC "WTRACE\0\0"
+#define TRACE_DUMP_VERSION 1
+
+struct trace_dump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_threads;
+	uint32_t n_strings;
+	uint32_t n_events;
+};
+
+struct trace_dump_thread {
+	uint32_t tid;
+	uint32_t dropped;
+	char name[16];
+};
+
+struct trace_dump_event {
+	uint64_t timestamp;
+	int64_t value;
+	uint32_t thread;
+	uint32_t string;
+	uint32_t kind;
+	uint32_t id;
+};
+
+/* Serializes a snapshot into a newly allocated buffer. */
+int
+trace_snapshot_serialize(const struct trace_snapshot *snap,
+			 char **data, size_t *size);
+
+#endif /* _TRACE_RING_H_ */
@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "vm-delta.h"
+
+void vm_delta_encoder_begin(struct vm_delta_encoder *enc,
+			    int keyframe_interval,
+			    struct vm_delta_header *delta)
+{
+	delta->flags = 0;
+	delta->base_counter = enc->header.counter;
+	delta->n_records = 0;
+
+	if (enc->force_keyframe ||
+	    enc->frames_since_keyframe + 1 >= keyframe_interval)
+		delta->flags |= VM_DELTA_KEYFRAME;
+}
+
+int vm_delta_encoder_changed(const struct vm_delta_encoder *enc,
+			     const struct vm_delta_header *delta,
+			     const struct vm_buffer_info *info)
+{
+	int slot = info->surf_index;
+
+	if (delta->flags & VM_DELTA_KEYFRAME)
+		return 1;
+
+	if (slot < 0 || slot >= VM_DELTA_MAX_BUFFERS)
+		return 0;
+
+	if (slot >= enc->header.n_buffers)
+		return 1;
+
+	return memcmp(&enc->table[slot], info, sizeof(*info)) != 0;
+}
+
+int vm_delta_encoder_header_changed(const struct vm_delta_encoder *enc,
+				    const struct vm_header *hdr)
+{
+	return enc->header.n_buffers != hdr->n_buffers ||
+		enc->header.disp_w != hdr->disp_w ||
+		enc->header.disp_h != hdr->disp_h;
+}
+
+void vm_delta_encoder_store(struct vm_delta_encoder *enc,
+			    const struct vm_buffer_info *info)
+{
+	int slot = info->surf_index;
+
+	if (slot < 0 || slot >= VM_DELTA_MAX_BUFFERS)
+		return;
+
+	memcpy(&enc->table[slot], info, sizeof(*info));
+}
+
+void vm_delta_encoder_end(struct vm_delta_encoder *enc,
+			  const struct vm_header *hdr,
+			  const struct vm_delta_header *delta)
+{
+	enc->header = *hdr;
+
+	if (delta->flags & VM_DELTA_KEYFRAME) {
+		enc->frames_since_keyframe = 0;
+		enc->force_keyframe = 0;
+	} else {
+		enc->frames_since_keyframe++;
+	}
+}
+
+void vm_delta_decoder_init(struct vm_delta_decoder *dec)
+{
+	memset(dec, 0, sizeof(*dec));
+}
+
+static int publish(struct vm_delta_decoder_output *out, void *table)
+{
+	struct vm_header hdr = out->pending;
+
+	out->header = out->pending;
+	out->valid = 1;
+
+	hdr.version = VM_TABLE_VERSION;
+	memcpy(table, &hdr, sizeof(hdr));
+	memcpy((char *)table + sizeof(hdr), out->table,
+	       hdr.n_buffers * sizeof(struct vm_buffer_info));
+
+	return hdr.output;
+}
+
+/*
+ * Returns 0 if the records of this frame can be applied on top of what we
+ * hold for its output, -1 if the frame has to be skipped.
+ */
+static int begin_frame(struct vm_delta_decoder *dec,
+		       const struct vm_header *hdr,
+		       const struct vm_delta_header *delta)
+{
+	struct vm_delta_decoder_output *out = &dec->outputs[hdr->output];
+
+	/* The records of the previous frame never all showed up */
+	if (out->records_left > 0) {
+		out->valid = 0;
+		dec->frames_dropped++;
+	}
+
+	out->pending = *hdr;
+	out->records_left = 0;
+
+	if (hdr->n_buffers < 0 || hdr->n_buffers > VM_DELTA_MAX_BUFFERS ||
+	    delta->n_records <= 0 || delta->n_records > hdr->n_buffers)
+		return -1;
+
+	if (!(delta->flags & VM_DELTA_KEYFRAME) &&
+	    (!out->valid || out->header.counter != delta->base_counter)) {
+		out->valid = 0;
+		dec->frames_dropped++;
+		return -1;
+	}
+
+	out->records_left = delta->n_records;
+
+	return 0;
+}
+
+static int apply_record(struct vm_delta_decoder_output *out,
+			const struct vm_buffer_info *info)
+{
+	int slot = info->surf_index;
+
+	if (slot < 0 || slot >= out->pending.n_buffers) {
+		/* A table with a hole in it is no use to anybody */
+		out->valid = 0;
+		out->records_left = 0;
+		return -1;
+	}
+
+	memcpy(&out->table[slot], info, sizeof(*info));
+	out->records_left--;
+
+	return 0;
+}
+
+int vm_delta_decode_frame(struct vm_delta_decoder *dec,
+			  const char *data, int len, void **tables)
+{
+	struct vm_delta_decoder_output *out;
+	struct vm_header hdr;
+	struct vm_delta_header delta;
+	struct vm_buffer_info info;
+	int i;
+
+	if (len < (int) sizeof(hdr))
+		return -1;
+
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if (hdr.version != VM_DELTA_VERSION) {
+		if (hdr.output >= 0 && hdr.output < VM_MAX_OUTPUTS)
+			memcpy(tables[hdr.output], data,
+			       len < METADATA_BUFFER_SIZE ?
+			       len : METADATA_BUFFER_SIZE);
+		return hdr.output;
+	}
+
+	if (hdr.output < 0 || hdr.output >= VM_MAX_OUTPUTS ||
+	    len < (int) (sizeof(hdr) + sizeof(delta)))
+		return -1;
+
+	memcpy(&delta, data + sizeof(hdr), sizeof(delta));
+	data += sizeof(hdr) + sizeof(delta);
+	len -= sizeof(hdr) + sizeof(delta);
+
+	if (delta.n_records < 0 ||
+	    len < delta.n_records * (int) sizeof(info))
+		return -1;
+
+	if (begin_frame(dec, &hdr, &delta) < 0)
+		return -1;
+
+	out = &dec->outputs[hdr.output];
+	for (i = 0; i < delta.n_records; i++) {
+		memcpy(&info, data + i * sizeof(info), sizeof(info));
+		if (apply_record(out, &info) < 0)
+			return -1;
+	}
+
+	return publish(out, tables[hdr.output]);
+}
+
+int vm_delta_decode_record(struct vm_delta_decoder *dec,
+			   const struct vm_header *hdr,
+			   const struct vm_delta_header *delta,
+			   const struct vm_buffer_info *info,
+			   void **tables)
+{
+	struct vm_delta_decoder_output *out;
+
+	if (hdr->output < 0 || hdr->output >= VM_MAX_OUTPUTS)
+		return -1;
+
+	out = &dec->outputs[hdr->output];
+
+	if (out->pending.counter != hdr->counter) {
+		/* First record of a new frame */
+		if (begin_frame(dec, hdr, delta) < 0)
+			return -1;
+	} else if (out->records_left == 0) {
+		/* Rest of a frame that is being skipped */
+		return -1;
+	}
+
+	if (apply_record(out, info) < 0)
+		return -1;
+
+	if (out->records_left > 0)
+		return -1;
+
+	return publish(out, tables[hdr->output]);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __VM_DELTA_H__
+#define __VM_DELTA_H__
+
+#include "vm-shared.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Largest table that still fits in a single frame of metadata */
+#define VM_DELTA_MAX_BUFFERS \
+	((int)((METADATA_BUFFER_SIZE - sizeof(struct vm_header)) / \
+	       sizeof(struct vm_buffer_info)))
+
+/*
+ * Compositor side copy of what the receivers hold for one output.
+ *
+ * For every frame: vm_delta_encoder_begin(), then
+ * vm_delta_encoder_changed() on each record to count the ones that have to
+ * go out, vm_delta_encoder_store() on each of those once it's final, and
+ * vm_delta_encoder_end() if at least one record was sent.
+ */
+struct vm_delta_encoder {
+	struct vm_header header;
+	int frames_since_keyframe;
+	int force_keyframe;
+	struct vm_buffer_info table[VM_DELTA_MAX_BUFFERS];
+};
+
+void vm_delta_encoder_begin(struct vm_delta_encoder *enc,
+			    int keyframe_interval,
+			    struct vm_delta_header *delta);
+int vm_delta_encoder_changed(const struct vm_delta_encoder *enc,
+			     const struct vm_delta_header *delta,
+			     const struct vm_buffer_info *info);
+int vm_delta_encoder_header_changed(const struct vm_delta_encoder *enc,
+				    const struct vm_header *hdr);
+void vm_delta_encoder_store(struct vm_delta_encoder *enc,
+			    const struct vm_buffer_info *info);
+void vm_delta_encoder_end(struct vm_delta_encoder *enc,
+			  const struct vm_header *hdr,
+			  const struct vm_delta_header *delta);
+
+struct vm_delta_decoder_output {
+	/* Last table handed out */
+	struct vm_header header;
+	int valid;
+
+	/* Frame whose records are being collected */
+	struct vm_header pending;
+	int records_left;
+
+	struct vm_buffer_info table[VM_DELTA_MAX_BUFFERS];
+};
+
+struct vm_delta_decoder {
+	struct vm_delta_decoder_output outputs[VM_MAX_OUTPUTS];
+	int frames_dropped;
+};
+
+void vm_delta_decoder_init(struct vm_delta_decoder *dec);
+
+/*
+ * Apply one frame of metadata (the bytes between the stream markers) and
+ * write the resulting full table to tables[output]. Frames in the old full
+ * table format are copied through unchanged.
+ *
+ * Returns the output number, or -1 when there is nothing to hand out yet.
+ */
+int vm_delta_decode_frame(struct vm_delta_decoder *dec,
+			  const char *data, int len, void **tables);
+
+/*
+ * Same for channels that deliver a frame one record at a time, such as
+ * hyper_dmabuf export events. The table is only written out once the last
+ * record of the frame has arrived.
+ */
+int vm_delta_decode_record(struct vm_delta_decoder *dec,
+			   const struct vm_header *hdr,
+			   const struct vm_delta_header *delta,
+			   const struct vm_buffer_info *info,
+			   void **tables);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif // __VM_DELTA_H__
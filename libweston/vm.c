@@ -1,7 +1,8 @@
 #include "config.h"
 #include "vm.h"
 #include "linux-dmabuf.h"
-#include <sched.h>
+#include <poll.h>
+#include <linux/dma-buf.h>
 #ifdef HYPER_DMABUF
 #include <hyper_dmabuf.h>
 #endif
@@ -14,13 +15,26 @@ int vm_data_offset;
 
 #define VBT_VERSION 3
 
+/* Frames whose buffers are still being rendered to are held back; beyond
+ * this many the oldest one is dropped rather than queueing up latency. */
+#define VM_MAX_PENDING_FRAMES 3
+
 static struct hyper_communication_interface comm_interface;
 static void *comm_module;
+static struct wl_event_source *comm_source;
 
-int vm_init(struct gl_renderer *gr)
+static int vm_comm_handler(int fd, uint32_t mask, void *data)
+{
+	comm_interface.dispatch();
+
+	return 0;
+}
+
+int vm_init(struct weston_compositor *ec, struct gl_renderer *gr)
 {
 	struct vm_buffer_table *vbt;
 	char *err;
+	int i;
 
 	gr->vm_buffer_table = (struct vm_buffer_table *) zalloc(
 			sizeof(struct vm_buffer_table));
@@ -30,6 +44,11 @@ int vm_init(struct gl_renderer *gr)
 	vbt->h.n_buffers = 0;
 
 	wl_list_init(&vbt->vm_buffer_info_list);
+	wl_list_init(&vbt->pending_frame_list);
+
+	for (i = 0; i < VM_MAX_OUTPUTS; i++) {
+		vbt->delta[i].force_keyframe = 1;
+	}
 
 	if (!gl_renderer_interface.vm_plugin_path || strlen(gl_renderer_interface.vm_plugin_path) == 0) {
 		weston_log("No VM plugin provided\n");
@@ -65,6 +84,17 @@ int vm_init(struct gl_renderer *gr)
 		weston_log("hypervisor communication channel initialization failed\n");
 		return -1;
 	}
+
+	if (comm_interface.get_fd && comm_interface.dispatch) {
+		comm_source = wl_event_loop_add_fd(
+				wl_display_get_event_loop(ec->wl_display),
+				comm_interface.get_fd(), WL_EVENT_READABLE,
+				vm_comm_handler, NULL);
+		if (!comm_source) {
+			weston_log("Failed to watch hypervisor communication channel\n");
+			return -1;
+		}
+	}
 	weston_log("Succesfully loaded hypervisor communication channel\n");
 
 	return 0;
@@ -82,31 +112,244 @@ static void add_to_vm_data(void *buf, int len)
 	vm_data_offset += len;
 }
 
-void vm_table_clean(struct gl_renderer *gr)
+static struct vm_frame *vm_frame_create(struct vm_buffer_table *vbt)
+{
+	struct vm_frame *frame;
+
+	frame = zalloc(sizeof(*frame));
+	if (!frame)
+		return NULL;
+
+	frame->vbt = vbt;
+	wl_list_init(&frame->fence_list);
+	wl_list_init(&frame->link);
+
+	return frame;
+}
+
+static void vm_frame_fence_destroy(struct vm_frame_fence *fence)
+{
+	wl_list_remove(&fence->link);
+	wl_event_source_remove(fence->event_source);
+	close(fence->fd);
+	free(fence);
+}
+
+static void vm_frame_destroy(struct vm_frame *frame)
+{
+	struct vm_frame_fence *fence, *tmp;
+
+	wl_list_for_each_safe(fence, tmp, &frame->fence_list, link) {
+		vm_frame_fence_destroy(fence);
+	}
+
+	wl_list_remove(&frame->link);
+	free(frame->data);
+	free(frame);
+}
+
+/* Receivers can't apply deltas on top of what they missed */
+static void vm_force_keyframes(struct vm_buffer_table *vbt)
+{
+	int i;
+
+	for (i = 0; i < VM_MAX_OUTPUTS; i++) {
+		vbt->delta[i].force_keyframe = 1;
+	}
+}
+
+static void vm_send_frame(struct vm_frame *frame)
 {
-	struct gr_buffer_ref *gr_buf, *tmp;
-	struct vm_buffer_table *vbt = gr->vm_buffer_table;
 	int i = 0, rc;
 	int retries = METADATA_SEND_RETRIES;
 
-	while (comm_interface.available_space() < vm_data_offset && retries--) {
+	if (comm_interface.send_data == NULL)
+		return;
+
+	/* Asynchronous channels take or drop the frame whole themselves,
+	 * waiting for them would only hold up the compositor */
+	if (comm_interface.dispatch) {
+		if (comm_interface.send_data(frame->data, frame->len) != frame->len)
+			vm_force_keyframes(frame->vbt);
+		return;
+	}
+
+	while (comm_interface.available_space() < frame->len && retries--) {
 		usleep(METADATA_SEND_SLEEP);
 	}
 
-	if (comm_interface.available_space() >= vm_data_offset) {
-		if (comm_interface.send_data != NULL) {
-			add_marker_to_vm_data(METADATA_STREAM_END);
-			do {
-				rc = comm_interface.send_data(&vm_data[i], vm_data_offset - i);
-				i += rc;
-			} while (i != vm_data_offset && rc >= 0);
-		}
+	if (comm_interface.available_space() >= frame->len) {
+		do {
+			rc = comm_interface.send_data(&frame->data[i], frame->len - i);
+			i += rc;
+		} while (i != frame->len && rc >= 0);
+		if (rc < 0)
+			vm_force_keyframes(frame->vbt);
 	} else {
 		printf("No space in comm channel - skipping frame %d < %d\n",
-			comm_interface.available_space(), vm_data_offset);
+			comm_interface.available_space(), frame->len);
+		vm_force_keyframes(frame->vbt);
+	}
+}
+
+/*
+ * Send every queued frame, oldest first, up to the first one that still has
+ * buffers being rendered to. Keeping the order means the host never sees a
+ * newer frame's metadata before an older one's.
+ */
+static void vm_flush_frames(struct vm_buffer_table *vbt)
+{
+	struct vm_frame *frame, *tmp;
+
+	wl_list_for_each_reverse_safe(frame, tmp, &vbt->pending_frame_list, link) {
+		if (!wl_list_empty(&frame->fence_list))
+			break;
+
+		vm_send_frame(frame);
+		vm_frame_destroy(frame);
 	}
+}
+
+static int vm_frame_fence_handler(int fd, uint32_t mask, void *data)
+{
+	struct vm_frame_fence *fence = data;
+	struct vm_frame *frame = fence->frame;
+
+	vm_frame_fence_destroy(fence);
+
+	/* Frames still being built by vm_table_expose() are not queued yet
+	 * and get flushed from vm_table_clean() instead. */
+	if (!wl_list_empty(&frame->link))
+		vm_flush_frames(frame->vbt);
+
+	return 0;
+}
+
+/*
+ * Returns an fd that polls readable once all pending GPU writes to the bo
+ * have completed. Prefer an explicit sync_file snapshot of the implicit
+ * fences; older kernels without the export ioctl still support polling the
+ * dma-buf itself for the same condition.
+ */
+static int vm_buffer_fence_fd(struct gbm_bo *bo)
+{
+	int dmabuf_fd;
+
+	dmabuf_fd = gbm_bo_get_fd(bo);
+	if (dmabuf_fd < 0)
+		return -1;
+
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+	struct dma_buf_export_sync_file req = {
+		.flags = DMA_BUF_SYNC_READ,
+		.fd = -1,
+	};
+
+	if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &req) == 0) {
+		close(dmabuf_fd);
+		return req.fd;
+	}
+#endif
+
+	return dmabuf_fd;
+}
+
+/*
+ * Take a fence for every buffer in the table and attach it to the frame
+ * currently being built. The metadata is only sent once all of them have
+ * signalled, so the host never composes a half rendered buffer, and the
+ * compositor never has to stall waiting for the client's GPU work.
+ */
+static void vm_track_buffers(struct vm_buffer_table *vbt,
+			     struct wl_event_loop *loop)
+{
+	struct gr_buffer_ref *gr_buf;
+	struct vm_frame_fence *fence;
+	struct pollfd pfd;
+	int fd;
+
+	if (!vbt->current_frame)
+		vbt->current_frame = vm_frame_create(vbt);
+
+	wl_list_for_each(gr_buf, &vbt->vm_buffer_info_list, elm) {
+		if (gr_buf->bo == NULL)
+			continue;
+
+		fd = vm_buffer_fence_fd(gr_buf->bo);
+		gbm_bo_destroy(gr_buf->bo);
+		gr_buf->bo = NULL;
+
+		if (fd < 0)
+			continue;
+
+		/* Most buffers are idle by the time they get here */
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) > 0 || !vbt->current_frame) {
+			close(fd);
+			continue;
+		}
+
+		fence = zalloc(sizeof(*fence));
+		if (!fence) {
+			close(fd);
+			continue;
+		}
+
+		fence->fd = fd;
+		fence->frame = vbt->current_frame;
+		fence->event_source = wl_event_loop_add_fd(loop, fd,
+							   WL_EVENT_READABLE,
+							   vm_frame_fence_handler,
+							   fence);
+		if (!fence->event_source) {
+			close(fd);
+			free(fence);
+			continue;
+		}
+
+		wl_list_insert(&vbt->current_frame->fence_list, &fence->link);
+	}
+}
+
+void vm_table_clean(struct gl_renderer *gr)
+{
+	struct gr_buffer_ref *gr_buf, *tmp;
+	struct vm_buffer_table *vbt = gr->vm_buffer_table;
+	struct vm_frame *frame;
+
+	add_marker_to_vm_data(METADATA_STREAM_END);
+
+	frame = vbt->current_frame;
+	vbt->current_frame = NULL;
+	if (!frame)
+		frame = vm_frame_create(vbt);
+
+	if (frame) {
+		frame->data = malloc(vm_data_offset);
+		if (frame->data) {
+			memcpy(frame->data, vm_data, vm_data_offset);
+			frame->len = vm_data_offset;
+			wl_list_insert(&vbt->pending_frame_list, &frame->link);
+		} else {
+			vm_frame_destroy(frame);
+			vm_force_keyframes(vbt);
+		}
+	}
+
+	if (wl_list_length(&vbt->pending_frame_list) > VM_MAX_PENDING_FRAMES) {
+		frame = container_of(vbt->pending_frame_list.prev,
+				     struct vm_frame, link);
+		if (gl_renderer_interface.vm_dbg) {
+			weston_log("Buffers still busy - dropping frame metadata\n");
+		}
+		vm_frame_destroy(frame);
+		vm_force_keyframes(vbt);
+	}
+
+	vm_flush_frames(vbt);
+
 	vm_data_offset = 0;
-	memset(vm_data, 0, METADATA_BUFFER_SIZE);
 
 	/* remove any buffer refs inside this table */
 	wl_list_for_each_safe(gr_buf, tmp, &vbt->vm_buffer_info_list, elm) {
@@ -131,14 +374,27 @@ void vm_destroy(struct gl_renderer * gr)
 {
 	struct gr_buffer_ref *gr_buf, *tmp;
 	struct vm_buffer_table *vbt = gr->vm_buffer_table;
+	struct vm_frame *frame, *frame_tmp;
 
 	/* free any buffers inside this table */
 	wl_list_for_each_safe(gr_buf, tmp, &vbt->vm_buffer_info_list, elm) {
 		buffer_destroy(gr_buf);
 	}
 
+	/* metadata still waiting on buffers is never going to be sent */
+	if (vbt->current_frame) {
+		vm_frame_destroy(vbt->current_frame);
+	}
+	wl_list_for_each_safe(frame, frame_tmp, &vbt->pending_frame_list, link) {
+		vm_frame_destroy(frame);
+	}
+
 	free(gr->vm_buffer_table);
 
+	if (comm_source != NULL) {
+		wl_event_source_remove(comm_source);
+		comm_source = NULL;
+	}
 	if (comm_interface.cleanup != NULL) {
 		comm_interface.cleanup();
 	}
@@ -315,24 +571,77 @@ void vm_add_buf(struct weston_compositor *ec, struct gl_renderer *gr,
 	}
 }
 
-static int wait_for_gpu(const struct wl_list * list, int drm_fd)
+static void vm_export_buffer(struct gr_buffer_ref *gr_buf,
+			     struct vm_header *hdr, struct vm_delta_header *delta)
 {
-	struct gr_buffer_ref *gr_buffer_ref_ptr;
-	int result = 0;
-	wl_list_for_each_reverse(gr_buffer_ref_ptr, list, elm) {
-		if (gr_buffer_ref_ptr->bo != NULL) {
-			struct drm_i915_gem_busy busy = {};
-			busy.handle = gbm_bo_get_handle(gr_buffer_ref_ptr->bo).u32;
-			drmIoctl(drm_fd, DRM_IOCTL_I915_GEM_BUSY, &busy);
-			while (busy.busy != 0) {
-				result = 1;
-				sched_yield();
-				drmIoctl(drm_fd, DRM_IOCTL_I915_GEM_BUSY, &busy);
-			}
-			gbm_bo_destroy(gr_buffer_ref_ptr->bo);
-		}
+	hyper_dmabuf_id_t old_hyper_dmabuf;
+
+	/* export bo */
+	old_hyper_dmabuf = gr_buf->vm_buffer_info.hyper_dmabuf_id;
+	export_bo(gr_buf->backend, gr_buf->bo, hdr, delta, &gr_buf->vm_buffer_info);
+
+	/*
+	 * If previous contents of buffer were exported using different
+	 * hyper_dmabuf, unexport it know, as we will lost reference
+	 * to that old id.
+	 */
+	if (old_hyper_dmabuf.id != 0 &&
+	    old_hyper_dmabuf.id != gr_buf->vm_buffer_info.hyper_dmabuf_id.id) {
+		unexport_bo(gr_buf->backend, &gr_buf->vm_buffer_info);
 	}
-	return result;
+}
+
+/*
+ * Delta mode: only buffers whose record differs from what the receivers
+ * already hold get exported and written out. Buffers that haven't changed
+ * keep their existing hyper_dmabuf export.
+ */
+static void vm_table_expose_delta(struct vm_buffer_table *vbt, int output_num)
+{
+	struct vm_delta_encoder *enc = &vbt->delta[output_num];
+	struct vm_delta_header delta;
+	struct vm_header hdr = vbt->h;
+	struct gr_buffer_ref *gr_buf;
+
+	hdr.version = VM_DELTA_VERSION;
+
+	vm_delta_encoder_begin(enc, gl_renderer_interface.vm_delta_keyframe, &delta);
+
+	wl_list_for_each(gr_buf, &vbt->vm_buffer_info_list, elm) {
+		gr_buf->delta_changed =
+			vm_delta_encoder_changed(enc, &delta, &gr_buf->vm_buffer_info);
+		delta.n_records += gr_buf->delta_changed;
+	}
+
+	/*
+	 * Buffers only went away or the output was resized, resend one
+	 * record so that the receivers pick up the new header.
+	 */
+	if (delta.n_records == 0 && vm_delta_encoder_header_changed(enc, &hdr)) {
+		gr_buf = container_of(vbt->vm_buffer_info_list.next,
+				      struct gr_buffer_ref, elm);
+		gr_buf->delta_changed = 1;
+		delta.n_records = 1;
+	}
+
+	/* Nothing the receivers don't already have */
+	if (delta.n_records == 0)
+		return;
+
+	add_marker_to_vm_data(METADATA_STREAM_START);
+	add_to_vm_data(&hdr, sizeof(struct vm_header));
+	add_to_vm_data(&delta, sizeof(struct vm_delta_header));
+
+	wl_list_for_each(gr_buf, &vbt->vm_buffer_info_list, elm) {
+		if (!gr_buf->delta_changed)
+			continue;
+
+		vm_export_buffer(gr_buf, &hdr, &delta);
+		vm_delta_encoder_store(enc, &gr_buf->vm_buffer_info);
+		add_to_vm_data(&gr_buf->vm_buffer_info, sizeof(struct vm_buffer_info));
+	}
+
+	vm_delta_encoder_end(enc, &hdr, &delta);
 }
 
 int vm_table_expose(struct weston_output *output, struct gl_output_state *go,
@@ -347,7 +656,6 @@ int vm_table_expose(struct weston_output *output, struct gl_output_state *go,
 	struct vm_buffer_table *vbt = gr->vm_buffer_table;
 	EGLint buffer_age = 0;
 	EGLBoolean ret;
-	int drm_fd = bc->drm.fd;
 	int shareable = 0;
 	struct weston_output *o;
 	int output_num = 0;
@@ -360,7 +668,7 @@ int vm_table_expose(struct weston_output *output, struct gl_output_state *go,
 		output_num++;
 	}
 
-	if (output_num > VM_MAX_OUTPUTS) {
+	if (output_num >= VM_MAX_OUTPUTS) {
 		weston_log("Exceeding maximum number of outputs supported by vm\n");
 		return 1;
 	}
@@ -407,35 +715,23 @@ int vm_table_expose(struct weston_output *output, struct gl_output_state *go,
 
 	/* No buffers */
 	if(vbt->h.n_buffers == 0) {
-		wait_for_gpu(&vbt->vm_buffer_info_list, drm_fd);
 		return 1;
 	}
 
-	add_marker_to_vm_data(METADATA_STREAM_START);
-	add_to_vm_data(&vbt->h, sizeof(struct vm_header));
+	if (gl_renderer_interface.vm_delta_keyframe > 0) {
+		vm_table_expose_delta(vbt, output_num);
+	} else {
+		add_marker_to_vm_data(METADATA_STREAM_START);
+		add_to_vm_data(&vbt->h, sizeof(struct vm_header));
 
-	/* Write individual buffers */
-	wl_list_for_each(gr_buf, &vbt->vm_buffer_info_list, elm) {
-		hyper_dmabuf_id_t old_hyper_dmabuf;
-
-		/* export bo */
-		old_hyper_dmabuf = gr_buf->vm_buffer_info.hyper_dmabuf_id;
-		export_bo(gr_buf->backend, gr_buf->bo, &vbt->h, &gr_buf->vm_buffer_info);
-
-		/*
-		 * If previous contents of buffer were exported using different
-		 * hyper_dmabuf, unexport it know, as we will lost reference
-		 * to that old id.
-		 */
-		if (old_hyper_dmabuf.id != 0 &&
-		    old_hyper_dmabuf.id != gr_buf->vm_buffer_info.hyper_dmabuf_id.id) {
-			unexport_bo(gr_buf->backend, &gr_buf->vm_buffer_info);
+		/* Write individual buffers */
+		wl_list_for_each(gr_buf, &vbt->vm_buffer_info_list, elm) {
+			vm_export_buffer(gr_buf, &vbt->h, NULL);
+			add_to_vm_data(&gr_buf->vm_buffer_info, sizeof(struct vm_buffer_info));
 		}
-
-		add_to_vm_data(&gr_buf->vm_buffer_info, sizeof(struct vm_buffer_info));
 	}
 
-	wait_for_gpu(&vbt->vm_buffer_info_list, drm_fd);
+	vm_track_buffers(vbt, wl_display_get_event_loop(ec->wl_display));
 	return 1;
 }
 
@@ -444,7 +740,8 @@ void vm_output_init(struct weston_output *output)
 	output->disable_planes++;
 }
 
-void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hdr, struct vm_buffer_info *vb)
+void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hdr,
+	       struct vm_delta_header *v_delta, struct vm_buffer_info *vb)
 {
 #ifdef HYPER_DMABUF
 	struct ioctl_hyper_dmabuf_export_remote msg;
@@ -457,6 +754,8 @@ void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hd
 	}
 
 	msg.sz_priv = sizeof(*v_hdr) + sizeof(*vb);
+	if (v_delta)
+		msg.sz_priv += sizeof(*v_delta);
 	msg.priv = (char*)malloc(msg.sz_priv);
 
 	if (!msg.priv) {
@@ -472,6 +771,10 @@ void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hd
 
 	memcpy(meta_ptr, v_hdr, sizeof(*v_hdr));
 	meta_ptr += sizeof(*v_hdr);
+	if (v_delta) {
+		memcpy(meta_ptr, v_delta, sizeof(*v_delta));
+		meta_ptr += sizeof(*v_delta);
+	}
 	memcpy(meta_ptr, vb, sizeof(*vb));
 
 	/* invalidating old hyper_dmabuf, it will be udpated by importer
@@ -3,7 +3,7 @@
 
 #ifndef USE_VM
 
-#define VM_INIT(gr, res)
+#define VM_INIT(ec, gr, res)
 #define VM_ADD_BUF(es, gr, gs, bc, buf, surf, idx)
 #define VM_TABLE_DRAW(o, go, gr)
 #define VM_TABLE_EXPOSE(o, go, gr)
@@ -17,9 +17,10 @@
 #include "gl-renderer.h"
 #include "ias-backend.h"
 #include "vm_comm.h"
+#include "vm-delta.h"
 
-#define VM_INIT(gr, res)            if(gl_renderer_interface.vm_exec) \
-										{ res = vm_init(gr); } else { res = 0; }
+#define VM_INIT(ec, gr, res)        if(gl_renderer_interface.vm_exec) \
+										{ res = vm_init(ec, gr); } else { res = 0; }
 #define VM_ADD_BUF(es, gr, gs, bc, buf, surf, idx) if(gl_renderer_interface.vm_exec) \
 										{ vm_add_buf(es, gr, gs, bc, buf, surf, idx); }
 #define VM_TABLE_EXPOSE(o, go, gr)    if(gl_renderer_interface.vm_exec) \
@@ -46,9 +47,30 @@
 
 #define VM_MAX_BUFFERS_NUMBER 4
 
+struct vm_frame;
+
 struct vm_buffer_table {
 	struct vm_header h;
 	struct wl_list vm_buffer_info_list;
+	struct wl_list pending_frame_list; /* vm_frame::link, newest first */
+	struct vm_frame *current_frame;
+	struct vm_delta_encoder delta[VM_MAX_OUTPUTS];
+};
+
+/* Metadata for one composited frame, held until its buffers are idle */
+struct vm_frame {
+	struct wl_list link;
+	struct vm_buffer_table *vbt;
+	char *data;
+	int len;
+	struct wl_list fence_list; /* vm_frame_fence::link */
+};
+
+struct vm_frame_fence {
+	struct wl_list link;
+	struct vm_frame *frame;
+	int fd;
+	struct wl_event_source *event_source;
 };
 
 struct gr_buffer_ref {
@@ -61,9 +83,10 @@ struct gr_buffer_ref {
 	int cleanup_required;
 	struct weston_surface* surface;
 	struct gbm_bo *bo;
+	int delta_changed;
 };
 
-int vm_init(struct gl_renderer *gr);
+int vm_init(struct weston_compositor *ec, struct gl_renderer *gr);
 void vm_add_buf(struct weston_compositor *ec, struct gl_renderer *gr,
 		struct gl_surface_state *gs, struct ias_backend *bc, struct weston_buffer *buffer,
 		struct weston_view *view, int buf_ind);
@@ -74,7 +97,8 @@ int vm_table_draw(struct weston_output *output, struct gl_output_state *go,
 void vm_table_clean(struct gl_renderer *gr);
 void vm_output_init(struct weston_output *output);
 void pin_bo(struct gl_renderer *gr, void *buf, struct vm_buffer_info *vb);
-void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hdr, struct vm_buffer_info *vb);
+void export_bo(struct ias_backend *bk, struct gbm_bo *bo, struct vm_header *v_hdr,
+	       struct vm_delta_header *v_delta, struct vm_buffer_info *vb);
 int unexport_bo(struct ias_backend *bk, struct vm_buffer_info *vb);
 void unpin_bo(struct gl_renderer *gr, void *buf);
 void vm_destroy(struct gl_renderer *gr);
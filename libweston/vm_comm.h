@@ -5,6 +5,14 @@ struct hyper_communication_interface {
 	void (*cleanup)(void);
 	int (*send_data)(void *data, int len);
 	int (*available_space)(void);
+	/*
+	 * Optional, for channels that queue and send asynchronously: an fd
+	 * that polls readable whenever dispatch() has work to do. Such a
+	 * channel takes or drops each frame whole in send_data(), and returns
+	 * less than len if any receiver missed it and needs a keyframe.
+	 */
+	int (*get_fd)(void);
+	void (*dispatch)(void);
 };
 
 typedef int (*init_comm_interface)(struct hyper_communication_interface * comm_interface,
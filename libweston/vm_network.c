@@ -1,45 +1,200 @@
+#include "config.h"
+
 #include "vm_comm.h"
 #include "vm-shared.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
-#include <signal.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <limits.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <errno.h>
+
+/* Receivers served at the same time */
+#define MAX_CLIENTS 8
+
+/*
+ * Bytes queued per receiver. A frame that doesn't fit is dropped for that
+ * receiver only, and always as a whole, so it never sees a cut short frame.
+ */
+#define CLIENT_QUEUE_SIZE (4 * (METADATA_BUFFER_SIZE + \
+				(int) sizeof(struct vm_frame_prefix)))
 
-int sock_fd;
-int client_sock_fd;
-int portno;
-struct sockaddr_in server_addr, client_addr;
-pthread_t thread;
-void* listener_thread(void *arg);
+struct client {
+	int fd;
+	char *queue;
+	int head;	/* next byte queued */
+	int len;	/* bytes queued, starting at head - len */
+	unsigned int sent;
+	unsigned int dropped;
+	/* Missed a frame or just joined, and needs a keyframe */
+	int resync;
+};
 
+static int sock_fd = -1;
+static int epoll_fd = -1;
+static int portno;
+/* Prefix every frame with its length, see struct vm_frame_prefix */
+static int framed;
+static struct sockaddr_in server_addr;
+static struct client clients[MAX_CLIENTS];
+
+static int queue_space(const struct client *c)
+{
+	return CLIENT_QUEUE_SIZE - c->len;
+}
 
-void* listener_thread(void *arg)
+static void client_watch(struct client *c)
 {
-	socklen_t clilen;
+	struct epoll_event ev = {
+		.events = EPOLLIN | (c->len ? EPOLLOUT : 0),
+		.data.ptr = c,
+	};
 
-	clilen = sizeof(client_addr);
-	client_sock_fd = accept(sock_fd, (struct sockaddr *) &client_addr, &clilen);
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
 
-	return NULL;
+static void client_destroy(struct client *c)
+{
+	printf("VM client disconnected, %u frames sent, %u dropped\n",
+	       c->sent, c->dropped);
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->queue);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
 }
 
-static void signal_callback_handler(int signum)
+static void client_accept(void)
 {
-	if (client_sock_fd >= 0) {
-		printf("VM client disconnected\n");
-		close(client_sock_fd);
-		client_sock_fd = -1;
-		/* Kick off thread to start listening for new connection */
-		pthread_create(&thread, NULL, listener_thread, NULL);
+	struct sockaddr_in client_addr;
+	socklen_t clilen = sizeof(client_addr);
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct client *c = NULL;
+	int tcp_nodelay_enable = 1;
+	int fd, i;
+
+	fd = accept4(sock_fd, (struct sockaddr *) &client_addr, &clilen,
+		     SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd < 0) {
+			c = &clients[i];
+			break;
+		}
+	}
+
+	if (!c) {
+		printf("Too many VM clients, refusing %s\n",
+		       inet_ntoa(client_addr.sin_addr));
+		close(fd);
+		return;
+	}
+
+	c->queue = malloc(CLIENT_QUEUE_SIZE);
+	if (!c->queue) {
+		close(fd);
+		return;
 	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &tcp_nodelay_enable,
+		   sizeof(tcp_nodelay_enable));
+
+	ev.data.ptr = c;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(c->queue);
+		c->queue = NULL;
+		return;
+	}
+
+	c->fd = fd;
+	c->head = 0;
+	c->len = 0;
+	c->resync = 1;
+
+	printf("VM client connected from %s\n", inet_ntoa(client_addr.sin_addr));
+}
+
+/*
+ * Write out as much of the queue as the socket takes. Returns -1 if the
+ * client has gone away.
+ */
+static int client_flush(struct client *c)
+{
+	struct iovec iov[2];
+	int start, first;
+	ssize_t rc;
+
+	while (c->len > 0) {
+		start = (c->head - c->len + CLIENT_QUEUE_SIZE) % CLIENT_QUEUE_SIZE;
+		first = CLIENT_QUEUE_SIZE - start;
+		if (first > c->len)
+			first = c->len;
+
+		iov[0].iov_base = &c->queue[start];
+		iov[0].iov_len = first;
+		iov[1].iov_base = c->queue;
+		iov[1].iov_len = c->len - first;
+
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = iov[1].iov_len ? 2 : 1,
+		};
+
+		rc = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+
+		c->len -= rc;
+	}
+
+	client_watch(c);
+
+	return 0;
+}
+
+static void client_queue(struct client *c, const void *data, int len)
+{
+	int first = CLIENT_QUEUE_SIZE - c->head;
+
+	if (first > len)
+		first = len;
+
+	memcpy(&c->queue[c->head], data, first);
+	memcpy(c->queue, (const char *) data + first, len - first);
+	c->head = (c->head + len) % CLIENT_QUEUE_SIZE;
+	c->len += len;
+}
+
+/* Anything the receiver sends is of no interest, but EOF means it's gone */
+static int client_read(struct client *c)
+{
+	char buf[256];
+	ssize_t rc;
+
+	do {
+		rc = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	} while (rc > 0 || (rc < 0 && errno == EINTR));
+
+	if (rc == 0)
+		return -1;
+
+	return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
 }
 
 static int hyper_communication_network_init(int dom_id, int buffer_size,
@@ -51,8 +206,11 @@ static int hyper_communication_network_init(int dom_id, int buffer_size,
 	char args_tmp[256];
 	char *addr;
 	char *port;
+	char *mode;
 	int reuse_enable = 1;
 	int tcp_nodelay_enable = 1;
+	struct epoll_event ev = { .events = EPOLLIN };
+	int i;
 
 	if (!strlen(args)) {
 		printf("No valid parameters for network plugin\n");
@@ -74,9 +232,16 @@ static int hyper_communication_network_init(int dom_id, int buffer_size,
 		return -1;
 	}
 
-	printf("Network socket listening on %s:%s\n", addr, port);
+	mode = strtok(NULL, ":");
+	framed = mode && strcmp(mode, "framed") == 0;
+
+	printf("Network socket listening on %s:%s%s\n", addr, port,
+	       framed ? " (framed)" : "");
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
 
-	sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (sock_fd < 0) {
 		printf("Cannot create socket\n");
 		return -1;
@@ -98,25 +263,38 @@ static int hyper_communication_network_init(int dom_id, int buffer_size,
 	}
 
 	/*
-	 * Start listening on socket and register SIGPIPE signal handler,
-	 * otherwise whenever client will disconnect, weston will be killed
+	 * Connections are accepted and served from the compositor's event
+	 * loop, through the epoll fd handed out by get_fd(). All sockets are
+	 * non-blocking and written with MSG_NOSIGNAL, so neither a slow nor a
+	 * vanished receiver can hold up or kill the compositor.
 	 */
-	listen(sock_fd, 1);
-	signal(SIGPIPE, signal_callback_handler);
-
-	/* Kick off thread to accept connection from client, to not block main thread */
-	pthread_create(&thread, NULL, listener_thread, NULL);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0 || listen(sock_fd, MAX_CLIENTS) < 0 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) < 0) {
+		printf("Cannot listen on socket\n");
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+		epoll_fd = -1;
+		close(sock_fd);
+		sock_fd = -1;
+		return -1;
+	}
 
 	return 0;
 }
 
 static void hyper_communication_network_cleanup(void)
 {
-	if (client_sock_fd >= 0) {
-		close(client_sock_fd);
-		client_sock_fd = -1;
-	} else {
-		pthread_join(thread, NULL);
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			client_destroy(&clients[i]);
+	}
+
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
 	}
 
 	if (sock_fd >= 0) {
@@ -125,22 +303,100 @@ static void hyper_communication_network_cleanup(void)
 	}
 }
 
+/*
+ * Queues the frame for every receiver that has room for all of it, and
+ * tries to push it out straight away. Each receiver gets either the whole
+ * frame or none of it. Returns len if none of them needs resyncing, or -1
+ * if one missed this frame or has connected since the last one, so the
+ * caller can follow up with a keyframe.
+ */
 static int hyper_communication_network_send_data(void *data, int len)
 {
-	if (client_sock_fd >= 0) {
-		return send(client_sock_fd, data, len, 0);
+	struct vm_frame_prefix prefix = {
+		.magic = METADATA_FRAME_MAGIC,
+		.len = len,
+	};
+	int total = len + (framed ? (int) sizeof(prefix) : 0);
+	int resync = 0;
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->fd < 0)
+			continue;
+
+		if (queue_space(c) < total) {
+			c->dropped++;
+			c->resync = 1;
+		} else {
+			if (framed)
+				client_queue(c, &prefix, sizeof(prefix));
+			client_queue(c, data, len);
+			c->sent++;
+		}
+
+		/* Reported once; the next frame will be a keyframe */
+		if (c->resync) {
+			resync = 1;
+			c->resync = 0;
+		}
+
+		if (c->len && client_flush(c) < 0)
+			client_destroy(c);
 	}
-	return -1;
+
+	return resync ? -1 : len;
 }
 
+/* The most any one receiver can take right now */
 static int hyper_communication_network_space(void)
 {
-	/*
-	 * It seems there is no way to query what is size
-	 * of internal buffer used by network socket,
-	 * so just assume that is big enought for our needs
-	 */
-	return INT_MAX;
+	int space = 0;
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0 && queue_space(&clients[i]) > space)
+			space = queue_space(&clients[i]);
+	}
+
+	return space;
+}
+
+static int hyper_communication_network_get_fd(void)
+{
+	return epoll_fd;
+}
+
+static void hyper_communication_network_dispatch(void)
+{
+	struct epoll_event ev[MAX_CLIENTS + 1];
+	struct client *c;
+	int count, i;
+	int pending_accept = 0;
+
+	count = epoll_wait(epoll_fd, ev, MAX_CLIENTS + 1, 0);
+
+	for (i = 0; i < count; i++) {
+		if (ev[i].data.ptr == NULL) {
+			pending_accept = 1;
+			continue;
+		}
+
+		c = ev[i].data.ptr;
+		if (c->fd < 0)
+			continue;
+
+		if ((ev[i].events & (EPOLLERR | EPOLLHUP)) ||
+		    ((ev[i].events & EPOLLIN) && client_read(c) < 0) ||
+		    ((ev[i].events & EPOLLOUT) && client_flush(c) < 0))
+			client_destroy(c);
+	}
+
+	/* Only now, so a freed slot can't pick up events meant for its
+	 * previous owner */
+	if (pending_accept)
+		client_accept();
 }
 
 int __attribute__((__visibility__("default")))
@@ -155,5 +411,7 @@ init_comm(struct hyper_communication_interface * comm_interface, int dom_id,
 	comm_interface->cleanup = hyper_communication_network_cleanup;
 	comm_interface->send_data = hyper_communication_network_send_data;
 	comm_interface->available_space = hyper_communication_network_space;
+	comm_interface->get_fd = hyper_communication_network_get_fd;
+	comm_interface->dispatch = hyper_communication_network_dispatch;
 	return 0;
 }
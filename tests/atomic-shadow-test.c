@@ -0,0 +1,412 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libweston/atomic-shadow.h"
+
+#include "shared/helpers.h"
+#include "shared/zalloc.h"
+#include "zunitc/zunitc.h"
+
+/*
+ * Records the libdrm atomic calls, and applies committed requests to a
+ * mock kernel state so that the tests can check nothing got lost.
+ */
+#define MOCK_MAX_ITEMS 64
+
+struct mock_item {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint64_t value;
+};
+
+struct mock_req {
+	struct mock_item items[MOCK_MAX_ITEMS];
+	int n_items;
+};
+
+struct mock_drm {
+	struct mock_item kernel[MOCK_MAX_ITEMS];
+	int n_kernel;
+	bool fail_commit;
+
+	int n_allocs;
+	int n_frees;
+	int n_props;
+	int n_commits;
+};
+
+static struct mock_req *
+mock_alloc(struct mock_drm *drm)
+{
+	drm->n_allocs++;
+	return zalloc(sizeof(struct mock_req));
+}
+
+static void
+mock_free(struct mock_drm *drm, struct mock_req *req)
+{
+	drm->n_frees++;
+	free(req);
+}
+
+static struct mock_drm *mock_current;
+
+static int
+mock_add_property(void *data, uint32_t object_id, uint32_t property_id,
+		  uint64_t value)
+{
+	struct mock_req *req = data;
+	struct mock_item *item;
+
+	ZUC_ASSERTG_TRUE(req->n_items < MOCK_MAX_ITEMS, out);
+
+	item = &req->items[req->n_items++];
+	item->object_id = object_id;
+	item->property_id = property_id;
+	item->value = value;
+	mock_current->n_props++;
+out:
+	return req->n_items;
+}
+
+static void
+mock_set_kernel(struct mock_drm *drm, const struct mock_item *item)
+{
+	int i;
+
+	for (i = 0; i < drm->n_kernel; i++) {
+		if (drm->kernel[i].object_id == item->object_id &&
+		    drm->kernel[i].property_id == item->property_id) {
+			drm->kernel[i].value = item->value;
+			return;
+		}
+	}
+
+	drm->kernel[drm->n_kernel++] = *item;
+}
+
+static int
+mock_commit(void *data, void *req_data, uint32_t flags, void *user_data)
+{
+	struct mock_drm *drm = data;
+	struct mock_req *req = req_data;
+	int i;
+
+	drm->n_commits++;
+	if (drm->fail_commit)
+		return -1;
+
+	for (i = 0; i < req->n_items; i++)
+		mock_set_kernel(drm, &req->items[i]);
+
+	return 0;
+}
+
+static void
+mock_reset(void *data)
+{
+	struct mock_req *req = data;
+
+	req->n_items = 0;
+}
+
+static const struct atomic_shadow_ops mock_ops = {
+	.add_property = mock_add_property,
+	.commit = mock_commit,
+	.reset = mock_reset,
+};
+
+static uint64_t
+mock_kernel_value(struct mock_drm *drm, uint32_t object_id,
+		  uint32_t property_id)
+{
+	int i;
+
+	for (i = 0; i < drm->n_kernel; i++) {
+		if (drm->kernel[i].object_id == object_id &&
+		    drm->kernel[i].property_id == property_id)
+			return drm->kernel[i].value;
+	}
+
+	return ~0ull;
+}
+
+/* The plane properties flip_flexible() sets, FB_ID first */
+#define PLANE_ID 31
+#define N_PLANE_PROPS 10
+
+static const uint32_t plane_props[N_PLANE_PROPS] = {
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 10
+};
+
+static void
+plane_values(uint64_t *values, uint32_t fb, int32_t x, int32_t y)
+{
+	values[0] = fb;				/* FB_ID */
+	values[1] = 40;				/* CRTC_ID */
+	values[2] = x;				/* CRTC_X */
+	values[3] = y;				/* CRTC_Y */
+	values[4] = 1920;			/* CRTC_W */
+	values[5] = 1080;			/* CRTC_H */
+	values[6] = 0;				/* SRC_X */
+	values[7] = 0;				/* SRC_Y */
+	values[8] = 1920 << 16;			/* SRC_W */
+	values[9] = 1080 << 16;			/* SRC_H */
+}
+
+/* What commit() used to do: a fresh request with everything, every frame */
+static void
+flip_unshadowed(struct mock_drm *drm, uint32_t fb)
+{
+	struct mock_req *req;
+	uint64_t values[N_PLANE_PROPS];
+	int i;
+
+	plane_values(values, fb, 0, 0);
+
+	req = mock_alloc(drm);
+	for (i = 0; i < N_PLANE_PROPS; i++)
+		mock_add_property(req, PLANE_ID, plane_props[i], values[i]);
+	mock_commit(drm, req, 0, NULL);
+	mock_free(drm, req);
+}
+
+static int
+flip_shadowed(struct atomic_shadow *shadow, struct mock_req *req,
+	      uint32_t fb, int32_t x, int32_t y)
+{
+	uint64_t values[N_PLANE_PROPS];
+	int i;
+
+	plane_values(values, fb, x, y);
+
+	atomic_shadow_add_always(shadow, req, PLANE_ID, plane_props[0],
+				 values[0]);
+	for (i = 1; i < N_PLANE_PROPS; i++)
+		atomic_shadow_add(shadow, req, PLANE_ID, plane_props[i],
+				  values[i]);
+
+	return atomic_shadow_commit(shadow, req, 0, NULL);
+}
+
+static void
+assert_plane_state(struct mock_drm *drm, uint32_t fb, int32_t x, int32_t y)
+{
+	uint64_t values[N_PLANE_PROPS];
+	int i;
+
+	plane_values(values, fb, x, y);
+	for (i = 0; i < N_PLANE_PROPS; i++)
+		ZUC_ASSERT_EQ(values[i], mock_kernel_value(drm, PLANE_ID,
+							   plane_props[i]));
+}
+
+static struct atomic_shadow *
+shadow_create(struct mock_drm *drm)
+{
+	memset(drm, 0, sizeof *drm);
+	mock_current = drm;
+
+	return atomic_shadow_create(&mock_ops, drm);
+}
+
+ZUC_TEST(atomic_shadow_test, per_frame_savings)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+	int frame, n_frames = 60;
+
+	memset(&drm, 0, sizeof drm);
+	mock_current = &drm;
+	for (frame = 0; frame < n_frames; frame++)
+		flip_unshadowed(&drm, 100 + frame % 2);
+
+	ZUC_ASSERT_EQ(n_frames, drm.n_allocs);
+	ZUC_ASSERT_EQ(n_frames, drm.n_frees);
+	ZUC_ASSERT_EQ(n_frames * N_PLANE_PROPS, drm.n_props);
+
+	shadow = shadow_create(&drm);
+	ZUC_ASSERT_NOT_NULL(shadow);
+	req = mock_alloc(&drm);
+
+	/* Everything on the first frame, just the new FB_ID afterwards */
+	for (frame = 0; frame < n_frames; frame++) {
+		ZUC_ASSERT_EQ(0, flip_shadowed(shadow, req, 100 + frame % 2,
+					       0, 0));
+		assert_plane_state(&drm, 100 + frame % 2, 0, 0);
+	}
+
+	ZUC_ASSERT_EQ(1, drm.n_allocs);
+	ZUC_ASSERT_EQ(0, drm.n_frees);
+	ZUC_ASSERT_EQ(N_PLANE_PROPS + n_frames - 1, drm.n_props);
+	ZUC_ASSERT_EQ(n_frames, drm.n_commits);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
+
+ZUC_TEST(atomic_shadow_test, only_changes_are_sent)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+
+	shadow = shadow_create(&drm);
+	req = mock_alloc(&drm);
+
+	flip_shadowed(shadow, req, 100, 0, 0);
+	ZUC_ASSERT_EQ(N_PLANE_PROPS, drm.n_props);
+
+	/* The plane moved: FB_ID, CRTC_X and CRTC_Y */
+	drm.n_props = 0;
+	flip_shadowed(shadow, req, 101, 16, 8);
+	ZUC_ASSERT_EQ(3, drm.n_props);
+	assert_plane_state(&drm, 101, 16, 8);
+
+	/* The request was emptied for reuse */
+	ZUC_ASSERT_EQ(0, req->n_items);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
+
+ZUC_TEST(atomic_shadow_test, failed_commit_is_resent)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+
+	shadow = shadow_create(&drm);
+	req = mock_alloc(&drm);
+
+	flip_shadowed(shadow, req, 100, 0, 0);
+
+	drm.fail_commit = true;
+	ZUC_ASSERT_EQ(-1, flip_shadowed(shadow, req, 101, 16, 8));
+	assert_plane_state(&drm, 100, 0, 0);
+
+	/* The kernel never saw the move, so it has to go again */
+	drm.fail_commit = false;
+	drm.n_props = 0;
+	ZUC_ASSERT_EQ(0, flip_shadowed(shadow, req, 102, 16, 8));
+	ZUC_ASSERT_EQ(3, drm.n_props);
+	assert_plane_state(&drm, 102, 16, 8);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
+
+ZUC_TEST(atomic_shadow_test, invalidate_resends_everything)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+
+	shadow = shadow_create(&drm);
+	req = mock_alloc(&drm);
+
+	flip_shadowed(shadow, req, 100, 0, 0);
+
+	/* Someone else, e.g. another session, turned the plane off */
+	drm.n_kernel = 0;
+	atomic_shadow_invalidate(shadow);
+
+	drm.n_props = 0;
+	flip_shadowed(shadow, req, 101, 0, 0);
+	ZUC_ASSERT_EQ(N_PLANE_PROPS, drm.n_props);
+	assert_plane_state(&drm, 101, 0, 0);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
+
+ZUC_TEST(atomic_shadow_test, last_value_in_a_request_wins)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+
+	shadow = shadow_create(&drm);
+	req = mock_alloc(&drm);
+
+	atomic_shadow_add(shadow, req, 1, 1, 5);
+	atomic_shadow_commit(shadow, req, 0, NULL);
+
+	/* Set to something else and back within the same request */
+	drm.n_props = 0;
+	atomic_shadow_add(shadow, req, 1, 1, 7);
+	atomic_shadow_add(shadow, req, 1, 1, 7);
+	atomic_shadow_add(shadow, req, 1, 1, 5);
+	ZUC_ASSERT_EQ(2, drm.n_props);
+	atomic_shadow_commit(shadow, req, 0, NULL);
+	ZUC_ASSERT_EQ(5, mock_kernel_value(&drm, 1, 1));
+
+	drm.n_props = 0;
+	atomic_shadow_add(shadow, req, 1, 1, 5);
+	ZUC_ASSERT_EQ(0, drm.n_props);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
+
+ZUC_TEST(atomic_shadow_test, many_objects_and_properties)
+{
+	struct mock_drm drm;
+	struct atomic_shadow *shadow;
+	struct mock_req *req;
+	uint32_t obj, prop;
+
+	shadow = shadow_create(&drm);
+	req = mock_alloc(&drm);
+
+	/* More objects than the table starts with, and one property past
+	 * what an object tracks, which is then always sent */
+	for (obj = 1; obj <= 20; obj++)
+		atomic_shadow_add(shadow, req, obj, 1, obj);
+	for (prop = 1; prop <= ATOMIC_SHADOW_MAX_PROPS + 1; prop++)
+		atomic_shadow_add(shadow, req, 1, prop, prop);
+	atomic_shadow_commit(shadow, req, 0, NULL);
+
+	drm.n_props = 0;
+	for (obj = 1; obj <= 20; obj++)
+		atomic_shadow_add(shadow, req, obj, 1, obj);
+	for (prop = 1; prop <= ATOMIC_SHADOW_MAX_PROPS + 1; prop++)
+		atomic_shadow_add(shadow, req, 1, prop, prop);
+	ZUC_ASSERT_EQ(1, drm.n_props);
+	ZUC_ASSERT_EQ(ATOMIC_SHADOW_MAX_PROPS + 1, req->items[0].property_id);
+
+	mock_free(&drm, req);
+	atomic_shadow_destroy(shadow);
+}
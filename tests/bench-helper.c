@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "bench-helper.h"
+
+struct bench_sample {
+	uint64_t cpu_ns;
+	uint64_t allocs;
+	uint64_t wall_ns;
+};
+
+struct bench_run {
+	struct client *client;
+	const char *scenario;
+	int n_steps;
+	int step;
+	bool count_allocs;
+
+	uint64_t cpu_ns;
+	uint64_t allocs;
+	struct timespec step_start;
+
+	struct bench_sample *samples;
+};
+
+static void
+get_usage(struct bench_run *run, uint64_t *cpu_ns, uint64_t *allocs)
+{
+	struct test *test = run->client->test;
+
+	test->usage_done = 0;
+	weston_test_get_usage(test->weston_test);
+	while (!test->usage_done)
+		assert(wl_display_dispatch(run->client->wl_display) >= 0);
+
+	*cpu_ns = test->cpu_time_ns;
+	*allocs = test->allocations;
+}
+
+struct bench_run *
+bench_run_create(struct client *client, const char *scenario, int n_steps)
+{
+	struct bench_run *run;
+
+	assert(n_steps > 0);
+	assert(wl_proxy_get_version((struct wl_proxy *)
+				    client->test->weston_test) >= 2);
+
+	run = xzalloc(sizeof *run);
+	run->client = client;
+	run->scenario = scenario;
+	run->n_steps = n_steps;
+	run->samples = xzalloc(n_steps * sizeof *run->samples);
+
+	get_usage(run, &run->cpu_ns, &run->allocs);
+	run->count_allocs = run->allocs != UINT64_MAX;
+
+	return run;
+}
+
+void
+bench_step_begin(struct bench_run *run)
+{
+	assert(run->step < run->n_steps);
+
+	clock_gettime(CLOCK_MONOTONIC, &run->step_start);
+}
+
+void
+bench_step_end(struct bench_run *run)
+{
+	struct bench_sample *sample = &run->samples[run->step];
+	struct timespec now;
+	uint64_t cpu_ns, allocs;
+
+	/* Asking for the usage isn't part of the step */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sample->wall_ns = timespec_sub_to_nsec(&now, &run->step_start);
+
+	get_usage(run, &cpu_ns, &allocs);
+	sample->cpu_ns = cpu_ns - run->cpu_ns;
+	sample->allocs = allocs - run->allocs;
+	run->cpu_ns = cpu_ns;
+	run->allocs = allocs;
+
+	printf("bench scenario=%s step=%d cpu_ns=%llu allocs=%lld "
+	       "wall_ns=%llu\n", run->scenario, run->step,
+	       (unsigned long long)sample->cpu_ns,
+	       run->count_allocs ? (long long)sample->allocs : -1LL,
+	       (unsigned long long)sample->wall_ns);
+
+	run->step++;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Sorts values in place */
+static uint64_t
+percentile(uint64_t *values, int n, int percent)
+{
+	qsort(values, n, sizeof *values, compare_u64);
+
+	return values[(n - 1) * percent / 100];
+}
+
+void
+bench_run_destroy(struct bench_run *run)
+{
+	uint64_t *cpu, *wall;
+	uint64_t allocs = 0;
+	int n = run->step;
+	int i;
+
+	if (n == 0) {
+		free(run->samples);
+		free(run);
+		return;
+	}
+
+	cpu = xzalloc(n * sizeof *cpu);
+	wall = xzalloc(n * sizeof *wall);
+	for (i = 0; i < n; i++) {
+		cpu[i] = run->samples[i].cpu_ns;
+		wall[i] = run->samples[i].wall_ns;
+		allocs += run->samples[i].allocs;
+	}
+
+	printf("bench-summary scenario=%s steps=%d "
+	       "cpu_ns_p50=%llu cpu_ns_p90=%llu cpu_ns_p99=%llu "
+	       "cpu_ns_max=%llu allocs_per_step=%lld "
+	       "wall_ns_p50=%llu wall_ns_p90=%llu wall_ns_p99=%llu "
+	       "wall_ns_max=%llu\n", run->scenario, n,
+	       (unsigned long long)percentile(cpu, n, 50),
+	       (unsigned long long)percentile(cpu, n, 90),
+	       (unsigned long long)percentile(cpu, n, 99),
+	       (unsigned long long)percentile(cpu, n, 100),
+	       run->count_allocs ? (long long)(allocs / n) : -1LL,
+	       (unsigned long long)percentile(wall, n, 50),
+	       (unsigned long long)percentile(wall, n, 90),
+	       (unsigned long long)percentile(wall, n, 99),
+	       (unsigned long long)percentile(wall, n, 100));
+
+	free(cpu);
+	free(wall);
+	free(run->samples);
+	free(run);
+}
+
+int
+bench_env_int(const char *name, int fallback)
+{
+	const char *value = getenv(name);
+
+	return value ? atoi(value) : fallback;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BENCH_HELPER_H
+#define BENCH_HELPER_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+/*
+ * Benchmark runs. A run is a number of steps, usually one per frame;
+ * each step is measured by the compositor CPU time and allocations it
+ * cost, and by the wall-clock time the client waited for it. Every step
+ * prints a line
+ *
+ *   bench scenario=<name> step=<n> cpu_ns=<n> allocs=<n> wall_ns=<n>
+ *
+ * and the end of the run a bench-summary line with percentiles. allocs
+ * is -1 when the compositor isn't counting allocations.
+ */
+
+struct client;
+struct bench_run;
+
+struct bench_run *
+bench_run_create(struct client *client, const char *scenario, int n_steps);
+
+void
+bench_step_begin(struct bench_run *run);
+
+void
+bench_step_end(struct bench_run *run);
+
+/* Prints the summary */
+void
+bench_run_destroy(struct bench_run *run);
+
+int
+bench_env_int(const char *name, int fallback);
+
+#endif /* BENCH_HELPER_H */
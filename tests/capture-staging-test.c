@@ -0,0 +1,351 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "libweston/capture-staging.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define WIDTH	64
+#define HEIGHT	48
+#define CPP	4
+/* Staging buffers are padded, like VA images usually are */
+#define PITCH_PAD	32
+
+/* Staging buffers in plain memory */
+struct cpu_stub {
+	uint32_t next_id;
+	int created;
+	int destroyed;
+	int reads;
+};
+
+struct cpu_buffer {
+	char *pixels;
+	int pitch;
+};
+
+static int
+cpu_create(void *data, struct capture_staging_buffer *buf)
+{
+	struct cpu_stub *stub = data;
+	struct cpu_buffer *cb = calloc(1, sizeof(*cb));
+
+	cb->pitch = buf->width * CPP + PITCH_PAD;
+	cb->pixels = calloc(buf->height, cb->pitch);
+
+	buf->id = ++stub->next_id;
+	buf->priv = cb;
+	stub->created++;
+
+	return 0;
+}
+
+static void
+cpu_destroy(void *data, struct capture_staging_buffer *buf)
+{
+	struct cpu_stub *stub = data;
+	struct cpu_buffer *cb = buf->priv;
+
+	free(cb->pixels);
+	free(cb);
+	stub->destroyed++;
+}
+
+static void *
+cpu_map(void *data, struct capture_staging_buffer *buf, int *pitch)
+{
+	struct cpu_buffer *cb = buf->priv;
+
+	*pitch = cb->pitch;
+	return cb->pixels;
+}
+
+static void
+cpu_unmap(void *data, struct capture_staging_buffer *buf)
+{
+}
+
+static void
+cpu_begin_read(void *data, void *source)
+{
+	struct cpu_stub *stub = data;
+
+	stub->reads++;
+}
+
+static const struct capture_staging_ops cpu_ops = {
+	cpu_create,
+	cpu_destroy,
+	cpu_map,
+	cpu_unmap,
+	cpu_begin_read,
+	NULL,
+};
+
+struct frame {
+	char *pixels;
+	int width, height, stride;
+};
+
+static void
+frame_init(struct frame *f, int width, int height)
+{
+	f->width = width;
+	f->height = height;
+	/* Sources can be padded too */
+	f->stride = width * CPP + 16;
+	f->pixels = calloc(height, f->stride);
+}
+
+/* Paints a rectangle with a value and reports it as damage */
+static void
+frame_paint(struct frame *f, struct capture_staging *cs,
+	    int x, int y, int w, int h, char value)
+{
+	struct capture_staging_rect rect = { x, y, x + w, y + h };
+	int row;
+
+	for (row = y; row < y + h; row++)
+		memset(f->pixels + row * f->stride + x * CPP, value, w * CPP);
+
+	capture_staging_damage(cs, &rect);
+}
+
+static int
+frame_matches(const struct frame *f, struct capture_staging_buffer *buf)
+{
+	struct cpu_buffer *cb = buf->priv;
+	int row;
+
+	for (row = 0; row < f->height; row++) {
+		if (memcmp(f->pixels + row * f->stride,
+			   cb->pixels + row * cb->pitch, f->width * CPP))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+submit(struct capture_staging *cs, struct frame *f, void *user)
+{
+	struct capture_staging_frame frame = {
+		.pixels = f->pixels,
+		.stride = f->stride,
+		.width = f->width,
+		.height = f->height,
+		.cpp = CPP,
+		.user = user,
+	};
+
+	return capture_staging_submit(cs, &frame);
+}
+
+/* Waits for the copy thread to signal the next frame, like the
+ * compositor's event loop would. */
+static struct capture_staging_buffer *
+collect(struct capture_staging *cs, void **user)
+{
+	struct pollfd pfd = { capture_staging_get_fd(cs), POLLIN, 0 };
+	struct capture_staging_buffer *buf;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		buf = capture_staging_next_done(cs, user);
+		if (buf)
+			return buf;
+		poll(&pfd, 1, 10);
+	}
+
+	return NULL;
+}
+
+ZUC_TEST(capture_staging_test, only_damage_is_copied)
+{
+	struct cpu_stub stub = { 0 };
+	struct capture_staging *cs;
+	struct capture_staging_buffer *buf;
+	struct capture_staging_stats stats;
+	struct frame f;
+	uint64_t full = WIDTH * HEIGHT * CPP;
+
+	cs = capture_staging_create(&cpu_ops, &stub, 1);
+	ZUC_ASSERT_NOT_NULL(cs);
+	frame_init(&f, WIDTH, HEIGHT);
+	frame_paint(&f, cs, 0, 0, WIDTH, HEIGHT, 0x11);
+
+	/* A new buffer gets a full copy */
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	buf = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(buf);
+	ZUC_ASSERT_TRUE(frame_matches(&f, buf));
+	capture_staging_get_stats(cs, &stats);
+	ZUC_ASSERT_EQ(full, stats.bytes_copied);
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, buf->id));
+
+	/* After that, only what changed */
+	frame_paint(&f, cs, 8, 4, 10, 6, 0x22);
+	frame_paint(&f, cs, 40, 30, 5, 5, 0x33);
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	buf = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(buf);
+	ZUC_ASSERT_TRUE(frame_matches(&f, buf));
+	capture_staging_get_stats(cs, &stats);
+	ZUC_ASSERT_EQ(full + (10 * 6 + 5 * 5) * CPP, stats.bytes_copied);
+	ZUC_ASSERT_EQ(1, stats.buffers_created);
+	ZUC_ASSERT_EQ(2, stub.reads);
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, buf->id));
+
+	capture_staging_destroy(cs);
+	ZUC_ASSERT_EQ(stub.created, stub.destroyed);
+	free(f.pixels);
+}
+
+/* Damage is tracked per buffer, so a buffer that missed some frames
+ * catches up on all of them. */
+ZUC_TEST(capture_staging_test, buffers_catch_up_on_missed_damage)
+{
+	struct cpu_stub stub = { 0 };
+	struct capture_staging *cs;
+	struct capture_staging_buffer *a, *b;
+	struct frame f;
+	int i;
+
+	cs = capture_staging_create(&cpu_ops, &stub, 2);
+	ZUC_ASSERT_NOT_NULL(cs);
+	frame_init(&f, WIDTH, HEIGHT);
+	frame_paint(&f, cs, 0, 0, WIDTH, HEIGHT, 0x01);
+
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	a = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(a);
+
+	/* a is still with the client, so this goes into a new buffer */
+	frame_paint(&f, cs, 1, 1, 3, 3, 0x02);
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	b = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(b);
+	ZUC_ASSERT_TRUE(a != b);
+	ZUC_ASSERT_TRUE(frame_matches(&f, b));
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, a->id));
+
+	/* Enough small changes for the damage to collapse to its extents */
+	for (i = 0; i < CAPTURE_STAGING_MAX_RECTS + 4; i++)
+		frame_paint(&f, cs, (i * 7) % (WIDTH - 2), (i * 5) % (HEIGHT - 2),
+			    2, 2, 0x10 + i);
+
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	ZUC_ASSERT_TRUE(collect(cs, NULL) == a);
+	ZUC_ASSERT_TRUE(frame_matches(&f, a));
+
+	capture_staging_destroy(cs);
+	ZUC_ASSERT_EQ(2, stub.created);
+	ZUC_ASSERT_EQ(2, stub.destroyed);
+	free(f.pixels);
+}
+
+ZUC_TEST(capture_staging_test, busy_until_released)
+{
+	struct cpu_stub stub = { 0 };
+	struct capture_staging *cs;
+	struct capture_staging_buffer *buf;
+	struct frame f;
+	void *user;
+	int tags[3];
+
+	cs = capture_staging_create(&cpu_ops, &stub, 2);
+	ZUC_ASSERT_NOT_NULL(cs);
+	frame_init(&f, WIDTH, HEIGHT);
+
+	ZUC_ASSERT_EQ(0, submit(cs, &f, &tags[0]));
+	ZUC_ASSERT_EQ(0, submit(cs, &f, &tags[1]));
+	ZUC_ASSERT_EQ(EBUSY, submit(cs, &f, &tags[2]));
+
+	/* Frames come back in the order they were submitted */
+	buf = collect(cs, &user);
+	ZUC_ASSERT_TRUE(user == &tags[0]);
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, buf->id));
+	ZUC_ASSERT_EQ(-1, capture_staging_release(cs, buf->id));
+
+	ZUC_ASSERT_EQ(0, submit(cs, &f, &tags[2]));
+	ZUC_ASSERT_NOT_NULL(collect(cs, &user));
+	ZUC_ASSERT_TRUE(user == &tags[1]);
+	ZUC_ASSERT_NOT_NULL(collect(cs, &user));
+	ZUC_ASSERT_TRUE(user == &tags[2]);
+	ZUC_ASSERT_NULL(capture_staging_next_done(cs, &user));
+
+	ZUC_ASSERT_EQ(2, stub.created);
+
+	capture_staging_destroy(cs);
+	ZUC_ASSERT_EQ(2, stub.destroyed);
+	free(f.pixels);
+}
+
+ZUC_TEST(capture_staging_test, resize_replaces_buffers)
+{
+	struct cpu_stub stub = { 0 };
+	struct capture_staging *cs;
+	struct capture_staging_buffer *old, *buf;
+	struct frame f, g;
+
+	cs = capture_staging_create(&cpu_ops, &stub, 2);
+	ZUC_ASSERT_NOT_NULL(cs);
+	frame_init(&f, WIDTH, HEIGHT);
+	frame_init(&g, WIDTH / 2, HEIGHT * 2);
+
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	ZUC_ASSERT_EQ(0, submit(cs, &f, NULL));
+	old = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(old);
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, old->id));
+	old = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(old);
+
+	/* The free buffer goes right away, the other one once released */
+	frame_paint(&g, cs, 0, 0, g.width, g.height, 0x44);
+	ZUC_ASSERT_EQ(0, submit(cs, &g, NULL));
+	ZUC_ASSERT_EQ(1, stub.destroyed);
+	buf = collect(cs, NULL);
+	ZUC_ASSERT_NOT_NULL(buf);
+	ZUC_ASSERT_EQ(g.width, buf->width);
+	ZUC_ASSERT_TRUE(frame_matches(&g, buf));
+
+	ZUC_ASSERT_EQ(0, capture_staging_release(cs, old->id));
+	ZUC_ASSERT_EQ(2, stub.destroyed);
+
+	capture_staging_destroy(cs);
+	ZUC_ASSERT_EQ(stub.created, stub.destroyed);
+	free(f.pixels);
+	free(g.pixels);
+}
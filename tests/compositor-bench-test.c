@@ -0,0 +1,349 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Core compositor benchmarks on the headless backend, see bench-helper.h
+ * for the output. The noop renderer is used unless WESTON_BENCH_PIXMAN is
+ * set. WESTON_BENCH_FRAMES, WESTON_BENCH_SURFACES, WESTON_BENCH_COMMITS
+ * and WESTON_BENCH_EVENTS scale the scenarios.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <linux/input.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "bench-helper.h"
+
+#define SURFACE_SIZE 32
+#define PARENT_SIZE 256
+
+char *server_parameters = "";
+
+static void __attribute__((constructor))
+select_renderer(void)
+{
+	if (getenv("WESTON_BENCH_PIXMAN"))
+		server_parameters = "--use-pixman";
+}
+
+static struct wl_subcompositor *
+get_subcompositor(struct client *client)
+{
+	struct global *g;
+	struct wl_subcompositor *sub = NULL;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "wl_subcompositor"))
+			continue;
+
+		sub = wl_registry_bind(client->wl_registry, g->name,
+				       &wl_subcompositor_interface, 1);
+	}
+
+	assert(sub && "no wl_subcompositor found");
+
+	return sub;
+}
+
+static void
+commit_damage(struct surface *surface, int *done)
+{
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0,
+			  surface->width, surface->height);
+	if (done)
+		frame_callback_set(surface->wl_surface, done);
+	wl_surface_commit(surface->wl_surface);
+}
+
+/* Synchronized subsurfaces all updating, applied by their parent */
+TEST(subsurfaces)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct wl_subsurface **subs;
+	struct surface **children;
+	struct bench_run *run;
+	int n_frames = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_subs = bench_env_int("WESTON_BENCH_SURFACES", 16);
+	int per_row = PARENT_SIZE / SURFACE_SIZE;
+	int i, frame, done;
+
+	client = create_client_and_test_surface(0, 0, PARENT_SIZE,
+						PARENT_SIZE);
+	subco = get_subcompositor(client);
+
+	subs = xzalloc(n_subs * sizeof *subs);
+	children = xzalloc(n_subs * sizeof *children);
+	for (i = 0; i < n_subs; i++) {
+		children[i] = create_test_surface(client);
+		children[i]->width = SURFACE_SIZE;
+		children[i]->height = SURFACE_SIZE;
+		children[i]->buffer =
+			create_shm_buffer_a8r8g8b8(client, SURFACE_SIZE,
+						   SURFACE_SIZE);
+		subs[i] = wl_subcompositor_get_subsurface(subco,
+						children[i]->wl_surface,
+						client->surface->wl_surface);
+		wl_subsurface_set_position(subs[i],
+					   (i % per_row) * SURFACE_SIZE,
+					   (i / per_row) * SURFACE_SIZE);
+	}
+
+	/* Mapping them isn't part of the benchmark */
+	for (i = 0; i < n_subs; i++)
+		commit_damage(children[i], NULL);
+	commit_damage(client->surface, &done);
+	frame_callback_wait(client, &done);
+
+	run = bench_run_create(client, "subsurfaces", n_frames);
+	for (frame = 0; frame < n_frames; frame++) {
+		bench_step_begin(run);
+		for (i = 0; i < n_subs; i++)
+			commit_damage(children[i], NULL);
+		commit_damage(client->surface, &done);
+		frame_callback_wait(client, &done);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	for (i = 0; i < n_subs; i++) {
+		wl_subsurface_destroy(subs[i]);
+		wl_surface_destroy(children[i]->wl_surface);
+		buffer_destroy(children[i]->buffer);
+		free(children[i]);
+	}
+	free(children);
+	free(subs);
+	wl_subcompositor_destroy(subco);
+}
+
+static struct surface *
+create_bench_surface(struct client *client, int width, int height)
+{
+	struct surface *surface;
+
+	surface = create_test_surface(client);
+	surface->width = width;
+	surface->height = height;
+	surface->buffer = create_shm_buffer_a8r8g8b8(client, width, height);
+
+	return surface;
+}
+
+static void
+bench_surface_destroy(struct surface *surface)
+{
+	wl_surface_destroy(surface->wl_surface);
+	buffer_destroy(surface->buffer);
+	free(surface);
+}
+
+/*
+ * A mostly static scene: windows with sub-surfaces, of which only one
+ * updates. Nothing is restacked, so the view list needn't be rebuilt.
+ */
+TEST(static_scene)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct surface **windows, **children;
+	struct wl_subsurface **subs;
+	struct bench_run *run;
+	int n_frames = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_windows = bench_env_int("WESTON_BENCH_SURFACES", 16);
+	int n_children = 4;
+	int i, j, frame, done;
+
+	client = create_client_and_test_surface(0, 0, SURFACE_SIZE * 2,
+						SURFACE_SIZE * 2);
+	subco = get_subcompositor(client);
+
+	windows = xzalloc(n_windows * sizeof *windows);
+	children = xzalloc(n_windows * n_children * sizeof *children);
+	subs = xzalloc(n_windows * n_children * sizeof *subs);
+	windows[0] = client->surface;
+	for (i = 1; i < n_windows; i++) {
+		windows[i] = create_bench_surface(client, SURFACE_SIZE * 2,
+						  SURFACE_SIZE * 2);
+		windows[i]->x = (i % 8) * SURFACE_SIZE * 2;
+		windows[i]->y = (i / 8) * SURFACE_SIZE * 2;
+		weston_test_move_surface(client->test->weston_test,
+					 windows[i]->wl_surface,
+					 windows[i]->x, windows[i]->y);
+	}
+
+	for (i = 0; i < n_windows; i++) {
+		for (j = 0; j < n_children; j++) {
+			struct surface *child;
+			int k = i * n_children + j;
+
+			child = create_bench_surface(client, SURFACE_SIZE / 2,
+						     SURFACE_SIZE / 2);
+			subs[k] = wl_subcompositor_get_subsurface(subco,
+						child->wl_surface,
+						windows[i]->wl_surface);
+			wl_subsurface_set_position(subs[k],
+						   j * SURFACE_SIZE / 2, 0);
+			commit_damage(child, NULL);
+			children[k] = child;
+		}
+		commit_damage(windows[i], i == n_windows - 1 ? &done : NULL);
+	}
+	frame_callback_wait(client, &done);
+
+	run = bench_run_create(client, "static_scene", n_frames);
+	for (frame = 0; frame < n_frames; frame++) {
+		bench_step_begin(run);
+		commit_damage(client->surface, &done);
+		frame_callback_wait(client, &done);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	for (i = 0; i < n_windows * n_children; i++) {
+		wl_subsurface_destroy(subs[i]);
+		bench_surface_destroy(children[i]);
+	}
+	for (i = 1; i < n_windows; i++)
+		bench_surface_destroy(windows[i]);
+	free(subs);
+	free(children);
+	free(windows);
+	wl_subcompositor_destroy(subco);
+}
+
+/* Many commits per frame, of which only the last is presented */
+TEST(high_frequency_commits)
+{
+	struct client *client;
+	struct surface *surface;
+	struct buffer *buffers[2];
+	struct bench_run *run;
+	int n_frames = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_commits = bench_env_int("WESTON_BENCH_COMMITS", 8);
+	int i, frame, done;
+
+	client = create_client_and_test_surface(0, 0, PARENT_SIZE,
+						PARENT_SIZE);
+	surface = client->surface;
+	buffers[0] = surface->buffer;
+	buffers[1] = create_shm_buffer_a8r8g8b8(client, PARENT_SIZE,
+						PARENT_SIZE);
+
+	run = bench_run_create(client, "high_frequency_commits", n_frames);
+	for (frame = 0; frame < n_frames; frame++) {
+		bench_step_begin(run);
+		for (i = 0; i < n_commits; i++) {
+			wl_surface_attach(surface->wl_surface,
+					  buffers[i & 1]->proxy, 0, 0);
+			wl_surface_damage(surface->wl_surface,
+					  (i * SURFACE_SIZE) % PARENT_SIZE, 0,
+					  SURFACE_SIZE, SURFACE_SIZE);
+			if (i == n_commits - 1)
+				frame_callback_set(surface->wl_surface, &done);
+			wl_surface_commit(surface->wl_surface);
+		}
+		frame_callback_wait(client, &done);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	buffer_destroy(buffers[1]);
+}
+
+/* Pointer, button, axis and key events in bursts, without repaints */
+TEST(input_storm)
+{
+	struct client *client;
+	struct weston_test *test;
+	struct bench_run *run;
+	struct timespec time = { 0 };
+	uint32_t sec_hi = 0, sec_lo = 0, nsec = 0;
+	int buttons = 0, keys = 0;
+	int n_steps = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_events = bench_env_int("WESTON_BENCH_EVENTS", 32);
+	int step, i;
+
+	client = create_client_and_test_surface(0, 0, PARENT_SIZE,
+						PARENT_SIZE);
+	test = client->test->weston_test;
+	weston_test_activate_surface(test, client->surface->wl_surface);
+	client_roundtrip(client);
+
+	run = bench_run_create(client, "input_storm", n_steps);
+	for (step = 0; step < n_steps; step++) {
+		bench_step_begin(run);
+		for (i = 0; i < n_events; i++) {
+			timespec_add_msec(&time, &time, 1);
+			timespec_to_proto(&time, &sec_hi, &sec_lo, &nsec);
+
+			switch (i % 4) {
+			case 0:
+				weston_test_move_pointer(test, sec_hi, sec_lo,
+							 nsec, i % PARENT_SIZE,
+							 step % PARENT_SIZE);
+				break;
+			case 1:
+				weston_test_send_button(test, sec_hi, sec_lo,
+							nsec, BTN_LEFT,
+							!(buttons++ & 1));
+				break;
+			case 2:
+				weston_test_send_axis(test, sec_hi, sec_lo,
+						      nsec,
+						      WL_POINTER_AXIS_VERTICAL_SCROLL,
+						      wl_fixed_from_int(1));
+				break;
+			case 3:
+				weston_test_send_key(test, sec_hi, sec_lo,
+						     nsec, KEY_A,
+						     !(keys++ & 1));
+				break;
+			}
+		}
+		client_roundtrip(client);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	/* Don't leave anything pressed */
+	if (buttons & 1)
+		weston_test_send_button(test, sec_hi, sec_lo, nsec, BTN_LEFT,
+					WL_POINTER_BUTTON_STATE_RELEASED);
+	if (keys & 1)
+		weston_test_send_key(test, sec_hi, sec_lo, nsec, KEY_A,
+				     WL_KEYBOARD_KEY_STATE_RELEASED);
+	client_roundtrip(client);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libweston/damage-merge.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/* A call costs as much as 4096 bytes, at 4 bytes per pixel */
+#define CALL_COST 4096
+#define PIXEL_COST 4
+
+static bool
+box_contains(const struct damage_merge_box *outer,
+	     const struct damage_merge_box *inner)
+{
+	return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+	       outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+/* Everything damaged is still covered */
+static void
+assert_covered(const struct damage_merge_box *orig, int n_orig,
+	       const struct damage_merge_box *merged, int n_merged)
+{
+	int i, k;
+	bool found;
+
+	for (i = 0; i < n_orig; i++) {
+		found = false;
+		for (k = 0; k < n_merged; k++)
+			found = found || box_contains(&merged[k], &orig[i]);
+		ZUC_ASSERT_TRUE(found);
+	}
+}
+
+ZUC_TEST(damage_merge_test, nothing_to_merge)
+{
+	struct damage_merge_box boxes[] = {
+		{ 0, 0, 64, 64 },
+	};
+
+	ZUC_ASSERT_EQ(0, damage_merge(boxes, 0, CALL_COST, PIXEL_COST));
+	ZUC_ASSERT_EQ(1, damage_merge(boxes, 1, CALL_COST, PIXEL_COST));
+	ZUC_ASSERT_EQ(64, boxes[0].x2);
+	ZUC_ASSERT_EQ(64, boxes[0].y2);
+}
+
+ZUC_TEST(damage_merge_test, neighbours_are_merged)
+{
+	struct damage_merge_box boxes[] = {
+		{ 0, 0, 8, 16 },
+		{ 8, 0, 16, 16 },
+		{ 24, 0, 32, 16 },
+	};
+
+	/* The gap costs less than the extra calls */
+	ZUC_ASSERT_EQ(1, damage_merge(boxes, ARRAY_LENGTH(boxes),
+				      CALL_COST, PIXEL_COST));
+	ZUC_ASSERT_EQ(0, boxes[0].x1);
+	ZUC_ASSERT_EQ(0, boxes[0].y1);
+	ZUC_ASSERT_EQ(32, boxes[0].x2);
+	ZUC_ASSERT_EQ(16, boxes[0].y2);
+}
+
+ZUC_TEST(damage_merge_test, distant_boxes_stay_apart)
+{
+	struct damage_merge_box boxes[] = {
+		{ 0, 0, 100, 100 },
+		{ 1820, 980, 1920, 1080 },
+	};
+
+	ZUC_ASSERT_EQ(2, damage_merge(boxes, ARRAY_LENGTH(boxes),
+				      CALL_COST, PIXEL_COST));
+	ZUC_ASSERT_EQ(0, boxes[0].x1);
+	ZUC_ASSERT_EQ(1820, boxes[1].x1);
+}
+
+ZUC_TEST(damage_merge_test, free_calls_only_merge_overlaps)
+{
+	struct damage_merge_box boxes[] = {
+		{ 0, 0, 10, 10 },
+		{ 10, 0, 20, 10 },
+		{ 12, 2, 22, 10 },
+	};
+
+	ZUC_ASSERT_EQ(2, damage_merge(boxes, ARRAY_LENGTH(boxes),
+				      0, PIXEL_COST));
+	ZUC_ASSERT_EQ(10, boxes[0].x2);
+	ZUC_ASSERT_EQ(10, boxes[1].x1);
+	ZUC_ASSERT_EQ(22, boxes[1].x2);
+	ZUC_ASSERT_EQ(10, boxes[1].y2);
+}
+
+ZUC_TEST(damage_merge_test, terminal_lines)
+{
+	struct damage_merge_box orig[3 * 40], boxes[3 * 40];
+	int line, cell, n = 0, merged;
+
+	/* Every other 8x16 glyph cell on three lines, 20 lines apart */
+	for (line = 0; line < 3; line++) {
+		for (cell = 0; cell < 40; cell++) {
+			orig[n].x1 = cell * 16;
+			orig[n].y1 = line * 20 * 16;
+			orig[n].x2 = cell * 16 + 8;
+			orig[n].y2 = line * 20 * 16 + 16;
+			boxes[n] = orig[n];
+			n++;
+		}
+	}
+
+	merged = damage_merge(boxes, n, CALL_COST, PIXEL_COST);
+
+	/* One upload per line, the lines in between aren't worth it */
+	ZUC_ASSERT_EQ(3, merged);
+	assert_covered(orig, n, boxes, merged);
+	ZUC_ASSERT_TRUE(damage_merge_cost(boxes, merged,
+					  CALL_COST, PIXEL_COST) <
+			damage_merge_cost(orig, n, CALL_COST, PIXEL_COST));
+}
+
+ZUC_TEST(damage_merge_test, never_costs_more)
+{
+	struct damage_merge_box orig[64], boxes[64];
+	uint32_t seed = 1;
+	int i, merged;
+
+	for (i = 0; i < 64; i++) {
+		seed = seed * 1103515245 + 12345;
+		orig[i].x1 = (seed >> 8) % 1900;
+		orig[i].y1 = (seed >> 16) % 1060;
+		orig[i].x2 = orig[i].x1 + 1 + (seed >> 4) % 20;
+		orig[i].y2 = orig[i].y1 + 1 + (seed >> 12) % 20;
+		boxes[i] = orig[i];
+	}
+
+	merged = damage_merge(boxes, 64, CALL_COST, PIXEL_COST);
+
+	ZUC_ASSERT_TRUE(merged <= 64);
+	assert_covered(orig, 64, boxes, merged);
+	ZUC_ASSERT_TRUE(damage_merge_cost(boxes, merged,
+					  CALL_COST, PIXEL_COST) <=
+			damage_merge_cost(orig, 64, CALL_COST, PIXEL_COST));
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "weston-test-client-helper.h"
+#include "ias-shell-client-protocol.h"
+
+/*
+ * A client that commits its surface while an ias_hmi transaction holds
+ * changes for it must not apply those changes early; they only show once
+ * the HMI commits.
+ */
+
+struct hmi_state {
+	struct ias_shell *shell;
+	struct ias_hmi *hmi;
+	uint32_t id;
+	int32_t x, y;
+	uint32_t zorder;
+	int infos;
+};
+
+static void
+hmi_surface_info(void *data, struct ias_hmi *hmi, uint32_t id,
+		const char *title, uint32_t z_order, int32_t x, int32_t y,
+		uint32_t width, uint32_t height, uint32_t alpha,
+		uint32_t behavior, uint32_t pid, const char *pname,
+		uint32_t output, uint32_t flipped)
+{
+	struct hmi_state *state = data;
+
+	if (strcmp(title, "txn-test")) {
+		return;
+	}
+
+	state->id = id;
+	state->x = x;
+	state->y = y;
+	state->zorder = z_order;
+	state->infos++;
+}
+
+static void
+hmi_surface_destroyed(void *data, struct ias_hmi *hmi, uint32_t id,
+		const char *title, uint32_t pid, const char *pname)
+{
+}
+
+static void
+hmi_surface_sharing_info(void *data, struct ias_hmi *hmi, uint32_t id,
+		const char *title, uint32_t shareable, uint32_t pid,
+		const char *pname)
+{
+}
+
+static void
+hmi_raw_buffer_handle(void *data, struct ias_hmi *hmi, int32_t handle,
+		uint32_t timestamp, uint32_t frame_number, uint32_t stride0,
+		uint32_t stride1, uint32_t stride2, uint32_t format,
+		uint32_t out_width, uint32_t out_height, uint32_t shm_surf_id,
+		uint32_t buf_id, uint32_t image_id)
+{
+}
+
+static void
+hmi_raw_buffer_fd(void *data, struct ias_hmi *hmi, int32_t prime_fd,
+		uint32_t timestamp, uint32_t frame_number, uint32_t stride0,
+		uint32_t stride1, uint32_t stride2, uint32_t format,
+		uint32_t out_width, uint32_t out_height)
+{
+}
+
+static void
+hmi_capture_error(void *data, struct ias_hmi *hmi, int32_t pid,
+		int32_t error)
+{
+}
+
+static void
+hmi_capture_stats(void *data, struct ias_hmi *hmi, uint32_t surfid,
+		uint32_t output_number, uint32_t captured,
+		uint32_t skipped_rate, uint32_t skipped_busy,
+		uint32_t deferred)
+{
+}
+
+static void
+hmi_surface_info_stats(void *data, struct ias_hmi *hmi, uint32_t sent,
+		uint32_t coalesced, uint32_t filtered)
+{
+}
+
+static const struct ias_hmi_listener hmi_listener = {
+	hmi_surface_info,
+	hmi_surface_destroyed,
+	hmi_surface_sharing_info,
+	hmi_raw_buffer_handle,
+	hmi_raw_buffer_fd,
+	hmi_capture_error,
+	hmi_capture_stats,
+	hmi_surface_info_stats,
+};
+
+static void
+bind_ias(struct client *client, struct hmi_state *state)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (!strcmp(g->interface, "ias_shell")) {
+			state->shell = wl_registry_bind(client->wl_registry,
+					g->name, &ias_shell_interface, 1);
+		} else if (!strcmp(g->interface, "ias_hmi")) {
+			assert(g->version >= 3);
+			state->hmi = wl_registry_bind(client->wl_registry,
+					g->name, &ias_hmi_interface, 3);
+		}
+	}
+
+	assert(state->shell && "no ias_shell found");
+	assert(state->hmi && "no ias_hmi found");
+	ias_hmi_add_listener(state->hmi, &hmi_listener, state);
+}
+
+/* Plain client commit of a new frame, like any application would do */
+static void
+client_commit(struct client *client)
+{
+	struct surface *surface = client->surface;
+	int done;
+
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, surface->width,
+			  surface->height);
+	frame_callback_set(surface->wl_surface, &done);
+	wl_surface_commit(surface->wl_surface);
+	frame_callback_wait(client, &done);
+
+	/* surface_info goes out once the frame is drawn */
+	client_roundtrip(client);
+}
+
+TEST(client_commit_within_hmi_transaction)
+{
+	struct client *client;
+	struct surface *surface;
+	struct ias_surface *ias_surface;
+	struct hmi_state state = { 0 };
+	int32_t x, y;
+	uint32_t zorder;
+
+	client = create_client();
+	bind_ias(client, &state);
+
+	surface = create_test_surface(client);
+	client->surface = surface;
+	surface->width = 64;
+	surface->height = 64;
+	surface->buffer = create_shm_buffer_a8r8g8b8(client, 64, 64);
+	ias_surface = ias_shell_get_ias_surface(state.shell,
+			surface->wl_surface, "txn-test");
+
+	client_commit(client);
+	assert(state.infos > 0);
+	x = state.x;
+	y = state.y;
+	zorder = state.zorder;
+	assert(!(zorder & 0xff000000));
+
+	ias_hmi_begin(state.hmi);
+	ias_hmi_move_surface(state.hmi, state.id, x + 100, y + 50);
+	ias_hmi_zorder_surface(state.hmi, state.id, zorder + 1);
+
+	/* The client's own commit leaves the held back changes alone */
+	client_commit(client);
+	client_commit(client);
+	assert(state.x == x && state.y == y);
+	assert(state.zorder == zorder);
+
+	ias_hmi_commit(state.hmi);
+	client_roundtrip(client);
+	client_commit(client);
+	assert(state.x == x + 100 && state.y == y + 50);
+	assert(state.zorder == zorder + 1);
+
+	ias_surface_destroy(ias_surface);
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * ivi-shell benchmarks, see bench-helper.h for the output. No layout
+ * controller runs, so the surfaces never reach the screen: these measure
+ * the ivi-shell and ivi-layout side of commits and of surface lifetimes.
+ * WESTON_BENCH_FRAMES and WESTON_BENCH_SURFACES scale the scenarios.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "ivi-application-client-protocol.h"
+#include "bench-helper.h"
+
+#define SURFACE_SIZE 32
+#define IVI_ID_BASE 0x1000
+
+struct bench_window {
+	struct wl_surface *wl_surface;
+	struct ivi_surface *ivi_surface;
+};
+
+static struct ivi_application *
+get_ivi_application(struct client *client)
+{
+	struct global *g;
+	struct ivi_application *iviapp = NULL;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "ivi_application"))
+			continue;
+
+		iviapp = wl_registry_bind(client->wl_registry, g->name,
+					  &ivi_application_interface, 1);
+	}
+
+	assert(iviapp && "no ivi_application found");
+
+	return iviapp;
+}
+
+static void
+window_create(struct client *client, struct ivi_application *iviapp,
+	      struct bench_window *wnd, uint32_t ivi_id)
+{
+	wnd->wl_surface = wl_compositor_create_surface(client->wl_compositor);
+	wnd->ivi_surface = ivi_application_surface_create(iviapp, ivi_id,
+							  wnd->wl_surface);
+}
+
+static void
+window_destroy(struct bench_window *wnd)
+{
+	ivi_surface_destroy(wnd->ivi_surface);
+	wl_surface_destroy(wnd->wl_surface);
+}
+
+static void
+window_commit(struct bench_window *wnd, struct buffer *buffer)
+{
+	wl_surface_attach(wnd->wl_surface, buffer->proxy, 0, 0);
+	wl_surface_damage(wnd->wl_surface, 0, 0, SURFACE_SIZE, SURFACE_SIZE);
+	wl_surface_commit(wnd->wl_surface);
+}
+
+/* Every ivi surface committing new content */
+TEST(ivi_surface_commits)
+{
+	struct client *client;
+	struct ivi_application *iviapp;
+	struct bench_window *windows;
+	struct buffer *buffer;
+	struct bench_run *run;
+	int n_steps = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_windows = bench_env_int("WESTON_BENCH_SURFACES", 16);
+	int step, i;
+
+	client = create_client();
+	iviapp = get_ivi_application(client);
+	buffer = create_shm_buffer_a8r8g8b8(client, SURFACE_SIZE,
+					    SURFACE_SIZE);
+
+	windows = xzalloc(n_windows * sizeof *windows);
+	for (i = 0; i < n_windows; i++) {
+		window_create(client, iviapp, &windows[i], IVI_ID_BASE + i);
+		window_commit(&windows[i], buffer);
+	}
+	client_roundtrip(client);
+
+	run = bench_run_create(client, "ivi_surface_commits", n_steps);
+	for (step = 0; step < n_steps; step++) {
+		bench_step_begin(run);
+		for (i = 0; i < n_windows; i++)
+			window_commit(&windows[i], buffer);
+		client_roundtrip(client);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	for (i = 0; i < n_windows; i++)
+		window_destroy(&windows[i]);
+	free(windows);
+	buffer_destroy(buffer);
+	ivi_application_destroy(iviapp);
+}
+
+/* Every ivi surface created, mapped and destroyed again */
+TEST(ivi_surface_churn)
+{
+	struct client *client;
+	struct ivi_application *iviapp;
+	struct bench_window *windows;
+	struct buffer *buffer;
+	struct bench_run *run;
+	int n_steps = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int n_windows = bench_env_int("WESTON_BENCH_SURFACES", 16);
+	int step, i;
+
+	client = create_client();
+	iviapp = get_ivi_application(client);
+	buffer = create_shm_buffer_a8r8g8b8(client, SURFACE_SIZE,
+					    SURFACE_SIZE);
+	windows = xzalloc(n_windows * sizeof *windows);
+
+	run = bench_run_create(client, "ivi_surface_churn", n_steps);
+	for (step = 0; step < n_steps; step++) {
+		bench_step_begin(run);
+		for (i = 0; i < n_windows; i++) {
+			window_create(client, iviapp, &windows[i],
+				      IVI_ID_BASE + i);
+			window_commit(&windows[i], buffer);
+		}
+		for (i = 0; i < n_windows; i++)
+			window_destroy(&windows[i]);
+		client_roundtrip(client);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	free(windows);
+	buffer_destroy(buffer);
+	ivi_application_destroy(iviapp);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Pixman renderer benchmark on the headless backend, see bench-helper.h
+ * for the output. A full HD desktop of opaque and translucent windows is
+ * damaged whole every frame, and repainted first without tiles on the
+ * compositor thread alone, then in tiles on WESTON_BENCH_THREADS threads.
+ * Every run also prints the pixels the renderer wrote per frame, and the
+ * output has to be the same in both.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "bench-helper.h"
+
+char *server_parameters = "--use-pixman --width=1920 --height=1080";
+
+struct bench_window {
+	int x, y, width, height;
+	bool has_alpha;
+	bool opaque_region;	/* the client says it is opaque */
+	bool translucent;	/* has pixels that aren't */
+};
+
+/* Bottom to top */
+static const struct bench_window scene[] = {
+	{ 0, 0, 1920, 1080, false, false, false },
+	{ 100, 80, 1200, 800, false, false, false },
+	{ 640, 200, 1200, 800, true, true, false },
+	{ 300, 500, 800, 500, true, false, true },
+	{ 1100, 120, 640, 400, true, false, true },
+};
+
+static void
+fill_pattern(struct buffer *buffer, int seed, bool translucent)
+{
+	uint32_t *pixels = pixman_image_get_data(buffer->image);
+	int stride = pixman_image_get_stride(buffer->image) / 4;
+	int width = pixman_image_get_width(buffer->image);
+	int height = pixman_image_get_height(buffer->image);
+	uint32_t r, g, b, a;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			r = (x + seed * 40) & 0xff;
+			g = (y + seed * 90) & 0xff;
+			b = (x ^ y) & 0xff;
+			a = 0xff;
+
+			/* Premultiplied */
+			if (translucent) {
+				a = 0x60 + ((x + y) & 0x7f);
+				r = r * a / 0xff;
+				g = g * a / 0xff;
+				b = b * a / 0xff;
+			}
+
+			pixels[y * stride + x] = a << 24 | r << 16 | g << 8 | b;
+		}
+	}
+}
+
+static struct surface *
+create_window(struct client *client, const struct bench_window *spec,
+	      int seed)
+{
+	struct surface *surface;
+	struct wl_region *region;
+
+	surface = create_test_surface(client);
+	surface->x = spec->x;
+	surface->y = spec->y;
+	surface->width = spec->width;
+	surface->height = spec->height;
+	if (spec->has_alpha)
+		surface->buffer = create_shm_buffer_a8r8g8b8(client,
+							     spec->width,
+							     spec->height);
+	else
+		surface->buffer = create_shm_buffer_x8r8g8b8(client,
+							     spec->width,
+							     spec->height);
+	fill_pattern(surface->buffer, seed, spec->translucent);
+
+	if (spec->opaque_region) {
+		region = wl_compositor_create_region(client->wl_compositor);
+		wl_region_add(region, 0, 0, spec->width, spec->height);
+		wl_surface_set_opaque_region(surface->wl_surface, region);
+		wl_region_destroy(region);
+	}
+
+	weston_test_move_surface(client->test->weston_test,
+				 surface->wl_surface, surface->x, surface->y);
+
+	return surface;
+}
+
+/* Every window damaged whole, one frame */
+static void
+commit_frame(struct client *client, struct surface **windows, int n)
+{
+	int i, done;
+
+	for (i = 0; i < n; i++) {
+		wl_surface_attach(windows[i]->wl_surface,
+				  windows[i]->buffer->proxy, 0, 0);
+		wl_surface_damage(windows[i]->wl_surface, 0, 0,
+				  windows[i]->width, windows[i]->height);
+		if (i == n - 1)
+			frame_callback_set(windows[i]->wl_surface, &done);
+		wl_surface_commit(windows[i]->wl_surface);
+	}
+
+	frame_callback_wait(client, &done);
+}
+
+static void
+get_render_usage(struct client *client, int *threads, uint64_t *pixels)
+{
+	struct test *test = client->test;
+
+	test->render_usage_done = 0;
+	weston_test_get_render_usage(test->weston_test);
+	while (!test->render_usage_done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	*threads = test->render_threads;
+	*pixels = test->pixels_written;
+}
+
+/* Returns the screenshot of the last frame */
+static struct buffer *
+run_frames(struct client *client, struct surface **windows, int n_windows,
+	   int threads, int n_frames)
+{
+	struct bench_run *run;
+	char scenario[64];
+	uint64_t pixels_start, pixels_end;
+	int frame, current;
+
+	weston_test_set_render_threads(client->test->weston_test, threads);
+	commit_frame(client, windows, n_windows);
+
+	get_render_usage(client, &current, &pixels_start);
+	assert(current == threads);
+
+	if (threads == 0)
+		snprintf(scenario, sizeof scenario, "pixman_untiled");
+	else
+		snprintf(scenario, sizeof scenario, "pixman_tiled_%d", threads);
+
+	run = bench_run_create(client, scenario, n_frames);
+	for (frame = 0; frame < n_frames; frame++) {
+		bench_step_begin(run);
+		commit_frame(client, windows, n_windows);
+		bench_step_end(run);
+	}
+	bench_run_destroy(run);
+
+	get_render_usage(client, &current, &pixels_end);
+	printf("bench-pixels scenario=%s threads=%d pixels_per_frame=%llu\n",
+	       scenario, threads,
+	       (unsigned long long)(pixels_end - pixels_start) / n_frames);
+
+	return capture_screenshot_of_output(client);
+}
+
+static void
+write_screenshot(struct buffer *shot, const char *basename)
+{
+	char *fname;
+
+	fname = screenshot_output_filename(basename, 0);
+	write_image_as_png(shot->image, fname);
+	free(fname);
+}
+
+TEST(tiled_repaint)
+{
+	struct client *client;
+	struct surface *windows[ARRAY_LENGTH(scene)];
+	struct buffer *untiled, *tiled;
+	bool match;
+	int n_frames = bench_env_int("WESTON_BENCH_FRAMES", 120);
+	int threads = bench_env_int("WESTON_BENCH_THREADS", 4);
+	int i;
+
+	client = create_client();
+	assert(wl_proxy_get_version((struct wl_proxy *)
+				    client->test->weston_test) >= 3);
+
+	for (i = 0; i < (int)ARRAY_LENGTH(scene); i++)
+		windows[i] = create_window(client, &scene[i], i);
+
+	untiled = run_frames(client, windows, ARRAY_LENGTH(scene), 0,
+			     n_frames);
+	tiled = run_frames(client, windows, ARRAY_LENGTH(scene), threads,
+			   n_frames);
+
+	match = check_images_match(untiled->image, tiled->image, NULL);
+	if (!match) {
+		write_screenshot(untiled, "pixman-bench-untiled");
+		write_screenshot(tiled, "pixman-bench-tiled");
+	}
+	assert(match && "tiled repaint differs");
+
+	buffer_destroy(untiled);
+	buffer_destroy(tiled);
+	for (i = 0; i < (int)ARRAY_LENGTH(scene); i++) {
+		wl_surface_destroy(windows[i]->wl_surface);
+		buffer_destroy(windows[i]->buffer);
+		free(windows[i]);
+	}
+}
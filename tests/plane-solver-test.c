@@ -0,0 +1,292 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libweston/plane-solver.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/*
+ * Stands in for the display: accepts up to max_planes sprites at once,
+ * and never view reject_view on sprite reject_sprite.
+ */
+struct mock_kms {
+	struct plane_solver_kms base;
+	int max_planes;
+	int reject_view;
+	int reject_sprite;
+	int n_tests;
+};
+
+static int
+mock_kms_test(struct plane_solver_kms *base,
+	      const struct plane_solver_view *views,
+	      const int *sprite, int n_views)
+{
+	struct mock_kms *kms = container_of(base, struct mock_kms, base);
+	int i, planes = 0;
+
+	kms->n_tests++;
+
+	for (i = 0; i < n_views; i++) {
+		if (sprite[i] < 0)
+			continue;
+
+		if (i == kms->reject_view && sprite[i] == kms->reject_sprite)
+			return -1;
+		planes++;
+	}
+
+	return planes <= kms->max_planes ? 0 : -1;
+}
+
+static void
+mock_kms_init(struct mock_kms *kms, int max_planes)
+{
+	memset(kms, 0, sizeof *kms);
+	kms->base.test = mock_kms_test;
+	kms->max_planes = max_planes;
+	kms->reject_view = -1;
+	kms->reject_sprite = -1;
+}
+
+static void
+solve(struct mock_kms *kms, int n_sprites, int max_tests,
+      const struct plane_solver_view *views, int n_views,
+      int *sprite, struct plane_solver_result *result)
+{
+	struct plane_solver *solver;
+
+	solver = plane_solver_create(8, n_sprites, max_tests);
+	ZUC_ASSERT_NOT_NULL(solver);
+	plane_solver_solve(solver, &kms->base, views, n_views, sprite, result);
+	plane_solver_destroy(solver);
+
+	ZUC_ASSERT_EQ(kms->n_tests, result->n_tests);
+}
+
+ZUC_TEST(plane_solver_test, ineligible_views_are_composited)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 100, 100, 0 },
+		{ 200, 0, 300, 100, 0 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 3);
+	solve(&kms, 3, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(-1, sprite[0]);
+	ZUC_ASSERT_EQ(-1, sprite[1]);
+	ZUC_ASSERT_EQ(0, result.n_scanout);
+	ZUC_ASSERT_EQ(0, result.scanout_area);
+	ZUC_ASSERT_EQ(20000, result.composited_area);
+	ZUC_ASSERT_EQ(0, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, separate_views_all_scanned_out)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 100, 100, 0x3 },
+		{ 200, 0, 300, 100, 0x3 },
+		{ 0, 200, 800, 600, 0 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 2);
+	solve(&kms, 2, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	/* The greedy pass gets it right, no backtracking needed */
+	ZUC_ASSERT_EQ(1, sprite[0]);
+	ZUC_ASSERT_EQ(0, sprite[1]);
+	ZUC_ASSERT_EQ(-1, sprite[2]);
+	ZUC_ASSERT_EQ(2, result.n_scanout);
+	ZUC_ASSERT_EQ(20000, result.scanout_area);
+	ZUC_ASSERT_EQ(320000, result.composited_area);
+	ZUC_ASSERT_EQ(2, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, view_below_composited_is_composited)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 50, 50, 150, 150, 0 },
+		{ 0, 0, 400, 300, 0x3 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 2);
+	solve(&kms, 2, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(-1, sprite[0]);
+	ZUC_ASSERT_EQ(-1, sprite[1]);
+	ZUC_ASSERT_EQ(0, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, overlapping_views_keep_their_stacking)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 50, 50, 150, 150, 0x7 },
+		{ 0, 0, 400, 300, 0x7 },
+		{ 100, 100, 500, 400, 0x7 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 3);
+	solve(&kms, 3, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(2, sprite[0]);
+	ZUC_ASSERT_EQ(1, sprite[1]);
+	ZUC_ASSERT_EQ(0, sprite[2]);
+	ZUC_ASSERT_EQ(3, result.n_scanout);
+
+	/* The top view only fits the bottom sprite, leaving none below it */
+	views[0].sprite_mask = 0x1;
+	mock_kms_init(&kms, 3);
+	solve(&kms, 3, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(0, sprite[0]);
+	ZUC_ASSERT_EQ(-1, sprite[1]);
+	ZUC_ASSERT_EQ(-1, sprite[2]);
+	ZUC_ASSERT_EQ(100 * 100, result.scanout_area);
+}
+
+ZUC_TEST(plane_solver_test, backtracks_to_larger_view)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 64, 64, 0x3 },
+		{ 100, 0, 740, 480, 0x3 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	/* Only one sprite fits the bandwidth; greedy would spend it on the
+	 * small view */
+	mock_kms_init(&kms, 1);
+	solve(&kms, 2, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(-1, sprite[0]);
+	ZUC_ASSERT_TRUE(sprite[1] >= 0);
+	ZUC_ASSERT_EQ(1, result.n_scanout);
+	ZUC_ASSERT_EQ(640 * 480, result.scanout_area);
+	ZUC_ASSERT_EQ(64 * 64, result.composited_area);
+}
+
+ZUC_TEST(plane_solver_test, rejected_sprite_tries_the_next)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 320, 240, 0x3 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 2);
+	kms.reject_view = 0;
+	kms.reject_sprite = 1;
+	solve(&kms, 2, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(0, sprite[0]);
+	ZUC_ASSERT_EQ(2, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, everything_rejected_falls_back)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 320, 240, 0x3 },
+		{ 400, 0, 720, 240, 0x3 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	mock_kms_init(&kms, 0);
+	solve(&kms, 2, 16, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(-1, sprite[0]);
+	ZUC_ASSERT_EQ(-1, sprite[1]);
+	ZUC_ASSERT_EQ(0, result.n_scanout);
+	ZUC_ASSERT_EQ(2 * 320 * 240, result.composited_area);
+	ZUC_ASSERT_EQ(4, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, test_budget_is_respected)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[] = {
+		{ 0, 0, 64, 64, 0x3 },
+		{ 100, 0, 740, 480, 0x3 },
+	};
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+
+	/* The budget runs out on the greedy pass, which keeps its result */
+	mock_kms_init(&kms, 1);
+	solve(&kms, 2, 2, views, ARRAY_LENGTH(views), sprite, &result);
+
+	ZUC_ASSERT_EQ(1, sprite[0]);
+	ZUC_ASSERT_EQ(-1, sprite[1]);
+	ZUC_ASSERT_EQ(2, result.n_tests);
+}
+
+ZUC_TEST(plane_solver_test, views_past_capacity_are_composited)
+{
+	struct mock_kms kms;
+	struct plane_solver_view views[10];
+	struct plane_solver_result result;
+	int sprite[ARRAY_LENGTH(views)];
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		views[i].x1 = i * 10;
+		views[i].y1 = 0;
+		views[i].x2 = i * 10 + 10;
+		views[i].y2 = 10;
+		views[i].sprite_mask = 0xffffffff;
+	}
+
+	mock_kms_init(&kms, 32);
+	solve(&kms, 32, 1000, views, ARRAY_LENGTH(views), sprite, &result);
+
+	for (i = 0; i < 8; i++)
+		ZUC_ASSERT_TRUE(sprite[i] >= 0);
+	ZUC_ASSERT_EQ(-1, sprite[8]);
+	ZUC_ASSERT_EQ(-1, sprite[9]);
+	ZUC_ASSERT_EQ(8, result.n_scanout);
+}
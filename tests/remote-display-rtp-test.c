@@ -0,0 +1,354 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libdrm/intel_bufmgr.h>
+
+#include "clients/RemoteDisplay/transport_plugin.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "zunitc/zunitc.h"
+
+#define TEST_MTU	1000
+#define MAX_PACKET	2048
+#define MAX_STREAM	(4 * 1024 * 1024)
+#define NUM_FRAMES	6
+#define TS_STEP		3000	/* 30 fps at 90 kHz */
+
+struct receiver {
+	int fd;
+	uint16_t port;
+	pthread_t thread;
+	int done;
+
+	/* Depacketised Annex B stream, with 4-byte start codes. */
+	uint8_t *stream;
+	size_t size;
+
+	int packets;
+	int errors;
+	int frames;
+	int have_seq;
+	uint16_t seq;
+	uint32_t ssrc;
+	uint32_t timestamps[NUM_FRAMES];
+	int in_fu;
+};
+
+static void
+append(struct receiver *rx, const void *data, size_t len)
+{
+	if (rx->size + len > MAX_STREAM) {
+		rx->errors++;
+		return;
+	}
+	memcpy(rx->stream + rx->size, data, len);
+	rx->size += len;
+}
+
+static void
+receive_packet(struct receiver *rx, const uint8_t *pkt, ssize_t len)
+{
+	static const uint8_t start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+	uint16_t seq;
+	uint32_t ts, ssrc;
+	const uint8_t *payload = pkt + 12;
+	ssize_t payload_len = len - 12;
+	uint8_t nal_type;
+
+	rx->packets++;
+	if (len <= 12 || len > TEST_MTU || pkt[0] != 0x80 ||
+	    (pkt[1] & 0x7f) != 96) {
+		rx->errors++;
+		return;
+	}
+
+	memcpy(&seq, pkt + 2, 2);
+	memcpy(&ts, pkt + 4, 4);
+	memcpy(&ssrc, pkt + 8, 4);
+	seq = ntohs(seq);
+	ts = ntohl(ts);
+	ssrc = ntohl(ssrc);
+
+	if (rx->have_seq && (seq != (uint16_t)(rx->seq + 1) || ssrc != rx->ssrc))
+		rx->errors++;
+	rx->have_seq = 1;
+	rx->seq = seq;
+	rx->ssrc = ssrc;
+
+	if (rx->frames >= NUM_FRAMES) {
+		rx->errors++;
+		return;
+	}
+	if (rx->timestamps[rx->frames] != ts)
+		rx->errors++;
+
+	nal_type = payload[0] & 0x1f;
+	if (nal_type == 28) {
+		uint8_t fu_header = payload[1];
+
+		if (fu_header & 0x80) {
+			uint8_t nal_header = (payload[0] & 0xe0) | (fu_header & 0x1f);
+
+			if (rx->in_fu)
+				rx->errors++;
+			rx->in_fu = 1;
+			append(rx, start_code, sizeof(start_code));
+			append(rx, &nal_header, 1);
+		} else if (!rx->in_fu) {
+			rx->errors++;
+		}
+		append(rx, payload + 2, payload_len - 2);
+		if (fu_header & 0x40)
+			rx->in_fu = 0;
+	} else {
+		if (rx->in_fu)
+			rx->errors++;
+		append(rx, start_code, sizeof(start_code));
+		append(rx, payload, payload_len);
+	}
+
+	/* Marker bit ends the access unit. */
+	if (pkt[1] & 0x80) {
+		if (rx->in_fu)
+			rx->errors++;
+		rx->frames++;
+	}
+}
+
+static void *
+receiver_thread(void *data)
+{
+	struct receiver *rx = data;
+	uint8_t pkt[MAX_PACKET];
+	struct pollfd pfd;
+	ssize_t len;
+
+	pfd.fd = rx->fd;
+	pfd.events = POLLIN;
+	while (1) {
+		if (poll(&pfd, 1, 100) <= 0) {
+			if (rx->done)
+				break;
+			continue;
+		}
+		len = recv(rx->fd, pkt, sizeof(pkt), 0);
+		if (len > 0)
+			receive_packet(rx, pkt, len);
+	}
+
+	return NULL;
+}
+
+static int
+receiver_start(struct receiver *rx)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int size = 4 * 1024 * 1024;
+
+	memset(rx, 0, sizeof(*rx));
+	rx->stream = malloc(MAX_STREAM);
+	rx->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!rx->stream || rx->fd < 0)
+		return -1;
+
+	setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(rx->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(rx->fd, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+	rx->port = ntohs(addr.sin_port);
+
+	return pthread_create(&rx->thread, NULL, receiver_thread, rx);
+}
+
+static void
+receiver_finish(struct receiver *rx)
+{
+	rx->done = 1;
+	pthread_join(rx->thread, NULL);
+	close(rx->fd);
+}
+
+static void *
+plugin_connect(struct receiver *rx, int pace)
+{
+	void *plugin_data = NULL;
+	char port[32], mtu[32], pacing[32];
+	char *argv[] = { "remote-display-rtp-test", "--ipaddr=127.0.0.1",
+			 port, mtu, pacing, "--fps=30", "--batch=4", NULL };
+	int argc = ARRAY_LENGTH(argv) - 1;
+
+	snprintf(port, sizeof(port), "--port=%u", rx->port);
+	snprintf(mtu, sizeof(mtu), "--mtu=%d", TEST_MTU);
+	snprintf(pacing, sizeof(pacing), "--pace=%d", pace);
+
+	if (init(&argc, argv, &plugin_data, 0) != 0)
+		return NULL;
+
+	return plugin_data;
+}
+
+static size_t
+add_nal(uint8_t *buf, uint8_t header, size_t len, uint32_t seed)
+{
+	size_t i;
+
+	buf[0] = 0x00;
+	buf[1] = 0x00;
+	buf[2] = 0x00;
+	buf[3] = 0x01;
+	buf[4] = header;
+	/* Never zero, so no start code emulation in the payload. */
+	for (i = 1; i < len; i++)
+		buf[4 + i] = ((seed + i * 7) & 0x7f) | 0x01;
+
+	return len + 4;
+}
+
+/* An IDR frame with SPS and PPS every third frame, P frames otherwise.
+ * Slice sizes cover single NAL packets, FU-A and exact MTU boundaries. */
+static size_t
+make_frame(uint8_t *buf, int number)
+{
+	size_t size = 0;
+
+	if ((number % 3) == 0) {
+		size += add_nal(buf + size, 0x67, 12, number);
+		size += add_nal(buf + size, 0x68, 4, number);
+		size += add_nal(buf + size, 0x65, 40000 + number, number);
+	} else if (number == 1) {
+		size += add_nal(buf + size, 0x41, TEST_MTU - 12, number);
+	} else {
+		size += add_nal(buf + size, 0x41, 3000 + number * 17, number);
+	}
+
+	return size;
+}
+
+static int
+send_frames(void *plugin_data, struct receiver *rx, uint8_t *expected,
+	    size_t *expected_size)
+{
+	uint8_t *buf = malloc(64 * 1024);
+	drm_intel_bo bo;
+	size_t size;
+	int ret = 0;
+	int i;
+
+	if (!buf)
+		return -ENOMEM;
+
+	*expected_size = 0;
+	memset(&bo, 0, sizeof(bo));
+	bo.virtual = buf;
+	for (i = 0; i < NUM_FRAMES && ret == 0; i++) {
+		size = make_frame(buf, i);
+		memcpy(expected + *expected_size, buf, size);
+		*expected_size += size;
+		/* Start near the top of the range to cover the wrap. */
+		rx->timestamps[i] = 0xfffff000u + i * TS_STEP;
+		ret = send_frame(plugin_data, &bo, size, rx->timestamps[i]);
+	}
+
+	free(buf);
+	return ret;
+}
+
+ZUC_TEST(remote_display_rtp_test, depacketised_stream_matches)
+{
+	struct receiver rx;
+	void *plugin_data;
+	uint8_t *expected = malloc(MAX_STREAM);
+	size_t expected_size;
+
+	ZUC_ASSERT_NOT_NULL(expected);
+	ZUC_ASSERT_EQ(0, receiver_start(&rx));
+	plugin_data = plugin_connect(&rx, 0);
+	ZUC_ASSERT_NOT_NULL(plugin_data);
+
+	ZUC_ASSERT_EQ(0, send_frames(plugin_data, &rx, expected, &expected_size));
+	destroy(&plugin_data);
+	ZUC_ASSERT_NULL(plugin_data);
+	receiver_finish(&rx);
+
+	ZUC_ASSERT_EQ(0, rx.errors);
+	ZUC_ASSERT_EQ(NUM_FRAMES, rx.frames);
+	ZUC_ASSERT_EQ(expected_size, rx.size);
+	ZUC_ASSERT_EQ(0, memcmp(expected, rx.stream, expected_size));
+	free(expected);
+	free(rx.stream);
+}
+
+ZUC_TEST(remote_display_rtp_test, packets_are_paced)
+{
+	struct receiver rx;
+	void *plugin_data;
+	uint8_t *expected = malloc(MAX_STREAM);
+	size_t expected_size;
+	struct timespec start, end;
+	int64_t elapsed;
+
+	ZUC_ASSERT_NOT_NULL(expected);
+	ZUC_ASSERT_EQ(0, receiver_start(&rx));
+	/* Spread each frame across half of its 33 ms interval. */
+	plugin_data = plugin_connect(&rx, 50);
+	ZUC_ASSERT_NOT_NULL(plugin_data);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ZUC_ASSERT_EQ(0, send_frames(plugin_data, &rx, expected, &expected_size));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	destroy(&plugin_data);
+	receiver_finish(&rx);
+
+	/* The two IDR frames need eleven batches each, so each of them
+	 * takes at least 10/11 of its 16.7 ms window to go out. */
+	elapsed = timespec_sub_to_nsec(&end, &start);
+	ZUC_ASSERT_TRUE(elapsed > 2 * 15000000LL);
+
+	ZUC_ASSERT_EQ(0, rx.errors);
+	ZUC_ASSERT_EQ(NUM_FRAMES, rx.frames);
+	ZUC_ASSERT_EQ(0, memcmp(expected, rx.stream, expected_size));
+	free(expected);
+	free(rx.stream);
+}
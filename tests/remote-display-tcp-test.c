@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libdrm/intel_bufmgr.h>
+
+#include "clients/RemoteDisplay/transport_plugin.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/* Frames are large enough that a single write can't take a whole one. */
+#define FRAME_SIZE	(256 * 1024)
+#define GOP_LENGTH	8
+
+struct receiver {
+	int listen_fd;
+	int fd;
+	uint16_t port;
+	pthread_t thread;
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int
+receiver_listen(struct receiver *rx)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int small = 16 * 1024;
+
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = -1;
+	rx->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (rx->listen_fd < 0)
+		return -1;
+
+	/* Keep the socket buffers small so that the sender backs up. */
+	setsockopt(rx->listen_fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if (bind(rx->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(rx->listen_fd, 1) < 0 ||
+	    getsockname(rx->listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+		close(rx->listen_fd);
+		return -1;
+	}
+	rx->port = ntohs(addr.sin_port);
+
+	return 0;
+}
+
+static void *
+receiver_thread(void *data)
+{
+	struct receiver *rx = data;
+	ssize_t n;
+
+	do {
+		if (rx->capacity - rx->size < FRAME_SIZE) {
+			rx->capacity += 16 * FRAME_SIZE;
+			rx->data = realloc(rx->data, rx->capacity);
+			if (!rx->data)
+				return NULL;
+		}
+		n = read(rx->fd, rx->data + rx->size, rx->capacity - rx->size);
+		if (n > 0)
+			rx->size += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	return NULL;
+}
+
+static void
+receiver_start(struct receiver *rx)
+{
+	pthread_create(&rx->thread, NULL, receiver_thread, rx);
+}
+
+static void
+receiver_finish(struct receiver *rx)
+{
+	pthread_join(rx->thread, NULL);
+	close(rx->fd);
+	close(rx->listen_fd);
+}
+
+static void *
+plugin_connect(struct receiver *rx, int nonblock, int sendq)
+{
+	void *plugin_data = NULL;
+	char port[32], mode[32], queue[32];
+	char *argv[] = { "remote-display-tcp-test", "--ipaddr=127.0.0.1",
+			 port, mode, queue, NULL };
+	int argc = ARRAY_LENGTH(argv) - 1;
+
+	snprintf(port, sizeof(port), "--port=%u", rx->port);
+	snprintf(mode, sizeof(mode), "--nonblock=%d", nonblock);
+	snprintf(queue, sizeof(queue), "--sendq=%d", sendq);
+
+	if (init(&argc, argv, &plugin_data, 0) != 0)
+		return NULL;
+
+	rx->fd = accept(rx->listen_fd, NULL, NULL);
+
+	return plugin_data;
+}
+
+/* Each frame starts like encoder output: SPS for an IDR frame, a non-IDR
+ * slice otherwise, followed by the frame number and a fill pattern. */
+static void
+make_frame(uint8_t *buf, uint32_t number)
+{
+	int idr = (number % GOP_LENGTH) == 0;
+
+	buf[0] = 0x00;
+	buf[1] = 0x00;
+	buf[2] = 0x00;
+	buf[3] = 0x01;
+	buf[4] = idr ? 0x67 : 0x41;
+	memcpy(buf + 5, &number, sizeof(number));
+	memset(buf + 9, 0x80 | (number & 0x7f), FRAME_SIZE - 9);
+}
+
+/* Check that the received bytes are whole frames in order, and that any
+ * gap in the sequence is followed by an IDR frame. Only the last frame
+ * may be cut short, by the connection closing. Returns the number of
+ * complete frames, or -1 if the stream is corrupt. */
+static int
+check_stream(const uint8_t *data, size_t size)
+{
+	uint8_t *expected = malloc(FRAME_SIZE);
+	uint32_t number, last = 0;
+	int frames = 0;
+	size_t off;
+
+	if (!expected)
+		return -1;
+
+	for (off = 0; off + FRAME_SIZE <= size; off += FRAME_SIZE) {
+		memcpy(&number, data + off + 5, sizeof(number));
+		make_frame(expected, number);
+		if (memcmp(expected, data + off, FRAME_SIZE) != 0)
+			goto corrupt;
+		if (frames && number <= last)
+			goto corrupt;
+		if (frames && number != last + 1 && (number % GOP_LENGTH) != 0)
+			goto corrupt;
+		last = number;
+		frames++;
+	}
+
+	free(expected);
+	return frames;
+
+corrupt:
+	fprintf(stderr, "Stream corrupt at byte %zu.\n", off);
+	free(expected);
+	return -1;
+}
+
+static int
+send_frames(void *plugin_data, int count)
+{
+	uint8_t *buf = malloc(FRAME_SIZE);
+	drm_intel_bo bo;
+	int ret = 0;
+	int i;
+
+	if (!buf)
+		return -ENOMEM;
+
+	memset(&bo, 0, sizeof(bo));
+	bo.virtual = buf;
+	for (i = 0; i < count && ret == 0; i++) {
+		make_frame(buf, i);
+		ret = send_frame(plugin_data, &bo, FRAME_SIZE, i * 1500);
+	}
+
+	free(buf);
+	return ret;
+}
+
+ZUC_TEST(remote_display_tcp_test, blocking_sends_complete_frames)
+{
+	struct receiver rx;
+	void *plugin_data;
+
+	ZUC_ASSERT_EQ(0, receiver_listen(&rx));
+	plugin_data = plugin_connect(&rx, 0, 0);
+	ZUC_ASSERT_NOT_NULL(plugin_data);
+	ZUC_ASSERT_TRUE(rx.fd >= 0);
+
+	receiver_start(&rx);
+	ZUC_ASSERT_EQ(0, send_frames(plugin_data, 32));
+	destroy(&plugin_data);
+	ZUC_ASSERT_NULL(plugin_data);
+	receiver_finish(&rx);
+
+	ZUC_ASSERT_EQ((size_t)32 * FRAME_SIZE, rx.size);
+	ZUC_ASSERT_EQ(32, check_stream(rx.data, rx.size));
+	free(rx.data);
+}
+
+ZUC_TEST(remote_display_tcp_test, nonblocking_keeps_stream_decodable)
+{
+	struct receiver rx;
+	void *plugin_data;
+	int frames;
+
+	ZUC_ASSERT_EQ(0, receiver_listen(&rx));
+	plugin_data = plugin_connect(&rx, 1, 2);
+	ZUC_ASSERT_NOT_NULL(plugin_data);
+	ZUC_ASSERT_TRUE(rx.fd >= 0);
+
+	/* Nobody is reading yet, so the queue has to overflow, but
+	 * send_frame() must never block. */
+	ZUC_ASSERT_EQ(0, send_frames(plugin_data, 64));
+
+	receiver_start(&rx);
+	usleep(200000);
+	destroy(&plugin_data);
+	receiver_finish(&rx);
+
+	frames = check_stream(rx.data, rx.size);
+	ZUC_ASSERT_TRUE(frames > 0);
+	ZUC_ASSERT_TRUE(frames < 64);
+	free(rx.data);
+}
+
+ZUC_TEST(remote_display_tcp_test, receiver_hangup_stops_writer)
+{
+	struct receiver rx;
+	void *plugin_data;
+	struct timespec before, after;
+	long cpu_ns;
+
+	ZUC_ASSERT_EQ(0, receiver_listen(&rx));
+	plugin_data = plugin_connect(&rx, 1, 2);
+	ZUC_ASSERT_NOT_NULL(plugin_data);
+	ZUC_ASSERT_TRUE(rx.fd >= 0);
+
+	/* Back the queue up, then hang up with data unread */
+	ZUC_ASSERT_EQ(0, send_frames(plugin_data, 8));
+	close(rx.fd);
+	rx.fd = -1;
+	usleep(50000);
+
+	/* The writer thread must not spin on the dead socket */
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &before);
+	usleep(200000);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &after);
+	cpu_ns = (after.tv_sec - before.tv_sec) * 1000000000L +
+		 (after.tv_nsec - before.tv_nsec);
+	ZUC_ASSERT_TRUE(cpu_ns < 50000000L);
+
+	ZUC_ASSERT_TRUE(send_frames(plugin_data, 8) < 0);
+
+	destroy(&plugin_data);
+	close(rx.listen_fd);
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Repaint loop benchmark: keeps a number of surfaces committing new
+ * content every frame on the headless backend, then reports the repaint
+ * statistics the compositor gathered. WESTON_BENCH_SURFACES and
+ * WESTON_BENCH_FRAMES override the defaults.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "trace-reporter-client-protocol.h"
+
+#define SURFACE_SIZE 32
+
+static const char *stage_names[] = {
+	[TRACE_REPORTER_REPAINT_STAGE_BUILD_VIEW_LIST] = "build_view_list",
+	[TRACE_REPORTER_REPAINT_STAGE_ASSIGN_PLANES] = "assign_planes",
+	[TRACE_REPORTER_REPAINT_STAGE_ACCUMULATE_DAMAGE] = "accumulate_damage",
+	[TRACE_REPORTER_REPAINT_STAGE_RENDER] = "render",
+	[TRACE_REPORTER_REPAINT_STAGE_FLIP] = "flip",
+	[TRACE_REPORTER_REPAINT_STAGE_TOTAL] = "total",
+	[TRACE_REPORTER_REPAINT_STAGE_PRESENT_LATENCY] = "present_latency",
+	[TRACE_REPORTER_REPAINT_STAGE_UPLOAD] = "upload",
+	[TRACE_REPORTER_REPAINT_STAGE_UPLOAD_SIZE] = "upload_size",
+};
+
+struct stats {
+	int quiet;
+	int done;
+	uint32_t frames;
+	uint32_t render_count;
+	uint32_t latency_count;
+};
+
+static void
+handle_tracepoint(void *data, struct trace_reporter *reporter,
+		  const char *message, uint32_t time_sec, uint32_t time_usec)
+{
+}
+
+static void
+handle_trace_end(void *data, struct trace_reporter *reporter)
+{
+	struct stats *stats = data;
+
+	stats->done = 1;
+}
+
+static void
+handle_output_stats(void *data, struct trace_reporter *reporter,
+		    const char *output, uint32_t frames,
+		    uint32_t missed_vblank, uint32_t over_budget)
+{
+	struct stats *stats = data;
+
+	stats->frames += frames;
+	if (!stats->quiet)
+		printf("output=%s frames=%u missed_vblank=%u over_budget=%u\n",
+		       output, frames, missed_vblank, over_budget);
+}
+
+static void
+handle_histogram(void *data, struct trace_reporter *reporter,
+		 const char *name, uint32_t stage, uint32_t count,
+		 uint32_t min, uint32_t max, uint32_t mean,
+		 uint32_t p50, uint32_t p90, uint32_t p99,
+		 struct wl_array *buckets)
+{
+	struct stats *stats = data;
+
+	assert(stage < ARRAY_LENGTH(stage_names));
+	assert(buckets->size == 64 * sizeof(uint32_t));
+
+	if (stage == TRACE_REPORTER_REPAINT_STAGE_RENDER)
+		stats->render_count += count;
+	if (stage == TRACE_REPORTER_REPAINT_STAGE_PRESENT_LATENCY)
+		stats->latency_count += count;
+
+	if (stats->quiet)
+		return;
+
+	/* One line per histogram, in microseconds, upload_size in KiB */
+	printf("histogram name=\"%s\" stage=%s count=%u min=%u mean=%u "
+	       "p50=%u p90=%u p99=%u max=%u\n", name, stage_names[stage],
+	       count, min, mean, p50, p90, p99, max);
+}
+
+static const struct trace_reporter_listener reporter_listener = {
+	handle_tracepoint,
+	handle_trace_end,
+	handle_output_stats,
+	handle_histogram,
+};
+
+static struct trace_reporter *
+bind_reporter(struct client *client, struct stats *stats)
+{
+	struct trace_reporter *reporter = NULL;
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, trace_reporter_interface.name))
+			continue;
+
+		assert(g->version >= 4);
+		reporter = wl_registry_bind(client->wl_registry, g->name,
+					    &trace_reporter_interface, 4);
+	}
+
+	assert(reporter && "trace-reporter.so not loaded");
+	trace_reporter_add_listener(reporter, &reporter_listener, stats);
+
+	return reporter;
+}
+
+static void
+fetch_stats(struct client *client, struct trace_reporter *reporter,
+	    struct stats *stats)
+{
+	stats->done = 0;
+	trace_reporter_repaint_stats(reporter,
+				     TRACE_REPORTER_LOG_REPORT_CLEAR);
+	while (!stats->done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+}
+
+static int
+env_int(const char *name, int fallback)
+{
+	const char *value = getenv(name);
+
+	return value ? atoi(value) : fallback;
+}
+
+static struct surface *
+create_bench_surface(struct client *client, int i)
+{
+	struct surface *surface;
+
+	surface = create_test_surface(client);
+	surface->width = SURFACE_SIZE;
+	surface->height = SURFACE_SIZE;
+	surface->buffer = create_shm_buffer_a8r8g8b8(client, SURFACE_SIZE,
+						     SURFACE_SIZE);
+	surface->x = (i % 8) * (SURFACE_SIZE + 8);
+	surface->y = (i / 8) * (SURFACE_SIZE + 8);
+	weston_test_move_surface(client->test->weston_test,
+				 surface->wl_surface, surface->x, surface->y);
+
+	return surface;
+}
+
+static void
+commit_all(struct client *client, struct surface **surfaces, int n)
+{
+	int i, done;
+
+	for (i = 0; i < n; i++) {
+		wl_surface_attach(surfaces[i]->wl_surface,
+				  surfaces[i]->buffer->proxy, 0, 0);
+		wl_surface_damage(surfaces[i]->wl_surface, 0, 0,
+				  SURFACE_SIZE, SURFACE_SIZE);
+		if (i == n - 1)
+			frame_callback_set(surfaces[i]->wl_surface, &done);
+		wl_surface_commit(surfaces[i]->wl_surface);
+	}
+
+	frame_callback_wait(client, &done);
+}
+
+TEST(repaint_stats_benchmark)
+{
+	struct client *client;
+	struct trace_reporter *reporter;
+	struct surface **surfaces;
+	struct stats stats = { 0 };
+	int n_surfaces = env_int("WESTON_BENCH_SURFACES", 16);
+	int n_frames = env_int("WESTON_BENCH_FRAMES", 120);
+	int i;
+
+	assert(n_surfaces > 0 && n_frames > 0);
+
+	client = create_client_and_test_surface(0, 0, SURFACE_SIZE,
+						SURFACE_SIZE);
+	reporter = bind_reporter(client, &stats);
+
+	surfaces = xzalloc(n_surfaces * sizeof *surfaces);
+	surfaces[0] = client->surface;
+	for (i = 1; i < n_surfaces; i++)
+		surfaces[i] = create_bench_surface(client, i);
+
+	/* Mapping everything isn't part of the benchmark */
+	commit_all(client, surfaces, n_surfaces);
+	stats.quiet = 1;
+	fetch_stats(client, reporter, &stats);
+	memset(&stats, 0, sizeof stats);
+
+	for (i = 0; i < n_frames; i++)
+		commit_all(client, surfaces, n_surfaces);
+
+	printf("surfaces=%d frames=%d\n", n_surfaces, n_frames);
+	fetch_stats(client, reporter, &stats);
+
+	/* Every frame waited for a repaint, all but the last one presented */
+	assert(stats.render_count >= (uint32_t)n_frames);
+	assert(stats.frames >= (uint32_t)n_frames - 1);
+	assert(stats.latency_count >= (uint32_t)(n_frames - 1) * n_surfaces);
+
+	for (i = 1; i < n_surfaces; i++) {
+		wl_surface_destroy(surfaces[i]->wl_surface);
+		buffer_destroy(surfaces[i]->buffer);
+		free(surfaces[i]);
+	}
+	free(surfaces);
+	trace_reporter_destroy(reporter);
+}
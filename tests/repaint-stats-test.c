@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "libweston/repaint-stats.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+ZUC_TEST(repaint_stats_test, buckets_cover_every_value_once)
+{
+	struct weston_histogram h;
+	uint32_t v;
+	unsigned int b;
+
+	/* Each bucket starts right where the previous one ends */
+	for (b = 1; b < WESTON_HISTOGRAM_BUCKETS; b++)
+		ZUC_ASSERT_TRUE(weston_histogram_bucket_start(b) >
+				weston_histogram_bucket_start(b - 1));
+
+	for (v = 0; v < 200000; v += 7) {
+		weston_histogram_reset(&h);
+		weston_histogram_add(&h, v);
+
+		for (b = 0; h.buckets[b] == 0; b++)
+			;
+		ZUC_ASSERT_TRUE(weston_histogram_bucket_start(b) <= v);
+		if (b < WESTON_HISTOGRAM_BUCKETS - 1)
+			ZUC_ASSERT_TRUE(v < weston_histogram_bucket_start(b + 1));
+	}
+}
+
+ZUC_TEST(repaint_stats_test, percentiles_within_a_quarter)
+{
+	struct weston_histogram h;
+	uint32_t i, p50, p99;
+
+	weston_histogram_reset(&h);
+	ZUC_ASSERT_EQ(0, weston_histogram_percentile(&h, 50));
+
+	for (i = 1; i <= 1000; i++)
+		weston_histogram_add(&h, i * 10);
+
+	ZUC_ASSERT_EQ(1000, h.count);
+	ZUC_ASSERT_EQ(10, h.min);
+	ZUC_ASSERT_EQ(10000, h.max);
+	ZUC_ASSERT_EQ(5005000, h.sum);
+
+	/* Estimates never fall short, nor overshoot a bucket's width */
+	p50 = weston_histogram_percentile(&h, 50);
+	ZUC_ASSERT_TRUE(p50 >= 5000 && p50 < 5000 * 5 / 4);
+	p99 = weston_histogram_percentile(&h, 99);
+	ZUC_ASSERT_TRUE(p99 >= 9900 && p99 <= 10000);
+	ZUC_ASSERT_EQ(10000, weston_histogram_percentile(&h, 100));
+}
+
+ZUC_TEST(repaint_stats_test, intervals_and_reset)
+{
+	struct weston_repaint_stats stats;
+	struct timespec unset = { 0, 0 };
+	struct timespec a = { 10, 999000000 };
+	struct timespec b = { 11, 1500000 };
+	struct weston_histogram *render;
+
+	memset(&stats, 0, sizeof stats);
+	render = &stats.stage[WESTON_REPAINT_STAGE_RENDER];
+
+	weston_histogram_add_interval(render, &a, &b);
+	ZUC_ASSERT_EQ(1, render->count);
+	ZUC_ASSERT_EQ(2500, render->max);
+
+	/* Nothing was started, or the clock went backwards */
+	weston_histogram_add_interval(render, &unset, &b);
+	ZUC_ASSERT_EQ(1, render->count);
+	weston_histogram_add_interval(render, &b, &a);
+	ZUC_ASSERT_EQ(2, render->count);
+	ZUC_ASSERT_EQ(0, render->min);
+
+	stats.frames = 3;
+	stats.missed_vblank = 1;
+	weston_histogram_add(&stats.upload_size, 8100);
+	weston_repaint_stats_reset(&stats);
+	ZUC_ASSERT_EQ(0, render->count);
+	ZUC_ASSERT_EQ(0, stats.upload_size.count);
+	ZUC_ASSERT_EQ(0, stats.frames);
+	ZUC_ASSERT_EQ(0, stats.missed_vblank);
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libweston/shader-cache.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+struct cache_dir {
+	char dir[64];
+	char path[256];
+	struct shader_cache_key key;
+};
+
+static const uint8_t binary[] = {
+	0xde, 0xad, 0xbe, 0xef, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+};
+
+static void
+cache_dir_init(struct cache_dir *cache)
+{
+	strcpy(cache->dir, "/tmp/weston-shader-cache-test-XXXXXX");
+	ZUC_ASSERT_NOT_NULL(mkdtemp(cache->dir));
+
+	shader_cache_key_init(&cache->key);
+	shader_cache_key_add_string(&cache->key, "llvmpipe");
+	shader_cache_key_add_string(&cache->key, "void main() {}");
+	ZUC_ASSERT_EQ(0, shader_cache_path(cache->path, sizeof cache->path,
+					   cache->dir, &cache->key));
+}
+
+static int
+cache_dir_count(struct cache_dir *cache)
+{
+	struct dirent *de;
+	DIR *dir;
+	int n = 0;
+
+	dir = opendir(cache->dir);
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] != '.')
+			n++;
+	}
+	closedir(dir);
+
+	return n;
+}
+
+static void
+cache_dir_fini(struct cache_dir *cache)
+{
+	unlink(cache->path);
+	rmdir(cache->dir);
+}
+
+ZUC_TEST(shader_cache_test, key_covers_every_chunk)
+{
+	struct shader_cache_key a, b;
+
+	shader_cache_key_init(&a);
+	shader_cache_key_add_string(&a, "ab");
+	shader_cache_key_add_string(&a, "c");
+	shader_cache_key_init(&b);
+	shader_cache_key_add_string(&b, "a");
+	shader_cache_key_add_string(&b, "bc");
+	ZUC_ASSERT_NE(a.hash, b.hash);
+
+	shader_cache_key_init(&b);
+	shader_cache_key_add_string(&b, "ab");
+	shader_cache_key_add_string(&b, "c");
+	ZUC_ASSERT_EQ(a.hash, b.hash);
+
+	/* A driver update changes the key */
+	shader_cache_key_add_string(&a, "Mesa 18.0.5");
+	shader_cache_key_add_string(&b, "Mesa 18.1.0");
+	ZUC_ASSERT_NE(a.hash, b.hash);
+}
+
+ZUC_TEST(shader_cache_test, path_must_fit)
+{
+	struct shader_cache_key key;
+	char path[40];
+
+	shader_cache_key_init(&key);
+	ZUC_ASSERT_EQ(-1, shader_cache_path(path, sizeof path,
+					    "/a/directory/that/is/too/long",
+					    &key));
+	ZUC_ASSERT_EQ(0, shader_cache_path(path, sizeof path, "/c", &key));
+	ZUC_ASSERT_EQ(0, strcmp(path, "/c/weston-cbf29ce484222325.shader"));
+}
+
+ZUC_TEST(shader_cache_test, stored_entry_loads)
+{
+	struct cache_dir cache;
+	struct shader_cache_entry entry;
+
+	cache_dir_init(&cache);
+
+	ZUC_ASSERT_EQ(-1, shader_cache_load(cache.path, &cache.key, &entry));
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 0x8740,
+					    binary, sizeof binary));
+
+	/* Only the entry itself, no temporary file left behind */
+	ZUC_ASSERT_EQ(1, cache_dir_count(&cache));
+
+	ZUC_ASSERT_EQ(0, shader_cache_load(cache.path, &cache.key, &entry));
+	ZUC_ASSERT_EQ(0x8740, entry.format);
+	ZUC_ASSERT_EQ(sizeof binary, entry.size);
+	ZUC_ASSERT_EQ(0, memcmp(binary, entry.binary, sizeof binary));
+	shader_cache_entry_release(&entry);
+	ZUC_ASSERT_NULL(entry.map);
+
+	cache_dir_fini(&cache);
+}
+
+ZUC_TEST(shader_cache_test, store_replaces_entry)
+{
+	struct cache_dir cache;
+	struct shader_cache_entry entry;
+
+	cache_dir_init(&cache);
+
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 1,
+					    binary, sizeof binary));
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 2,
+					    binary, 4));
+	ZUC_ASSERT_EQ(1, cache_dir_count(&cache));
+
+	ZUC_ASSERT_EQ(0, shader_cache_load(cache.path, &cache.key, &entry));
+	ZUC_ASSERT_EQ(2, entry.format);
+	ZUC_ASSERT_EQ(4, entry.size);
+	shader_cache_entry_release(&entry);
+
+	cache_dir_fini(&cache);
+}
+
+ZUC_TEST(shader_cache_test, other_key_is_rejected)
+{
+	struct cache_dir cache;
+	struct shader_cache_entry entry;
+	struct shader_cache_key other;
+
+	cache_dir_init(&cache);
+
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 1,
+					    binary, sizeof binary));
+
+	/* As if the file had been copied from another driver's cache */
+	other = cache.key;
+	shader_cache_key_add_string(&other, "Mesa 18.1.0");
+	ZUC_ASSERT_EQ(-1, shader_cache_load(cache.path, &other, &entry));
+	ZUC_ASSERT_NULL(entry.map);
+
+	cache_dir_fini(&cache);
+}
+
+ZUC_TEST(shader_cache_test, damaged_entry_is_rejected)
+{
+	struct cache_dir cache;
+	struct shader_cache_entry entry;
+	struct stat st;
+	FILE *fp;
+
+	cache_dir_init(&cache);
+
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 1,
+					    binary, sizeof binary));
+	ZUC_ASSERT_EQ(0, stat(cache.path, &st));
+
+	/* Last byte of the binary flipped */
+	fp = fopen(cache.path, "r+");
+	ZUC_ASSERT_NOT_NULL(fp);
+	fseek(fp, st.st_size - 1, SEEK_SET);
+	fputc(binary[sizeof binary - 1] ^ 0xff, fp);
+	fclose(fp);
+	ZUC_ASSERT_EQ(-1, shader_cache_load(cache.path, &cache.key, &entry));
+
+	/* Cut short, as after a crash */
+	ZUC_ASSERT_EQ(0, shader_cache_store(cache.path, &cache.key, 1,
+					    binary, sizeof binary));
+	ZUC_ASSERT_EQ(0, truncate(cache.path, st.st_size - 2));
+	ZUC_ASSERT_EQ(-1, shader_cache_load(cache.path, &cache.key, &entry));
+
+	ZUC_ASSERT_EQ(0, truncate(cache.path, 3));
+	ZUC_ASSERT_EQ(-1, shader_cache_load(cache.path, &cache.key, &entry));
+
+	cache_dir_fini(&cache);
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libweston/tile-pool.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define N_JOBS 1000
+
+struct batch {
+	int runs[N_JOBS];	/* each job only writes its own entry */
+	int thread[N_JOBS];
+};
+
+static void
+count_job(void *data, int job, int thread)
+{
+	struct batch *batch = data;
+
+	batch->runs[job]++;
+	batch->thread[job] = thread;
+}
+
+static void
+slow_job(void *data, int job, int thread)
+{
+	struct batch *batch = data;
+
+	usleep(1000);
+	batch->runs[job]++;
+	batch->thread[job] = thread;
+}
+
+static void
+check_batch(struct batch *batch, int n_jobs, int n_threads)
+{
+	int i;
+
+	for (i = 0; i < n_jobs; i++) {
+		ZUC_ASSERT_EQ(1, batch->runs[i]);
+		ZUC_ASSERT_TRUE(batch->thread[i] >= 0);
+		ZUC_ASSERT_TRUE(batch->thread[i] < n_threads);
+	}
+	for (; i < N_JOBS; i++)
+		ZUC_ASSERT_EQ(0, batch->runs[i]);
+}
+
+ZUC_TEST(tile_pool_test, bad_thread_counts)
+{
+	ZUC_ASSERT_NULL(tile_pool_create(0));
+	ZUC_ASSERT_NULL(tile_pool_create(-1));
+	ZUC_ASSERT_NULL(tile_pool_create(TILE_POOL_MAX_THREADS + 1));
+}
+
+ZUC_TEST(tile_pool_test, single_thread_runs_inline)
+{
+	struct tile_pool *pool;
+	struct batch batch;
+	int i;
+
+	pool = tile_pool_create(1);
+	ZUC_ASSERT_NOT_NULL(pool);
+	ZUC_ASSERT_EQ(1, tile_pool_get_threads(pool));
+
+	memset(&batch, 0, sizeof batch);
+	tile_pool_run(pool, N_JOBS, count_job, &batch);
+	check_batch(&batch, N_JOBS, 1);
+	for (i = 0; i < N_JOBS; i++)
+		ZUC_ASSERT_EQ(0, batch.thread[i]);
+
+	tile_pool_destroy(pool);
+}
+
+ZUC_TEST(tile_pool_test, every_job_runs_once)
+{
+	struct tile_pool *pool;
+	struct batch batch;
+	int n;
+
+	pool = tile_pool_create(4);
+	ZUC_ASSERT_NOT_NULL(pool);
+	ZUC_ASSERT_EQ(4, tile_pool_get_threads(pool));
+
+	for (n = 0; n <= N_JOBS; n += 97) {
+		memset(&batch, 0, sizeof batch);
+		tile_pool_run(pool, n, count_job, &batch);
+		check_batch(&batch, n, 4);
+	}
+
+	tile_pool_destroy(pool);
+}
+
+ZUC_TEST(tile_pool_test, workers_share_the_batch)
+{
+	struct tile_pool *pool;
+	struct batch batch;
+	int used[4] = { 0 };
+	int i, n_used = 0;
+
+	pool = tile_pool_create(4);
+	ZUC_ASSERT_NOT_NULL(pool);
+
+	/* Slow enough that the caller can't run them all alone */
+	memset(&batch, 0, sizeof batch);
+	tile_pool_run(pool, 64, slow_job, &batch);
+	check_batch(&batch, 64, 4);
+
+	for (i = 0; i < 64; i++)
+		used[batch.thread[i]] = 1;
+	for (i = 0; i < 4; i++)
+		n_used += used[i];
+	ZUC_ASSERT_TRUE(n_used > 1);
+
+	tile_pool_destroy(pool);
+}
+
+ZUC_TEST(tile_pool_test, many_batches)
+{
+	struct tile_pool *pool;
+	struct batch batch;
+	int i;
+
+	pool = tile_pool_create(TILE_POOL_MAX_THREADS);
+	ZUC_ASSERT_NOT_NULL(pool);
+
+	memset(&batch, 0, sizeof batch);
+	for (i = 0; i < 500; i++)
+		tile_pool_run(pool, 1 + i % 7, count_job, &batch);
+
+	/* Job 0 is in every batch, job 6 in one of seven */
+	ZUC_ASSERT_EQ(500, batch.runs[0]);
+	ZUC_ASSERT_EQ(71, batch.runs[6]);
+	ZUC_ASSERT_EQ(0, batch.runs[7]);
+
+	tile_pool_destroy(pool);
+}
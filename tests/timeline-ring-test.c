@@ -0,0 +1,247 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libweston/timeline-ring.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "zunitc/zunitc.h"
+
+static const char repaint_msg[] = "core_repaint_finished";
+static const char commit_msg[] = "core_commit_damage";
+
+/*
+ * A point should cost well under 100 ns to record. Only fail when it is
+ * an order of magnitude over, so that loaded or instrumented test runs
+ * don't trip over it.
+ */
+#define POINT_BUDGET_NS 100
+#define POINT_LIMIT_NS (10 * POINT_BUDGET_NS)
+
+static void
+add_point(struct timeline_ring *ring, uint64_t timestamp, const char *name,
+	  int type, uint64_t value)
+{
+	struct timeline_ring_point *p = timeline_ring_add_point(ring);
+
+	memset(p, 0, sizeof *p);
+	p->timestamp = timestamp;
+	p->name = name;
+	p->type[0] = type;
+	p->value[0] = value;
+}
+
+static void
+add_desc(struct timeline_ring *ring, uint64_t timestamp, uint32_t id,
+	 int type, uint32_t main_surface, const char *text)
+{
+	struct timeline_ring_desc *desc = timeline_ring_add_desc(ring);
+
+	memset(desc, 0, sizeof *desc);
+	desc->timestamp = timestamp;
+	desc->id = id;
+	desc->type = type;
+	desc->main_surface = main_surface;
+	snprintf(desc->desc, sizeof desc->desc, "%s", text);
+}
+
+/* Converts the ring like weston-timeline-convert would */
+static char *
+ring_to_json(struct timeline_ring *ring)
+{
+	struct timeline_ring *copy;
+	char *data, *json;
+	size_t size, json_size;
+	FILE *fp;
+	int ret;
+
+	copy = timeline_ring_copy(ring);
+	if (!copy)
+		return NULL;
+	ret = timeline_ring_serialize(copy, &data, &size);
+	timeline_ring_destroy(copy);
+	if (ret < 0)
+		return NULL;
+
+	fp = open_memstream(&json, &json_size);
+	ret = timeline_dump_to_json(data, size, fp);
+	fclose(fp);
+	free(data);
+
+	if (ret < 0) {
+		free(json);
+		return NULL;
+	}
+
+	return json;
+}
+
+ZUC_TEST(timeline_ring_test, full_ring_keeps_newest_points)
+{
+	struct timeline_ring *ring;
+	struct timeline_dump_header header;
+	struct timeline_dump_point point;
+	size_t size;
+	char *data, *p;
+	uint32_t len;
+	int i;
+
+	ring = timeline_ring_create(4, 4);
+	ZUC_ASSERT_NOT_NULL(ring);
+
+	for (i = 0; i < 10; i++)
+		add_point(ring, 1000 + i, repaint_msg, TIMELINE_RING_END, 0);
+
+	ZUC_ASSERT_EQ(0, timeline_ring_serialize(ring, &data, &size));
+	timeline_ring_destroy(ring);
+
+	p = data;
+	memcpy(&header, p, sizeof header);
+	p += sizeof header;
+	ZUC_ASSERT_EQ(0, memcmp(header.magic, TIMELINE_DUMP_MAGIC, 8));
+	ZUC_ASSERT_EQ(TIMELINE_DUMP_VERSION, header.version);
+	ZUC_ASSERT_EQ(1, header.n_strings);
+	ZUC_ASSERT_EQ(0, header.n_descs);
+	ZUC_ASSERT_EQ(4, header.n_points);
+	ZUC_ASSERT_EQ(6, header.lost_points);
+
+	memcpy(&len, p, sizeof len);
+	p += sizeof len + len;
+	ZUC_ASSERT_EQ(strlen(repaint_msg), len);
+
+	for (i = 0; i < 4; i++) {
+		memcpy(&point, p, sizeof point);
+		p += sizeof point;
+		ZUC_ASSERT_EQ(1006 + i, point.timestamp);
+		ZUC_ASSERT_EQ(0, point.name);
+	}
+
+	ZUC_ASSERT_EQ(size, (size_t)(p - data));
+	free(data);
+}
+
+ZUC_TEST(timeline_ring_test, json_matches_timeline_log)
+{
+	static const char expected[] =
+		"{ \"id\":1, \"type\":\"weston_output\", \"name\":\"HDMI-A-1\" }\n"
+		"{ \"T\":[2, 5], \"N\":\"core_repaint_finished\", \"wo\":1, "
+			"\"vblank\":[1, 999999999] }\n"
+		"{ \"id\":3, \"type\":\"weston_surface\", \"desc\":null }\n"
+		"{ \"id\":2, \"type\":\"weston_surface\", \"desc\":\"popup\", "
+			"\"main_surface\":3 }\n"
+		"{ \"T\":[3, 0], \"N\":\"core_commit_damage\", \"ws\":2 }\n"
+		"{ \"T\":[3, 1], \"N\":\"core_commit_damage\", \"ws\":2 }\n";
+	struct timeline_ring *ring;
+	struct timeline_ring_point *p;
+	char *json;
+
+	ring = timeline_ring_create(8, 8);
+	ZUC_ASSERT_NOT_NULL(ring);
+
+	/* Descriptions are recorded with the point that made them */
+	add_desc(ring, 2000000005, 1, TIMELINE_RING_OUTPUT, 0, "HDMI-A-1");
+	add_point(ring, 2000000005, repaint_msg, TIMELINE_RING_OUTPUT, 1);
+	p = &ring->points[0];
+	p->type[1] = TIMELINE_RING_VBLANK;
+	p->value[1] = 1999999999;
+
+	add_desc(ring, 3000000000, 3, TIMELINE_RING_SURFACE, 0, "");
+	add_desc(ring, 3000000000, 2, TIMELINE_RING_SURFACE, 3, "popup");
+	add_point(ring, 3000000000, commit_msg, TIMELINE_RING_SURFACE, 2);
+	add_point(ring, 3000000001, commit_msg, TIMELINE_RING_SURFACE, 2);
+
+	json = ring_to_json(ring);
+	timeline_ring_destroy(ring);
+	ZUC_ASSERT_NOT_NULL(json);
+	ZUC_ASSERT_STREQ(expected, json);
+	free(json);
+}
+
+ZUC_TEST(timeline_ring_test, refreshed_description_is_written_again)
+{
+	static const char expected[] =
+		"{ \"id\":4, \"type\":\"weston_surface\", \"desc\":\"old\" }\n"
+		"{ \"T\":[0, 10], \"N\":\"core_commit_damage\", \"ws\":4 }\n"
+		"{ \"id\":4, \"type\":\"weston_surface\", \"desc\":\"new\" }\n"
+		"{ \"T\":[0, 20], \"N\":\"core_commit_damage\", \"ws\":4 }\n";
+	struct timeline_ring *ring;
+	char *json;
+
+	ring = timeline_ring_create(8, 8);
+	ZUC_ASSERT_NOT_NULL(ring);
+
+	add_desc(ring, 10, 4, TIMELINE_RING_SURFACE, 0, "old");
+	add_point(ring, 10, commit_msg, TIMELINE_RING_SURFACE, 4);
+	add_desc(ring, 20, 4, TIMELINE_RING_SURFACE, 0, "new");
+	add_point(ring, 20, commit_msg, TIMELINE_RING_SURFACE, 4);
+
+	json = ring_to_json(ring);
+	timeline_ring_destroy(ring);
+	ZUC_ASSERT_NOT_NULL(json);
+	ZUC_ASSERT_STREQ(expected, json);
+	free(json);
+}
+
+/* Records points the way weston_timeline_point() does with the log closed */
+ZUC_TEST(timeline_ring_test, recording_a_point_is_cheap)
+{
+	struct timeline_ring *ring;
+	struct timeline_ring_point *p;
+	struct timespec ts, start, end;
+	uint64_t ns;
+	int i, n = 1 << 20;
+
+	ring = timeline_ring_create(4096, 8);
+	ZUC_ASSERT_NOT_NULL(ring);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		p = timeline_ring_add_point(ring);
+		p->timestamp = timespec_to_nsec(&ts);
+		p->name = commit_msg;
+		p->type[0] = TIMELINE_RING_SURFACE;
+		p->value[0] = i;
+		p->type[1] = TIMELINE_RING_END;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ZUC_ASSERT_EQ((uint64_t)n, ring->points_written);
+	timeline_ring_destroy(ring);
+
+	ns = timespec_sub_to_nsec(&end, &start) / n;
+	printf("timeline ring: %" PRIu64 " ns per point (budget %d ns)\n",
+	       ns, POINT_BUDGET_NS);
+	ZUC_ASSERT_LT(ns, POINT_LIMIT_NS);
+}
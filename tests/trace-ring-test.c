@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libweston/trace-ring.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define WRITERS		4
+#define ENTRIES		20000
+
+static const char writer_msg[] = "writer";
+
+static int writers_done;
+
+static void *
+writer_thread(void *data)
+{
+	uint32_t id = (uintptr_t)data;
+	int64_t i;
+
+	for (i = 0; i < ENTRIES; i++)
+		trace_ring_record(writer_msg, TRACE_KIND_COUNTER, id, i);
+
+	__atomic_add_fetch(&writers_done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* Leaves the rings empty for the next test */
+static void
+drain(void)
+{
+	struct trace_snapshot snap;
+
+	trace_ring_snapshot(&snap, 1);
+	trace_snapshot_release(&snap);
+}
+
+ZUC_TEST(trace_ring_test, concurrent_writers_lose_nothing_uncounted)
+{
+	pthread_t threads[WRITERS];
+	struct trace_snapshot snap;
+	int64_t next[WRITERS] = { 0 };
+	uint64_t received = 0, dropped = 0, last_ts;
+	int finished = 0;
+	int bad_order = 0;
+	uint32_t i;
+	int w;
+
+	drain();
+
+	for (w = 0; w < WRITERS; w++)
+		pthread_create(&threads[w], NULL, writer_thread,
+			       (void *)(uintptr_t)w);
+
+	/* Read while they write, then once more after they're done */
+	while (!finished) {
+		finished = __atomic_load_n(&writers_done, __ATOMIC_ACQUIRE) ==
+			   WRITERS;
+		ZUC_ASSERT_EQ(0, trace_ring_snapshot(&snap, 1));
+
+		/* Snapshots are in order, but not with respect to each other */
+		last_ts = 0;
+		for (i = 0; i < snap.n_records; i++) {
+			struct trace_entry *e = &snap.records[i].entry;
+
+			if (e->msg != writer_msg)
+				continue;
+			ZUC_ASSERT_TRUE(e->id < WRITERS);
+
+			/* Drops only ever skip ahead */
+			if (e->value < next[e->id])
+				bad_order++;
+			next[e->id] = e->value + 1;
+
+			if (e->timestamp < last_ts)
+				bad_order++;
+			last_ts = e->timestamp;
+			received++;
+		}
+		for (i = 0; i < snap.n_threads; i++)
+			dropped += snap.threads[i].dropped;
+
+		trace_snapshot_release(&snap);
+	}
+
+	for (w = 0; w < WRITERS; w++)
+		pthread_join(threads[w], NULL);
+
+	ZUC_ASSERT_EQ(0, bad_order);
+	ZUC_ASSERT_EQ((uint64_t)WRITERS * ENTRIES, received + dropped);
+}
+
+ZUC_TEST(trace_ring_test, full_ring_drops_new_entries)
+{
+	struct trace_snapshot snap;
+	uint32_t i;
+
+	drain();
+
+	for (i = 0; i < 100000; i++)
+		trace_ring_record(writer_msg, TRACE_KIND_INSTANT, i, 0);
+
+	/* Preserving the log reports the same entries twice */
+	ZUC_ASSERT_EQ(0, trace_ring_snapshot(&snap, 0));
+	trace_snapshot_release(&snap);
+	ZUC_ASSERT_EQ(0, trace_ring_snapshot(&snap, 1));
+
+	ZUC_ASSERT_EQ(1, snap.n_threads);
+	ZUC_ASSERT_TRUE(snap.threads[0].dropped > 0);
+	ZUC_ASSERT_EQ(100000, snap.n_records + snap.threads[0].dropped);
+
+	/* The oldest entries are the ones kept */
+	for (i = 0; i < snap.n_records; i++)
+		ZUC_ASSERT_EQ(i, snap.records[i].entry.id);
+
+	trace_snapshot_release(&snap);
+
+	/* Clearing made room again */
+	trace_ring_record(writer_msg, TRACE_KIND_INSTANT, 7, 0);
+	ZUC_ASSERT_EQ(0, trace_ring_snapshot(&snap, 1));
+	ZUC_ASSERT_EQ(1, snap.n_records);
+	ZUC_ASSERT_EQ(0, snap.threads[0].dropped);
+	trace_snapshot_release(&snap);
+}
+
+ZUC_TEST(trace_ring_test, serialized_dump_round_trips)
+{
+	static const char begin_msg[] = "frame";
+	static const char counter_msg[] = "queue depth";
+	struct trace_snapshot snap;
+	struct trace_dump_header header;
+	struct trace_dump_thread thread;
+	struct trace_dump_event ev;
+	uint32_t len;
+	size_t size;
+	char *data, *p;
+
+	drain();
+
+	trace_ring_record(begin_msg, TRACE_KIND_BEGIN, 3, 0);
+	trace_ring_record(counter_msg, TRACE_KIND_COUNTER, 0, -42);
+	trace_ring_record(begin_msg, TRACE_KIND_END, 3, 0);
+
+	ZUC_ASSERT_EQ(0, trace_ring_snapshot(&snap, 1));
+	ZUC_ASSERT_EQ(0, trace_snapshot_serialize(&snap, &data, &size));
+	trace_snapshot_release(&snap);
+
+	p = data;
+	memcpy(&header, p, sizeof header);
+	p += sizeof header;
+	ZUC_ASSERT_EQ(0, memcmp(header.magic, TRACE_DUMP_MAGIC, 8));
+	ZUC_ASSERT_EQ(TRACE_DUMP_VERSION, header.version);
+	ZUC_ASSERT_EQ(1, header.n_threads);
+	ZUC_ASSERT_EQ(2, header.n_strings);
+	ZUC_ASSERT_EQ(3, header.n_events);
+
+	memcpy(&thread, p, sizeof thread);
+	p += sizeof thread;
+	ZUC_ASSERT_EQ(0, thread.dropped);
+
+	memcpy(&len, p, sizeof len);
+	p += sizeof len;
+	ZUC_ASSERT_EQ(strlen(begin_msg), len);
+	ZUC_ASSERT_EQ(0, memcmp(p, begin_msg, len));
+	p += len;
+	memcpy(&len, p, sizeof len);
+	p += sizeof len + len;
+
+	memcpy(&ev, p, sizeof ev);
+	p += sizeof ev;
+	ZUC_ASSERT_EQ(TRACE_KIND_BEGIN, ev.kind);
+	ZUC_ASSERT_EQ(0, ev.string);
+	ZUC_ASSERT_EQ(3, ev.id);
+
+	memcpy(&ev, p, sizeof ev);
+	p += sizeof ev;
+	ZUC_ASSERT_EQ(TRACE_KIND_COUNTER, ev.kind);
+	ZUC_ASSERT_EQ(1, ev.string);
+	ZUC_ASSERT_EQ(-42, ev.value);
+
+	memcpy(&ev, p, sizeof ev);
+	p += sizeof ev;
+	ZUC_ASSERT_EQ(TRACE_KIND_END, ev.kind);
+	ZUC_ASSERT_EQ(0, ev.string);
+
+	ZUC_ASSERT_EQ(size, (size_t)(p - data));
+	free(data);
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libweston/vm-delta.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/*
+ * Replays a synthetic compositor session through both metadata formats and
+ * checks that whatever a delta receiver hands out is what the full table
+ * receiver would have handed out for the same frame.
+ */
+
+#define NUM_OUTPUTS	3
+#define NUM_FRAMES	2000
+#define MAX_SURFACES	16
+#define KEYFRAME	30
+#define QUEUE_DEPTH	(2 * NUM_OUTPUTS)
+
+struct scene {
+	struct vm_header h;
+	int n;
+	struct vm_buffer_info buffers[MAX_SURFACES];
+	uint64_t next_id;
+};
+
+struct replay {
+	struct scene scenes[NUM_OUTPUTS];
+	struct vm_delta_encoder *enc;
+	struct vm_delta_decoder *dec;
+	void *tables[VM_MAX_OUTPUTS];
+	int32_t counter;
+	uint32_t seed;
+
+	int drop_every;
+	int per_record;
+
+	size_t full_bytes;
+	size_t delta_bytes;
+	int published;
+	int mismatches;
+	int stale;
+};
+
+static uint32_t
+next_rand(struct replay *r)
+{
+	r->seed = r->seed * 1103515245 + 12345;
+	return (r->seed >> 16) & 0x7fff;
+}
+
+static void
+new_surface(struct replay *r, struct scene *s, struct vm_buffer_info *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->surface_id = s->next_id++;
+	b->width = 64 + next_rand(r) % 1024;
+	b->height = 64 + next_rand(r) % 1024;
+	b->pitch[0] = b->width * 4;
+	b->format = 0x34325258;
+	b->status = UPDATED;
+	b->hyper_dmabuf_id.id = next_rand(r);
+	snprintf(b->surface_name, SURFACE_NAME_LENGTH, "surface-%d",
+		 (int) b->surface_id);
+	b->bbox[2] = b->width;
+	b->bbox[3] = b->height;
+}
+
+/* What a compositor frame might do to the shared surfaces on an output */
+static void
+step_scene(struct replay *r, struct scene *s)
+{
+	int i, pos;
+
+	for (i = 0; i < s->n; i++) {
+		if (next_rand(r) % 4 == 0) {
+			s->buffers[i].counter++;
+			s->buffers[i].hyper_dmabuf_id.id = next_rand(r);
+		}
+		if (next_rand(r) % 50 == 0)
+			s->buffers[i].bbox[0] += 8;
+	}
+
+	if (s->n < MAX_SURFACES && next_rand(r) % 20 == 0) {
+		pos = next_rand(r) % (s->n + 1);
+		memmove(&s->buffers[pos + 1], &s->buffers[pos],
+			(s->n - pos) * sizeof(s->buffers[0]));
+		new_surface(r, s, &s->buffers[pos]);
+		s->n++;
+	}
+
+	if (s->n > 1 && next_rand(r) % 20 == 0) {
+		pos = next_rand(r) % s->n;
+		memmove(&s->buffers[pos], &s->buffers[pos + 1],
+			(s->n - pos - 1) * sizeof(s->buffers[0]));
+		s->n--;
+	}
+
+	if (next_rand(r) % 200 == 0)
+		s->h.disp_w = s->h.disp_w == 1920 ? 1280 : 1920;
+
+	for (i = 0; i < s->n; i++)
+		s->buffers[i].surf_index = i;
+
+	s->h.counter = ++r->counter;
+	s->h.n_buffers = s->n;
+}
+
+/* Same steps as vm_table_expose_delta() in libweston/vm.c */
+static int
+encode_frame(struct vm_delta_encoder *enc, const struct scene *s, char *out)
+{
+	struct vm_delta_header delta;
+	struct vm_header hdr = s->h;
+	int changed[MAX_SURFACES];
+	int i, len = 0;
+
+	hdr.version = VM_DELTA_VERSION;
+	vm_delta_encoder_begin(enc, KEYFRAME, &delta);
+
+	for (i = 0; i < s->n; i++) {
+		changed[i] = vm_delta_encoder_changed(enc, &delta,
+						      &s->buffers[i]);
+		delta.n_records += changed[i];
+	}
+
+	if (delta.n_records == 0 && vm_delta_encoder_header_changed(enc, &hdr)) {
+		changed[0] = 1;
+		delta.n_records = 1;
+	}
+
+	if (delta.n_records == 0)
+		return 0;
+
+	memcpy(out + len, &hdr, sizeof(hdr));
+	len += sizeof(hdr);
+	memcpy(out + len, &delta, sizeof(delta));
+	len += sizeof(delta);
+
+	for (i = 0; i < s->n; i++) {
+		if (!changed[i])
+			continue;
+		vm_delta_encoder_store(enc, &s->buffers[i]);
+		memcpy(out + len, &s->buffers[i], sizeof(s->buffers[i]));
+		len += sizeof(s->buffers[i]);
+	}
+
+	vm_delta_encoder_end(enc, &hdr, &delta);
+
+	return len;
+}
+
+/* Feed a frame the way hyper_dmabuf events deliver it, one record each */
+static int
+decode_per_record(struct vm_delta_decoder *dec, const char *data,
+		  void **tables)
+{
+	struct vm_header hdr;
+	struct vm_delta_header delta;
+	struct vm_buffer_info info;
+	int i, output = -1;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	memcpy(&delta, data + sizeof(hdr), sizeof(delta));
+	data += sizeof(hdr) + sizeof(delta);
+
+	for (i = 0; i < delta.n_records; i++) {
+		memcpy(&info, data + i * sizeof(info), sizeof(info));
+		output = vm_delta_decode_record(dec, &hdr, &delta, &info,
+						tables);
+		if (output >= 0 && i != delta.n_records - 1)
+			return -2;
+	}
+
+	return output;
+}
+
+/* The table a receiver gets from the full table stream */
+static int
+matches_full_table(const struct scene *s, const void *table)
+{
+	struct vm_header hdr;
+
+	memcpy(&hdr, table, sizeof(hdr));
+
+	/* The header counter only says which frame last had changes */
+	if (hdr.version != VM_TABLE_VERSION ||
+	    hdr.output != s->h.output ||
+	    hdr.n_buffers != s->h.n_buffers ||
+	    hdr.disp_w != s->h.disp_w ||
+	    hdr.disp_h != s->h.disp_h)
+		return 0;
+
+	return memcmp((const char *) table + sizeof(hdr), s->buffers,
+		      s->n * sizeof(s->buffers[0])) == 0;
+}
+
+static void
+replay_init(struct replay *r, uint32_t seed)
+{
+	int i, j;
+
+	memset(r, 0, sizeof(*r));
+	r->seed = seed;
+	r->enc = calloc(NUM_OUTPUTS, sizeof(*r->enc));
+	r->dec = calloc(1, sizeof(*r->dec));
+	vm_delta_decoder_init(r->dec);
+
+	for (i = 0; i < VM_MAX_OUTPUTS; i++)
+		r->tables[i] = calloc(1, METADATA_BUFFER_SIZE);
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		struct scene *s = &r->scenes[i];
+
+		r->enc[i].force_keyframe = 1;
+		s->h.version = VM_TABLE_VERSION;
+		s->h.output = i;
+		s->h.disp_w = 1920;
+		s->h.disp_h = 720;
+		s->next_id = (uint64_t) (i + 1) << 32;
+		s->n = 1 + i * 4;
+		for (j = 0; j < s->n; j++)
+			new_surface(r, s, &s->buffers[j]);
+	}
+}
+
+static void
+replay_fini(struct replay *r)
+{
+	int i;
+
+	for (i = 0; i < VM_MAX_OUTPUTS; i++)
+		free(r->tables[i]);
+	free(r->enc);
+	free(r->dec);
+}
+
+static void
+replay_run(struct replay *r)
+{
+	static char frame[METADATA_BUFFER_SIZE];
+	int f, i, o, len, output;
+	int needs_keyframe[NUM_OUTPUTS] = { 0 };
+	int force_at = -1;
+
+	for (f = 0; f < NUM_FRAMES; f++) {
+		o = f % NUM_OUTPUTS;
+		step_scene(r, &r->scenes[o]);
+
+		r->full_bytes += sizeof(struct vm_header) +
+			r->scenes[o].n * sizeof(struct vm_buffer_info);
+
+		if (f == force_at) {
+			for (i = 0; i < NUM_OUTPUTS; i++)
+				r->enc[i].force_keyframe = 1;
+		}
+
+		len = encode_frame(&r->enc[o], &r->scenes[o], frame);
+		r->delta_bytes += len;
+
+		if (len > 0 && r->drop_every && f % r->drop_every == 0) {
+			/*
+			 * vm_table_clean() drops the oldest queued frame and
+			 * asks for a keyframe, but the deltas queued behind
+			 * it still go out first.
+			 */
+			force_at = f + QUEUE_DEPTH;
+			needs_keyframe[o] = 1;
+			len = 0;
+		}
+
+		if (len > 0) {
+			if (r->per_record)
+				output = decode_per_record(r->dec, frame,
+							   r->tables);
+			else
+				output = vm_delta_decode_frame(r->dec, frame,
+							       len, r->tables);
+			if (output >= 0) {
+				r->published++;
+				if (output != o ||
+				    !matches_full_table(&r->scenes[o],
+							r->tables[o]))
+					r->mismatches++;
+				needs_keyframe[o] = 0;
+			}
+		}
+
+		/*
+		 * Whether or not anything went out, the last table handed
+		 * out has to match unless frames have been lost since.
+		 */
+		if (!matches_full_table(&r->scenes[o], r->tables[o])) {
+			if (needs_keyframe[o])
+				r->stale++;
+			else
+				r->mismatches++;
+		}
+	}
+}
+
+ZUC_TEST(vm_delta_test, replay_matches_full_tables)
+{
+	struct replay r;
+
+	replay_init(&r, 1);
+	replay_run(&r);
+
+	ZUC_ASSERT_EQ(0, r.mismatches);
+	ZUC_ASSERT_EQ(0, r.stale);
+	ZUC_ASSERT_TRUE(r.published > 0);
+	ZUC_ASSERT_TRUE(r.delta_bytes < r.full_bytes);
+
+	printf("full tables: %zu bytes, deltas: %zu bytes\n",
+	       r.full_bytes, r.delta_bytes);
+
+	replay_fini(&r);
+}
+
+ZUC_TEST(vm_delta_test, replay_matches_full_tables_per_record)
+{
+	struct replay r;
+
+	replay_init(&r, 2);
+	r.per_record = 1;
+	replay_run(&r);
+
+	ZUC_ASSERT_EQ(0, r.mismatches);
+	ZUC_ASSERT_EQ(0, r.stale);
+	ZUC_ASSERT_TRUE(r.published > 0);
+
+	replay_fini(&r);
+}
+
+ZUC_TEST(vm_delta_test, recovers_from_dropped_frames)
+{
+	struct replay r;
+
+	replay_init(&r, 3);
+	r.drop_every = 17;
+	replay_run(&r);
+
+	/* Never a wrong table, only an old one until the next keyframe */
+	ZUC_ASSERT_EQ(0, r.mismatches);
+	ZUC_ASSERT_TRUE(r.stale > 0);
+	ZUC_ASSERT_TRUE(r.dec->frames_dropped > 0);
+	ZUC_ASSERT_TRUE(r.published > 0);
+
+	replay_fini(&r);
+}
+
+ZUC_TEST(vm_delta_test, delta_without_keyframe_is_ignored)
+{
+	struct vm_delta_decoder *dec = calloc(1, sizeof(*dec));
+	void *tables[VM_MAX_OUTPUTS] = { 0 };
+	char table[METADATA_BUFFER_SIZE];
+	char frame[sizeof(struct vm_header) + sizeof(struct vm_delta_header) +
+		   sizeof(struct vm_buffer_info)];
+	struct vm_header hdr = { 0 };
+	struct vm_delta_header delta = { 0 };
+	struct vm_buffer_info info = { 0 };
+
+	ZUC_ASSERT_NOT_NULL(dec);
+	vm_delta_decoder_init(dec);
+	tables[0] = table;
+
+	hdr.version = VM_DELTA_VERSION;
+	hdr.counter = 5;
+	hdr.n_buffers = 1;
+	delta.base_counter = 4;
+	delta.n_records = 1;
+
+	memcpy(frame, &hdr, sizeof(hdr));
+	memcpy(frame + sizeof(hdr), &delta, sizeof(delta));
+	memcpy(frame + sizeof(hdr) + sizeof(delta), &info, sizeof(info));
+
+	ZUC_ASSERT_EQ(-1, vm_delta_decode_frame(dec, frame, sizeof(frame),
+						tables));
+
+	delta.flags = VM_DELTA_KEYFRAME;
+	memcpy(frame + sizeof(hdr), &delta, sizeof(delta));
+	ZUC_ASSERT_EQ(0, vm_delta_decode_frame(dec, frame, sizeof(frame),
+					       tables));
+
+	/* Truncated frames are rejected */
+	ZUC_ASSERT_EQ(-1, vm_delta_decode_frame(dec, frame, sizeof(frame) - 1,
+						tables));
+
+	free(dec);
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "clients/vmdisplay/vmdisplay-shm.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define GENERATIONS	20000
+#define READERS		4
+
+struct shm_test {
+	struct vmdisplay_shm *shm;
+	int done;
+	int torn;
+	int updates[READERS];
+};
+
+struct reader {
+	struct shm_test *test;
+	int id;
+};
+
+/* Every generation has its own length and is filled with its own value */
+static uint32_t
+gen_len(uint32_t gen)
+{
+	return sizeof(uint32_t) + (gen * 97) % (METADATA_BUFFER_SIZE - 4);
+}
+
+static void
+gen_fill(char *table, uint32_t gen)
+{
+	memcpy(table, &gen, sizeof(gen));
+	memset(table + sizeof(gen), gen & 0xff, gen_len(gen) - sizeof(gen));
+}
+
+static int
+gen_check(const char *table, uint32_t len)
+{
+	uint32_t gen, i;
+
+	if (len == 0)
+		return 1;
+
+	memcpy(&gen, table, sizeof(gen));
+	if (len != gen_len(gen))
+		return 0;
+
+	for (i = sizeof(gen); i < len; i++)
+		if ((unsigned char) table[i] != (gen & 0xff))
+			return 0;
+
+	return 1;
+}
+
+static void *
+reader_thread(void *data)
+{
+	struct reader *reader = data;
+	struct shm_test *test = reader->test;
+	char *table = malloc(METADATA_BUFFER_SIZE);
+	uint32_t seq = 0, last = 0, len;
+
+	while (!__atomic_load_n(&test->done, __ATOMIC_ACQUIRE)) {
+		/* Half of them sleep between updates, half poll */
+		if (reader->id % 2 == 0 &&
+		    vmdisplay_shm_wait(test->shm, seq, 100) < 0)
+			continue;
+
+		seq = vmdisplay_shm_read(test->shm, table, &len);
+		if (!gen_check(table, len) || seq < last)
+			__atomic_add_fetch(&test->torn, 1, __ATOMIC_RELAXED);
+
+		last = seq;
+		test->updates[reader->id]++;
+	}
+
+	free(table);
+
+	return NULL;
+}
+
+static struct vmdisplay_shm *
+shm_create(void)
+{
+	void *addr = mmap(NULL, sizeof(struct vmdisplay_shm),
+			  PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+ZUC_TEST(vmdisplay_shm_test, readers_never_see_torn_tables)
+{
+	struct shm_test test = { 0 };
+	struct reader readers[READERS];
+	pthread_t threads[READERS];
+	char *table = malloc(METADATA_BUFFER_SIZE);
+	uint32_t gen;
+	int i;
+
+	test.shm = shm_create();
+	ZUC_ASSERT_NOT_NULL(test.shm);
+
+	for (i = 0; i < READERS; i++) {
+		readers[i].test = &test;
+		readers[i].id = i;
+		pthread_create(&threads[i], NULL, reader_thread, &readers[i]);
+	}
+
+	for (gen = 1; gen <= GENERATIONS; gen++) {
+		gen_fill(table, gen);
+		vmdisplay_shm_publish(test.shm, table, gen_len(gen));
+	}
+
+	__atomic_store_n(&test.done, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < READERS; i++)
+		pthread_join(threads[i], NULL);
+
+	ZUC_ASSERT_EQ(0, test.torn);
+	for (i = 0; i < READERS; i++)
+		ZUC_ASSERT_TRUE(test.updates[i] > 0);
+
+	free(table);
+	munmap(test.shm, sizeof(*test.shm));
+}
+
+ZUC_TEST(vmdisplay_shm_test, wait_times_out_without_update)
+{
+	struct vmdisplay_shm *shm = shm_create();
+	char table[16] = { 0 };
+	uint32_t seq, len;
+
+	ZUC_ASSERT_NOT_NULL(shm);
+
+	seq = vmdisplay_shm_read(shm, table, &len);
+	ZUC_ASSERT_EQ(0, len);
+	ZUC_ASSERT_EQ(-1, vmdisplay_shm_wait(shm, seq, 10));
+
+	vmdisplay_shm_publish(shm, table, sizeof(table));
+	ZUC_ASSERT_EQ(0, vmdisplay_shm_wait(shm, seq, 10));
+
+	seq = vmdisplay_shm_read(shm, table, &len);
+	ZUC_ASSERT_EQ(sizeof(table), len);
+	ZUC_ASSERT_EQ(-1, vmdisplay_shm_wait(shm, seq, 10));
+
+	munmap(shm, sizeof(*shm));
+}
+
+/* Readers keep getting the last complete table while the next is written */
+ZUC_TEST(vmdisplay_shm_test, read_during_update_gets_previous_table)
+{
+	struct vmdisplay_shm *shm = shm_create();
+	char *table = malloc(METADATA_BUFFER_SIZE);
+	uint32_t seq, gen, len;
+
+	ZUC_ASSERT_NOT_NULL(shm);
+
+	gen_fill(table, 1);
+	vmdisplay_shm_publish(shm, table, gen_len(1));
+	gen_fill(table, 2);
+	vmdisplay_shm_publish(shm, table, gen_len(2));
+
+	/* What the writer leaves behind halfway through the third one */
+	seq = shm->seq;
+	shm->seq = seq + 1;
+	memset(shm->slot[((seq >> 1) + 1) % VMDISPLAY_SHM_SLOTS], 0xaa,
+	       METADATA_BUFFER_SIZE);
+
+	memset(table, 0, METADATA_BUFFER_SIZE);
+	ZUC_ASSERT_EQ(seq, vmdisplay_shm_read(shm, table, &len));
+	ZUC_ASSERT_TRUE(gen_check(table, len));
+	memcpy(&gen, table, sizeof(gen));
+	ZUC_ASSERT_EQ(2, gen);
+
+	/* Not a new table yet */
+	ZUC_ASSERT_EQ(-1, vmdisplay_shm_wait(shm, seq, 10));
+
+	free(table);
+	munmap(shm, sizeof(*shm));
+}
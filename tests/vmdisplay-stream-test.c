@@ -0,0 +1,313 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "clients/vmdisplay/vmdisplay-stream.h"
+
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+#define NUM_FRAMES	300
+#define MAX_FRAME	(METADATA_BUFFER_SIZE - 2 * sizeof(uint32_t))
+#define MAX_STREAM	(NUM_FRAMES * (METADATA_BUFFER_SIZE + 64) + 65536)
+
+enum frame_kind {
+	KIND_MARKERS,
+	KIND_PREFIXED,
+	KIND_MIXED,
+};
+
+struct replay {
+	uint32_t seed;
+
+	/* What the sender put in, back to back */
+	char *sent;
+	size_t sent_len;
+	int sent_frames;
+
+	/* What the sender wrote on the wire */
+	char *wire;
+	size_t wire_len;
+
+	/* What came out of the parser */
+	char *received;
+	size_t received_len;
+	int received_frames;
+	int bad_frames;
+};
+
+static uint32_t
+next_rand(struct replay *r)
+{
+	r->seed = r->seed * 1103515245 + 12345;
+	return (r->seed >> 16) & 0x7fff;
+}
+
+static void
+wire_put(struct replay *r, const void *data, size_t len)
+{
+	memcpy(r->wire + r->wire_len, data, len);
+	r->wire_len += len;
+}
+
+static void
+wire_put_u32(struct replay *r, uint32_t val)
+{
+	wire_put(r, &val, sizeof(val));
+}
+
+static void
+replay_init(struct replay *r, uint32_t seed)
+{
+	memset(r, 0, sizeof(*r));
+	r->seed = seed;
+	r->sent = malloc(MAX_STREAM);
+	r->wire = malloc(MAX_STREAM);
+	r->received = malloc(MAX_STREAM);
+}
+
+static void
+replay_fini(struct replay *r)
+{
+	free(r->sent);
+	free(r->wire);
+	free(r->received);
+}
+
+/*
+ * Frame contents. Only prefixed frames may contain the marker values, in
+ * the marker format they would be taken for the end of the frame.
+ */
+static void
+make_frames(struct replay *r, enum frame_kind kind)
+{
+	int i;
+	size_t j, len;
+	int prefixed;
+	char *frame;
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		if (kind == KIND_MIXED)
+			prefixed = next_rand(r) % 2;
+		else
+			prefixed = kind == KIND_PREFIXED;
+
+		len = 1 + (next_rand(r) * 7 + next_rand(r)) % MAX_FRAME;
+		frame = r->sent + r->sent_len;
+
+		for (j = 0; j < len; j++)
+			frame[j] = 1 + next_rand(r) % 255;
+
+		if (prefixed && len >= 2 * sizeof(uint32_t)) {
+			uint32_t end = METADATA_STREAM_END;
+			uint32_t start = METADATA_STREAM_START;
+
+			memcpy(frame, &end, sizeof(end));
+			memcpy(frame + len - sizeof(start), &start,
+			       sizeof(start));
+		}
+
+		/* The way vm_table_clean() and vm_network.c put them out */
+		if (prefixed) {
+			wire_put_u32(r, METADATA_FRAME_MAGIC);
+			wire_put_u32(r, len + 2 * sizeof(uint32_t));
+		} else if (next_rand(r) % 4 == 0) {
+			/* An END marker with no frame, as sent for idle repaints */
+			wire_put_u32(r, METADATA_STREAM_END);
+		}
+		wire_put_u32(r, METADATA_STREAM_START);
+		wire_put(r, frame, len);
+		wire_put_u32(r, METADATA_STREAM_END);
+
+		r->sent_len += len;
+		r->sent_frames++;
+	}
+}
+
+/* Push the wire bytes through in chunks of random size */
+static void
+feed(struct replay *r, struct vmdisplay_stream *stream,
+     const char *wire, size_t wire_len, int max_chunk)
+{
+	size_t off = 0;
+	const char *frame;
+	char *space;
+	int len, chunk;
+
+	while (1) {
+		while ((len = vmdisplay_stream_next_frame(stream, &frame)) > 0) {
+			if (len > METADATA_BUFFER_SIZE) {
+				r->bad_frames++;
+				continue;
+			}
+			memcpy(r->received + r->received_len, frame, len);
+			r->received_len += len;
+			r->received_frames++;
+		}
+
+		if (off == wire_len)
+			break;
+
+		len = vmdisplay_stream_get_space(stream, &space);
+		if (len <= 0) {
+			r->bad_frames++;
+			break;
+		}
+
+		chunk = 1 + next_rand(r) % max_chunk;
+		if (chunk > len)
+			chunk = len;
+		if ((size_t) chunk > wire_len - off)
+			chunk = wire_len - off;
+
+		memcpy(space, wire + off, chunk);
+		vmdisplay_stream_commit(stream, chunk);
+		off += chunk;
+	}
+}
+
+static int
+run(enum frame_kind kind, uint32_t seed, int max_chunk)
+{
+	struct vmdisplay_stream *stream = malloc(sizeof(*stream));
+	struct replay r;
+	int ok;
+
+	replay_init(&r, seed);
+	make_frames(&r, kind);
+
+	vmdisplay_stream_init(stream);
+	feed(&r, stream, r.wire, r.wire_len, max_chunk);
+
+	ok = r.bad_frames == 0 &&
+	     r.received_frames == r.sent_frames &&
+	     r.received_len == r.sent_len &&
+	     memcmp(r.received, r.sent, r.sent_len) == 0 &&
+	     stream->dropped == 0;
+
+	if (kind == KIND_PREFIXED)
+		ok = ok && stream->framed == (uint32_t) r.sent_frames;
+
+	free(stream);
+	replay_fini(&r);
+
+	return ok;
+}
+
+ZUC_TEST(vmdisplay_stream_test, marker_frames)
+{
+	ZUC_ASSERT_TRUE(run(KIND_MARKERS, 1, 4096));
+}
+
+ZUC_TEST(vmdisplay_stream_test, marker_frames_bytewise)
+{
+	ZUC_ASSERT_TRUE(run(KIND_MARKERS, 2, 1));
+}
+
+ZUC_TEST(vmdisplay_stream_test, prefixed_frames)
+{
+	ZUC_ASSERT_TRUE(run(KIND_PREFIXED, 3, 4096));
+}
+
+ZUC_TEST(vmdisplay_stream_test, prefixed_frames_bytewise)
+{
+	ZUC_ASSERT_TRUE(run(KIND_PREFIXED, 4, 1));
+}
+
+ZUC_TEST(vmdisplay_stream_test, mixed_frames)
+{
+	ZUC_ASSERT_TRUE(run(KIND_MIXED, 5, 9000));
+}
+
+/*
+ * Random garbage, including broken prefixes and unterminated frames, must
+ * neither produce oversized frames nor stop the frames after it from
+ * coming through.
+ */
+ZUC_TEST(vmdisplay_stream_test, recovers_after_garbage)
+{
+	struct vmdisplay_stream *stream = malloc(sizeof(*stream));
+	struct replay r;
+	char *wire;
+	size_t i, garbage_len = 200000;
+	size_t tail_len, tail_start;
+
+	ZUC_ASSERT_NOT_NULL(stream);
+	vmdisplay_stream_init(stream);
+	replay_init(&r, 6);
+
+	wire = malloc(garbage_len + 64);
+	ZUC_ASSERT_NOT_NULL(wire);
+	for (i = 0; i < garbage_len; i++) {
+		switch (next_rand(&r) % 64) {
+		case 0:
+			*(uint32_t *) &wire[i & ~3] = METADATA_STREAM_START;
+			break;
+		case 1:
+			*(uint32_t *) &wire[i & ~3] = METADATA_STREAM_END;
+			break;
+		case 2:
+			*(uint32_t *) &wire[i & ~3] = METADATA_FRAME_MAGIC;
+			break;
+		default:
+			wire[i] = next_rand(&r);
+			break;
+		}
+	}
+	/* Leave it inside a prefixed frame that is never completed */
+	memcpy(&wire[garbage_len], &(struct vm_frame_prefix) {
+		METADATA_FRAME_MAGIC, METADATA_BUFFER_SIZE }, 8);
+
+	feed(&r, stream, wire, garbage_len + 8, 3000);
+	ZUC_ASSERT_EQ(0, r.bad_frames);
+
+	/*
+	 * The unfinished prefixed frame swallows whatever comes next, up
+	 * to its length; after that proper frames must show up again.
+	 */
+	memset(wire, 1, METADATA_BUFFER_SIZE);
+	feed(&r, stream, wire, METADATA_BUFFER_SIZE, 3000);
+	free(wire);
+
+	tail_start = r.received_len;
+	tail_len = r.sent_len;
+	r.received_frames = 0;
+	make_frames(&r, KIND_MIXED);
+	feed(&r, stream, r.wire, r.wire_len, 3000);
+
+	ZUC_ASSERT_EQ(0, r.bad_frames);
+	ZUC_ASSERT_EQ(r.sent_frames, r.received_frames);
+	ZUC_ASSERT_EQ(0, memcmp(r.received + tail_start, r.sent + tail_len,
+				r.sent_len - tail_len));
+
+	free(stream);
+	replay_fini(&r);
+}
@@ -498,6 +498,13 @@ create_shm_buffer_a8r8g8b8(struct client *client, int width, int height)
 				 PIXMAN_a8r8g8b8, WL_SHM_FORMAT_ARGB8888);
 }
 
+struct buffer *
+create_shm_buffer_x8r8g8b8(struct client *client, int width, int height)
+{
+	return create_shm_buffer(client, width, height,
+				 PIXMAN_x8r8g8b8, WL_SHM_FORMAT_XRGB8888);
+}
+
 void
 buffer_destroy(struct buffer *buf)
 {
@@ -549,9 +556,35 @@ test_handle_capture_screenshot_done(void *data, struct weston_test *weston_test)
 	test->buffer_copy_done = 1;
 }
 
+static void
+test_handle_usage(void *data, struct weston_test *weston_test,
+		  uint32_t cpu_time_hi, uint32_t cpu_time_lo,
+		  uint32_t allocations_hi, uint32_t allocations_lo)
+{
+	struct test *test = data;
+
+	test->cpu_time_ns = (uint64_t)cpu_time_hi << 32 | cpu_time_lo;
+	test->allocations = (uint64_t)allocations_hi << 32 | allocations_lo;
+	test->usage_done = 1;
+}
+
+static void
+test_handle_render_usage(void *data, struct weston_test *weston_test,
+			 int32_t threads, uint32_t pixels_hi,
+			 uint32_t pixels_lo)
+{
+	struct test *test = data;
+
+	test->render_threads = threads;
+	test->pixels_written = (uint64_t)pixels_hi << 32 | pixels_lo;
+	test->render_usage_done = 1;
+}
+
 static const struct weston_test_listener test_listener = {
 	test_handle_pointer_position,
 	test_handle_capture_screenshot_done,
+	test_handle_usage,
+	test_handle_render_usage,
 };
 
 static void
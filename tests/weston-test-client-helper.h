@@ -72,6 +72,12 @@ struct test {
 	int pointer_y;
 	uint32_t n_egl_buffers;
 	int buffer_copy_done;
+	uint64_t cpu_time_ns;
+	uint64_t allocations;	/* UINT64_MAX if not counted */
+	int usage_done;
+	int render_threads;	/* -1 if not the pixman renderer */
+	uint64_t pixels_written;
+	int render_usage_done;
 };
 
 struct input {
@@ -188,6 +194,9 @@ create_client_and_test_surface(int x, int y, int width, int height);
 struct buffer *
 create_shm_buffer_a8r8g8b8(struct client *client, int width, int height);
 
+struct buffer *
+create_shm_buffer_x8r8g8b8(struct client *client, int width, int height);
+
 void
 buffer_destroy(struct buffer *buf);
 
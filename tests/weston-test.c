@@ -31,9 +31,12 @@
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <dlfcn.h>
 
 #include "compositor.h"
 #include "compositor/weston.h"
+#include "pixman-renderer.h"
 #include "weston-test-server-protocol.h"
 
 #ifdef ENABLE_EGL
@@ -51,6 +54,9 @@ struct weston_test {
 	struct weston_process process;
 	struct weston_seat seat;
 	bool is_seat_initialized;
+
+	/* From bench-alloc.so, if it was preloaded */
+	uint64_t (*get_allocations)(void);
 };
 
 struct weston_test_surface {
@@ -558,6 +564,47 @@ send_touch(struct wl_client *client, struct wl_resource *resource,
 		     wl_fixed_to_double(y), touch_type);
 }
 
+static void
+get_usage(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct timespec cpu_time;
+	uint64_t cpu_ns;
+	uint64_t allocations = UINT64_MAX;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+	cpu_ns = timespec_to_nsec(&cpu_time);
+
+	if (test->get_allocations)
+		allocations = test->get_allocations();
+
+	weston_test_send_usage(resource, cpu_ns >> 32, cpu_ns & 0xffffffff,
+			       allocations >> 32, allocations & 0xffffffff);
+}
+
+static void
+set_render_threads(struct wl_client *client, struct wl_resource *resource,
+		   uint32_t threads)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+
+	pixman_renderer_set_threads(test->compositor, threads);
+}
+
+static void
+get_render_usage(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	int threads = pixman_renderer_get_threads(test->compositor);
+	uint64_t pixels = UINT64_MAX;
+
+	if (threads >= 0)
+		pixels = pixman_renderer_get_pixels_written(test->compositor);
+
+	weston_test_send_render_usage(resource, threads, pixels >> 32,
+				      pixels & 0xffffffff);
+}
+
 static const struct weston_test_interface test_implementation = {
 	move_surface,
 	move_pointer,
@@ -569,6 +616,9 @@ static const struct weston_test_interface test_implementation = {
 	device_add,
 	capture_screenshot,
 	send_touch,
+	get_usage,
+	set_render_threads,
+	get_render_usage,
 };
 
 static void
@@ -577,7 +627,8 @@ bind_test(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 	struct weston_test *test = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client, &weston_test_interface, 1, id);
+	resource = wl_resource_create(client, &weston_test_interface,
+				      MIN(version, 3), id);
 	if (!resource) {
 		wl_client_post_no_memory(client);
 		return;
@@ -631,7 +682,9 @@ wet_module_init(struct weston_compositor *ec,
 	weston_layer_init(&test->layer, ec);
 	weston_layer_set_position(&test->layer, WESTON_LAYER_POSITION_CURSOR - 1);
 
-	if (wl_global_create(ec->wl_display, &weston_test_interface, 1,
+	test->get_allocations = dlsym(RTLD_DEFAULT, "weston_bench_allocations");
+
+	if (wl_global_create(ec->wl_display, &weston_test_interface, 3,
 			     test, bind_test) == NULL)
 		return -1;
 